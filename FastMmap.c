@@ -0,0 +1,2760 @@
+/*
+ * This file was generated automatically by ExtUtils::ParseXS version 3.45 from the
+ * contents of FastMmap.xs. Do not edit this file, edit FastMmap.xs instead.
+ *
+ *    ANY CHANGES MADE HERE WILL BE LOST!
+ *
+ */
+
+#line 1 "FastMmap.xs"
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include "ppport.h"
+#include "mmap_cache.h"
+
+#define FC_UTF8VAL (1<<31)
+#define FC_UTF8KEY (1<<30)
+#define FC_UNDEF (1<<29)
+
+/* Perl level flag, see FC_ISDIRTY in FastMmap.pm */
+#define FC_ISDIRTY 1
+
+#define FC_ENTRY \
+    mmap_cache * cache; \
+    if (!SvROK(obj)) { \
+      croak("Object not reference"); \
+      XSRETURN_UNDEF; \
+    } \
+    obj = SvRV(obj); \
+    if (!SvIOKp(obj)) { \
+      croak("Object not initialised correctly"); \
+      XSRETURN_UNDEF; \
+    } \
+    cache = INT2PTR(mmap_cache *, SvIV(obj) ); \
+    if (!cache) { \
+      croak("Object not created correctly"); \
+      XSRETURN_UNDEF; \
+    }
+
+/* Build a hash ref from the details of a page report */
+static SV * fc_page_report_rv(mmap_cache_page_report * report) {
+  HV * ih = (HV *)sv_2mortal((SV *)newHV());
+
+  hv_store(ih, "num_slots", 9, newSVuv((UV)report->num_slots), 0);
+  hv_store(ih, "used_slots", 10, newSVuv((UV)report->used_slots), 0);
+  hv_store(ih, "old_slots", 9, newSVuv((UV)report->old_slots), 0);
+  hv_store(ih, "free_bytes", 10, newSVuv((UV)report->free_bytes), 0);
+  hv_store(ih, "data_bytes", 10, newSVuv((UV)report->data_bytes), 0);
+
+  if (report->have_entries) {
+    hv_store(ih, "live_bytes", 10, newSVuv((UV)report->live_bytes), 0);
+    hv_store(ih, "dead_bytes", 10, newSVuv((UV)report->dead_bytes), 0);
+    hv_store(ih, "expired_slots", 13, newSVuv((UV)report->expired_slots), 0);
+    hv_store(ih, "avg_probe", 9, report->used_slots
+      ? newSVnv((NV)report->total_probe / report->used_slots) : newSV(0), 0);
+    hv_store(ih, "oldest_access", 13, report->oldest_access
+      ? newSVuv((UV)report->oldest_access) : newSV(0), 0);
+    hv_store(ih, "newest_access", 13, report->newest_access
+      ? newSVuv((UV)report->newest_access) : newSV(0), 0);
+  }
+
+  return sv_2mortal(newRV((SV *)ih));
+}
+
+
+/* Create the SV of a stored value in *val, decoding it if it was
+   stored with a codec. Returns 0, or the mmc_decode_value error (-1
+   corrupt, -2 dictionary replaced) leaving *val NULL */
+static int fc_new_val_sv(mmap_cache * cache, void * val_ptr, int val_len, MU32 flags, SV ** val) {
+  *val = NULL;
+
+  /* Counter from mmc_incr */
+  if (flags & FC_INTEGER) {
+    int64_t num;
+    if (val_len != sizeof(int64_t))
+      return _mmc_set_error(cache, 0, "Corrupt integer value");
+    memcpy(&num, val_ptr, sizeof(int64_t));
+    *val = sizeof(IV) < sizeof(int64_t) ? newSVnv((NV)num) : newSViv((IV)num);
+    return 0;
+  }
+
+  if (flags & FC_CODEC_MASK) {
+    int dec_len = mmc_decoded_len(val_ptr, val_len, flags), res;
+    if (dec_len < 0)
+      return _mmc_set_error(cache, 0, "Corrupt compressed value");
+    *val = newSV(dec_len);
+    if ((res = mmc_decode_value(cache, val_ptr, val_len, flags, SvPVX(*val), dec_len)) != 0) {
+      SvREFCNT_dec(*val);
+      *val = NULL;
+      return res;
+    }
+    SvCUR_set(*val, dec_len);
+    *SvEND(*val) = '\0';
+    SvPOK_only(*val);
+  } else {
+    *val = newSVpvn((const char *)val_ptr, val_len);
+  }
+
+  if (flags & FC_UTF8VAL)
+    SvUTF8_on(*val);
+
+  return 0;
+}
+
+/* Build a hash ref of an entry about to be expunged, for write back.
+   Returns NULL for tombstones, which have nothing to write back, and
+   for clean entries if dirty_only is set */
+static SV * fc_expunged_item_rv(mmap_cache * cache, MU32 * base_det, int dirty_only) {
+  HV * ih;
+  SV * key, * val;
+  void * key_ptr, * val_ptr;
+  int key_len, val_len;
+  MU32 last_access, expire_on, flags;
+  MU64 modseq = 0;
+
+  mmc_get_details(cache, base_det,
+    &key_ptr, &key_len, &val_ptr, &val_len,
+    &last_access, &expire_on, &flags, &modseq);
+
+  if ((flags & FC_TOMBSTONE) || (dirty_only && !(flags & FC_ISDIRTY)))
+    return NULL;
+
+  ih = (HV *)sv_2mortal((SV *)newHV());
+  key = newSVpvn((const char *)key_ptr, key_len);
+
+  if (flags & FC_UTF8KEY) {
+    SvUTF8_on(key);
+    flags ^= FC_UTF8KEY;
+  }
+
+  if (flags & FC_UNDEF) {
+    val = newSV(0);
+    flags ^= FC_UNDEF;
+  } else {
+    if (fc_new_val_sv(cache, val_ptr, val_len, flags, &val) != 0)
+      val = newSV(0);
+    flags &= ~(FC_UTF8VAL | FC_CODEC_MASK | FC_INTEGER);
+  }
+  flags &= ~(FC_HASVERSION | FC_LEASE | FC_HASSTALE);
+
+  /* Store in hash ref */
+  hv_store(ih, "key", 3, key, 0);
+  hv_store(ih, "value", 5, val, 0);
+  hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
+  hv_store(ih, "expire_on", 9, newSViv((IV)expire_on), 0);
+  if (flags & FC_HASMODSEQ) {
+    hv_store(ih, "modseq", 6, newSVuv((UV)modseq), 0);
+    flags ^= FC_HASMODSEQ;
+  }
+  hv_store(ih, "flags", 5, newSViv((IV)flags), 0);
+
+  /* Create reference to hash */
+  return sv_2mortal(newRV((SV *)ih));
+}
+
+/* A key argument is either the key itself, or a handle made by
+   key_handle(), a Cache::FastMmap::KeyHandle array ref of
+   [ key, hash_page, hash_slot, num_pages ]. Gets the key bytes and
+   hash page/slot, taking the hash from the handle if it was made for
+   a cache with the same number of pages. Returns the key SV, or NULL
+   for a corrupt handle */
+static SV * fc_key_hash(mmap_cache * cache, SV * key, void ** key_ptr, int * key_len, MU32 * hash_page, MU32 * hash_slot) {
+  STRLEN pl_key_len;
+  int hashed = 0;
+
+  if (SvROK(key) && sv_isa(key, "Cache::FastMmap::KeyHandle")) {
+    AV * handle = (AV *)SvRV(key);
+    SV ** elems;
+
+    if (SvTYPE((SV *)handle) != SVt_PVAV || AvFILLp(handle) < 3)
+      return NULL;
+    elems = AvARRAY(handle);
+    if (!elems[0] || !elems[1] || !elems[2] || !elems[3])
+      return NULL;
+
+    key = elems[0];
+    if ((MU32)SvUV(elems[3]) == (MU32)mmc_get_param(cache, "num_pages")) {
+      *hash_page = (MU32)SvUV(elems[1]);
+      *hash_slot = (MU32)SvUV(elems[2]);
+      hashed = 1;
+    }
+  }
+
+  *key_ptr = (void *)SvPV(key, pl_key_len);
+  *key_len = (int)pl_key_len;
+
+  if (!hashed)
+    mmc_hash(cache, *key_ptr, *key_len, hash_page, hash_slot);
+
+  return key;
+}
+
+/* Get the bytes to store for a value, setting the undef/UTF8 flags and
+   compressing with the cache's codec if set. Same as fc_write */
+static void fc_store_val(mmap_cache * cache, SV * key, SV * val, void ** val_ptr, int * val_len, MU32 * in_flags) {
+  STRLEN pl_val_len;
+
+  if (!SvOK(val)) {
+    *in_flags |= FC_UNDEF;
+    *val_ptr = "";
+    *val_len = 0;
+    return;
+  }
+
+  *val_ptr = (void *)SvPV(val, pl_val_len);
+  *val_len = (int)pl_val_len;
+
+  if (SvUTF8(val)) {
+    *in_flags |= FC_UTF8VAL;
+  }
+  if (SvUTF8(key)) {
+    *in_flags |= FC_UTF8KEY;
+  }
+
+  mmc_encode_value(cache, *val_ptr, *val_len, val_ptr, val_len, in_flags);
+}
+
+#line 220 "FastMmap.c"
+#ifndef PERL_UNUSED_VAR
+#  define PERL_UNUSED_VAR(var) if (0) var = var
+#endif
+
+#ifndef dVAR
+#  define dVAR		dNOOP
+#endif
+
+
+/* This stuff is not part of the API! You have been warned. */
+#ifndef PERL_VERSION_DECIMAL
+#  define PERL_VERSION_DECIMAL(r,v,s) (r*1000000 + v*1000 + s)
+#endif
+#ifndef PERL_DECIMAL_VERSION
+#  define PERL_DECIMAL_VERSION \
+	  PERL_VERSION_DECIMAL(PERL_REVISION,PERL_VERSION,PERL_SUBVERSION)
+#endif
+#ifndef PERL_VERSION_GE
+#  define PERL_VERSION_GE(r,v,s) \
+	  (PERL_DECIMAL_VERSION >= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+#ifndef PERL_VERSION_LE
+#  define PERL_VERSION_LE(r,v,s) \
+	  (PERL_DECIMAL_VERSION <= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+
+/* XS_INTERNAL is the explicit static-linkage variant of the default
+ * XS macro.
+ *
+ * XS_EXTERNAL is the same as XS_INTERNAL except it does not include
+ * "STATIC", ie. it exports XSUB symbols. You probably don't want that
+ * for anything but the BOOT XSUB.
+ *
+ * See XSUB.h in core!
+ */
+
+
+/* TODO: This might be compatible further back than 5.10.0. */
+#if PERL_VERSION_GE(5, 10, 0) && PERL_VERSION_LE(5, 15, 1)
+#  undef XS_EXTERNAL
+#  undef XS_INTERNAL
+#  if defined(__CYGWIN__) && defined(USE_DYNAMIC_LOADING)
+#    define XS_EXTERNAL(name) __declspec(dllexport) XSPROTO(name)
+#    define XS_INTERNAL(name) STATIC XSPROTO(name)
+#  endif
+#  if defined(__SYMBIAN32__)
+#    define XS_EXTERNAL(name) EXPORT_C XSPROTO(name)
+#    define XS_INTERNAL(name) EXPORT_C STATIC XSPROTO(name)
+#  endif
+#  ifndef XS_EXTERNAL
+#    if defined(HASATTRIBUTE_UNUSED) && !defined(__cplusplus)
+#      define XS_EXTERNAL(name) void name(pTHX_ CV* cv __attribute__unused__)
+#      define XS_INTERNAL(name) STATIC void name(pTHX_ CV* cv __attribute__unused__)
+#    else
+#      ifdef __cplusplus
+#        define XS_EXTERNAL(name) extern "C" XSPROTO(name)
+#        define XS_INTERNAL(name) static XSPROTO(name)
+#      else
+#        define XS_EXTERNAL(name) XSPROTO(name)
+#        define XS_INTERNAL(name) STATIC XSPROTO(name)
+#      endif
+#    endif
+#  endif
+#endif
+
+/* perl >= 5.10.0 && perl <= 5.15.1 */
+
+
+/* The XS_EXTERNAL macro is used for functions that must not be static
+ * like the boot XSUB of a module. If perl didn't have an XS_EXTERNAL
+ * macro defined, the best we can do is assume XS is the same.
+ * Dito for XS_INTERNAL.
+ */
+#ifndef XS_EXTERNAL
+#  define XS_EXTERNAL(name) XS(name)
+#endif
+#ifndef XS_INTERNAL
+#  define XS_INTERNAL(name) XS(name)
+#endif
+
+/* Now, finally, after all this mess, we want an ExtUtils::ParseXS
+ * internal macro that we're free to redefine for varying linkage due
+ * to the EXPORT_XSUB_SYMBOLS XS keyword. This is internal, use
+ * XS_EXTERNAL(name) or XS_INTERNAL(name) in your code if you need to!
+ */
+
+#undef XS_EUPXS
+#if defined(PERL_EUPXS_ALWAYS_EXPORT)
+#  define XS_EUPXS(name) XS_EXTERNAL(name)
+#else
+   /* default to internal */
+#  define XS_EUPXS(name) XS_INTERNAL(name)
+#endif
+
+#ifndef PERL_ARGS_ASSERT_CROAK_XS_USAGE
+#define PERL_ARGS_ASSERT_CROAK_XS_USAGE assert(cv); assert(params)
+
+/* prototype to pass -Wmissing-prototypes */
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params);
+
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params)
+{
+    const GV *const gv = CvGV(cv);
+
+    PERL_ARGS_ASSERT_CROAK_XS_USAGE;
+
+    if (gv) {
+        const char *const gvname = GvNAME(gv);
+        const HV *const stash = GvSTASH(gv);
+        const char *const hvname = stash ? HvNAME(stash) : NULL;
+
+        if (hvname)
+	    Perl_croak_nocontext("Usage: %s::%s(%s)", hvname, gvname, params);
+        else
+	    Perl_croak_nocontext("Usage: %s(%s)", gvname, params);
+    } else {
+        /* Pants. I don't think that it should be possible to get here. */
+	Perl_croak_nocontext("Usage: CODE(0x%" UVxf ")(%s)", PTR2UV(cv), params);
+    }
+}
+#undef  PERL_ARGS_ASSERT_CROAK_XS_USAGE
+
+#define croak_xs_usage        S_croak_xs_usage
+
+#endif
+
+/* NOTE: the prototype of newXSproto() is different in versions of perls,
+ * so we define a portable version of newXSproto()
+ */
+#ifdef newXS_flags
+#define newXSproto_portable(name, c_impl, file, proto) newXS_flags(name, c_impl, file, proto, 0)
+#else
+#define newXSproto_portable(name, c_impl, file, proto) (PL_Sv=(SV*)newXS(name, c_impl, file), sv_setpv(PL_Sv, proto), (CV*)PL_Sv)
+#endif /* !defined(newXS_flags) */
+
+#if PERL_VERSION_LE(5, 21, 5)
+#  define newXS_deffile(a,b) Perl_newXS(aTHX_ a,b,file)
+#else
+#  define newXS_deffile(a,b) Perl_newXS_deffile(aTHX_ a,b)
+#endif
+
+#line 364 "FastMmap.c"
+
+XS_EUPXS(XS_Cache__FastMmap_fc_new); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_new)
+{
+    dVAR; dXSARGS;
+    if (items != 0)
+       croak_xs_usage(cv,  "");
+    {
+	SV *	RETVAL;
+#line 216 "FastMmap.xs"
+    mmap_cache * cache;
+    SV * obj_pnt, * obj;
+#line 377 "FastMmap.c"
+#line 219 "FastMmap.xs"
+    cache = mmc_new();
+
+    /* Create integer which is pointer to cache object */
+    obj_pnt = newSViv(PTR2IV(cache));
+
+    /* Create reference to integer value. This will be the object */
+    obj = newRV_noinc((SV *)obj_pnt);
+
+    RETVAL = obj;
+#line 388 "FastMmap.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_set_param); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_set_param)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, param, val");
+    {
+	SV *	obj = ST(0)
+;
+	char *	param = (char *)SvPV_nolen(ST(1))
+;
+	char *	val = (char *)SvPV_nolen(ST(2))
+;
+	int	RETVAL;
+	dXSTARG;
+#line 237 "FastMmap.xs"
+    FC_ENTRY
+
+#line 414 "FastMmap.c"
+#line 240 "FastMmap.xs"
+    RETVAL = mmc_set_param(cache, param, val);
+#line 417 "FastMmap.c"
+#line 242 "FastMmap.xs"
+    if (RETVAL != 0) {
+      croak("%s", mmc_error(cache));
+    }
+#line 422 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_init); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_init)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 250 "FastMmap.xs"
+    FC_ENTRY
+
+#line 442 "FastMmap.c"
+#line 253 "FastMmap.xs"
+    RETVAL = mmc_init(cache);
+#line 445 "FastMmap.c"
+#line 255 "FastMmap.xs"
+    if (RETVAL != 0) {
+      croak("%s", mmc_error(cache));
+    }
+#line 450 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_param); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_param)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, param");
+    {
+	SV *	obj = ST(0)
+;
+	char *	param = (char *)SvPV_nolen(ST(1))
+;
+	int	RETVAL;
+	dXSTARG;
+#line 264 "FastMmap.xs"
+    FC_ENTRY
+
+#line 472 "FastMmap.c"
+#line 267 "FastMmap.xs"
+    RETVAL = mmc_get_param(cache, param);
+
+#line 476 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_close); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_close)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+#line 277 "FastMmap.xs"
+    FC_ENTRY
+
+#line 496 "FastMmap.c"
+#line 280 "FastMmap.xs"
+    mmc_close(cache);
+    sv_setiv(obj, 0);
+#line 500 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_clone); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_clone)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+	SV *	RETVAL;
+#line 287 "FastMmap.xs"
+    mmap_cache * clone;
+
+    FC_ENTRY
+
+#line 521 "FastMmap.c"
+#line 292 "FastMmap.xs"
+    /* Another handle on the same mapping, for another thread */
+    clone = mmc_clone(cache);
+    if (!clone)
+      croak("%s", mmc_error(cache));
+
+    RETVAL = newRV_noinc(newSViv(PTR2IV(clone)));
+#line 529 "FastMmap.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_hash); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_hash)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, key");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+#line 307 "FastMmap.xs"
+    int key_len;
+    void * key_ptr;
+    MU32 hash_page, hash_slot;
+
+    FC_ENTRY
+
+#line 557 "FastMmap.c"
+#line 315 "FastMmap.xs"
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    XPUSHs(sv_2mortal(newSViv((IV)hash_page)));
+    XPUSHs(sv_2mortal(newSViv((IV)hash_slot)));
+#line 565 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_lock); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_lock)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, page");
+    {
+	SV *	obj = ST(0)
+;
+	UV	page = (UV)SvUV(ST(1))
+;
+	int	RETVAL;
+	dXSTARG;
+#line 328 "FastMmap.xs"
+    FC_ENTRY
+
+#line 588 "FastMmap.c"
+#line 331 "FastMmap.xs"
+    RETVAL = mmc_lock(cache, (MU32)page);
+#line 591 "FastMmap.c"
+#line 333 "FastMmap.xs"
+    if (RETVAL != 0) {
+      croak("%s", mmc_error(cache));
+    }
+#line 596 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_unlock); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_unlock)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 342 "FastMmap.xs"
+    FC_ENTRY
+
+#line 616 "FastMmap.c"
+#line 345 "FastMmap.xs"
+    RETVAL = mmc_unlock(cache);
+#line 619 "FastMmap.c"
+#line 347 "FastMmap.xs"
+    if (RETVAL != 0) {
+      croak("%s", mmc_error(cache));
+    }
+#line 624 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_is_locked); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_is_locked)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 355 "FastMmap.xs"
+    FC_ENTRY
+
+#line 644 "FastMmap.c"
+#line 358 "FastMmap.xs"
+    /* Write value to cache */
+    RETVAL = mmc_is_locked(cache);
+
+#line 649 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_read); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_read)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, hash_slot, key");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+#line 371 "FastMmap.xs"
+    int key_len, val_len, found;
+    void * key_ptr, * val_ptr;
+    MU32 expire_on = 0;
+    MU32 flags = 0;
+    MU64 modseq = 0;
+    STRLEN pl_key_len;
+    SV * val;
+    SV * modseq_sv, * version_sv;
+
+    FC_ENTRY
+
+#line 684 "FastMmap.c"
+#line 384 "FastMmap.xs"
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Get value data pointer */
+    found = mmc_read(cache, (MU32)hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+    modseq_sv = version_sv = &PL_sv_undef;
+    val = &PL_sv_undef;
+
+    /* Create PERL SV, decoded and UTF8 if stored from UTF8. A value
+       compressed with a replaced dictionary is as good as not found */
+    if (found != -1 && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1)
+        croak("%s", mmc_error(cache));
+      if (res == -2) {
+        val = &PL_sv_undef;
+        found = -1;
+        flags = expire_on = 0;
+      } else {
+        sv_2mortal(val);
+      }
+    }
+
+    if (found != -1) {
+      if (flags & FC_HASMODSEQ) {
+        modseq_sv = sv_2mortal(newSVuv((UV)modseq));
+      }
+      version_sv = sv_2mortal(newSVuv((UV)mmc_val_version(flags, val_ptr)));
+
+      flags = flags & ~(FC_UTF8KEY | FC_UTF8VAL | FC_UNDEF | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_CODEC_MASK | FC_INTEGER | FC_HASVERSION);
+    }
+
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)flags)));
+    XPUSHs(sv_2mortal(newSViv((IV)(found != -1))));
+    XPUSHs(sv_2mortal(newSViv((IV)expire_on)));
+    XPUSHs(modseq_sv);
+    XPUSHs(version_sv);
+#line 726 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_lease); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_lease)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "obj, hash_slot, key, lease_time");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+	U32	lease_time = (unsigned long)SvUV(ST(3))
+;
+#line 433 "FastMmap.xs"
+    int key_len, val_len, state;
+    void * key_ptr, * val_ptr;
+    MU32 flags = 0, version = 0;
+    MU64 modseq = 0;
+    STRLEN pl_key_len;
+    SV * val;
+
+    FC_ENTRY
+
+#line 760 "FastMmap.c"
+#line 444 "FastMmap.xs"
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* A new marker has no stale value, so reads back as undef */
+    state = mmc_lease(cache, (MU32)hash_slot, key_ptr, key_len, (MU32)lease_time,
+      FC_UNDEF | (SvUTF8(key) ? FC_UTF8KEY : 0), &val_ptr, &val_len, &flags, &modseq, &version);
+
+    /* Returns the value (or stale value), the mmc_lease state and
+       the lease's version */
+    val = &PL_sv_undef;
+    if ((state == 0 || state == 2 || state == 3) && val_ptr && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1)
+        croak("%s", mmc_error(cache));
+      if (res == -2) {
+        val = &PL_sv_undef;
+        if (state == 0 || state == 3)
+          state = -1;
+      } else {
+        sv_2mortal(val);
+      }
+    }
+
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)state)));
+    XPUSHs(state == 1 ? sv_2mortal(newSVuv((UV)version)) : &PL_sv_undef);
+#line 788 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_release_lease); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_release_lease)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "obj, hash_slot, key, version");
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+	U32	version = (unsigned long)SvUV(ST(3))
+;
+	int	RETVAL;
+	dXSTARG;
+#line 479 "FastMmap.xs"
+    STRLEN pl_key_len;
+    void * key_ptr;
+
+    FC_ENTRY
+
+#line 818 "FastMmap.c"
+#line 485 "FastMmap.xs"
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    RETVAL = mmc_release_lease(cache, (MU32)hash_slot, key_ptr, (int)pl_key_len, (MU32)version);
+
+#line 823 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_write); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_write)
+{
+    dVAR; dXSARGS;
+    if (items < 6 || items > 7)
+       croak_xs_usage(cv,  "obj, hash_slot, key, val, expire_on, in_flags, modseq_sv = &PL_sv_undef");
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+	SV *	val = ST(3)
+;
+	U32	expire_on = (unsigned long)SvUV(ST(4))
+;
+	U32	in_flags = (unsigned long)SvUV(ST(5))
+;
+	SV *	modseq_sv;
+	int	RETVAL;
+	dXSTARG;
+
+	if (items < 7)
+	    modseq_sv = &PL_sv_undef;
+	else {
+	    modseq_sv = ST(6)
+;
+	}
+#line 502 "FastMmap.xs"
+    int key_len, val_len;
+    void * key_ptr, * val_ptr;
+    MU64 modseq = 0;
+    STRLEN pl_key_len, pl_val_len;
+
+    FC_ENTRY
+
+#line 868 "FastMmap.c"
+#line 511 "FastMmap.xs"
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Storing with a modseq? (see TOMBSTONES AND MODSEQS in the pod) */
+    if (SvOK(modseq_sv)) {
+      if (sizeof(UV) < sizeof(MU64))
+        croak("modseq support requires a 64 bit perl");
+      in_flags |= FC_HASMODSEQ;
+      modseq = (MU64)SvUV(modseq_sv);
+    }
+
+    /* Check for storing undef, and store empty string with undef flag set */
+    if (!SvOK(val)) {
+      in_flags |= FC_UNDEF;
+
+      val_ptr = "";
+      val_len = 0;
+
+    } else {
+
+      /* Get key length, data pointer */
+      val_ptr = (void *)SvPV(val, pl_val_len);
+      val_len = (int)pl_val_len;
+
+      /* Set UTF8-ness flag of stored value */
+      if (SvUTF8(val)) {
+        in_flags |= FC_UTF8VAL;
+      }
+      if (SvUTF8(key)) {
+        in_flags |= FC_UTF8KEY;
+      }
+
+      /* Compress with the cache's codec if set */
+      mmc_encode_value(cache, val_ptr, val_len, &val_ptr, &val_len, &in_flags);
+    }
+
+    /* Write value to cache (1 stored, 0 no space, -1 refused) */
+    RETVAL = mmc_write(cache, (MU32)hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq);
+
+#line 910 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_tombstone); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_tombstone)
+{
+    dVAR; dXSARGS;
+    if (items != 5)
+       croak_xs_usage(cv,  "obj, hash_slot, key, expire_on, modseq_sv");
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+	U32	expire_on = (unsigned long)SvUV(ST(3))
+;
+	SV *	modseq_sv = ST(4)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 562 "FastMmap.xs"
+    int key_len;
+    void * key_ptr;
+    MU32 in_flags = FC_TOMBSTONE | FC_HASMODSEQ;
+    MU64 modseq;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+#line 946 "FastMmap.c"
+#line 572 "FastMmap.xs"
+    if (sizeof(UV) < sizeof(MU64))
+      croak("modseq support requires a 64 bit perl");
+    if (!SvOK(modseq_sv))
+      croak("fc_tombstone requires a modseq");
+    modseq = (MU64)SvUV(modseq_sv);
+
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+    if (SvUTF8(key)) {
+      in_flags |= FC_UTF8KEY;
+    }
+
+    /* A tombstone is an empty value with the modseq prefix; mmc_write
+     * enforces never lowering an existing tombstone's modseq */
+    RETVAL = mmc_write(cache, (MU32)hash_slot, key_ptr, key_len, "", 0, (MU32)expire_on, in_flags, modseq);
+
+#line 965 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_delete); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_delete)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, hash_slot, key");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	U32	hash_slot = (unsigned long)SvUV(ST(1))
+;
+	SV *	key = ST(2)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 598 "FastMmap.xs"
+    MU32 out_flags;
+    int key_len, did_delete;
+    void * key_ptr;
+    STRLEN pl_key_len;
+
+    FC_ENTRY
+
+#line 998 "FastMmap.c"
+#line 607 "FastMmap.xs"
+    /* Get key length, data pointer */
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* Write value to cache */
+    did_delete = mmc_delete(cache, (MU32)hash_slot, key_ptr, key_len, &out_flags);
+
+    XPUSHs(sv_2mortal(newSViv((IV)did_delete)));
+    XPUSHs(sv_2mortal(newSViv((IV)out_flags)));
+#line 1009 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_details); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_details)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+#line 622 "FastMmap.xs"
+    MU32 nreads = 0, nreadhits = 0;
+
+    FC_ENTRY
+
+#line 1032 "FastMmap.c"
+#line 627 "FastMmap.xs"
+    mmc_get_page_details(cache, &nreads, &nreadhits);
+
+    XPUSHs(sv_2mortal(newSViv((IV)nreads)));
+    XPUSHs(sv_2mortal(newSViv((IV)nreadhits)));
+#line 1038 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_dirty_count); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_dirty_count)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, clear");
+    {
+	SV *	obj = ST(0)
+;
+	int	clear = (int)SvIV(ST(1))
+;
+	UV	RETVAL;
+	dXSTARG;
+#line 638 "FastMmap.xs"
+    FC_ENTRY
+
+#line 1061 "FastMmap.c"
+#line 641 "FastMmap.xs"
+    RETVAL = (UV)mmc_get_dirty_count(cache, clear);
+
+#line 1065 "FastMmap.c"
+	XSprePUSH;
+	PUSHu((UV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_stats); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_stats)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, clear");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	clear = (int)SvIV(ST(1))
+;
+#line 652 "FastMmap.xs"
+    MU64 counts[MMC_STAT_COUNT];
+    int stat;
+
+    FC_ENTRY
+
+#line 1092 "FastMmap.c"
+#line 658 "FastMmap.xs"
+    mmc_get_stats(cache, counts, clear);
+
+    EXTEND(SP, MMC_STAT_COUNT);
+    for (stat = 0; stat < MMC_STAT_COUNT; stat++) {
+      PUSHs(sv_2mortal(newSVuv((UV)counts[stat])));
+    }
+#line 1100 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_report); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_report)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+#line 670 "FastMmap.xs"
+    mmap_cache_page_report report;
+
+    FC_ENTRY
+
+#line 1123 "FastMmap.c"
+#line 675 "FastMmap.xs"
+    mmc_get_page_report(cache, &report);
+
+    XPUSHs(fc_page_report_rv(&report));
+#line 1128 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_header_report); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_page_header_report)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, page");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	UV	page = (UV)SvUV(ST(1))
+;
+#line 685 "FastMmap.xs"
+    mmap_cache_page_report report;
+
+    FC_ENTRY
+
+#line 1153 "FastMmap.c"
+#line 690 "FastMmap.xs"
+    if (mmc_get_page_header_report(cache, (MU32)page, &report) != 0) {
+      croak("%s", mmc_error(cache));
+    }
+
+    XPUSHs(fc_page_report_rv(&report));
+#line 1160 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_latency); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_latency)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, op, clear");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	op = (int)SvIV(ST(1))
+;
+	int	clear = (int)SvIV(ST(2))
+;
+#line 703 "FastMmap.xs"
+    MU64 buckets[MMC_LAT_BUCKETS];
+    MU64 count;
+
+    FC_ENTRY
+
+#line 1188 "FastMmap.c"
+#line 709 "FastMmap.xs"
+    if (op < 0 || op >= MMC_LAT_COUNT) {
+      croak("Bad latency op %d", op);
+    }
+
+    count = mmc_get_latency(cache, op, buckets, clear);
+
+    EXTEND(SP, 5);
+    PUSHs(sv_2mortal(newSVuv((UV)count)));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.5))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.99))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.999))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 1.0))));
+#line 1202 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_hot_keys); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_hot_keys)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, n, clear");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	n = (int)SvIV(ST(1))
+;
+	int	clear = (int)SvIV(ST(2))
+;
+#line 729 "FastMmap.xs"
+    mmap_cache_hot_key * keys;
+    int num_keys, i;
+
+    FC_ENTRY
+
+#line 1230 "FastMmap.c"
+#line 735 "FastMmap.xs"
+    num_keys = mmc_get_hot_keys(cache, &keys);
+    if (n >= 0 && n < num_keys)
+      num_keys = n;
+
+    EXTEND(SP, num_keys);
+    for (i = 0; i < num_keys; i++) {
+      mmap_cache_hot_key * hk = keys + i;
+      HV * ih = (HV *)sv_2mortal((SV *)newHV());
+      int key_len = hk->key_len > MMC_HOT_KEY_LEN ? MMC_HOT_KEY_LEN : hk->key_len;
+
+      hv_store(ih, "key", 3, newSVpvn(hk->key, key_len), 0);
+      hv_store(ih, "key_len", 7, newSViv((IV)hk->key_len), 0);
+      hv_store(ih, "page", 4, newSVuv((UV)hk->page), 0);
+      hv_store(ih, "count", 5, newSVuv((UV)hk->count), 0);
+      hv_store(ih, "error", 5, newSVuv((UV)hk->error), 0);
+
+      PUSHs(sv_2mortal(newRV((SV *)ih)));
+    }
+
+    if (clear)
+      mmc_reset_hot_keys(cache);
+#line 1253 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_reset_page_details); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_reset_page_details)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+#line 762 "FastMmap.xs"
+    FC_ENTRY
+
+#line 1272 "FastMmap.c"
+#line 765 "FastMmap.xs"
+    mmc_reset_page_details(cache);
+#line 1275 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_expunge); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_expunge)
+{
+    dVAR; dXSARGS;
+    if (items != 4)
+       croak_xs_usage(cv,  "obj, mode, wb, len");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	mode = (int)SvIV(ST(1))
+;
+	int	wb = (int)SvIV(ST(2))
+;
+	int	len = (int)SvIV(ST(3))
+;
+#line 776 "FastMmap.xs"
+    MU32 new_num_slots = 0, ** to_expunge = 0;
+    int num_expunge, item;
+
+    FC_ENTRY
+
+#line 1304 "FastMmap.c"
+#line 783 "FastMmap.xs"
+    num_expunge = mmc_calc_expunge(cache, mode, len, &new_num_slots, &to_expunge);
+    if (to_expunge) {
+
+      /* Want list of expunged keys/values? */
+      if (wb) {
+
+        for (item = 0; item < num_expunge; item++) {
+          SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 0);
+          if (item_rv)
+            XPUSHs(item_rv);
+        }
+      }
+
+      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+        croak("%s", mmc_error(cache));
+        XSRETURN_UNDEF;
+      }
+    }
+#line 1324 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_take_dirty); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_take_dirty)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, max_items");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	max_items = (int)SvIV(ST(1))
+;
+#line 808 "FastMmap.xs"
+    MU32 ** entries;
+    int num, item;
+
+    FC_ENTRY
+
+#line 1350 "FastMmap.c"
+#line 815 "FastMmap.xs"
+    /* Items for dirty entries of the current page, as fc_expunge
+       returns them, marking clean only the entries returned, so none
+       is marked clean without being written back */
+    if (max_items <= 0)
+      XSRETURN_EMPTY;
+
+    Newx(entries, max_items, MU32 *);
+    num = mmc_get_flagged(cache, FC_ISDIRTY, max_items, entries);
+
+    for (item = 0; item < num; item++) {
+      SV * item_rv = fc_expunged_item_rv(cache, entries[item], 1);
+      if (item_rv) {
+        XPUSHs(item_rv);
+        mmc_clear_flags(cache, entries[item], FC_ISDIRTY);
+      }
+    }
+
+    Safefree(entries);
+#line 1370 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_keys); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_keys)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, mode");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	int	mode = (int)SvIV(ST(1))
+;
+#line 840 "FastMmap.xs"
+    mmap_cache_it * it;
+    MU32 * entry_ptr;
+    void * key_ptr, * val_ptr;
+    int key_len, val_len;
+    MU32 last_access, expire_on, flags;
+
+    FC_ENTRY
+
+#line 1399 "FastMmap.c"
+#line 850 "FastMmap.xs"
+    it = mmc_iterate_new(cache);
+
+    /* Iterate over all items */
+    while ((entry_ptr = mmc_iterate_next(it))) {
+      SV *  key;
+      MU64 modseq = 0;
+      mmc_get_details(cache, entry_ptr,
+        &key_ptr, &key_len, &val_ptr, &val_len,
+        &last_access, &expire_on, &flags, &modseq);
+
+      /* Tombstones and lease markers are misses, so hide them */
+      if (flags & (FC_TOMBSTONE | FC_LEASE))
+        continue;
+
+      /* Create key SV, and set UTF8'ness if needed */
+      key = newSVpvn((const char *)key_ptr, key_len);
+      if (flags & FC_UTF8KEY) {
+        SvUTF8_on(key);
+        flags ^= FC_UTF8KEY;
+      }
+
+      /* Mode 0 is just list of keys */
+      if (mode == 0) {
+        XPUSHs(sv_2mortal(key));
+
+      /* Mode 1/2 is list of hash-refs */
+      } else if (mode == 1 || mode == 2) {
+        HV * ih = (HV *)sv_2mortal((SV *)newHV());
+
+        if (flags & FC_HASMODSEQ) {
+          hv_store(ih, "modseq", 6, newSVuv((UV)modseq), 0);
+          flags ^= FC_HASMODSEQ;
+        }
+
+        /* These things by default */
+        hv_store(ih, "key", 3, key, 0);
+        hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
+        hv_store(ih, "expire_on", 9, newSViv((IV)expire_on), 0);
+        hv_store(ih, "flags", 5, newSViv((IV)(flags & ~(FC_CODEC_MASK | FC_HASVERSION | FC_HASSTALE))), 0);
+
+        /* Add value to hash-ref if mode 2 */
+        if (mode == 2) {
+          SV * val;
+          if (flags & FC_UNDEF) {
+            val = newSV(0);
+            flags ^= FC_UNDEF;
+          } else if (fc_new_val_sv(cache, val_ptr, val_len, flags, &val) != 0) {
+            val = newSV(0);
+          }
+          hv_store(ih, "value", 5, val, 0);
+        }
+
+        /* Create reference to hash */
+        XPUSHs(sv_2mortal(newRV((SV *)ih)));
+      }
+    }
+
+    mmc_iterate_close(it);
+#line 1459 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get)
+{
+    dVAR; dXSARGS;
+    if (items < 2 || items > 4)
+       croak_xs_usage(cv,  "obj, key, modseq_ref = &PL_sv_undef, version_ref = &PL_sv_undef");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	modseq_ref;
+	SV *	version_ref;
+
+	if (items < 3)
+	    modseq_ref = &PL_sv_undef;
+	else {
+	    modseq_ref = ST(2)
+;
+	}
+
+	if (items < 4)
+	    version_ref = &PL_sv_undef;
+	else {
+	    version_ref = ST(3)
+;
+	}
+#line 920 "FastMmap.xs"
+    int key_len, val_len, found;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags, version = 0;
+    MU64 modseq = 0, lat_start;
+    SV * val;
+
+    FC_ENTRY
+
+#line 1504 "FastMmap.c"
+#line 929 "FastMmap.xs"
+    lat_start = mmc_latency_start(cache);
+
+    if (SvOK(modseq_ref) && (!SvROK(modseq_ref) || SvTYPE(SvRV(modseq_ref)) > SVt_PVMG))
+      croak("get modseq option must be a scalar ref");
+    if (SvOK(version_ref) && (!SvROK(version_ref) || SvTYPE(SvRV(version_ref)) > SVt_PVMG))
+      croak("get version option must be a scalar ref");
+
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Get value data pointer, 1 if stale and we're to refresh it */
+    found = mmc_read_stale(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+    if (found != -1)
+      version = mmc_val_version(flags, val_ptr);
+
+    /* Copy the value out while the page is still locked */
+    val = &PL_sv_undef;
+    if (found != -1 && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+
+      /* Compressed with a replaced dictionary, treat as not found */
+      if (res == -2) {
+        val = &PL_sv_undef;
+        found = -1;
+      } else {
+        sv_2mortal(val);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    if (SvOK(modseq_ref)) {
+      if (found != -1 && (flags & FC_HASMODSEQ))
+        sv_setuv(SvRV(modseq_ref), (UV)modseq);
+      else
+        sv_setsv(SvRV(modseq_ref), &PL_sv_undef);
+    }
+    if (SvOK(version_ref)) {
+      if (found != -1)
+        sv_setuv(SvRV(version_ref), (UV)version);
+      else
+        sv_setsv(SvRV(version_ref), &PL_sv_undef);
+    }
+
+    mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+    /* Not found is an empty list, so callers can tell it from a
+       cached undef. A stale value (see stale_time) is followed by 1
+       if this caller should refresh it */
+    if (found != -1)
+      XPUSHs(val);
+    if (found == 1)
+      XPUSHs(&PL_sv_yes);
+#line 1568 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_into); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_into)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, key, buf");
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	buf = ST(2)
+;
+	int	RETVAL;
+	dXSTARG;
+#line 999 "FastMmap.xs"
+    int key_len, val_len, found, dec_len = 0;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0, lat_start;
+
+    FC_ENTRY
+
+#line 1598 "FastMmap.c"
+#line 1007 "FastMmap.xs"
+    if (SvREADONLY(buf))
+      croak("Modification of a read-only value attempted");
+
+    lat_start = mmc_latency_start(cache);
+
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+    /* Copy (or decode) into buf's existing buffer, which only grows if
+       it's too small */
+    if (found == -1 || (flags & FC_UNDEF)) {
+      sv_setsv(buf, &PL_sv_undef);
+
+    } else if (flags & FC_INTEGER) {
+      SV * num;
+      if (fc_new_val_sv(cache, val_ptr, val_len, flags, &num) != 0) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+      sv_setsv(buf, num);
+      SvREFCNT_dec(num);
+
+    } else if (!(flags & FC_CODEC_MASK)) {
+      sv_setpvn(buf, (const char *)val_ptr, val_len);
+
+    } else if ((dec_len = mmc_decoded_len(val_ptr, val_len, flags)) < 0) {
+      mmc_unlock(cache);
+      croak("Corrupt compressed value");
+
+    } else {
+      int res;
+      sv_setpvn(buf, "", 0);
+      SvGROW(buf, (STRLEN)dec_len + 1);
+      res = mmc_decode_value(cache, val_ptr, val_len, flags, SvPVX(buf), dec_len);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+      if (res == -2) {
+        /* Compressed with a replaced dictionary, treat as not found */
+        found = -1;
+        sv_setsv(buf, &PL_sv_undef);
+      } else {
+        SvCUR_set(buf, dec_len);
+        *SvEND(buf) = '\0';
+      }
+    }
+    if (found != -1 && !(flags & FC_UNDEF) && (flags & FC_UTF8VAL))
+      SvUTF8_on(buf);
+
+    mmc_unlock(cache);
+    SvSETMAGIC(buf);
+
+    mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+    RETVAL = found != -1;
+
+#line 1662 "FastMmap.c"
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_with_value); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_with_value)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "obj, key, cb");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	cb = ST(2)
+;
+#line 1079 "FastMmap.xs"
+    int key_len, val_len, found, aliased = 0;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0;
+    SV * val, * result = NULL;
+
+    FC_ENTRY
+
+#line 1694 "FastMmap.c"
+#line 1088 "FastMmap.xs"
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+    val = NULL;
+    if (found != -1 && (flags & FC_UNDEF)) {
+      val = newSV(0);
+
+    } else if (found != -1 && !(flags & (FC_CODEC_MASK | FC_INTEGER))) {
+      /* Read only SV of the mapped value bytes themselves. Perl won't
+         free a buffer with SvLEN 0 */
+      val = newSV(0);
+      SvUPGRADE(val, SVt_PV);
+      SvPV_set(val, (char *)val_ptr);
+      SvCUR_set(val, val_len);
+      SvLEN_set(val, 0);
+      SvPOK_only(val);
+      if (flags & FC_UTF8VAL)
+        SvUTF8_on(val);
+      SvREADONLY_on(val);
+      aliased = 1;
+
+    } else if (found != -1) {
+      /* Encoded values and counters have to be decoded to a copy */
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+    }
+
+    /* Call the callback with the page locked, trapping any error so
+       the page is always unlocked */
+    if (val) {
+      int count;
+
+      ENTER;
+      SAVETMPS;
+      PUSHMARK(SP);
+      XPUSHs(val);
+      PUTBACK;
+      count = call_sv(cb, G_SCALAR | G_EVAL);
+      SPAGAIN;
+      if (count == 1)
+        result = newSVsv(POPs);
+      PUTBACK;
+      FREETMPS;
+      LEAVE;
+
+      /* If the callback kept a reference to the value, it gets its own
+         copy, otherwise detach it from the mapping */
+      if (aliased) {
+        SvREADONLY_off(val);
+        SvPV_set(val, NULL);
+        SvLEN_set(val, 0);
+        SvCUR_set(val, 0);
+        SvPOK_off(val);
+        if (SvREFCNT(val) > 1) {
+          sv_setpvn(val, (const char *)val_ptr, val_len);
+          if (flags & FC_UTF8VAL)
+            SvUTF8_on(val);
+        }
+      }
+      SvREFCNT_dec(val);
+
+      /* The callback may have reallocated the stack, so return our
+         result at the start of our frame in the new one */
+      SP = PL_stack_base + ax - 1;
+    }
+
+    mmc_unlock(cache);
+
+    if (val && SvTRUE(ERRSV)) {
+      if (result)
+        SvREFCNT_dec(result);
+      croak(NULL);
+    }
+
+    XPUSHs(result ? sv_2mortal(result) : &PL_sv_undef);
+#line 1779 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_set); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_set)
+{
+    dVAR; dXSARGS;
+    if (items < 3 || items > 8)
+       croak_xs_usage(cv,  "obj, key, val, expire_on = -1, in_flags = 0, modseq_sv = &PL_sv_undef, wb = 0, stale_sv = &PL_sv_undef");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	val = ST(2)
+;
+	U32	expire_on;
+	U32	in_flags;
+	SV *	modseq_sv;
+	int	wb;
+	SV *	stale_sv;
+
+	if (items < 4)
+	    expire_on = -1;
+	else {
+	    expire_on = (unsigned long)SvUV(ST(3))
+;
+	}
+
+	if (items < 5)
+	    in_flags = 0;
+	else {
+	    in_flags = (unsigned long)SvUV(ST(4))
+;
+	}
+
+	if (items < 6)
+	    modseq_sv = &PL_sv_undef;
+	else {
+	    modseq_sv = ST(5)
+;
+	}
+
+	if (items < 7)
+	    wb = 0;
+	else {
+	    wb = (int)SvIV(ST(6))
+;
+	}
+
+	if (items < 8)
+	    stale_sv = &PL_sv_undef;
+	else {
+	    stale_sv = ST(7)
+;
+	}
+#line 1184 "FastMmap.xs"
+    int key_len, val_len, num_expunge, item, did_store;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+    MU64 modseq = 0, lat_start;
+
+    FC_ENTRY
+
+#line 1849 "FastMmap.c"
+#line 1192 "FastMmap.xs"
+    lat_start = mmc_latency_start(cache);
+
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+
+    /* Storing with a modseq? (see TOMBSTONES AND MODSEQS in the pod) */
+    if (SvOK(modseq_sv)) {
+      if (sizeof(UV) < sizeof(MU64))
+        croak("modseq support requires a 64 bit perl");
+      in_flags |= FC_HASMODSEQ;
+      modseq = (MU64)SvUV(modseq_sv);
+    }
+
+    /* Same value/flag handling as fc_write, compressing before locking */
+    fc_store_val(cache, key, val, &val_ptr, &val_len, (MU32 *)&in_flags);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Make space if needed. Only build write back items for dirty
+       entries, and only if the caller will write them back */
+    XPUSHs(&PL_sv_undef);
+    num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+    if (to_expunge) {
+      if (wb) {
+        for (item = 0; item < num_expunge; item++) {
+          SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+          if (item_rv)
+            XPUSHs(item_rv);
+        }
+      }
+
+      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+    }
+
+    /* Write value to cache (1 stored, 0 no space, -1 refused), with
+       the cache's stale_time unless given one */
+    if (SvOK(stale_sv))
+      did_store = mmc_write_stale(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, (MU32)SvUV(stale_sv));
+    else
+      did_store = mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq);
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    /* Store result, then any expunged items to write back */
+    ST(0) = sv_2mortal(newSViv((IV)did_store));
+#line 1904 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_cas); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_cas)
+{
+    dVAR; dXSARGS;
+    if (items < 4 || items > 8)
+       croak_xs_usage(cv,  "obj, key, val, version_sv, expire_on = -1, in_flags = 0, modseq_sv = &PL_sv_undef, wb = 0");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	val = ST(2)
+;
+	SV *	version_sv = ST(3)
+;
+	U32	expire_on;
+	U32	in_flags;
+	SV *	modseq_sv;
+	int	wb;
+
+	if (items < 5)
+	    expire_on = -1;
+	else {
+	    expire_on = (unsigned long)SvUV(ST(4))
+;
+	}
+
+	if (items < 6)
+	    in_flags = 0;
+	else {
+	    in_flags = (unsigned long)SvUV(ST(5))
+;
+	}
+
+	if (items < 7)
+	    modseq_sv = &PL_sv_undef;
+	else {
+	    modseq_sv = ST(6)
+;
+	}
+
+	if (items < 8)
+	    wb = 0;
+	else {
+	    wb = (int)SvIV(ST(7))
+;
+	}
+#line 1258 "FastMmap.xs"
+    int key_len, val_len, num_expunge, item, did_store;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, version, new_num_slots = 0, ** to_expunge = 0;
+    MU64 modseq = 0, lat_start;
+
+    FC_ENTRY
+
+#line 1968 "FastMmap.c"
+#line 1266 "FastMmap.xs"
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+
+    /* An undef version only stores if the key isn't in the cache */
+    version = SvOK(version_sv) ? (MU32)SvUV(version_sv) : FC_NOVERSION;
+
+    if (SvOK(modseq_sv)) {
+      if (sizeof(UV) < sizeof(MU64))
+        croak("modseq support requires a 64 bit perl");
+      in_flags |= FC_HASMODSEQ;
+      modseq = (MU64)SvUV(modseq_sv);
+    }
+
+    fc_store_val(cache, key, val, &val_ptr, &val_len, (MU32 *)&in_flags);
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Returns the store result, then any dirty items expunged that
+       need writing back. Same size values are overwritten in place, so
+       only make space if it didn't fit */
+    XPUSHs(&PL_sv_undef);
+    did_store = mmc_cas(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, version);
+    if (did_store == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        did_store = mmc_cas(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, version);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    /* 1 stored, 0 no space, -1 refused by a modseq, -2 version changed */
+    ST(0) = sv_2mortal(newSViv((IV)did_store));
+#line 2020 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_incr); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_incr)
+{
+    dVAR; dXSARGS;
+    if (items < 3 || items > 7)
+       croak_xs_usage(cv,  "obj, key, delta, initial = 0, expire_on = -1, in_flags = 0, wb = 0");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	IV	delta = (IV)SvIV(ST(2))
+;
+	IV	initial;
+	U32	expire_on;
+	U32	in_flags;
+	int	wb;
+
+	if (items < 4)
+	    initial = 0;
+	else {
+	    initial = (IV)SvIV(ST(3))
+;
+	}
+
+	if (items < 5)
+	    expire_on = -1;
+	else {
+	    expire_on = (unsigned long)SvUV(ST(4))
+;
+	}
+
+	if (items < 6)
+	    in_flags = 0;
+	else {
+	    in_flags = (unsigned long)SvUV(ST(5))
+;
+	}
+
+	if (items < 7)
+	    wb = 0;
+	else {
+	    wb = (int)SvIV(ST(6))
+;
+	}
+#line 1328 "FastMmap.xs"
+    int key_len, num_expunge, item, res;
+    void * key_ptr;
+    MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+    MU64 lat_start;
+    int64_t result = 0;
+
+    FC_ENTRY
+
+#line 2083 "FastMmap.c"
+#line 1337 "FastMmap.xs"
+    if (sizeof(IV) < sizeof(int64_t))
+      croak("incr requires a 64 bit perl");
+
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+    if (SvUTF8(key))
+      in_flags |= FC_UTF8KEY;
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Returns the new value and mmc_incr's result, then any dirty items
+       expunged that need writing back */
+    XPUSHs(&PL_sv_undef);
+    XPUSHs(&PL_sv_undef);
+
+    /* Counters are updated in place, so only make space if a new one
+       didn't fit */
+    res = mmc_incr(cache, hash_slot, key_ptr, key_len, (int64_t)delta, (int64_t)initial, (MU32)expire_on, (MU32)in_flags, &result);
+    if (res == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + (int)sizeof(int64_t), &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        res = mmc_incr(cache, hash_slot, key_ptr, key_len, (int64_t)delta, (int64_t)initial, (MU32)expire_on, (MU32)in_flags, &result);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    if (res == 1)
+      ST(0) = sv_2mortal(newSViv((IV)result));
+    ST(1) = sv_2mortal(newSViv((IV)res));
+#line 2132 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_append); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_append)
+{
+    dVAR; dXSARGS;
+    if (items < 3 || items > 8)
+       croak_xs_usage(cv,  "obj, key, val, prepend = 0, max_len = 0, expire_on = -1, in_flags = 0, wb = 0");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	SV *	key = ST(1)
+;
+	SV *	val = ST(2)
+;
+	int	prepend;
+	U32	max_len;
+	U32	expire_on;
+	U32	in_flags;
+	int	wb;
+
+	if (items < 4)
+	    prepend = 0;
+	else {
+	    prepend = (int)SvIV(ST(3))
+;
+	}
+
+	if (items < 5)
+	    max_len = 0;
+	else {
+	    max_len = (unsigned long)SvUV(ST(4))
+;
+	}
+
+	if (items < 6)
+	    expire_on = -1;
+	else {
+	    expire_on = (unsigned long)SvUV(ST(5))
+;
+	}
+
+	if (items < 7)
+	    in_flags = 0;
+	else {
+	    in_flags = (unsigned long)SvUV(ST(6))
+;
+	}
+
+	if (items < 8)
+	    wb = 0;
+	else {
+	    wb = (int)SvIV(ST(7))
+;
+	}
+#line 1397 "FastMmap.xs"
+    int key_len, val_len, num_expunge, item, res, found, utf8;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, old_flags, new_num_slots = 0, ** to_expunge = 0;
+    STRLEN pl_val_len;
+    MU64 lat_start;
+
+    FC_ENTRY
+
+#line 2203 "FastMmap.c"
+#line 1406 "FastMmap.xs"
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+    if (SvUTF8(key))
+      in_flags |= FC_UTF8KEY;
+
+    /* Stringify before locking, overloading could run perl code */
+    val_ptr = (void *)SvPV(val, pl_val_len);
+    val_len = (int)pl_val_len;
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Values are joined as bytes, so the new bytes must be encoded the
+       same as the stored value (UTF-8 or not). With no value they're
+       stored as bytes if they can be, else as UTF-8 */
+    found = mmc_peek_flags(cache, hash_slot, key_ptr, key_len, &old_flags) == 0;
+    utf8 = found && (old_flags & FC_UTF8VAL);
+    if (utf8 != (SvUTF8(val) != 0)) {
+      SV * copy = sv_2mortal(newSVpvn((const char *)val_ptr, val_len));
+      if (utf8) {
+        sv_utf8_upgrade(copy);
+      } else {
+        SvUTF8_on(copy);
+        if (!sv_utf8_downgrade(copy, 1)) {
+          if (found) {
+            mmc_unlock(cache);
+            croak("Wide character appended to a byte string value");
+          }
+          utf8 = 1;
+          copy = NULL;
+        }
+      }
+      if (copy) {
+        val_ptr = (void *)SvPV(copy, pl_val_len);
+        val_len = (int)pl_val_len;
+      }
+    }
+
+    /* Trimming UTF-8 to max_len bytes could split a character */
+    if (utf8 && max_len) {
+      mmc_unlock(cache);
+      croak("append max_len needs a byte string value");
+    }
+    if (utf8)
+      in_flags |= FC_UTF8VAL;
+
+    /* Returns mmc_append's result, then any dirty items expunged that
+       need writing back */
+    XPUSHs(&PL_sv_undef);
+
+    /* Only make space if the value couldn't grow where it is. We don't
+       know its new size here, so expunge as for a full page */
+    res = mmc_append(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, prepend, (MU32)max_len, (MU32)expire_on, (MU32)in_flags, FC_UNDEF);
+    if (res == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, -1, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        res = mmc_append(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, prepend, (MU32)max_len, (MU32)expire_on, (MU32)in_flags, FC_UNDEF);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    ST(0) = sv_2mortal(newSViv((IV)res));
+#line 2284 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_batch); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_batch)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, keys");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	AV *	keys;
+
+	STMT_START {
+		SV* const xsub_tmp_sv = ST(1);
+		SvGETMAGIC(xsub_tmp_sv);
+		if (SvROK(xsub_tmp_sv) && SvTYPE(SvRV(xsub_tmp_sv)) == SVt_PVAV){
+		    keys = (AV*)SvRV(xsub_tmp_sv);
+		}
+		else{
+		    Perl_croak_nocontext("%s: %s is not an ARRAY reference",
+				"Cache::FastMmap::fc_get_batch",
+				"keys");
+		}
+	} STMT_END
+;
+#line 1492 "FastMmap.xs"
+    int key_len, val_len, found, i, num_keys, cur_page = -1;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0;
+    SV * val;
+
+    FC_ENTRY
+
+#line 2326 "FastMmap.c"
+#line 1501 "FastMmap.xs"
+    /* Keys or key handles, ideally sorted by page so each page is
+       locked once. Returns a value (undef if not found) for each */
+    num_keys = av_len(keys) + 1;
+    EXTEND(SP, num_keys);
+
+    for (i = 0; i < num_keys; i++) {
+      SV ** key = av_fetch(keys, i, 0);
+
+      if (!key || !fc_key_hash(cache, *key, &key_ptr, &key_len, &hash_page, &hash_slot)) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        croak("Corrupt key handle");
+      }
+
+      if ((int)hash_page != cur_page) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        cur_page = (int)hash_page;
+      }
+
+      found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+      val = &PL_sv_undef;
+      if (found != -1 && !(flags & FC_UNDEF)) {
+        int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+        if (res == -1) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        if (res == -2)
+          val = &PL_sv_undef;
+        else
+          sv_2mortal(val);
+      }
+      PUSHs(val);
+    }
+
+    if (cur_page != -1)
+      mmc_unlock(cache);
+#line 2369 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_set_batch); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_set_batch)
+{
+    dVAR; dXSARGS;
+    if (items < 3 || items > 6)
+       croak_xs_usage(cv,  "obj, keys, vals, expire_on = -1, flags = 0, wb = 0");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+	AV *	keys;
+	AV *	vals;
+	U32	expire_on;
+	U32	flags;
+	int	wb;
+
+	STMT_START {
+		SV* const xsub_tmp_sv = ST(1);
+		SvGETMAGIC(xsub_tmp_sv);
+		if (SvROK(xsub_tmp_sv) && SvTYPE(SvRV(xsub_tmp_sv)) == SVt_PVAV){
+		    keys = (AV*)SvRV(xsub_tmp_sv);
+		}
+		else{
+		    Perl_croak_nocontext("%s: %s is not an ARRAY reference",
+				"Cache::FastMmap::fc_set_batch",
+				"keys");
+		}
+	} STMT_END
+;
+
+	STMT_START {
+		SV* const xsub_tmp_sv = ST(2);
+		SvGETMAGIC(xsub_tmp_sv);
+		if (SvROK(xsub_tmp_sv) && SvTYPE(SvRV(xsub_tmp_sv)) == SVt_PVAV){
+		    vals = (AV*)SvRV(xsub_tmp_sv);
+		}
+		else{
+		    Perl_croak_nocontext("%s: %s is not an ARRAY reference",
+				"Cache::FastMmap::fc_set_batch",
+				"vals");
+		}
+	} STMT_END
+;
+
+	if (items < 4)
+	    expire_on = -1;
+	else {
+	    expire_on = (unsigned long)SvUV(ST(3))
+;
+	}
+
+	if (items < 5)
+	    flags = 0;
+	else {
+	    flags = (unsigned long)SvUV(ST(4))
+;
+	}
+
+	if (items < 6)
+	    wb = 0;
+	else {
+	    wb = (int)SvIV(ST(5))
+;
+	}
+#line 1553 "FastMmap.xs"
+    int key_len, val_len, num_expunge, item, i, num_keys, cur_page = -1;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, in_flags, new_num_slots, ** to_expunge;
+    AV * wb_items;
+
+    FC_ENTRY
+
+#line 2449 "FastMmap.c"
+#line 1561 "FastMmap.xs"
+    /* Keys or key handles, ideally sorted by page so each page is
+       locked once, and a value for each. Returns the store result of
+       each, followed by any dirty items expunged that need writing
+       back */
+    num_keys = av_len(keys) + 1;
+    wb_items = (AV *)sv_2mortal((SV *)newAV());
+    EXTEND(SP, num_keys);
+
+    for (i = 0; i < num_keys; i++) {
+      SV ** key = av_fetch(keys, i, 0), ** val = av_fetch(vals, i, 0), * key_sv;
+
+      if (!key || !(key_sv = fc_key_hash(cache, *key, &key_ptr, &key_len, &hash_page, &hash_slot))) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        croak("Corrupt key handle");
+      }
+
+      if ((int)hash_page != cur_page) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        cur_page = (int)hash_page;
+      }
+
+      /* Encoded into the cache's codec buffer, so written straight away */
+      in_flags = (MU32)flags;
+      fc_store_val(cache, key_sv, val ? *val : &PL_sv_undef, &val_ptr, &val_len, &in_flags);
+
+      new_num_slots = 0;
+      to_expunge = 0;
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              av_push(wb_items, SvREFCNT_inc(item_rv));
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+      }
+
+      PUSHs(sv_2mortal(newSViv((IV)mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, in_flags, 0))));
+    }
+
+    if (cur_page != -1)
+      mmc_unlock(cache);
+
+    EXTEND(SP, av_len(wb_items) + 1);
+    for (i = 0; i <= av_len(wb_items); i++)
+      PUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, i, 0))));
+#line 2507 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_set_dict); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_set_dict)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "obj, dict");
+    {
+	SV *	obj = ST(0)
+;
+	SV *	dict = ST(1)
+;
+	UV	RETVAL;
+	dXSTARG;
+#line 1624 "FastMmap.xs"
+    void * dict_ptr;
+    STRLEN dict_len;
+
+    FC_ENTRY
+
+#line 2533 "FastMmap.c"
+#line 1630 "FastMmap.xs"
+    dict_ptr = (void *)SvPV(dict, dict_len);
+    RETVAL = (UV)mmc_set_dict(cache, dict_ptr, (int)dict_len);
+    if (!RETVAL)
+      croak("%s", mmc_error(cache));
+
+#line 2540 "FastMmap.c"
+	XSprePUSH;
+	PUSHu((UV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_get_dict); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_get_dict)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	SV *	obj = ST(0)
+;
+#line 1643 "FastMmap.xs"
+    void * dict_ptr;
+    int dict_len;
+    MU64 gen;
+
+    FC_ENTRY
+
+#line 2566 "FastMmap.c"
+#line 1650 "FastMmap.xs"
+    gen = mmc_get_dict(cache, &dict_ptr, &dict_len);
+    XPUSHs(sv_2mortal(newSVuv((UV)gen)));
+    XPUSHs(gen ? sv_2mortal(newSVpvn((const char *)dict_ptr, dict_len)) : &PL_sv_undef);
+#line 2571 "FastMmap.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_train_dict); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_train_dict)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "samples, dict_size");
+    {
+	SV *	samples = ST(0)
+;
+	int	dict_size = (int)SvIV(ST(1))
+;
+	SV *	RETVAL;
+#line 1660 "FastMmap.xs"
+    AV * av;
+    MU32 * lens;
+    char * buf;
+    STRLEN total = 0, len;
+    int n, i, dict_len;
+
+#line 2597 "FastMmap.c"
+#line 1667 "FastMmap.xs"
+    if (!SvROK(samples) || SvTYPE(SvRV(samples)) != SVt_PVAV)
+      croak("samples must be an array ref");
+    av = (AV *)SvRV(samples);
+    n = av_len(av) + 1;
+
+    /* Concatenate the samples */
+    for (i = 0; i < n; i++) {
+      SV ** svp = av_fetch(av, i, 0);
+      if (svp && SvOK(*svp))
+        total += sv_len(*svp);
+    }
+    Newx(buf, total + 1, char);
+    Newx(lens, n + 1, MU32);
+    for (i = 0, total = 0; i < n; i++) {
+      SV ** svp = av_fetch(av, i, 0);
+      char * ptr;
+      lens[i] = 0;
+      if (!svp || !SvOK(*svp))
+        continue;
+      ptr = SvPV(*svp, len);
+      memcpy(buf + total, ptr, len);
+      lens[i] = (MU32)len;
+      total += len;
+    }
+
+    RETVAL = newSV(dict_size > 0 ? dict_size : 1);
+    dict_len = mmc_train_dict(buf, lens, n, SvPVX(RETVAL), dict_size > 0 ? dict_size : 0);
+    Safefree(buf);
+    Safefree(lens);
+
+    if (dict_len) {
+      SvCUR_set(RETVAL, dict_len);
+      SvPOK_only(RETVAL);
+    } else {
+      SvREFCNT_dec(RETVAL);
+      RETVAL = &PL_sv_undef;
+    }
+
+#line 2637 "FastMmap.c"
+	RETVAL = sv_2mortal(RETVAL);
+	ST(0) = RETVAL;
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_dump_page); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_dump_page)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "obj");
+    {
+	SV *	obj = ST(0)
+;
+#line 1713 "FastMmap.xs"
+    FC_ENTRY
+
+#line 2657 "FastMmap.c"
+#line 1716 "FastMmap.xs"
+    _mmc_dump_page(cache);
+#line 2660 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+
+XS_EUPXS(XS_Cache__FastMmap_fc_set_time_override); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_Cache__FastMmap_fc_set_time_override)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "set_time");
+    {
+	UV	set_time = (UV)SvUV(ST(0))
+;
+#line 1724 "FastMmap.xs"
+    mmc_set_time_override((MU32)set_time);
+#line 2677 "FastMmap.c"
+    }
+    XSRETURN_EMPTY;
+}
+
+#ifdef __cplusplus
+extern "C"
+#endif
+XS_EXTERNAL(boot_Cache__FastMmap); /* prototype to pass -Wmissing-prototypes */
+XS_EXTERNAL(boot_Cache__FastMmap)
+{
+#if PERL_VERSION_LE(5, 21, 5)
+    dVAR; dXSARGS;
+#else
+    dVAR; dXSBOOTARGSXSAPIVERCHK;
+#endif
+#if PERL_VERSION_LE(5, 8, 999) /* PERL_VERSION_LT is 5.33+ */
+    char* file = __FILE__;
+#else
+    const char* file = __FILE__;
+#endif
+
+    PERL_UNUSED_VAR(file);
+
+    PERL_UNUSED_VAR(cv); /* -W */
+    PERL_UNUSED_VAR(items); /* -W */
+#if PERL_VERSION_LE(5, 21, 5)
+    XS_VERSION_BOOTCHECK;
+#  ifdef XS_APIVERSION_BOOTCHECK
+    XS_APIVERSION_BOOTCHECK;
+#  endif
+#endif
+
+        (void)newXSproto_portable("Cache::FastMmap::fc_new", XS_Cache__FastMmap_fc_new, file, "");
+        (void)newXSproto_portable("Cache::FastMmap::fc_set_param", XS_Cache__FastMmap_fc_set_param, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_init", XS_Cache__FastMmap_fc_init, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_param", XS_Cache__FastMmap_fc_get_param, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_close", XS_Cache__FastMmap_fc_close, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_clone", XS_Cache__FastMmap_fc_clone, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_hash", XS_Cache__FastMmap_fc_hash, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_lock", XS_Cache__FastMmap_fc_lock, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_unlock", XS_Cache__FastMmap_fc_unlock, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_is_locked", XS_Cache__FastMmap_fc_is_locked, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_read", XS_Cache__FastMmap_fc_read, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_lease", XS_Cache__FastMmap_fc_lease, file, "$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_release_lease", XS_Cache__FastMmap_fc_release_lease, file, "$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_write", XS_Cache__FastMmap_fc_write, file, "$$$$$$;$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_tombstone", XS_Cache__FastMmap_fc_tombstone, file, "$$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_delete", XS_Cache__FastMmap_fc_delete, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_page_details", XS_Cache__FastMmap_fc_get_page_details, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_dirty_count", XS_Cache__FastMmap_fc_get_dirty_count, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_stats", XS_Cache__FastMmap_fc_get_stats, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_page_report", XS_Cache__FastMmap_fc_get_page_report, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_page_header_report", XS_Cache__FastMmap_fc_get_page_header_report, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_latency", XS_Cache__FastMmap_fc_get_latency, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_hot_keys", XS_Cache__FastMmap_fc_get_hot_keys, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_reset_page_details", XS_Cache__FastMmap_fc_reset_page_details, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_expunge", XS_Cache__FastMmap_fc_expunge, file, "$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_take_dirty", XS_Cache__FastMmap_fc_take_dirty, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_keys", XS_Cache__FastMmap_fc_get_keys, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get", XS_Cache__FastMmap_fc_get, file, "$$;$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_into", XS_Cache__FastMmap_fc_get_into, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_with_value", XS_Cache__FastMmap_fc_with_value, file, "$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_set", XS_Cache__FastMmap_fc_set, file, "$$$;$$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_cas", XS_Cache__FastMmap_fc_cas, file, "$$$$;$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_incr", XS_Cache__FastMmap_fc_incr, file, "$$$;$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_append", XS_Cache__FastMmap_fc_append, file, "$$$;$$$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_batch", XS_Cache__FastMmap_fc_get_batch, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_set_batch", XS_Cache__FastMmap_fc_set_batch, file, "$$$;$$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_set_dict", XS_Cache__FastMmap_fc_set_dict, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_get_dict", XS_Cache__FastMmap_fc_get_dict, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_train_dict", XS_Cache__FastMmap_fc_train_dict, file, "$$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_dump_page", XS_Cache__FastMmap_fc_dump_page, file, "$");
+        (void)newXSproto_portable("Cache::FastMmap::fc_set_time_override", XS_Cache__FastMmap_fc_set_time_override, file, "$");
+#if PERL_VERSION_LE(5, 21, 5)
+#  if PERL_VERSION_GE(5, 9, 0)
+    if (PL_unitcheckav)
+        call_list(PL_scopestack_ix, PL_unitcheckav);
+#  endif
+    XSRETURN_YES;
+#else
+    Perl_xs_boot_epilog(aTHX_ ax);
+#endif
+}
+
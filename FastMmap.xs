@@ -9,6 +9,9 @@
 #define FC_UTF8KEY (1<<30)
 #define FC_UNDEF (1<<29)
 
+/* Perl level flag, see FC_ISDIRTY in FastMmap.pm */
+#define FC_ISDIRTY 1
+
 #define FC_ENTRY \
     mmap_cache * cache; \
     if (!SvROK(obj)) { \
@@ -26,6 +29,183 @@
       XSRETURN_UNDEF; \
     }
 
+/* Build a hash ref from the details of a page report */
+static SV * fc_page_report_rv(mmap_cache_page_report * report) {
+  HV * ih = (HV *)sv_2mortal((SV *)newHV());
+
+  hv_store(ih, "num_slots", 9, newSVuv((UV)report->num_slots), 0);
+  hv_store(ih, "used_slots", 10, newSVuv((UV)report->used_slots), 0);
+  hv_store(ih, "old_slots", 9, newSVuv((UV)report->old_slots), 0);
+  hv_store(ih, "free_bytes", 10, newSVuv((UV)report->free_bytes), 0);
+  hv_store(ih, "data_bytes", 10, newSVuv((UV)report->data_bytes), 0);
+
+  if (report->have_entries) {
+    hv_store(ih, "live_bytes", 10, newSVuv((UV)report->live_bytes), 0);
+    hv_store(ih, "dead_bytes", 10, newSVuv((UV)report->dead_bytes), 0);
+    hv_store(ih, "expired_slots", 13, newSVuv((UV)report->expired_slots), 0);
+    hv_store(ih, "avg_probe", 9, report->used_slots
+      ? newSVnv((NV)report->total_probe / report->used_slots) : newSV(0), 0);
+    hv_store(ih, "oldest_access", 13, report->oldest_access
+      ? newSVuv((UV)report->oldest_access) : newSV(0), 0);
+    hv_store(ih, "newest_access", 13, report->newest_access
+      ? newSVuv((UV)report->newest_access) : newSV(0), 0);
+  }
+
+  return sv_2mortal(newRV((SV *)ih));
+}
+
+
+/* Create the SV of a stored value in *val, decoding it if it was
+   stored with a codec. Returns 0, or the mmc_decode_value error (-1
+   corrupt, -2 dictionary replaced) leaving *val NULL */
+static int fc_new_val_sv(mmap_cache * cache, void * val_ptr, int val_len, MU32 flags, SV ** val) {
+  *val = NULL;
+
+  /* Counter from mmc_incr */
+  if (flags & FC_INTEGER) {
+    int64_t num;
+    if (val_len != sizeof(int64_t))
+      return _mmc_set_error(cache, 0, "Corrupt integer value");
+    memcpy(&num, val_ptr, sizeof(int64_t));
+    *val = sizeof(IV) < sizeof(int64_t) ? newSVnv((NV)num) : newSViv((IV)num);
+    return 0;
+  }
+
+  if (flags & FC_CODEC_MASK) {
+    int dec_len = mmc_decoded_len(val_ptr, val_len, flags), res;
+    if (dec_len < 0)
+      return _mmc_set_error(cache, 0, "Corrupt compressed value");
+    *val = newSV(dec_len);
+    if ((res = mmc_decode_value(cache, val_ptr, val_len, flags, SvPVX(*val), dec_len)) != 0) {
+      SvREFCNT_dec(*val);
+      *val = NULL;
+      return res;
+    }
+    SvCUR_set(*val, dec_len);
+    *SvEND(*val) = '\0';
+    SvPOK_only(*val);
+  } else {
+    *val = newSVpvn((const char *)val_ptr, val_len);
+  }
+
+  if (flags & FC_UTF8VAL)
+    SvUTF8_on(*val);
+
+  return 0;
+}
+
+/* Build a hash ref of an entry about to be expunged, for write back.
+   Returns NULL for tombstones, which have nothing to write back, and
+   for clean entries if dirty_only is set */
+static SV * fc_expunged_item_rv(mmap_cache * cache, MU32 * base_det, int dirty_only) {
+  HV * ih;
+  SV * key, * val;
+  void * key_ptr, * val_ptr;
+  int key_len, val_len;
+  MU32 last_access, expire_on, flags;
+  MU64 modseq = 0;
+
+  mmc_get_details(cache, base_det,
+    &key_ptr, &key_len, &val_ptr, &val_len,
+    &last_access, &expire_on, &flags, &modseq);
+
+  if ((flags & FC_TOMBSTONE) || (dirty_only && !(flags & FC_ISDIRTY)))
+    return NULL;
+
+  ih = (HV *)sv_2mortal((SV *)newHV());
+  key = newSVpvn((const char *)key_ptr, key_len);
+
+  if (flags & FC_UTF8KEY) {
+    SvUTF8_on(key);
+    flags ^= FC_UTF8KEY;
+  }
+
+  if (flags & FC_UNDEF) {
+    val = newSV(0);
+    flags ^= FC_UNDEF;
+  } else {
+    if (fc_new_val_sv(cache, val_ptr, val_len, flags, &val) != 0)
+      val = newSV(0);
+    flags &= ~(FC_UTF8VAL | FC_CODEC_MASK | FC_INTEGER);
+  }
+  flags &= ~(FC_HASVERSION | FC_LEASE | FC_HASSTALE);
+
+  /* Store in hash ref */
+  hv_store(ih, "key", 3, key, 0);
+  hv_store(ih, "value", 5, val, 0);
+  hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
+  hv_store(ih, "expire_on", 9, newSViv((IV)expire_on), 0);
+  if (flags & FC_HASMODSEQ) {
+    hv_store(ih, "modseq", 6, newSVuv((UV)modseq), 0);
+    flags ^= FC_HASMODSEQ;
+  }
+  hv_store(ih, "flags", 5, newSViv((IV)flags), 0);
+
+  /* Create reference to hash */
+  return sv_2mortal(newRV((SV *)ih));
+}
+
+/* A key argument is either the key itself, or a handle made by
+   key_handle(), a Cache::FastMmap::KeyHandle array ref of
+   [ key, hash_page, hash_slot, num_pages ]. Gets the key bytes and
+   hash page/slot, taking the hash from the handle if it was made for
+   a cache with the same number of pages. Returns the key SV, or NULL
+   for a corrupt handle */
+static SV * fc_key_hash(mmap_cache * cache, SV * key, void ** key_ptr, int * key_len, MU32 * hash_page, MU32 * hash_slot) {
+  STRLEN pl_key_len;
+  int hashed = 0;
+
+  if (SvROK(key) && sv_isa(key, "Cache::FastMmap::KeyHandle")) {
+    AV * handle = (AV *)SvRV(key);
+    SV ** elems;
+
+    if (SvTYPE((SV *)handle) != SVt_PVAV || AvFILLp(handle) < 3)
+      return NULL;
+    elems = AvARRAY(handle);
+    if (!elems[0] || !elems[1] || !elems[2] || !elems[3])
+      return NULL;
+
+    key = elems[0];
+    if ((MU32)SvUV(elems[3]) == (MU32)mmc_get_param(cache, "num_pages")) {
+      *hash_page = (MU32)SvUV(elems[1]);
+      *hash_slot = (MU32)SvUV(elems[2]);
+      hashed = 1;
+    }
+  }
+
+  *key_ptr = (void *)SvPV(key, pl_key_len);
+  *key_len = (int)pl_key_len;
+
+  if (!hashed)
+    mmc_hash(cache, *key_ptr, *key_len, hash_page, hash_slot);
+
+  return key;
+}
+
+/* Get the bytes to store for a value, setting the undef/UTF8 flags and
+   compressing with the cache's codec if set. Same as fc_write */
+static void fc_store_val(mmap_cache * cache, SV * key, SV * val, void ** val_ptr, int * val_len, MU32 * in_flags) {
+  STRLEN pl_val_len;
+
+  if (!SvOK(val)) {
+    *in_flags |= FC_UNDEF;
+    *val_ptr = "";
+    *val_len = 0;
+    return;
+  }
+
+  *val_ptr = (void *)SvPV(val, pl_val_len);
+  *val_len = (int)pl_val_len;
+
+  if (SvUTF8(val)) {
+    *in_flags |= FC_UTF8VAL;
+  }
+  if (SvUTF8(key)) {
+    *in_flags |= FC_UTF8KEY;
+  }
+
+  mmc_encode_value(cache, *val_ptr, *val_len, val_ptr, val_len, in_flags);
+}
 
 MODULE = Cache::FastMmap		PACKAGE = Cache::FastMmap
 PROTOTYPES: ENABLE
@@ -76,6 +256,19 @@ fc_init(obj)
       croak("%s", mmc_error(cache));
     }
 
+int
+fc_get_param(obj, param)
+    SV * obj;
+    char * param;
+  INIT:
+    FC_ENTRY
+
+  CODE:
+    RETVAL = mmc_get_param(cache, param);
+
+  OUTPUT:
+    RETVAL
+
 
 void
 fc_close(obj)
@@ -87,6 +280,24 @@ fc_close(obj)
     mmc_close(cache);
     sv_setiv(obj, 0);
 
+SV *
+fc_clone(obj)
+    SV * obj
+  INIT:
+    mmap_cache * clone;
+
+    FC_ENTRY
+
+  CODE:
+    /* Another handle on the same mapping, for another thread */
+    clone = mmc_clone(cache);
+    if (!clone)
+      croak("%s", mmc_error(cache));
+
+    RETVAL = newRV_noinc(newSViv(PTR2IV(clone)));
+  OUTPUT:
+    RETVAL
+
 
 void
 fc_hash(obj, key);
@@ -96,18 +307,14 @@ fc_hash(obj, key);
     int key_len;
     void * key_ptr;
     MU32 hash_page, hash_slot;
-    STRLEN pl_key_len;
 
     FC_ENTRY
 
   PPCODE:
 
-    /* Get key length, data pointer */
-    key_ptr = (void *)SvPV(key, pl_key_len);
-    key_len = (int)pl_key_len;
-
-    /* Hash key to get page and slot */
-    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
 
     XPUSHs(sv_2mortal(newSViv((IV)hash_page)));
     XPUSHs(sv_2mortal(newSViv((IV)hash_slot)));
@@ -168,7 +375,7 @@ fc_read(obj, hash_slot, key)
     MU64 modseq = 0;
     STRLEN pl_key_len;
     SV * val;
-    SV * modseq_sv;
+    SV * modseq_sv, * version_sv;
 
     FC_ENTRY
 
@@ -181,41 +388,105 @@ fc_read(obj, hash_slot, key)
     /* Get value data pointer */
     found = mmc_read(cache, (MU32)hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
 
-    modseq_sv = &PL_sv_undef;
+    modseq_sv = version_sv = &PL_sv_undef;
+    val = &PL_sv_undef;
 
-    /* If not found, use undef */
-    if (found == -1) {
-      val = &PL_sv_undef;
-    } else {
-
-      /* Cached an undef value? */
-      if (flags & FC_UNDEF) {
+    /* Create PERL SV, decoded and UTF8 if stored from UTF8. A value
+       compressed with a replaced dictionary is as good as not found */
+    if (found != -1 && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1)
+        croak("%s", mmc_error(cache));
+      if (res == -2) {
         val = &PL_sv_undef;
-
+        found = -1;
+        flags = expire_on = 0;
       } else {
-
-        /* Create PERL SV */
-        val = sv_2mortal(newSVpvn((const char *)val_ptr, val_len));
-
-        /* Make UTF8 if stored from UTF8 */
-        if (flags & FC_UTF8VAL) {
-          SvUTF8_on(val);
-        }
-
+        sv_2mortal(val);
       }
+    }
 
+    if (found != -1) {
       if (flags & FC_HASMODSEQ) {
         modseq_sv = sv_2mortal(newSVuv((UV)modseq));
       }
+      version_sv = sv_2mortal(newSVuv((UV)mmc_val_version(flags, val_ptr)));
 
-      flags = flags & ~(FC_UTF8KEY | FC_UTF8VAL | FC_UNDEF | FC_HASMODSEQ | FC_TOMBSTONE);
+      flags = flags & ~(FC_UTF8KEY | FC_UTF8VAL | FC_UNDEF | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_CODEC_MASK | FC_INTEGER | FC_HASVERSION);
     }
 
     XPUSHs(val);
     XPUSHs(sv_2mortal(newSViv((IV)flags)));
-    XPUSHs(sv_2mortal(newSViv((IV)!found)));
+    XPUSHs(sv_2mortal(newSViv((IV)(found != -1))));
     XPUSHs(sv_2mortal(newSViv((IV)expire_on)));
     XPUSHs(modseq_sv);
+    XPUSHs(version_sv);
+
+
+void
+fc_lease(obj, hash_slot, key, lease_time)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+    U32  lease_time;
+  INIT:
+    int key_len, val_len, state;
+    void * key_ptr, * val_ptr;
+    MU32 flags = 0, version = 0;
+    MU64 modseq = 0;
+    STRLEN pl_key_len;
+    SV * val;
+
+    FC_ENTRY
+
+  PPCODE:
+
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    key_len = (int)pl_key_len;
+
+    /* A new marker has no stale value, so reads back as undef */
+    state = mmc_lease(cache, (MU32)hash_slot, key_ptr, key_len, (MU32)lease_time,
+      FC_UNDEF | (SvUTF8(key) ? FC_UTF8KEY : 0), &val_ptr, &val_len, &flags, &modseq, &version);
+
+    /* Returns the value (or stale value), the mmc_lease state and
+       the lease's version */
+    val = &PL_sv_undef;
+    if ((state == 0 || state == 2 || state == 3) && val_ptr && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1)
+        croak("%s", mmc_error(cache));
+      if (res == -2) {
+        val = &PL_sv_undef;
+        if (state == 0 || state == 3)
+          state = -1;
+      } else {
+        sv_2mortal(val);
+      }
+    }
+
+    XPUSHs(val);
+    XPUSHs(sv_2mortal(newSViv((IV)state)));
+    XPUSHs(state == 1 ? sv_2mortal(newSVuv((UV)version)) : &PL_sv_undef);
+
+
+int
+fc_release_lease(obj, hash_slot, key, version)
+    SV * obj;
+    U32  hash_slot;
+    SV * key;
+    U32  version;
+  INIT:
+    STRLEN pl_key_len;
+    void * key_ptr;
+
+    FC_ENTRY
+
+  CODE:
+    key_ptr = (void *)SvPV(key, pl_key_len);
+    RETVAL = mmc_release_lease(cache, (MU32)hash_slot, key_ptr, (int)pl_key_len, (MU32)version);
+
+  OUTPUT:
+    RETVAL
 
 
 int
@@ -269,6 +540,9 @@ fc_write(obj, hash_slot, key, val, expire_on, in_flags, modseq_sv = &PL_sv_undef
       if (SvUTF8(key)) {
         in_flags |= FC_UTF8KEY;
       }
+
+      /* Compress with the cache's codec if set */
+      mmc_encode_value(cache, val_ptr, val_len, &val_ptr, &val_len, &in_flags);
     }
 
     /* Write value to cache (1 stored, 0 no space, -1 refused) */
@@ -356,6 +630,131 @@ fc_get_page_details(obj)
     XPUSHs(sv_2mortal(newSViv((IV)nreadhits)));
 
 
+UV
+fc_get_dirty_count(obj, clear)
+    SV * obj;
+    int clear;
+  INIT:
+    FC_ENTRY
+
+  CODE:
+    RETVAL = (UV)mmc_get_dirty_count(cache, clear);
+
+  OUTPUT:
+    RETVAL
+
+
+void
+fc_get_stats(obj, clear)
+    SV * obj;
+    int clear;
+  INIT:
+    MU64 counts[MMC_STAT_COUNT];
+    int stat;
+
+    FC_ENTRY
+
+  PPCODE:
+    mmc_get_stats(cache, counts, clear);
+
+    EXTEND(SP, MMC_STAT_COUNT);
+    for (stat = 0; stat < MMC_STAT_COUNT; stat++) {
+      PUSHs(sv_2mortal(newSVuv((UV)counts[stat])));
+    }
+
+
+void
+fc_get_page_report(obj)
+    SV * obj;
+  INIT:
+    mmap_cache_page_report report;
+
+    FC_ENTRY
+
+  PPCODE:
+    mmc_get_page_report(cache, &report);
+
+    XPUSHs(fc_page_report_rv(&report));
+
+
+void
+fc_get_page_header_report(obj, page)
+    SV * obj;
+    UV page;
+  INIT:
+    mmap_cache_page_report report;
+
+    FC_ENTRY
+
+  PPCODE:
+    if (mmc_get_page_header_report(cache, (MU32)page, &report) != 0) {
+      croak("%s", mmc_error(cache));
+    }
+
+    XPUSHs(fc_page_report_rv(&report));
+
+
+void
+fc_get_latency(obj, op, clear)
+    SV * obj;
+    int op;
+    int clear;
+  INIT:
+    MU64 buckets[MMC_LAT_BUCKETS];
+    MU64 count;
+
+    FC_ENTRY
+
+  PPCODE:
+    if (op < 0 || op >= MMC_LAT_COUNT) {
+      croak("Bad latency op %d", op);
+    }
+
+    count = mmc_get_latency(cache, op, buckets, clear);
+
+    EXTEND(SP, 5);
+    PUSHs(sv_2mortal(newSVuv((UV)count)));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.5))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.99))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 0.999))));
+    PUSHs(sv_2mortal(newSVuv((UV)mmc_latency_percentile(buckets, count, 1.0))));
+
+
+void
+fc_get_hot_keys(obj, n, clear)
+    SV * obj;
+    int n;
+    int clear;
+  INIT:
+    mmap_cache_hot_key * keys;
+    int num_keys, i;
+
+    FC_ENTRY
+
+  PPCODE:
+    num_keys = mmc_get_hot_keys(cache, &keys);
+    if (n >= 0 && n < num_keys)
+      num_keys = n;
+
+    EXTEND(SP, num_keys);
+    for (i = 0; i < num_keys; i++) {
+      mmap_cache_hot_key * hk = keys + i;
+      HV * ih = (HV *)sv_2mortal((SV *)newHV());
+      int key_len = hk->key_len > MMC_HOT_KEY_LEN ? MMC_HOT_KEY_LEN : hk->key_len;
+
+      hv_store(ih, "key", 3, newSVpvn(hk->key, key_len), 0);
+      hv_store(ih, "key_len", 7, newSViv((IV)hk->key_len), 0);
+      hv_store(ih, "page", 4, newSVuv((UV)hk->page), 0);
+      hv_store(ih, "count", 5, newSVuv((UV)hk->count), 0);
+      hv_store(ih, "error", 5, newSVuv((UV)hk->error), 0);
+
+      PUSHs(sv_2mortal(newRV((SV *)ih)));
+    }
+
+    if (clear)
+      mmc_reset_hot_keys(cache);
+
+
 NO_OUTPUT void
 fc_reset_page_details(obj)
     SV * obj;
@@ -377,10 +776,6 @@ fc_expunge(obj, mode, wb, len)
     MU32 new_num_slots = 0, ** to_expunge = 0;
     int num_expunge, item;
 
-    void * key_ptr, * val_ptr;
-    int key_len, val_len;
-    MU32 last_access, expire_on, flags;
-
     FC_ENTRY
 
   PPCODE:
@@ -392,61 +787,49 @@ fc_expunge(obj, mode, wb, len)
       if (wb) {
 
         for (item = 0; item < num_expunge; item++) {
-          MU64 modseq = 0;
-          mmc_get_details(cache, to_expunge[item],
-            &key_ptr, &key_len, &val_ptr, &val_len,
-            &last_access, &expire_on, &flags, &modseq);
+          SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 0);
+          if (item_rv)
+            XPUSHs(item_rv);
+        }
+      }
 
-          /* Tombstones have nothing to write back */
-          if (flags & FC_TOMBSTONE)
-            continue;
+      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+        croak("%s", mmc_error(cache));
+        XSRETURN_UNDEF;
+      }
+    }
 
-          {
-          HV * ih = (HV *)sv_2mortal((SV *)newHV());
 
-          SV * key = newSVpvn((const char *)key_ptr, key_len);
-          SV * val;
+void
+fc_take_dirty(obj, max_items)
+    SV * obj;
+    int max_items;
+  INIT:
+    MU32 ** entries;
+    int num, item;
 
-          if (flags & FC_UTF8KEY) {
-            SvUTF8_on(key);
-            flags ^= FC_UTF8KEY;
-          }
+    FC_ENTRY
 
-          if (flags & FC_UNDEF) {
-            val = newSV(0);
-            flags ^= FC_UNDEF;
-          } else {
-            val = newSVpvn((const char *)val_ptr, val_len);
-            if (flags & FC_UTF8VAL) {
-              SvUTF8_on(val);
-              flags ^= FC_UTF8VAL;
-            }
-          }
+  PPCODE:
 
-          /* Store in hash ref */
-          hv_store(ih, "key", 3, key, 0);
-          hv_store(ih, "value", 5, val, 0);
-          hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
-          hv_store(ih, "expire_on", 9, newSViv((IV)expire_on), 0);
-          if (flags & FC_HASMODSEQ) {
-            hv_store(ih, "modseq", 6, newSVuv((UV)modseq), 0);
-            flags ^= FC_HASMODSEQ;
-          }
-          hv_store(ih, "flags", 5, newSViv((IV)flags), 0);
+    /* Items for dirty entries of the current page, as fc_expunge
+       returns them, marking clean only the entries returned, so none
+       is marked clean without being written back */
+    if (max_items <= 0)
+      XSRETURN_EMPTY;
 
-          /* Create reference to hash */
-          XPUSHs(sv_2mortal(newRV((SV *)ih)));
-          }
-        }
-      }
+    Newx(entries, max_items, MU32 *);
+    num = mmc_get_flagged(cache, FC_ISDIRTY, max_items, entries);
 
-      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
-        croak("%s", mmc_error(cache));
-        XSRETURN_UNDEF;
+    for (item = 0; item < num; item++) {
+      SV * item_rv = fc_expunged_item_rv(cache, entries[item], 1);
+      if (item_rv) {
+        XPUSHs(item_rv);
+        mmc_clear_flags(cache, entries[item], FC_ISDIRTY);
       }
     }
 
-
+    Safefree(entries);
 
 
 void
@@ -474,8 +857,8 @@ fc_get_keys(obj, mode)
         &key_ptr, &key_len, &val_ptr, &val_len,
         &last_access, &expire_on, &flags, &modseq);
 
-      /* Tombstones are misses, so hide them */
-      if (flags & FC_TOMBSTONE)
+      /* Tombstones and lease markers are misses, so hide them */
+      if (flags & (FC_TOMBSTONE | FC_LEASE))
         continue;
 
       /* Create key SV, and set UTF8'ness if needed */
@@ -502,7 +885,7 @@ fc_get_keys(obj, mode)
         hv_store(ih, "key", 3, key, 0);
         hv_store(ih, "last_access", 11, newSViv((IV)last_access), 0);
         hv_store(ih, "expire_on", 9, newSViv((IV)expire_on), 0);
-        hv_store(ih, "flags", 5, newSViv((IV)flags), 0);
+        hv_store(ih, "flags", 5, newSViv((IV)(flags & ~(FC_CODEC_MASK | FC_HASVERSION | FC_HASSTALE))), 0);
 
         /* Add value to hash-ref if mode 2 */
         if (mode == 2) {
@@ -510,12 +893,8 @@ fc_get_keys(obj, mode)
           if (flags & FC_UNDEF) {
             val = newSV(0);
             flags ^= FC_UNDEF;
-          } else {
-            val = newSVpvn((const char *)val_ptr, val_len);
-            if (flags & FC_UTF8VAL) {
-              SvUTF8_on(val);
-              flags ^= FC_UTF8VAL;
-            }
+          } else if (fc_new_val_sv(cache, val_ptr, val_len, flags, &val) != 0) {
+            val = newSV(0);
           }
           hv_store(ih, "value", 5, val, 0);
         }
@@ -531,84 +910,801 @@ fc_get_keys(obj, mode)
 
 
 
-SV *
-fc_get(obj, key)
+void
+fc_get(obj, key, modseq_ref = &PL_sv_undef, version_ref = &PL_sv_undef)
     SV * obj;
     SV * key;
+    SV * modseq_ref;
+    SV * version_ref;
   INIT:
     int key_len, val_len, found;
     void * key_ptr, * val_ptr;
-    MU32 hash_page, hash_slot, expire_on, flags;
-    MU64 modseq = 0;
-    STRLEN pl_key_len;
+    MU32 hash_page, hash_slot, expire_on, flags, version = 0;
+    MU64 modseq = 0, lat_start;
     SV * val;
 
     FC_ENTRY
 
-  CODE:
+  PPCODE:
+    lat_start = mmc_latency_start(cache);
 
-    /* Get key length, data pointer */
-    key_ptr = (void *)SvPV(key, pl_key_len);
-    key_len = (int)pl_key_len;
+    if (SvOK(modseq_ref) && (!SvROK(modseq_ref) || SvTYPE(SvRV(modseq_ref)) > SVt_PVMG))
+      croak("get modseq option must be a scalar ref");
+    if (SvOK(version_ref) && (!SvROK(version_ref) || SvTYPE(SvRV(version_ref)) > SVt_PVMG))
+      croak("get version option must be a scalar ref");
 
-    /* Hash key to get page and slot */
-    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
 
     /* Get and lock the page */
-    mmc_lock(cache, hash_page);
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Get value data pointer, 1 if stale and we're to refresh it */
+    found = mmc_read_stale(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+    if (found != -1)
+      version = mmc_val_version(flags, val_ptr);
+
+    /* Copy the value out while the page is still locked */
+    val = &PL_sv_undef;
+    if (found != -1 && !(flags & FC_UNDEF)) {
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+
+      /* Compressed with a replaced dictionary, treat as not found */
+      if (res == -2) {
+        val = &PL_sv_undef;
+        found = -1;
+      } else {
+        sv_2mortal(val);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    if (SvOK(modseq_ref)) {
+      if (found != -1 && (flags & FC_HASMODSEQ))
+        sv_setuv(SvRV(modseq_ref), (UV)modseq);
+      else
+        sv_setsv(SvRV(modseq_ref), &PL_sv_undef);
+    }
+    if (SvOK(version_ref)) {
+      if (found != -1)
+        sv_setuv(SvRV(version_ref), (UV)version);
+      else
+        sv_setsv(SvRV(version_ref), &PL_sv_undef);
+    }
+
+    mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+    /* Not found is an empty list, so callers can tell it from a
+       cached undef. A stale value (see stale_time) is followed by 1
+       if this caller should refresh it */
+    if (found != -1)
+      XPUSHs(val);
+    if (found == 1)
+      XPUSHs(&PL_sv_yes);
+
+
+int
+fc_get_into(obj, key, buf)
+    SV * obj;
+    SV * key;
+    SV * buf;
+  INIT:
+    int key_len, val_len, found, dec_len = 0;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0, lat_start;
+
+    FC_ENTRY
+
+  CODE:
+    if (SvREADONLY(buf))
+      croak("Modification of a read-only value attempted");
+
+    lat_start = mmc_latency_start(cache);
+
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
 
-    /* Get value data pointer */
     found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
 
-    /* If not found, use undef */
-    if (found == -1) {
-      val = &PL_sv_undef;
-    } else {
+    /* Copy (or decode) into buf's existing buffer, which only grows if
+       it's too small */
+    if (found == -1 || (flags & FC_UNDEF)) {
+      sv_setsv(buf, &PL_sv_undef);
+
+    } else if (flags & FC_INTEGER) {
+      SV * num;
+      if (fc_new_val_sv(cache, val_ptr, val_len, flags, &num) != 0) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+      sv_setsv(buf, num);
+      SvREFCNT_dec(num);
+
+    } else if (!(flags & FC_CODEC_MASK)) {
+      sv_setpvn(buf, (const char *)val_ptr, val_len);
+
+    } else if ((dec_len = mmc_decoded_len(val_ptr, val_len, flags)) < 0) {
+      mmc_unlock(cache);
+      croak("Corrupt compressed value");
 
-      /* Create PERL SV */
-      val = newSVpvn((const char *)val_ptr, val_len);
+    } else {
+      int res;
+      sv_setpvn(buf, "", 0);
+      SvGROW(buf, (STRLEN)dec_len + 1);
+      res = mmc_decode_value(cache, val_ptr, val_len, flags, SvPVX(buf), dec_len);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+      if (res == -2) {
+        /* Compressed with a replaced dictionary, treat as not found */
+        found = -1;
+        sv_setsv(buf, &PL_sv_undef);
+      } else {
+        SvCUR_set(buf, dec_len);
+        *SvEND(buf) = '\0';
+      }
     }
+    if (found != -1 && !(flags & FC_UNDEF) && (flags & FC_UTF8VAL))
+      SvUTF8_on(buf);
 
     mmc_unlock(cache);
-    RETVAL = val;
+    SvSETMAGIC(buf);
+
+    mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+    RETVAL = found != -1;
+
   OUTPUT:
     RETVAL
 
 
 void
-fc_set(obj, key, val)
+fc_with_value(obj, key, cb)
+    SV * obj;
+    SV * key;
+    SV * cb;
+  INIT:
+    int key_len, val_len, found, aliased = 0;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0;
+    SV * val, * result = NULL;
+
+    FC_ENTRY
+
+  PPCODE:
+    if (!fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot))
+      croak("Corrupt key handle");
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+    val = NULL;
+    if (found != -1 && (flags & FC_UNDEF)) {
+      val = newSV(0);
+
+    } else if (found != -1 && !(flags & (FC_CODEC_MASK | FC_INTEGER))) {
+      /* Read only SV of the mapped value bytes themselves. Perl won't
+         free a buffer with SvLEN 0 */
+      val = newSV(0);
+      SvUPGRADE(val, SVt_PV);
+      SvPV_set(val, (char *)val_ptr);
+      SvCUR_set(val, val_len);
+      SvLEN_set(val, 0);
+      SvPOK_only(val);
+      if (flags & FC_UTF8VAL)
+        SvUTF8_on(val);
+      SvREADONLY_on(val);
+      aliased = 1;
+
+    } else if (found != -1) {
+      /* Encoded values and counters have to be decoded to a copy */
+      int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+      if (res == -1) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+    }
+
+    /* Call the callback with the page locked, trapping any error so
+       the page is always unlocked */
+    if (val) {
+      int count;
+
+      ENTER;
+      SAVETMPS;
+      PUSHMARK(SP);
+      XPUSHs(val);
+      PUTBACK;
+      count = call_sv(cb, G_SCALAR | G_EVAL);
+      SPAGAIN;
+      if (count == 1)
+        result = newSVsv(POPs);
+      PUTBACK;
+      FREETMPS;
+      LEAVE;
+
+      /* If the callback kept a reference to the value, it gets its own
+         copy, otherwise detach it from the mapping */
+      if (aliased) {
+        SvREADONLY_off(val);
+        SvPV_set(val, NULL);
+        SvLEN_set(val, 0);
+        SvCUR_set(val, 0);
+        SvPOK_off(val);
+        if (SvREFCNT(val) > 1) {
+          sv_setpvn(val, (const char *)val_ptr, val_len);
+          if (flags & FC_UTF8VAL)
+            SvUTF8_on(val);
+        }
+      }
+      SvREFCNT_dec(val);
+
+      /* The callback may have reallocated the stack, so return our
+         result at the start of our frame in the new one */
+      SP = PL_stack_base + ax - 1;
+    }
+
+    mmc_unlock(cache);
+
+    if (val && SvTRUE(ERRSV)) {
+      if (result)
+        SvREFCNT_dec(result);
+      croak(NULL);
+    }
+
+    XPUSHs(result ? sv_2mortal(result) : &PL_sv_undef);
+
+
+void
+fc_set(obj, key, val, expire_on = -1, in_flags = 0, modseq_sv = &PL_sv_undef, wb = 0, stale_sv = &PL_sv_undef)
     SV * obj;
     SV * key;
     SV * val;
+    U32 expire_on;
+    U32 in_flags;
+    SV * modseq_sv;
+    int wb;
+    SV * stale_sv;
   INIT:
-    int key_len, val_len;
+    int key_len, val_len, num_expunge, item, did_store;
     void * key_ptr, * val_ptr;
-    MU32 hash_page, hash_slot, flags = 0;
-    STRLEN pl_key_len, pl_val_len;
+    MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+    MU64 modseq = 0, lat_start;
 
     FC_ENTRY
 
-  CODE:
+  PPCODE:
+    lat_start = mmc_latency_start(cache);
 
-    /* Get key length, data pointer */
-    key_ptr = (void *)SvPV(key, pl_key_len);
-    key_len = (int)pl_key_len;
+    /* Hash key to get page and slot, or take them from a key handle */
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
 
-    /* Get key length, data pointer */
+    /* Storing with a modseq? (see TOMBSTONES AND MODSEQS in the pod) */
+    if (SvOK(modseq_sv)) {
+      if (sizeof(UV) < sizeof(MU64))
+        croak("modseq support requires a 64 bit perl");
+      in_flags |= FC_HASMODSEQ;
+      modseq = (MU64)SvUV(modseq_sv);
+    }
+
+    /* Same value/flag handling as fc_write, compressing before locking */
+    fc_store_val(cache, key, val, &val_ptr, &val_len, (MU32 *)&in_flags);
+
+    /* Get and lock the page */
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Make space if needed. Only build write back items for dirty
+       entries, and only if the caller will write them back */
+    XPUSHs(&PL_sv_undef);
+    num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+    if (to_expunge) {
+      if (wb) {
+        for (item = 0; item < num_expunge; item++) {
+          SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+          if (item_rv)
+            XPUSHs(item_rv);
+        }
+      }
+
+      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+        mmc_unlock(cache);
+        croak("%s", mmc_error(cache));
+      }
+    }
+
+    /* Write value to cache (1 stored, 0 no space, -1 refused), with
+       the cache's stale_time unless given one */
+    if (SvOK(stale_sv))
+      did_store = mmc_write_stale(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, (MU32)SvUV(stale_sv));
+    else
+      did_store = mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq);
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    /* Store result, then any expunged items to write back */
+    ST(0) = sv_2mortal(newSViv((IV)did_store));
+
+
+void
+fc_cas(obj, key, val, version_sv, expire_on = -1, in_flags = 0, modseq_sv = &PL_sv_undef, wb = 0)
+    SV * obj;
+    SV * key;
+    SV * val;
+    SV * version_sv;
+    U32 expire_on;
+    U32 in_flags;
+    SV * modseq_sv;
+    int wb;
+  INIT:
+    int key_len, val_len, num_expunge, item, did_store;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, version, new_num_slots = 0, ** to_expunge = 0;
+    MU64 modseq = 0, lat_start;
+
+    FC_ENTRY
+
+  PPCODE:
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+
+    /* An undef version only stores if the key isn't in the cache */
+    version = SvOK(version_sv) ? (MU32)SvUV(version_sv) : FC_NOVERSION;
+
+    if (SvOK(modseq_sv)) {
+      if (sizeof(UV) < sizeof(MU64))
+        croak("modseq support requires a 64 bit perl");
+      in_flags |= FC_HASMODSEQ;
+      modseq = (MU64)SvUV(modseq_sv);
+    }
+
+    fc_store_val(cache, key, val, &val_ptr, &val_len, (MU32 *)&in_flags);
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Returns the store result, then any dirty items expunged that
+       need writing back. Same size values are overwritten in place, so
+       only make space if it didn't fit */
+    XPUSHs(&PL_sv_undef);
+    did_store = mmc_cas(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, version);
+    if (did_store == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        did_store = mmc_cas(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, (MU32)in_flags, modseq, version);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    /* 1 stored, 0 no space, -1 refused by a modseq, -2 version changed */
+    ST(0) = sv_2mortal(newSViv((IV)did_store));
+
+
+void
+fc_incr(obj, key, delta, initial = 0, expire_on = -1, in_flags = 0, wb = 0)
+    SV * obj;
+    SV * key;
+    IV delta;
+    IV initial;
+    U32 expire_on;
+    U32 in_flags;
+    int wb;
+  INIT:
+    int key_len, num_expunge, item, res;
+    void * key_ptr;
+    MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+    MU64 lat_start;
+    int64_t result = 0;
+
+    FC_ENTRY
+
+  PPCODE:
+    if (sizeof(IV) < sizeof(int64_t))
+      croak("incr requires a 64 bit perl");
+
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+    if (SvUTF8(key))
+      in_flags |= FC_UTF8KEY;
+
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
+
+    /* Returns the new value and mmc_incr's result, then any dirty items
+       expunged that need writing back */
+    XPUSHs(&PL_sv_undef);
+    XPUSHs(&PL_sv_undef);
+
+    /* Counters are updated in place, so only make space if a new one
+       didn't fit */
+    res = mmc_incr(cache, hash_slot, key_ptr, key_len, (int64_t)delta, (int64_t)initial, (MU32)expire_on, (MU32)in_flags, &result);
+    if (res == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + (int)sizeof(int64_t), &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        res = mmc_incr(cache, hash_slot, key_ptr, key_len, (int64_t)delta, (int64_t)initial, (MU32)expire_on, (MU32)in_flags, &result);
+      }
+    }
+
+    mmc_unlock(cache);
+
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    if (res == 1)
+      ST(0) = sv_2mortal(newSViv((IV)result));
+    ST(1) = sv_2mortal(newSViv((IV)res));
+
+
+void
+fc_append(obj, key, val, prepend = 0, max_len = 0, expire_on = -1, in_flags = 0, wb = 0)
+    SV * obj;
+    SV * key;
+    SV * val;
+    int prepend;
+    U32 max_len;
+    U32 expire_on;
+    U32 in_flags;
+    int wb;
+  INIT:
+    int key_len, val_len, num_expunge, item, res, found, utf8;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, old_flags, new_num_slots = 0, ** to_expunge = 0;
+    STRLEN pl_val_len;
+    MU64 lat_start;
+
+    FC_ENTRY
+
+  PPCODE:
+    lat_start = mmc_latency_start(cache);
+
+    if (!(key = fc_key_hash(cache, key, &key_ptr, &key_len, &hash_page, &hash_slot)))
+      croak("Corrupt key handle");
+    if (SvUTF8(key))
+      in_flags |= FC_UTF8KEY;
+
+    /* Stringify before locking, overloading could run perl code */
     val_ptr = (void *)SvPV(val, pl_val_len);
     val_len = (int)pl_val_len;
 
-    /* Hash key to get page and slot */
-    mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+    if (mmc_lock(cache, hash_page) != 0)
+      croak("%s", mmc_error(cache));
 
-    /* Get and lock the page */
-    mmc_lock(cache, hash_page);
+    /* Values are joined as bytes, so the new bytes must be encoded the
+       same as the stored value (UTF-8 or not). With no value they're
+       stored as bytes if they can be, else as UTF-8 */
+    found = mmc_peek_flags(cache, hash_slot, key_ptr, key_len, &old_flags) == 0;
+    utf8 = found && (old_flags & FC_UTF8VAL);
+    if (utf8 != (SvUTF8(val) != 0)) {
+      SV * copy = sv_2mortal(newSVpvn((const char *)val_ptr, val_len));
+      if (utf8) {
+        sv_utf8_upgrade(copy);
+      } else {
+        SvUTF8_on(copy);
+        if (!sv_utf8_downgrade(copy, 1)) {
+          if (found) {
+            mmc_unlock(cache);
+            croak("Wide character appended to a byte string value");
+          }
+          utf8 = 1;
+          copy = NULL;
+        }
+      }
+      if (copy) {
+        val_ptr = (void *)SvPV(copy, pl_val_len);
+        val_len = (int)pl_val_len;
+      }
+    }
 
-    /* Get value data pointer */
-    mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, -1, flags, 0);
+    /* Trimming UTF-8 to max_len bytes could split a character */
+    if (utf8 && max_len) {
+      mmc_unlock(cache);
+      croak("append max_len needs a byte string value");
+    }
+    if (utf8)
+      in_flags |= FC_UTF8VAL;
+
+    /* Returns mmc_append's result, then any dirty items expunged that
+       need writing back */
+    XPUSHs(&PL_sv_undef);
+
+    /* Only make space if the value couldn't grow where it is. We don't
+       know its new size here, so expunge as for a full page */
+    res = mmc_append(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, prepend, (MU32)max_len, (MU32)expire_on, (MU32)in_flags, FC_UNDEF);
+    if (res == 0) {
+      num_expunge = mmc_calc_expunge(cache, 2, -1, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              XPUSHs(item_rv);
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        res = mmc_append(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, prepend, (MU32)max_len, (MU32)expire_on, (MU32)in_flags, FC_UNDEF);
+      }
+    }
 
     mmc_unlock(cache);
 
+    mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+    ST(0) = sv_2mortal(newSViv((IV)res));
+
+
+void
+fc_get_batch(obj, keys)
+    SV * obj;
+    AV * keys;
+  INIT:
+    int key_len, val_len, found, i, num_keys, cur_page = -1;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, expire_on, flags;
+    MU64 modseq = 0;
+    SV * val;
+
+    FC_ENTRY
+
+  PPCODE:
+    /* Keys or key handles, ideally sorted by page so each page is
+       locked once. Returns a value (undef if not found) for each */
+    num_keys = av_len(keys) + 1;
+    EXTEND(SP, num_keys);
+
+    for (i = 0; i < num_keys; i++) {
+      SV ** key = av_fetch(keys, i, 0);
+
+      if (!key || !fc_key_hash(cache, *key, &key_ptr, &key_len, &hash_page, &hash_slot)) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        croak("Corrupt key handle");
+      }
+
+      if ((int)hash_page != cur_page) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        cur_page = (int)hash_page;
+      }
+
+      found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+      val = &PL_sv_undef;
+      if (found != -1 && !(flags & FC_UNDEF)) {
+        int res = fc_new_val_sv(cache, val_ptr, val_len, flags, &val);
+        if (res == -1) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+        if (res == -2)
+          val = &PL_sv_undef;
+        else
+          sv_2mortal(val);
+      }
+      PUSHs(val);
+    }
+
+    if (cur_page != -1)
+      mmc_unlock(cache);
+
+
+void
+fc_set_batch(obj, keys, vals, expire_on = -1, flags = 0, wb = 0)
+    SV * obj;
+    AV * keys;
+    AV * vals;
+    U32 expire_on;
+    U32 flags;
+    int wb;
+  INIT:
+    int key_len, val_len, num_expunge, item, i, num_keys, cur_page = -1;
+    void * key_ptr, * val_ptr;
+    MU32 hash_page, hash_slot, in_flags, new_num_slots, ** to_expunge;
+    AV * wb_items;
+
+    FC_ENTRY
+
+  PPCODE:
+    /* Keys or key handles, ideally sorted by page so each page is
+       locked once, and a value for each. Returns the store result of
+       each, followed by any dirty items expunged that need writing
+       back */
+    num_keys = av_len(keys) + 1;
+    wb_items = (AV *)sv_2mortal((SV *)newAV());
+    EXTEND(SP, num_keys);
+
+    for (i = 0; i < num_keys; i++) {
+      SV ** key = av_fetch(keys, i, 0), ** val = av_fetch(vals, i, 0), * key_sv;
+
+      if (!key || !(key_sv = fc_key_hash(cache, *key, &key_ptr, &key_len, &hash_page, &hash_slot))) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        croak("Corrupt key handle");
+      }
+
+      if ((int)hash_page != cur_page) {
+        if (cur_page != -1)
+          mmc_unlock(cache);
+        if (mmc_lock(cache, hash_page) != 0)
+          croak("%s", mmc_error(cache));
+        cur_page = (int)hash_page;
+      }
+
+      /* Encoded into the cache's codec buffer, so written straight away */
+      in_flags = (MU32)flags;
+      fc_store_val(cache, key_sv, val ? *val : &PL_sv_undef, &val_ptr, &val_len, &in_flags);
+
+      new_num_slots = 0;
+      to_expunge = 0;
+      num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+      if (to_expunge) {
+        if (wb) {
+          for (item = 0; item < num_expunge; item++) {
+            SV * item_rv = fc_expunged_item_rv(cache, to_expunge[item], 1);
+            if (item_rv)
+              av_push(wb_items, SvREFCNT_inc(item_rv));
+          }
+        }
+
+        if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+          mmc_unlock(cache);
+          croak("%s", mmc_error(cache));
+        }
+      }
+
+      PUSHs(sv_2mortal(newSViv((IV)mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, (MU32)expire_on, in_flags, 0))));
+    }
+
+    if (cur_page != -1)
+      mmc_unlock(cache);
+
+    EXTEND(SP, av_len(wb_items) + 1);
+    for (i = 0; i <= av_len(wb_items); i++)
+      PUSHs(sv_2mortal(SvREFCNT_inc(*av_fetch(wb_items, i, 0))));
+
+
+UV
+fc_set_dict(obj, dict)
+    SV * obj;
+    SV * dict;
+  INIT:
+    void * dict_ptr;
+    STRLEN dict_len;
+
+    FC_ENTRY
+
+  CODE:
+    dict_ptr = (void *)SvPV(dict, dict_len);
+    RETVAL = (UV)mmc_set_dict(cache, dict_ptr, (int)dict_len);
+    if (!RETVAL)
+      croak("%s", mmc_error(cache));
+
+  OUTPUT:
+    RETVAL
+
+
+void
+fc_get_dict(obj)
+    SV * obj;
+  INIT:
+    void * dict_ptr;
+    int dict_len;
+    MU64 gen;
+
+    FC_ENTRY
+
+  PPCODE:
+    gen = mmc_get_dict(cache, &dict_ptr, &dict_len);
+    XPUSHs(sv_2mortal(newSVuv((UV)gen)));
+    XPUSHs(gen ? sv_2mortal(newSVpvn((const char *)dict_ptr, dict_len)) : &PL_sv_undef);
+
+
+SV *
+fc_train_dict(samples, dict_size)
+    SV * samples;
+    int dict_size;
+  INIT:
+    AV * av;
+    MU32 * lens;
+    char * buf;
+    STRLEN total = 0, len;
+    int n, i, dict_len;
+
+  CODE:
+    if (!SvROK(samples) || SvTYPE(SvRV(samples)) != SVt_PVAV)
+      croak("samples must be an array ref");
+    av = (AV *)SvRV(samples);
+    n = av_len(av) + 1;
+
+    /* Concatenate the samples */
+    for (i = 0; i < n; i++) {
+      SV ** svp = av_fetch(av, i, 0);
+      if (svp && SvOK(*svp))
+        total += sv_len(*svp);
+    }
+    Newx(buf, total + 1, char);
+    Newx(lens, n + 1, MU32);
+    for (i = 0, total = 0; i < n; i++) {
+      SV ** svp = av_fetch(av, i, 0);
+      char * ptr;
+      lens[i] = 0;
+      if (!svp || !SvOK(*svp))
+        continue;
+      ptr = SvPV(*svp, len);
+      memcpy(buf + total, ptr, len);
+      lens[i] = (MU32)len;
+      total += len;
+    }
+
+    RETVAL = newSV(dict_size > 0 ? dict_size : 1);
+    dict_len = mmc_train_dict(buf, lens, n, SvPVX(RETVAL), dict_size > 0 ? dict_size : 0);
+    Safefree(buf);
+    Safefree(lens);
+
+    if (dict_len) {
+      SvCUR_set(RETVAL, dict_len);
+      SvPOK_only(RETVAL);
+    } else {
+      SvREFCNT_dec(RETVAL);
+      RETVAL = &PL_sv_undef;
+    }
+
+  OUTPUT:
+    RETVAL
+
 
 NO_OUTPUT void
 fc_dump_page(obj);
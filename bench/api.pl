@@ -0,0 +1,143 @@
+#!/usr/bin/perl -w
+
+=head1 NAME
+
+bench/api.pl - Throughput of the Cache::FastMmap API under concurrency
+
+=head1 SYNOPSIS
+
+  perl -Mblib bench/api.pl [--procs 4] [--seconds 2] [--keys 10000]
+    [--value-size 200] [--serializers raw,storable,sereal,json]
+    [--compressors none,zlib,lz4,snappy]
+    [--ops get,set,get_and_set,multi_get,exists,remove]
+
+=head1 DESCRIPTION
+
+For each serializer and compressor combination, creates a cache,
+fills it with --keys keys, then for each API call forks --procs
+processes that all hammer the same share file with that call on
+random keys for --seconds, and reports the total calls per second.
+
+multi_get calls fetch 10 keys each. remove calls remove random keys,
+so later ones are mostly of keys already removed.
+
+Serializers and compressors whose modules aren't installed are
+skipped.
+
+=cut
+
+use Cache::FastMmap;
+use Getopt::Long;
+use POSIX ();
+use Time::HiRes qw(time);
+use strict;
+
+my %Opts = (
+  procs => 4,
+  seconds => 2,
+  keys => 10000,
+  'value-size' => 200,
+  serializers => 'raw,storable,sereal,json',
+  compressors => 'none,zlib,lz4,snappy',
+  ops => 'get,set,get_and_set,multi_get,exists,remove',
+);
+GetOptions(\%Opts, 'procs=i', 'seconds=f', 'keys=i', 'value-size=i',
+  'serializers=s', 'compressors=s', 'ops=s', 'share-file=s')
+  || die "Usage: $0 [--procs N] [--seconds N] [--keys N] [--value-size N]"
+    . " [--serializers ...] [--compressors ...] [--ops ...] [--share-file F]\n";
+
+my $NKeys = $Opts{keys};
+my $MultiPages = int($NKeys / 10) || 1;
+
+my %OpSubs = (
+  get         => sub { $_[0]->get("k" . int(rand($NKeys))) },
+  set         => sub { $_[0]->set("k" . int(rand($NKeys)), $_[1]) },
+  get_and_set => sub { $_[0]->get_and_set("k" . int(rand($NKeys)), sub { $_[1] }) },
+  multi_get   => sub { $_[0]->multi_get("p" . int(rand($MultiPages)), [ 0 .. 9 ]) },
+  exists      => sub { $_[0]->exists("k" . int(rand($NKeys))) },
+  remove      => sub { $_[0]->remove("k" . int(rand($NKeys))) },
+);
+my @Ops = split /,/, $Opts{ops};
+$OpSubs{$_} || die "Unknown op $_\n" for @Ops;
+
+printf "%d processes, %d keys, %d byte values, %.1fs per test\n\n",
+  $Opts{procs}, $NKeys, $Opts{'value-size'}, $Opts{seconds};
+printf "%-10s %-8s" . (" %12s" x @Ops) . "\n", "serializer", "compress", @Ops;
+
+for my $Serializer (split /,/, $Opts{serializers}) {
+  for my $Compressor (split /,/, $Opts{compressors}) {
+    my $FC = eval {
+      Cache::FastMmap->new(
+        init_file => 1,
+        num_pages => 89,
+        page_size => '256k',
+        serializer => ($Serializer eq 'raw' ? '' : $Serializer),
+        compressor => ($Compressor eq 'none' ? '' : $Compressor),
+        ($Opts{'share-file'} ? (share_file => $Opts{'share-file'}) : ()),
+      );
+    };
+    if (!$FC) {
+      (my $Err = $@) =~ s/ :.*//s;
+      printf "%-10s %-8s %s\n", $Serializer, $Compressor, "skipped: $Err";
+      next;
+    }
+
+    # Compressible but not trivially so
+    my $Str = join '', map { chr(97 + int(rand(4))) } 1 .. $Opts{'value-size'};
+    my $Value = $Serializer eq 'raw' ? $Str : { str => $Str, id => 12345, list => [ 1 .. 10 ] };
+
+    $FC->set("k$_", $Value) for 0 .. $NKeys-1;
+    $FC->multi_set("p$_", { map { $_ => $Value } 0 .. 9 }) for 0 .. $MultiPages-1;
+
+    my @Rates = map { RunOp($FC, $OpSubs{$_}, $Value) } @Ops;
+    printf "%-10s %-8s" . (" %12.0f" x @Rates) . "\n", $Serializer, $Compressor, @Rates;
+
+    $FC->cleanup();
+  }
+}
+
+# Fork procs processes that each call $OpSub on the cache in a loop
+#  for the test time, and return total calls per second
+sub RunOp {
+  my ($FC, $OpSub, $Value) = @_;
+
+  pipe(my $StartR, my $StartW) || die "pipe failed: $!";
+  pipe(my $CountR, my $CountW) || die "pipe failed: $!";
+
+  my @Pids;
+  for (1 .. $Opts{procs}) {
+    my $Pid = fork;
+    die "fork failed: $!" if !defined $Pid;
+    if (!$Pid) {
+      close $StartW; close $CountR;
+      srand($$);
+
+      # Wait for all processes to be ready
+      sysread($StartR, my $Go, 1);
+
+      my ($N, $End) = (0, time + $Opts{seconds});
+      while (1) {
+        $OpSub->($FC, $Value) for 1 .. 100;
+        $N += 100;
+        last if time >= $End;
+      }
+      syswrite($CountW, "$N\n");
+      close $CountW;
+
+      # Don't run the parent's cleanup/END handling
+      POSIX::_exit(0);
+    }
+    push @Pids, $Pid;
+  }
+  close $StartR; close $CountW;
+
+  my $Start = time;
+  close $StartW;
+  my $Total = 0;
+  while (my $Count = <$CountR>) {
+    $Total += $Count;
+  }
+  waitpid($_, 0) for @Pids;
+
+  return $Total / (time - $Start);
+}
@@ -0,0 +1,143 @@
+#!/usr/bin/perl -w
+
+=head1 NAME
+
+bench/overhead.pl - Where the time in get() and set() goes
+
+=head1 SYNOPSIS
+
+  perl -Mblib bench/overhead.pl [--iterations 200000] [--keys 10000]
+    [--value-size 200] [--serializers raw,storable,sereal,json]
+    [--compressors none,zlib,lz4,snappy]
+
+=head1 DESCRIPTION
+
+In a single process, times get() and set() calls on random keys, and
+splits the average time per call into:
+
+  xs     the single XS call get()/set() make (fc_get or fc_set),
+         made directly in a loop
+  c p50  of the xs time, the median time spent in the C layer waiting
+         for the page lock plus the median time reading/writing the
+         page, from the cache's latency_stats histograms. These are
+         medians, not averages like the other columns, so only a rough
+         guide to how much of xs is the C layer
+  codec  serializing/compressing or uncompressing/deserializing the
+         value
+  perl   the rest: the Perl wrapper code in get()/set() itself
+
+All times are in microseconds per call.
+
+=cut
+
+use Cache::FastMmap;
+use Getopt::Long;
+use Time::HiRes qw(time);
+use strict;
+
+my %Opts = (
+  iterations => 200000,
+  keys => 10000,
+  'value-size' => 200,
+  serializers => 'raw,storable,sereal,json',
+  compressors => 'none,zlib,lz4,snappy',
+);
+GetOptions(\%Opts, 'iterations=i', 'keys=i', 'value-size=i',
+  'serializers=s', 'compressors=s')
+  || die "Usage: $0 [--iterations N] [--keys N] [--value-size N]"
+    . " [--serializers ...] [--compressors ...]\n";
+
+my ($NIter, $NKeys) = @Opts{qw(iterations keys)};
+
+# Same random keys for every loop, generated up front
+my @Keys = map { "k" . int(rand($NKeys)) } 1 .. 1000;
+
+printf "%d iterations, %d keys, %d byte values, times in us per call\n\n",
+  $NIter, $NKeys, $Opts{'value-size'};
+printf "%-10s %-8s %-4s %8s %8s %8s %8s %8s\n",
+  "serializer", "compress", "op", "total", "xs", "c p50", "codec", "perl";
+
+for my $Serializer (split /,/, $Opts{serializers}) {
+  for my $Compressor (split /,/, $Opts{compressors}) {
+    my $FC = eval {
+      Cache::FastMmap->new(
+        init_file => 1,
+        num_pages => 89,
+        page_size => '256k',
+        serializer => ($Serializer eq 'raw' ? '' : $Serializer),
+        compressor => ($Compressor eq 'none' ? '' : $Compressor),
+        latency_stats => 1,
+      );
+    };
+    if (!$FC) {
+      (my $Err = $@) =~ s/ :.*//s;
+      printf "%-10s %-8s %s\n", $Serializer, $Compressor, "skipped: $Err";
+      next;
+    }
+    my $Cache = $FC->{Cache};
+    my ($Serialize, $Deserialize, $Compress, $Uncompress)
+      = @$FC{qw(serialize deserialize compress uncompress)};
+
+    my $Str = join '', map { chr(97 + int(rand(4))) } 1 .. $Opts{'value-size'};
+    my $Value = $Serializer eq 'raw' ? $Str : { str => $Str, id => 12345, list => [ 1 .. 10 ] };
+    $FC->set("k$_", $Value) for 0 .. $NKeys-1;
+
+    # The encoded value, as stored in the cache
+    my $Raw = $Serialize ? $Serialize->(\$Value) : $Value;
+    $Raw = $Compress->($Raw) if $Compress;
+
+    # get()
+    $FC->get_latency_statistics(1);
+    my $Total = TimeLoop(sub { $FC->get($_[0]) });
+    my $Lat = $FC->get_latency_statistics(1);
+    my $C = ($Lat->{lock_wait}->{p50} + $Lat->{read}->{p50}) / 1000;
+
+    my $XS = TimeLoop(sub { my @Res = Cache::FastMmap::fc_get($Cache, $_[0]); });
+    my $Codec = TimeLoop(sub {
+      my $Val = $Raw;
+      $Val = $Uncompress->($Val) if $Uncompress;
+      $Val = ${$Deserialize->($Val)} if $Deserialize;
+    });
+    Report($Serializer, $Compressor, "get", $Total, $XS, $C, $Codec);
+
+    # set()
+    $FC->get_latency_statistics(1);
+    $Total = TimeLoop(sub { $FC->set($_[0], $Value) });
+    $Lat = $FC->get_latency_statistics(1);
+    $C = ($Lat->{lock_wait}->{p50} + $Lat->{write}->{p50}) / 1000;
+
+    $XS = TimeLoop(sub { my @Res = Cache::FastMmap::fc_set($Cache, $_[0], $Raw); });
+    $Codec = TimeLoop(sub {
+      my $Val = $Serialize ? $Serialize->(\$Value) : $Value;
+      $Val = $Compress->($Val) if $Compress;
+    });
+    Report($Serializer, $Compressor, "set", $Total, $XS, $C, $Codec);
+
+    $FC->cleanup();
+  }
+}
+
+# Call $Sub with each of the keys in turn for iterations calls, and
+#  return the average time per call in us, less the loop overhead
+sub TimeLoop {
+  my $Sub = shift;
+  my $Loops = int($NIter / @Keys) || 1;
+
+  my $Start = time;
+  for (1 .. $Loops) { $Sub->($_) for @Keys; }
+  my $Elapsed = time - $Start;
+
+  my $Empty = sub { };
+  $Start = time;
+  for (1 .. $Loops) { $Empty->($_) for @Keys; }
+  $Elapsed -= time - $Start;
+
+  return $Elapsed * 1e6 / ($Loops * @Keys);
+}
+
+sub Report {
+  my ($Serializer, $Compressor, $Op, $Total, $XS, $C, $Codec) = @_;
+  my $Perl = $Total - $XS - $Codec;
+  printf "%-10s %-8s %-4s %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+    $Serializer, $Compressor, $Op, $Total, $XS, $C, $Codec, $Perl < 0 ? 0 : $Perl;
+}
@@ -0,0 +1,2934 @@
+package Cache::FastMmap;
+
+=head1 NAME
+
+Cache::FastMmap - Uses an mmap'ed file to act as a shared memory interprocess cache
+
+=head1 SYNOPSIS
+
+  use Cache::FastMmap;
+
+  # Uses vaguely sane defaults
+  $Cache = Cache::FastMmap->new();
+
+  # Uses Storable to serialize $Value to bytes for storage
+  $Cache->set($Key, $Value);
+  $Value = $Cache->get($Key);
+
+  $Cache = Cache::FastMmap->new(serializer => '');
+
+  # Stores stringified bytes of $Value directly
+  $Cache->set($Key, $Value);
+  $Value = $Cache->get($Key);
+
+=head1 ABSTRACT
+
+A shared memory cache through an mmap'ed file. It's core is written
+in C for performance. It uses fcntl locking to ensure multiple
+processes can safely access the cache at the same time. It uses
+a basic LRU algorithm to keep the most used entries in the cache.
+
+=head1 DESCRIPTION
+
+In multi-process environments (eg mod_perl, forking daemons, etc),
+it's common to want to cache information, but have that cache
+shared between processes. Many solutions already exist, and may
+suit your situation better:
+
+=over 4
+
+=item *
+
+L<MLDBM::Sync> - acts as a database, data is not automatically
+expired, slow
+
+=item *
+
+L<IPC::MM> - hash implementation is broken, data is not automatically
+expired, slow
+
+=item *
+
+L<Cache::FileCache> - lots of features, slow
+
+=item *
+
+L<Cache::SharedMemoryCache> - lots of features, VERY slow. Uses
+IPC::ShareLite which freeze/thaws ALL data at each read/write
+
+=item *
+
+L<DBI> - use your favourite RDBMS. can perform well, need a
+DB server running. very global. socket connection latency
+
+=item *
+
+L<Cache::Mmap> - similar to this module, in pure perl. slows down
+with larger pages
+
+=item *
+
+L<BerkeleyDB> - very fast (data ends up mostly in shared memory
+cache) but acts as a database overall, so data is not automatically
+expired
+
+=back
+
+In the case I was working on, I needed:
+
+=over 4
+
+=item *
+
+Automatic expiry and space management
+
+=item *
+
+Very fast access to lots of small items
+
+=item *
+
+The ability to fetch/store many items in one go
+
+=back
+
+Which is why I developed this module. It tries to be quite
+efficient through a number of means:
+
+=over 4
+
+=item *
+
+Core code is written in C for performance
+
+=item *
+
+It uses multiple pages within a file, and uses Fcntl to only lock
+a page at a time to reduce contention when multiple processes access
+the cache.
+
+=item *
+
+It uses a dual level hashing system (hash to find page, then hash
+within each page to find a slot) to make most C<get()> calls O(1) and
+fast
+
+=item *
+
+On each C<set()>, if there are slots and page space available, only
+the slot has to be updated and the data written at the end of the used
+data space. If either runs out, a re-organisation of the page is
+performed to create new slots/space which is done in an efficient way
+
+=back
+
+The class also supports read-through, and write-back or write-through
+callbacks to access the real data if it's not in the cache, meaning that
+code like this:
+
+  my $Value = $Cache->get($Key);
+  if (!defined $Value) {
+    $Value = $RealDataSource->get($Key);
+    $Cache->set($Key, $Value)
+  }
+
+Isn't required, you instead specify in the constructor:
+
+  Cache::FastMmap->new(
+    ...
+    context => $RealDataSourceHandle,
+    read_cb => sub { $_[0]->get($_[1]) },
+    write_cb => sub { $_[0]->set($_[1], $_[2]) },
+  );
+
+And then:
+
+  my $Value = $Cache->get($Key);
+
+  $Cache->set($Key, $NewValue);
+
+Will just work and will be read/written to the underlying data source as
+needed automatically.
+
+=head1 PERFORMANCE
+
+If you're storing relatively large and complex structures into
+the cache, then you're limited by the speed of the Storable module.
+If you're storing simple structures, or raw data, then
+Cache::FastMmap has noticeable performance improvements.
+
+See L<http://cpan.robm.fastmail.fm/cache_perf.html> for some
+comparisons to other modules.
+
+=head1 COMPATIBILITY
+
+Cache::FastMmap uses mmap to map a file as the shared cache space,
+and fcntl to do page locking. This means it should work on most
+UNIX like operating systems.
+
+Ash Berlin has written a Win32 layer using MapViewOfFile et al. to 
+provide support for Win32 platform.
+
+=head2 Threads
+
+Caches can be used from perl ithreads. When a thread is created,
+each cache object it gets a copy of is given its own handle on the
+same mapping, and page locks exclude other threads as well as other
+processes. A thread's copy of a cache never does empty_on_exit or
+unlink_on_exit, that's left to the thread that created it, and
+never uses catch_deadlocks.
+
+Don't share one cache object between threads via threads::shared.
+
+The C library works the same way, give each thread its own handle
+from mmc_clone().
+
+=head1 MEMORY SIZE
+
+Because Cache::FastMmap mmap's a shared file into your processes memory
+space, this can make each process look quite large, even though it's just
+mmap'd memory that's shared between all processes that use the cache,
+and may even be swapped out if the cache is getting low usage.
+
+However, the OS will think your process is quite large, which might
+mean you hit some BSD::Resource or 'ulimits' you set previously that you
+thought were sane, but aren't anymore, so be aware.
+
+=head1 CACHE FILES AND OS ISSUES
+
+Because Cache::FastMmap uses an mmap'ed file, when you put values into
+the cache, you are actually "dirtying" pages in memory that belong to
+the cache file. Your OS will want to write those dirty pages back to
+the file on the actual physical disk, but the rate it does that at is
+very OS dependent.
+
+In most cases, people are not actually concerned about the persistence
+of data in the cache, and so are happy to disable writing of any cache
+data back to disk at all. Baically what they want is an in memory only
+shared cache. The best way to do that is to use a "tmpfs" filesystem
+and put all cache files on there.
+
+For instance, all our machines have a /tmpfs mount point that we
+create in /etc/fstab as:
+
+  none /tmpfs tmpfs defaults,noatime,size=1000M 0 0
+
+And we put all our cache files on there. The tmpfs filesystem is smart
+enough to only use memory as required by files actually on the tmpfs,
+so making it 1G in size doesn't actually use 1G of memory, it only uses
+as much as the cache files we put on it. In all cases, we ensure that
+we never run out of real memory, so the cache files effectively act
+just as named access points to shared memory.
+
+If you do put the cache file on a filesystem backed by a real disk,
+in Linux you have some control over how the OS writes those pages
+back using a number of parameters in /proc/sys/vm
+
+  dirty_background_ratio
+  dirty_expire_centisecs
+  dirty_ratio
+  dirty_writeback_centisecs
+
+How you tune these depends heavily on your setup.
+
+To catch a cache file that accidentally ended up on a disk backed
+filesystem, pass C<check_tmpfs> to the constructor, which warns (or
+dies) if the share file isn't on a tmpfs/ramfs filesystem (currently
+only detected on Linux). C<on_tmpfs()> reports what was detected, and
+C<get_dirty_count()> counts how many page visits by this process wrote
+to the cache file, so you can see how much of your traffic is
+dirtying pages (without C<enable_stats>, plain read hits still update
+the entry's last access time, so they count too).
+
+Some people have suggested using anonymous mmaped memory. Unfortunately
+we need a file descriptor to do the fcntl locking on, so we'd have
+to create a separate file on a filesystem somewhere anyway. It seems
+easier to just create an explicit "tmpfs" filesystem.
+
+=head1 PAGE SIZE AND KEY/VALUE LIMITS
+
+To reduce lock contention, Cache::FastMmap breaks up the file
+into pages. When you get/set a value, it hashes the key to get a page,
+then locks that page, and uses a hash table within the page to
+get/store the actual key/value pair.
+
+One consequence of this is that you cannot store values larger than
+a page in the cache at all. Attempting to store values larger than
+a page size will fail (the set() function will return false).
+
+Also keep in mind that each page has it's own hash table, and that we
+store the key and value data of each item. So if you are expecting to
+store large values and/or keys in the cache, you should use page sizes
+that are definitely larger than your largest key + value size + a few
+kbytes for the overhead.
+
+=head1 USAGE
+
+Because the cache uses shared memory through an mmap'd file, you have
+to make sure each process connects up to the file. There's probably
+two main ways to do this:
+
+=over 4
+
+=item *
+
+Create the cache in the parent process, and then when it forks, each
+child will inherit the same file descriptor, mmap'ed memory, etc and
+just work. This is the recommended way. (BEWARE: This only works under
+UNIX as Win32 has no concept of forking)
+
+=item *
+
+Explicitly connect up in each forked child to the share file. In this
+case, make sure the file already exists and the children connect with
+init_file => 0 to avoid deleting the cache contents and possible
+race corruption conditions. Also be careful that multiple children
+may race to create the file at the same time, each overwriting and
+corrupting content. Use a separate lock file if you must to ensure
+only one child creates the file. (This is the only possible way under
+Win32)
+
+=back
+
+The first way is usually the easiest. If you're using the cache in a
+Net::Server based module, you'll want to open the cache in the
+C<pre_loop_hook>, because that's executed before the fork, but after
+the process ownership has changed and any chroot has been done.
+
+In mod_perl, just open the cache at the global level in the appropriate
+module, which is executed as the server is starting and before it
+starts forking children, but you'll probably want to chmod or chown
+the file to the permissions of the apache process.
+
+=head1 RELIABILITY
+
+Cache::FastMmap is being used in an extensive number of systems at
+L<www.fastmail.com> and is regarded as extremely stable and reliable.
+Development has in general slowed because there are currently no
+known bugs and no additional needed features at this time.
+
+=head1 TOMBSTONES AND MODSEQS
+
+These features close a stale write-back race in cache invalidation.
+The race: process A reads a value from the cache and is using it when
+an invalidation arrives (some other process changed the underlying
+data and called remove()). If A now stores its in-memory copy back -
+explicitly, or via a read-compute-store pattern that raced the
+invalidation - the out of date value is re-cached, and no further
+invalidation is coming.
+
+The fix is to give changes a monotonically increasing 64 bit sequence
+number (a "modseq") and make invalidation leave a marker instead of
+just deleting:
+
+=over 4
+
+=item *
+
+C<< $fc->remove($Key, { modseq => $ModSeq }) >> deletes the value but
+leaves a B<tombstone> recording the modseq of the invalidating change.
+get()/exists() treat tombstones as misses. A tombstone never has its
+modseq lowered by a remove with an older modseq.
+
+=item *
+
+C<< $fc->set($Key, $Value, { modseq => $ModSeq }) >> is a
+B<conditional store>: it's refused (returning false) if the key holds
+a tombstone with a newer modseq, or a live value with a newer modseq.
+Otherwise the value is stored with its modseq (readable back via
+C<< get($Key, { modseq => \my $ms }) >>).
+
+=item *
+
+A plain set() with no modseq is refused by I<any> tombstone. This is
+what you want for values computed from several underlying sources
+whose modseqs aren't mutually comparable: they can't prove freshness,
+so any pending invalidation blocks re-caching until the tombstone
+expires. The checks happen inside the existing slot lookup in the C
+layer, so none of this costs anything extra per operation.
+
+=back
+
+Tombstones expire like normal entries (see C<tombstone_expire_time>)
+and can be evicted under LRU pressure, in which case behaviour
+degrades to plain delete semantics - so they need only be trusted as
+an optimisation window, sized to cover in-flight requests. A plain
+remove() with no modseq deletes tombstones like any other entry.
+
+Internally a tombstone is an entry flag plus an 8 byte packed modseq
+in the value area, and a live value with a modseq carries it as an 8
+byte prefix, all managed by the C layer - the cache file format is
+unchanged, but older versions of this module will misread I<entries
+that use these features>, so upgrade all processes sharing a cache
+file before writing any.
+
+=head1 METHODS
+
+=over 4
+
+=cut
+
+# Modules/Export/XSLoader {{{
+use 5.006;
+use strict;
+use warnings;
+use bytes;
+
+our $VERSION = '1.64';
+
+require XSLoader;
+XSLoader::load('Cache::FastMmap', $VERSION);
+
+# Track currently live caches so we can cleanup in END {}
+#  if we have empty_on_exit set
+our %LiveCaches;
+
+# All open caches, to give each new thread its own handles (see CLONE)
+our %OpenCaches;
+
+# Global time override for testing
+my $time_override;
+
+use constant FC_ISDIRTY => 1;
+
+use File::Spec;
+use Scalar::Util qw(weaken);
+
+# }}}
+
+=item I<new(%Opts)>
+
+Create a new Cache::FastMmap object.
+
+Basic global parameters are:
+
+=over 4
+
+=item * B<share_file>
+
+File to mmap for sharing of data.
+default on unix: /tmp/sharefile-$pid-$time-$random
+default on windows: %TEMP%\sharefile-$pid-$time-$random
+
+=item * B<init_file>
+
+Clear any existing values and re-initialise file. Useful to do in a
+parent that forks off children to ensure that file is empty at the start
+(default: 0)
+
+B<Note:> This is quite important to do in the parent to ensure a
+consistent file structure. The shared file is not perfectly transaction
+safe, and so if a child is killed at the wrong instant, it might leave
+the cache file in an inconsistent state.
+
+=item * B<serializer>
+
+Use a serialization library to serialize perl data structures before
+storing in the cache. If not set, the raw value in the variable passed
+to set() is stored as a string. You must set this if you want to store
+anything other than basic scalar values. Supported values are:
+
+  ''         for none
+  'storable' for 'Storable'
+  'sereal'   for 'Sereal'
+  'json'     for 'JSON'
+  [ $s, $d ] for custom serializer/de-serializer
+
+If this parameter has a value the module will attempt to load the
+associated package and then use the API of that package to serialize data
+before storing in the cache, and deserialize it upon retrieval from the
+cache. (default: 'storable')
+
+You can use a custom serializer/de-serializer by passing an array-ref
+with two values. The first should be a subroutine reference that takes
+the data to serialize as a single argument and returns an octet stream
+to store. The second should be a subroutine reference that takes the
+octet stream as a single argument and returns the original data structure.
+
+One thing to note, the data structure passed to the serializer is always
+a *scalar* reference to the original data passed in to the ->set(...)
+call. If your serializer doesn't support that, you might need to
+dereference it first before storing, but rembember to return a reference
+again in the de-serializer.
+
+(Note: Historically this module only supported a boolean value for the
+`raw_values` parameter and defaulted to 0, which meant it used Storable
+to serialze all values.)
+
+=item * B<raw_values>
+
+Deprecated. Use B<serializer> above
+
+=item * B<compressor>
+
+Compress the value (but not the key) before storing into the cache, using
+the compression package identified by the value of the parameter. Supported
+values are:
+
+  'native'   for the built in LZ4 codec (see below)
+  'zlib'     for 'Compress::Zlib'
+  'lz4'      for 'Compress::LZ4'
+  'snappy'   for 'Compress::Snappy'
+  [ $c, $d ] for custom compressor/de-compressor
+
+If this parameter has a value the module will attempt to load the
+associated package and then use the API of that package to compress data
+before storing in the cache, and uncompress it upon retrieval from the
+cache. (default: undef)
+
+You can use a custom compressor/de-compressor by passing an array-ref
+with two values. The first should be a subroutine reference that takes
+the data to compress as a single octet stream argument and returns an
+octet stream to store. The second should be a subroutine reference that
+takes the compressed octet stream as a single argument and returns the
+original uncompressed data.
+
+(Note: Historically this module only supported a boolean value for the
+`compress` parameter and defaulted to use Compress::Zlib. The note for the
+old `compress` parameter stated: "Some initial testing shows that the
+uncompressing tends to be very fast, though the compressing can be quite
+slow, so it's probably best to use this option only if you know values in
+the cache are long-lived and have a high hit rate."
+
+Comparable test results for the other compression tools are not yet available;
+submission of benchmarks welcome. However, the documentation for the 'Snappy'
+library (http://google.github.io/snappy/) states: For instance, compared to
+the fastest mode of zlib, Snappy is an order of magnitude faster for most
+inputs, but the resulting compressed files are anywhere from 20% to 100%
+bigger. )
+
+The 'native' compressor is LZ4 implemented in the C part of this
+module, needs no other packages, and runs inside the XS get and set
+calls rather than in Perl. The codec is recorded in each entry's
+flags, so every reader decodes natively compressed entries whatever
+its own compressor setting. This means you can switch an existing
+uncompressed cache to 'native' one process at a time. Values shorter
+than B<compress_threshold>, or that don't get smaller, are stored
+uncompressed. For small values, see train_dictionary().
+
+=item * B<compress_threshold>
+
+With the 'native' compressor, values shorter than this many bytes
+(after serialization) are stored uncompressed. (default: 128)
+
+=item * B<compress>
+
+Deprecated. Please use B<compressor>, see above.
+
+=item * B<enable_stats>
+
+Enable some basic statistics capturing. When enabled, every read to
+the cache is counted, and every read to the cache that finds a value
+in the cache is also counted. You can then retrieve these values
+via the get_statistics() call, along with counts of writes,
+deletes, evictions and so on via get_all_statistics(). Counts are kept
+in per-process slots in the cache file, separate from the pages, so
+counting doesn't dirty the pages themselves, but it's still a write
+per operation, so it's disabled by default. (default: 0)
+
+=item * B<lru_granularity>
+
+Each read hit updates the entry's last access time (used to pick
+which entries to expunge first when a page is full), which writes to
+the page, dirtying it and bouncing its memory between CPUs. If set,
+the last access time is only updated if it's at least this many
+seconds old, which makes read hits on hot keys read only with respect
+to the cache pages. The LRU order of entries accessed within this
+window of each other is then approximate. Even when not set, the
+last access time isn't rewritten if it's already current to the
+second. (default: 0)
+
+=item * B<latency_stats>
+
+Record histograms of how long cache operations take, see
+get_latency_statistics(). Like enable_stats, they're kept in the
+cache file and summed over all processes. Each timed operation
+costs a couple of clock reads and an atomic add to the file, so
+it's disabled by default. (default: 0)
+
+=item * B<trace_file>
+
+Append a record of every read, write and delete this process does
+to the given file, for replaying with the mmap_cache_replay tool
+(see "make replay") to see how different num_pages/page_size
+settings would perform with the same traffic. Records are 24 bytes
+(time, key hash, key and value lengths, expiry, operation and
+whether it hit; no key or value data), buffered and appended about
+6k at a time, so several processes can share one trace file.
+(default: none)
+
+=item * B<hot_keys>
+
+Keep a sketch of the most accessed keys in this process, with room
+for this many keys, see get_hot_keys(). Each read and write then
+costs a scan of the sketch, so keep this small (say 16 - 256). The
+sketch is kept in process memory, not in the cache file, so each
+process only sees the accesses it made. (default: 0, disabled)
+
+=item * B<expire_time>
+
+Maximum time to hold values in the cache in seconds. A value of 0
+means does no explicit expiry time, and values are expired only based
+on LRU usage. Can be expressed as 1m, 1h, 1d for minutes/hours/days
+respectively. (default: 0)
+
+=item * B<tombstone_expire_time>
+
+Default expiry time for tombstones written by remove() with a modseq,
+in the same format as expire_time. Tombstones only need to outlive
+in-flight users of the old value, so this is typically short (e.g.
+'1m'). If 0/unset, tombstones use the cache's default expire_time.
+(default: 0)
+
+=back
+
+You may specify the cache size as:
+
+=over 4
+
+=item * B<cache_size>
+
+Size of cache. Can be expresses as 1k, 1m for kilobytes or megabytes
+respectively. Automatically guesses page size/page count values.
+
+=back
+
+Or specify explicit page size/page count values. If none of these are
+specified, the values page_size = 64k and num_pages = 89 are used.
+
+=over 4
+
+=item * B<page_size>
+
+Size of each page. Must be a power of 2 between 4k and 1024k. If not,
+is rounded to the nearest value.
+
+=item * B<num_pages>
+
+Number of pages. Should be a prime number for best hashing
+
+=back
+
+The cache allows the use of callbacks for reading/writing data to an
+underlying data store.
+
+=over 4
+
+=item * B<context>
+
+Opaque reference passed as the first parameter to any callback function
+if specified
+
+=item * B<read_cb>
+
+Callback to read data from the underlying data store.  Called as:
+
+  $read_cb->($context, $Key)
+  
+Should return the value to use. This value will be saved in the cache
+for future retrievals. Return undef if there is no value for the
+given key
+
+=item * B<write_cb>
+
+Callback to write data to the underlying data store.
+Called as:
+
+  $write_cb->($context, $Key, $Value, $ExpiryTime)
+  
+In 'write_through' mode, it's always called as soon as a I<set(...)>
+is called on the Cache::FastMmap class. In 'write_back' mode, it's
+called when a value is expunged from the cache if it's been changed
+by a I<set(...)> rather than read from the underlying store with the
+I<read_cb> above.
+
+Note: Expired items do result in the I<write_cb> being
+called if 'write_back' caching is enabled and the item has been
+changed. You can check the $ExpiryTime against C<time()> if you only
+want to write back values which aren't expired.
+
+Also remember that I<write_cb> may be called in a different process
+to the one that placed the data in the cache in the first place
+
+=item * B<write_many_cb>
+
+Callback to write many items to the underlying data store at once,
+for example as a single bulk insert. Called as:
+
+  $write_many_cb->($context, [ { key => $Key, value => $Value, expire_on => $ExpiryTime }, ... ])
+
+If set, it's called instead of I<write_cb> with the dirty items
+written back together: those expunged from a page to make space, all
+of a page's items for I<empty(...)>, and batches from
+I<flush_dirty(...)>. Without a I<write_cb>, it's also called with one
+item wherever I<write_cb> would be.
+
+=item * B<delete_cb>
+
+Callback to delete data from the underlying data store.  Called as:
+
+  $delete_cb->($context, $Key)
+
+Called as soon as I<remove(...)> is called on the Cache::FastMmap class
+
+=item * B<cache_not_found>
+
+If set to true, then if the I<read_cb> is called and it returns
+undef to say nothing was found, then that information is stored
+in the cache, so that next time a I<get(...)> is called on that
+key, undef is returned immediately rather than again calling
+the I<read_cb>
+
+=item * B<lease_time>
+
+Turns on stampede protection for I<read_cb>. Normally I<read_cb> is
+called with the page locked, so other processes wanting any key on
+the page wait for it, or with I<allow_recursive>, every process that
+misses on a key calls I<read_cb> for it at once.
+
+With I<lease_time> set (in the same format as I<expire_time>), the
+first process to miss on a key leaves a lease marker in the cache
+and calls I<read_cb> without the page locked. Other processes that
+miss on the key while the marker is there don't call I<read_cb>. If
+the key's value had only just expired, they return that stale value
+straight away. Otherwise they wait for the lease holder to store the
+value, for up to I<lease_wait>, then call I<read_cb> themselves.
+
+The lease holder's store (or a set() of the key by anyone) replaces
+the marker. If I<read_cb> returns undef (and I<cache_not_found> isn't
+set) or dies, the lease is released. A marker left by a process that
+died expires after I<lease_time>, and the next miss takes a new
+lease. (default: 0, off)
+
+=item * B<lease_wait>
+
+How long (in seconds, may be fractional) a process waits for another's
+lease before calling I<read_cb> itself, polling the cache meanwhile.
+(default: lease_time)
+
+=item * B<stale_time>
+
+Lets values be served stale for a while after they expire, so a busy
+key doesn't miss (and call I<read_cb>) in every process at once when
+it expires. Entries that expire (from I<expire_time>, or an expiry
+passed to set()) are kept for I<stale_time> more (in the same format
+as I<expire_time>), and aren't expunged as expired meanwhile.
+
+A get() of a key in that window returns the stale value. The first
+process to get it is picked to refresh it: with a I<refresh_cb>, that
+is called, otherwise with a I<read_cb>, the value is fetched and
+stored, and get() returns the new value. Other processes keep getting
+the stale value without refreshing for up to I<refresh_time>, after
+which the next get() is picked, in case the refresh failed. Pass a
+C<stale> option to get() to refresh the value yourself instead.
+(default: 0, off)
+
+=item * B<refresh_time>
+
+How long (in the same format as I<expire_time>) a process picked to
+refresh a stale value has before another one is picked. (default: 10
+seconds)
+
+=item * B<refresh_cb>
+
+Called instead of refreshing a stale value (see I<stale_time>) in
+get(), for example to queue the refresh to run in the background:
+
+  $refresh_cb->($context, $Key, $StaleValue)
+
+It should eventually set() a new value for the key. Any error it
+throws is ignored, and get() returns the stale value.
+
+=item * B<write_action>
+
+Either 'write_back' or 'write_through'. (default: write_through)
+
+=item * B<allow_recursive>
+
+If you're using a callback function, then normally the cache is not
+re-enterable, and attempting to call a get/set on the cache will
+cause an error. By setting this to one, the cache will unlock any
+pages before calling the callback. During the unlock time, other
+processes may change data in current cache page, causing possible
+unexpected effects. You shouldn't set this unless you know you
+want to be able to recall to the cache within a callback.
+(default: 0)
+
+=item * B<empty_on_exit>
+
+When you have 'write_back' mode enabled, then
+you really want to make sure all values from the cache are expunged
+when your program exits so any changes are written back.
+
+The trick is that we only want to do this in the parent process,
+we don't want any child processes to empty the cache when they exit.
+So if you set this, it takes the PID via $$, and only calls
+empty in the DESTROY method if $$ matches the pid we captured
+at the start. (default: 0)
+
+=item * B<unlink_on_exit>
+
+Unlink the share file when the cache is destroyed.
+
+As with empty_on_exit, this will only unlink the file if the
+DESTROY occurs in the same PID that the cache was created in
+so that any forked children don't unlink the file.
+
+This value defaults to 1 if the share_file specified does
+not already exist. If the share_file specified does already
+exist, it defaults to 0.
+
+=item * B<catch_deadlocks>
+
+Sets an alarm(10) before each page is locked via fcntl(F_SETLKW) to catch
+any deadlock. This used to be the default behaviour, but it's not really
+needed in the default case and could clobber sub-second Time::HiRes
+alarms setup by other code. Defaults to 0.
+
+The alarm is process wide, so it doesn't mix with threads. A new
+thread's copy of a cache never sets one (see L</Threads>), but the
+original object in the creating thread still does, and its alarm can
+clobber or be delivered in place of another thread's. Leave this off
+in threaded programs.
+
+=item * B<check_tmpfs>
+
+Check whether the share file is on a memory backed (tmpfs/ramfs)
+filesystem. If it's not, every page dirtied by a set() or read hit is
+eventually written back to disk by the OS (see L</CACHE FILES AND OS
+ISSUES>). Set to 'warn' to warn if it's not, or 'die' to die. Only
+detected on Linux, no check is done elsewhere. Defaults to 0.
+
+=back
+
+=cut
+sub new {
+  my $Proto = shift;
+  my $Class = ref($Proto) || $Proto;
+
+  # If first item is a hash ref, use it as arguments
+  my %Args = ref($_[0]) eq 'HASH' ? %{shift()} : @_;
+
+  my $Self = {};
+  bless ($Self, $Class);
+
+  # Work out cache file and whether to init
+  my $share_file = $Args{share_file};
+  if (!$share_file) {
+    my $tmp_dir = File::Spec->tmpdir;
+    $share_file = File::Spec->catfile($tmp_dir, "sharefile");
+    $share_file .= "-" . $$ . "-" . time . "-" . int(rand(100000));
+  }
+  !ref($share_file) || die "share_file argument was a reference";
+  $Self->{share_file} = $share_file;
+  my $permissions = $Args{permissions};
+
+  my $init_file = $Args{init_file} ? 1 : 0;
+  my $test_file = $Args{test_file} ? 1 : 0;
+  my $enable_stats = $Args{enable_stats} ? 1 : 0;
+  my $lru_granularity = int($Args{lru_granularity} || 0);
+  my $hot_keys = int($Args{hot_keys} || 0);
+  my $latency_stats = $Args{latency_stats} ? 1 : 0;
+  my $trace_file = $Args{trace_file};
+  my $catch_deadlocks = $Args{catch_deadlocks} ? 1 : 0;
+  my $check_tmpfs = $Args{check_tmpfs} || '';
+  $check_tmpfs =~ /^(|0|1|warn|die)$/
+    || die "Unrecognized value >$check_tmpfs< for `check_tmpfs` parameter";
+
+  # Worth out unlink default if not specified
+  if (!exists $Args{unlink_on_exit}) {
+    $Args{unlink_on_exit} = -f($share_file) ? 0 : 1;
+  }
+
+  # Serialise stored values?
+  my $serializer = $Args{serializer};
+  $serializer = ($Args{raw_values} ? '' : 'storable') if !defined $serializer;
+
+  if ($serializer) {
+    if (ref $serializer eq 'ARRAY') {
+      $Self->{serialize}   = $serializer->[0];
+      $Self->{deserialize} = $serializer->[1];
+    } elsif ($serializer eq 'storable') {
+      eval "require Storable;"
+        || die "Could not load serialization package: Storable : $@";
+      $Self->{serialize}   = Storable->can("freeze");
+      $Self->{deserialize} = Storable->can("thaw");
+    } elsif ($serializer eq 'sereal') {
+      eval "require Sereal::Encoder; require Sereal::Decoder;"
+        || die "Could not load serialization package: Sereal : $@";
+      my $SerealEnc = Sereal::Encoder->new();
+      my $SerealDec = Sereal::Decoder->new();
+      $Self->{serialize} = sub { $SerealEnc->encode(@_); };
+      $Self->{deserialize} = sub { $SerealDec->decode(@_); };
+    } elsif ($serializer eq 'json') {
+      eval "require JSON;"
+        || die "Could not load serialization package: JSON : $@";
+      my $JSON = JSON->new->utf8->allow_nonref;
+      $Self->{serialize}   = sub { $JSON->encode(${$_[0]}); };
+      $Self->{deserialize} = sub { \$JSON->decode($_[0]); };
+    } else {
+      die "Unrecognized value >$serializer< for `serializer` parameter";
+    }
+  }
+
+  # Compress stored values?
+  my $compressor = $Args{compressor};
+  $compressor = ($Args{compress} ? 'zlib' : 0) if !defined $compressor;
+
+  my %known_compressors = (
+    zlib   => 'Compress::Zlib',
+    lz4    => 'Compress::LZ4',
+    snappy => 'Compress::Snappy',
+  );
+
+  # Built in C codec, applied in the XS get/set calls
+  my $codec = '';
+  if ($compressor && $compressor eq 'native') {
+    $codec = 'lz4';
+    $compressor = 0;
+  }
+  my $compress_threshold = int($Args{compress_threshold} || 128);
+
+  if ( $compressor ) {
+    if (ref $compressor eq 'ARRAY') {
+      $Self->{compress}   = $compressor->[0];
+      $Self->{uncompress} = $compressor->[1];
+    } elsif (my $compressor_module = $known_compressors{$compressor}) {
+      eval "require $compressor_module;"
+        || die "Could not load compression package: $compressor_module : $@";
+
+      # LZ4 and Snappy use same API
+      if ($compressor_module eq 'Compress::LZ4' || $compressor_module eq 'Compress::Snappy') {
+        $Self->{compress}   = $compressor_module->can("compress");
+        $Self->{uncompress} = $compressor_module->can("uncompress");
+      } elsif ($compressor_module eq 'Compress::Zlib') {
+        $Self->{compress}   = $compressor_module->can("memGzip");
+        # (gunzip from tmp var: https://rt.cpan.org/Ticket/Display.html?id=72945)
+        my $uncompress = $compressor_module->can("memGunzip");
+        $Self->{uncompress} = sub { &$uncompress(my $Tmp = shift) };
+      }
+    } else {
+      die "Unrecognized value >$compressor< for `compressor` parameter";
+    }
+  }
+
+  # If using empty_on_exit, need to track used caches
+  my $empty_on_exit = $Self->{empty_on_exit} = int($Args{empty_on_exit} || 0);
+
+  # Work out expiry time in seconds
+  my $expire_time = $Self->{expire_time} = parse_expire_time($Args{expire_time});
+
+  # How long expired entries can be served stale, see stale_time
+  my $stale_time = parse_expire_time($Args{stale_time});
+  my $refresh_time = defined $Args{refresh_time} ? parse_expire_time($Args{refresh_time}) : 10;
+
+  # Default expiry for tombstones left by remove() with a modseq (see
+  #  TOMBSTONES AND MODSEQS)
+  $Self->{tombstone_expire_time} = parse_expire_time($Args{tombstone_expire_time});
+
+  # Function rounds to the nearest power of 2
+  sub RoundPow2 { return int(2 ** int(log($_[0])/log(2)) + 0.1); }
+
+  # Work out cache size
+  my ($cache_size, $num_pages, $page_size);
+
+  my %Sizes = (k => 1024, m => 1024*1024);
+  if ($cache_size = $Args{cache_size}) {
+    $cache_size *= $Sizes{lc($1)} if $cache_size =~ s/([km])$//i;
+
+    if ($num_pages = $Args{num_pages}) {
+      $page_size = RoundPow2($cache_size / $num_pages);
+      $page_size = 4096 if $page_size < 4096;
+
+    } else {
+      $page_size = $Args{page_size} || 65536;
+      $page_size *= $Sizes{lc($1)} if $page_size =~ s/([km])$//i;
+      $page_size = 4096 if $page_size < 4096;
+
+      # Increase num_pages till we exceed 
+      $num_pages = 89;
+      if ($num_pages * $page_size <= $cache_size) {
+        while ($num_pages * $page_size <= $cache_size) {
+          $num_pages = $num_pages * 2 + 1;
+        }
+      } else {
+        while ($num_pages * $page_size > $cache_size) {
+          $num_pages = int(($num_pages-1) / 2);
+        }
+        $num_pages = $num_pages * 2 + 1;
+      }
+
+    }
+
+  } else {
+    ($num_pages, $page_size) = @Args{qw(num_pages page_size)};
+    $num_pages ||= 89;
+    $page_size ||= 65536;
+    $page_size *= $Sizes{lc($1)} if $page_size =~ s/([km])$//i;
+    $page_size = RoundPow2($page_size);
+  }
+
+  $cache_size = $num_pages * $page_size;
+  @$Self{qw(cache_size num_pages page_size)}
+    = ($cache_size, $num_pages, $page_size);
+
+  # Number of slots to start in each page
+  my $start_slots = int($Args{start_slots} || 0) || 89;
+
+  # Save read through/write back/write through details
+  my $write_back = ($Args{write_action} || 'write_through') eq 'write_back';
+  @$Self{qw(context read_cb write_cb write_many_cb delete_cb refresh_cb)}
+    = @Args{qw(context read_cb write_cb write_many_cb delete_cb refresh_cb)};
+
+  # Single writes go to write_many_cb if there's no write_cb
+  if ((my $write_many_cb = $Self->{write_many_cb}) && !$Self->{write_cb}) {
+    $Self->{write_cb} = sub {
+      $write_many_cb->($_[0], [ { key => $_[1], value => $_[2], expire_on => $_[3] } ]);
+    };
+  }
+  @$Self{qw(cache_not_found allow_recursive write_back)}
+    = (@Args{qw(cache_not_found allow_recursive)}, $write_back);
+
+  # Lease markers for read_cb stampede protection
+  if (my $lease_time = $Args{lease_time}) {
+    $Self->{lease_time} = parse_expire_time($lease_time) || 1;
+    $Self->{lease_wait} = defined $Args{lease_wait} ? $Args{lease_wait} : $Self->{lease_time};
+  }
+  @$Self{qw(unlink_on_exit enable_stats)}
+    = (@Args{qw(unlink_on_exit)}, $enable_stats);
+
+  # Save pid
+  $Self->{pid} = $$;
+
+  # Initialise C cache code
+  my $Cache = fc_new();
+
+  $Self->{Cache} = $Cache;
+
+  # Setup cache parameters
+  fc_set_param($Cache, 'init_file', $init_file);
+  fc_set_param($Cache, 'test_file', $test_file);
+  fc_set_param($Cache, 'page_size', $page_size);
+  fc_set_param($Cache, 'num_pages', $num_pages);
+  fc_set_param($Cache, 'expire_time', $expire_time);
+  fc_set_param($Cache, 'stale_time', $stale_time);
+  fc_set_param($Cache, 'refresh_time', $refresh_time);
+  fc_set_param($Cache, 'share_file', $share_file);
+  fc_set_param($Cache, 'permissions', $permissions) if defined $permissions;
+  fc_set_param($Cache, 'start_slots', $start_slots);
+  fc_set_param($Cache, 'catch_deadlocks', $catch_deadlocks);
+  fc_set_param($Cache, 'enable_stats', $enable_stats);
+  fc_set_param($Cache, 'lru_granularity', $lru_granularity);
+  fc_set_param($Cache, 'hot_keys', $hot_keys);
+  fc_set_param($Cache, 'latency_stats', $latency_stats);
+  fc_set_param($Cache, 'trace_file', $trace_file) if defined $trace_file;
+  fc_set_param($Cache, 'codec', $codec);
+  fc_set_param($Cache, 'compress_threshold', $compress_threshold);
+
+  # And initialise it
+  fc_init($Cache);
+
+  # Dirty pages on a disk backed share file get written back by the OS
+  if ($check_tmpfs && fc_get_param($Cache, 'is_tmpfs') == 0) {
+    my $Msg = "Cache::FastMmap share_file $share_file is not on a tmpfs filesystem,"
+      . " dirty pages will be written back to disk";
+    die $Msg if $check_tmpfs eq 'die';
+    warn "$Msg\n";
+  }
+
+  # Track cache if need to empty on exit, and all caches for threads
+  weaken($LiveCaches{"$Self"} = $Self)
+    if $empty_on_exit;
+  weaken($OpenCaches{"$Self"} = $Self);
+
+  # All done, return PERL hash ref as class
+  return $Self;
+}
+
+=item I<get($Key, [ \%Options ])>
+
+Search cache for given Key. Returns undef if not found. If
+I<read_cb> specified and not found, calls the callback to try
+and find the value for the key, and if found (or 'cache_not_found'
+is set), stores it into the cache and returns the found value.
+
+Keys holding a tombstone report as not found, and a value found by
+I<read_cb> is returned but not stored back over a tombstone (see
+L</TOMBSTONES AND MODSEQS>).
+
+I<%Options> is optional. Pass C<< modseq => \my $ModSeq >> to receive
+the stored modseq of the value (undef if it was stored without one),
+and C<< version => \my $Version >> to receive the entry's version for
+a later cas() (undef if not found in the cache). Pass
+C<< stale => \my $Stale >> to refresh stale values yourself (see
+I<stale_time> in new()): I<$Stale> is set true if the value returned
+is stale and this caller was picked to refresh it, which it should do
+by set()ting a new value. Other entries are
+used by get_and_set() to control the locking behaviour. For now, you
+should probably ignore them unless you read the code to understand
+how it works
+
+=cut
+sub get {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $SkipUnlock = $_[2] && $_[2]->{skip_unlock};
+
+  if (my $StaleOut = $_[2] && $_[2]->{stale}) {
+    ref($StaleOut) eq 'SCALAR' || die "get stale option must be a scalar ref";
+    $$StaleOut = undef;
+  }
+
+  # Fast path, hash/lock/read/unlock in one XS call, which returns an
+  #  empty list if not found, or the value and 1 if it's stale and we
+  #  should refresh it. Only a miss with a read_cb, or a caller that
+  #  wants the page left locked, needs the full path below
+  if (!$SkipUnlock) {
+    if ((my ($Val, $Stale) = fc_get($Cache, $_[1], $_[2] && $_[2]->{modseq}, $_[2] && $_[2]->{version}))
+        || !$Self->{read_cb}) {
+      $Val = $Self->{uncompress}($Val) if defined($Val) && $Self->{compress};
+      $Val = ${$Self->{deserialize}($Val)} if defined($Val) && $Self->{deserialize};
+      return $Stale ? $Self->_get_stale($_[1], $Val, $_[2]) : $Val;
+    }
+  }
+
+  my $Locked = 0;
+
+  # Hash value, lock page, read result
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+
+  # Misses with leases call read_cb without the page locked
+  return $Self->_get_leased($_[1], $HashPage, $HashSlot, $_[2])
+    if $Self->{lease_time} && $Self->{read_cb} && !$SkipUnlock;
+
+  fc_lock($Cache, $HashPage);
+  $Locked = 1;
+
+  my ($Val, $Flags, $Found, $ExpireOn, $ModSeq, $Version);
+  my $Err;
+  eval {
+    ($Val, $Flags, $Found, $ExpireOn, $ModSeq, $Version) = fc_read($Cache, $HashSlot, $_[1]);
+
+    # Value not found, check underlying data store
+    if (!$Found && (my $read_cb = $Self->{read_cb})) {
+
+      # Callback to read from underlying data store
+      # (unlock page first if we allow recursive calls)
+      if ($Self->{allow_recursive}) {
+        fc_unlock($Cache);
+        $Val = eval { $read_cb->($Self->{context}, $_[1]); };
+        my $CbErr = $@;
+        fc_lock($Cache, $HashPage);
+        die $CbErr if $CbErr;
+      } else {
+        $Val = $read_cb->($Self->{context}, $_[1]);
+      }
+
+      # If we found it, or want to cache not-found, store back into our cache
+      if (defined $Val || $Self->{cache_not_found}) {
+
+        # Are we doing writeback's? If so, need to mark as dirty in cache
+        my $write_back = $Self->{write_back};
+
+        $Val = $Self->{serialize}(\$Val) if $Self->{serialize};
+        $Val = $Self->{compress}($Val) if $Self->{compress};
+
+        # Get key/value len (we've got 'use bytes'), and do expunge check to
+        #  create space if needed
+        my $KVLen = length($_[1]) + (defined($Val) ? length($Val) : 0);
+        $Self->_expunge_page(2, 1, $KVLen);
+
+        # A tombstone refuses this store, and rightly so: the value we
+        #  just computed may predate the invalidating change. It's
+        #  still returned to the caller, just not cached
+        fc_write($Cache, $HashSlot, $_[1], $Val, -1, 0);
+      }
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+
+  # On error, always unlock (caller can't clean up after a thrown exception).
+  # On success, unlock unless caller asked us to leave the page locked.
+  if (defined $Err) {
+    fc_unlock($Cache) if $Locked && fc_is_locked($Cache);
+    die $Err;
+  }
+  if (!$SkipUnlock) {
+    fc_unlock($Cache);
+    $Locked = 0;
+  }
+
+  # If not using raw values, use thaw() to turn data back into object
+  eval {
+    $Val = $Self->{uncompress}($Val) if defined($Val) && $Self->{compress};
+    $Val = ${$Self->{deserialize}($Val)} if defined($Val) && $Self->{deserialize};
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  if (defined $Err) {
+    fc_unlock($Cache) if $Locked && fc_is_locked($Cache);
+    die $Err;
+  }
+
+  # Report the value's stored modseq if the caller asked for it
+  if (my $ModSeqOut = $_[2] && $_[2]->{modseq}) {
+    ref($ModSeqOut) eq 'SCALAR' || die "get modseq option must be a scalar ref";
+    $$ModSeqOut = $ModSeq;
+  }
+
+  # And its version. A value just fetched by read_cb has none, as it
+  #  wasn't in the cache when we looked
+  if (my $VersionOut = $_[2] && $_[2]->{version}) {
+    ref($VersionOut) eq 'SCALAR' || die "get version option must be a scalar ref";
+    $$VersionOut = $Version;
+  }
+
+  # If explicitly asked to skip unlocking, return a sentinel so callers
+  # using the old 3-tuple unpack still work (slot 2 is now a placeholder).
+  return ($Val, 1, {
+    $Found ? (expire_on => $ExpireOn) : (),
+    defined $ModSeq ? (modseq => $ModSeq) : (),
+  }) if $SkipUnlock;
+
+  return $Val;
+}
+
+# get() of a key with lease_time set, see lease_time in new()
+sub _get_leased {
+  my ($Self, $Cache, $Key, $HashPage, $HashSlot, $Opts) = ($_[0], $_[0]->{Cache}, @_[1 .. 4]);
+
+  # Not done for leased gets, report none
+  for (grep { $Opts && $Opts->{$_} } qw(modseq version)) {
+    ref($Opts->{$_}) eq 'SCALAR' || die "get $_ option must be a scalar ref";
+    ${$Opts->{$_}} = undef;
+  }
+
+  my ($Waited, $Sleep) = (0, 0.005);
+  my ($Val, $State, $Version, $Err);
+
+  while (1) {
+    fc_lock($Cache, $HashPage);
+    eval {
+      # Make room for a marker, then read or take the lease
+      $Self->_expunge_page(2, 1, length($Key));
+      ($Val, $State, $Version) = fc_lease($Cache, $HashSlot, $Key,
+        $Self->{lease_time});
+      1;
+    } || do {
+      $Err = $@ || 'unknown error';
+    };
+    fc_unlock($Cache) if fc_is_locked($Cache);
+    die $Err if defined $Err;
+
+    # Found, or someone else is fetching and we have a stale value
+    last if $State == 0 || $State == 3 || ($State == 2 && defined $Val);
+
+    # Our lease, or we couldn't take one, or we've waited long enough
+    #  for someone else's
+    if ($State != 2 || $Waited >= $Self->{lease_wait}) {
+      $State = 1 if $State == 2;
+      undef $Val;
+      last;
+    }
+
+    select(undef, undef, undef, $Sleep);
+    $Waited += $Sleep;
+    $Sleep *= 2 if $Sleep < 0.1;
+  }
+
+  if ($State == 1 || $State == -1) {
+    $Val = eval { $Self->{read_cb}->($Self->{context}, $Key) };
+    $Err = $@;
+
+    # Replace our marker, unless someone stored the key meanwhile
+    if (!$Err && (defined $Val || $Self->{cache_not_found})) {
+      my $StoreVal = $Self->{serialize} ? $Self->{serialize}(\$Val) : $Val;
+      $StoreVal = $Self->{compress}($StoreVal) if $Self->{compress};
+      my ($DidStore, @WBItems) = fc_cas($Cache, $Key, $StoreVal, $Version, -1, 0, undef,
+        $Self->{write_back} && $Self->{write_cb} ? 1 : 0);
+      $Self->_write_back_items(\@WBItems) if @WBItems;
+      return $Val;
+    }
+
+    if (defined $Version) {
+      fc_lock($Cache, $HashPage);
+      eval { fc_release_lease($Cache, $HashSlot, $Key, $Version); 1; }
+        || do { $Err ||= $@ || 'unknown error'; };
+      fc_unlock($Cache) if fc_is_locked($Cache);
+    }
+    die $Err if $Err;
+    return $Val;
+  }
+
+  $Val = $Self->{uncompress}($Val) if defined($Val) && $Self->{compress};
+  $Val = ${$Self->{deserialize}($Val)} if defined($Val) && $Self->{deserialize};
+  return $State == 3 ? $Self->_get_stale($Key, $Val, $Opts) : $Val;
+}
+
+# get() of a stale value we were picked to refresh, see stale_time in
+#  new(). Returns the value for get() to return
+sub _get_stale {
+  my ($Self, $Cache, $Key, $Val, $Opts) = ($_[0], $_[0]->{Cache}, @_[1 .. 3]);
+  $Key = $Key->[0] if ref($Key) eq 'Cache::FastMmap::KeyHandle';
+
+  # Caller refreshes it
+  if (my $StaleOut = $Opts && $Opts->{stale}) {
+    $$StaleOut = 1;
+    return $Val;
+  }
+
+  if (my $refresh_cb = $Self->{refresh_cb}) {
+    eval { $refresh_cb->($Self->{context}, $Key, $Val); };
+    return $Val;
+  }
+
+  # Fetch it now. If that fails, keep serving the stale value, another
+  #  get() is picked to refresh it after refresh_time
+  my $read_cb = $Self->{read_cb} or return $Val;
+  my $NewVal = eval { $read_cb->($Self->{context}, $Key) };
+  return $Val if $@ || (!defined $NewVal && !$Self->{cache_not_found});
+
+  my $StoreVal = $Self->{serialize} ? $Self->{serialize}(\$NewVal) : $NewVal;
+  $StoreVal = $Self->{compress}($StoreVal) if $Self->{compress};
+  my ($DidStore, @WBItems) = fc_set($Cache, $Key, $StoreVal, -1, 0, undef,
+    $Self->{write_back} && $Self->{write_cb} ? 1 : 0);
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+
+  return $NewVal;
+}
+
+=item I<get_into($Key, $Buf)>
+
+Like get(), but copies the value into the caller supplied scalar
+I<$Buf> rather than returning a new one. The existing string buffer
+of I<$Buf> is reused, and only grown when the value doesn't fit, so
+reading large values into the same scalar in a loop avoids allocating
+(and freeing) a new buffer each time.
+
+Returns true if the key was found, in which case I<$Buf> holds the
+value (undef for a stored undef), otherwise returns false and sets
+I<$Buf> to undef. A miss with a I<read_cb> goes through get().
+
+This only avoids the copy for raw values. With a serializer or a perl
+level compressor, the value is deserialized with get() and assigned
+to I<$Buf>.
+
+=cut
+sub get_into {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  if (!$Self->{deserialize} && !$Self->{compress}) {
+    my $Found = fc_get_into($Cache, $_[1], $_[2]);
+    return $Found if $Found || !$Self->{read_cb};
+  }
+
+  $_[2] = $Self->get($_[1]);
+  return defined $_[2] ? 1 : 0;
+}
+
+=item I<with_value($Key, $Sub)>
+
+Calls I<$Sub> with a read only scalar that aliases the value bytes in
+the mapped cache file itself, so nothing is copied. Returns whatever
+I<$Sub> returns (in scalar context), or undef without calling I<$Sub>
+if the key isn't found. I<read_cb> is not used.
+
+  my $Len = $Cache->with_value($Key, sub { length $_[0] });
+
+The page holding the key stays locked while I<$Sub> runs, so keep it
+short, and don't call other methods on this cache from within it (any
+that lock the same page will deadlock). If I<$Sub> dies, the page is
+unlocked and the error rethrown.
+
+I<$_[0]> is only valid for the duration of the call. If I<$Sub> keeps
+a reference to it, that reference is given its own copy of the value
+before the page is unlocked.
+
+Values stored with the native codec are decompressed to a copy first.
+With a serializer or perl level compressor, I<$Sub> is passed the
+deserialized value from get().
+
+=cut
+sub with_value {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  if ($Self->{deserialize} || $Self->{compress}) {
+    my $Val = $Self->get($_[1]);
+    return defined $Val ? scalar $_[2]->($Val) : undef;
+  }
+
+  return fc_with_value($Cache, $_[1], $_[2]);
+}
+
+=item I<set($Key, $Value, [ \%Options ])>
+
+Store specified key/value pair into cache
+
+I<%Options> is optional. If it's not a hash reference, it's
+assumed to be an explicit expiry time for the key being set,
+this is to make set() compatible with the Cache::Cache interface
+
+If a hash is passed, the useful entries are expire_on to
+set an explicit expiry time for this entry (epoch seconds), expire_time
+to set an explicit relative future expiry time for this entry in
+seconds/minutes/days in the same format as passed to the new constructor,
+or modseq to make this a conditional store (see
+L</TOMBSTONES AND MODSEQS>): the value is stored tagged with the given
+64 bit unsigned modseq, unless the key holds a tombstone or live value
+with a newer modseq, in which case nothing is stored and false is
+returned. A set() without modseq is refused by any tombstone. Pass
+stale_time to serve the entry stale for that long after it expires,
+instead of the cache's I<stale_time> (see new()).
+
+Some other options are used internally, such as by get_and_set()
+to control the locking behaviour. For now, you should probably ignore
+it unless you read the code to understand how it works
+
+This method returns true if the value was stored in the cache,
+false otherwise. See the PAGE SIZE AND KEY/VALUE LIMITS section
+for more details.
+
+=cut
+sub set {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Get opts, make compatible with Cache::Cache interface
+  my $Opts = defined($_[3]) ? (ref($_[3]) ? $_[3] : { expire_time => $_[3] }) : undef;
+  # expire_on takes precedence, otherwise use expire_time if present
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+
+  # Are we doing writeback's? If so, need to mark as dirty in cache
+  my $write_back = $Self->{write_back};
+
+  my $ModSeq = $Opts ? $Opts->{modseq} : undef;
+  !defined($ModSeq) || $ModSeq =~ /^\d+$/
+    or die "set modseq option must be an unsigned integer";
+  my $StaleTime = $Opts && defined $Opts->{stale_time} ? parse_expire_time($Opts->{stale_time}) : undef;
+
+  # Fast path, hash/lock/expunge/write/unlock in one XS call, unless
+  #  the caller already holds the page lock. It returns the store result
+  #  followed by any dirty items expunged that need writing back
+  if (!($Opts && $Opts->{_locked})) {
+    my $Val = $Self->{serialize} ? $Self->{serialize}(\$_[2]) : $_[2];
+    $Val = $Self->{compress}($Val) if $Self->{compress};
+
+    my $WBItems = $write_back && $Self->{write_cb} ? 1 : 0;
+    my ($DidStore, @WBItems) = fc_set($Cache, $_[1], $Val, $expire_on,
+      $write_back ? FC_ISDIRTY : 0, $ModSeq, $WBItems, $StaleTime);
+    $Self->_write_back_items(\@WBItems) if @WBItems;
+    local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+
+    # Write through, or write back a value that didn't fit. Not for
+    #  refused stores, see below
+    if ($DidStore >= 0
+       && (!$write_back || !$DidStore) && (my $write_cb = $Self->{write_cb})) {
+      eval { $write_cb->($Self->{context}, $_[1], $_[2], $expire_on); };
+    }
+
+    return $DidStore > 0 ? 1 : 0;
+  }
+
+  # Hash value, page already locked by caller
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+
+  my ($DidStore, $Err);
+  eval {
+    my $Val = $Self->{serialize} ? $Self->{serialize}(\$_[2]) : $_[2];
+    $Val = $Self->{compress}($Val) if $Self->{compress};
+
+    # Get key/value len (we've got 'use bytes'), and do expunge check to
+    #  create space if needed
+    my $KVLen = length($_[1]) + (defined($Val) ? length($Val) : 0);
+    $Self->_expunge_page(2, 1, $KVLen);
+
+    # Now store into cache. 1 = stored, 0 = no space, -1 = conditional
+    #  store refused (see TOMBSTONES AND MODSEQS)
+    $DidStore = fc_write($Cache, $HashSlot, $_[1], $Val, $expire_on,
+      $write_back ? FC_ISDIRTY : 0, $ModSeq);
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  my $RefusedStore = $DidStore && $DidStore < 0;
+  $DidStore = $DidStore && $DidStore > 0 ? 1 : 0;
+
+  # Always unlock — caller passed _locked to transfer ownership
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  # If we're doing write-through, or write-back and didn't get into cache,
+  #  write back to the underlying store. Not for refused stores: the
+  #  whole point of the refusal is that our value is out of date
+  if (!$RefusedStore
+     && (!$write_back || !$DidStore) && (my $write_cb = $Self->{write_cb})) {
+    eval { $write_cb->($Self->{context}, $_[1], $_[2], $expire_on); };
+  }
+
+  return $DidStore;
+}
+
+=item I<cas($Key, $Value, $Version, [ \%Options ])>
+
+Compare-and-swap. Store $Value under $Key, but only if the entry's
+version is still $Version, as returned by
+C<< get($Key, { version => \my $Version }) >>. Every store to a key
+changes its version, so this only succeeds if nothing has stored to
+(or removed) the key since the get(). If $Version is undef, the value
+is only stored if $Key isn't in the cache.
+
+This allows read-modify-write cycles without holding the page lock
+while the new value is computed, unlike get_and_set().
+
+I<%Options> are as for set(). Returns 1 if the value was stored, 0
+if the version didn't match, and undef if it couldn't be stored for
+a reason retrying won't change: it's too big to fit in a page (see
+set()), or it was refused by a modseq (see
+L</TOMBSTONES AND MODSEQS>). On 0, get the value again and retry:
+
+  my $Stored;
+  do {
+    my $Val = $Cache->get($Key, { version => \my $Version });
+    $Stored = $Cache->cas($Key, compute($Val), $Version);
+  } while (defined $Stored && !$Stored);
+
+Versions are an internal 32 bit counter, separate from modseqs, kept
+in a 4 byte prefix of each entry's value. They only wrap after about
+4 billion stores to the same key.
+
+=cut
+sub cas {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $Opts = defined($_[4]) ? (ref($_[4]) ? $_[4] : { expire_time => $_[4] }) : undef;
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+
+  my $write_back = $Self->{write_back};
+
+  my $ModSeq = $Opts ? $Opts->{modseq} : undef;
+  !defined($ModSeq) || $ModSeq =~ /^\d+$/
+    or die "set modseq option must be an unsigned integer";
+  !defined($_[3]) || $_[3] =~ /^\d+$/
+    or die "cas version must be an unsigned integer";
+
+  my $Val = $Self->{serialize} ? $Self->{serialize}(\$_[2]) : $_[2];
+  $Val = $Self->{compress}($Val) if $Self->{compress};
+
+  my $WBItems = $write_back && $Self->{write_cb} ? 1 : 0;
+  my ($DidStore, @WBItems) = fc_cas($Cache, $_[1], $Val, $_[3], $expire_on,
+    $write_back ? FC_ISDIRTY : 0, $ModSeq, $WBItems);
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+  local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+
+  # Write through, or write back a value that didn't fit, as set()
+  #  does. Not when the version didn't match or the store was refused
+  if ($DidStore >= 0
+     && (!$write_back || !$DidStore) && (my $write_cb = $Self->{write_cb})) {
+    eval { $write_cb->($Self->{context}, $_[1], $_[2], $expire_on); };
+  }
+
+  # 1 stored, 0 version changed, undef no space or refused by a modseq
+  return $DidStore > 0 ? 1 : $DidStore == -2 ? 0 : undef;
+}
+
+=item I<get_and_set($Key, $AtomicSub)>
+
+Atomically retrieve and set the value of a Key.
+
+The page is locked while retrieving the $Key and is unlocked only after
+the value is set, thus guaranteeing the value does not change between
+the get and set operations.
+
+$AtomicSub is a reference to a subroutine that is called to calculate the
+new value to store. $AtomicSub gets $Key, the current value from the
+cache, and an options hash as paramaters. Currently the only option
+passed is the expire_on of the item.
+
+It should return the new value to set in the cache for the given $Key,
+and an optional hash of arguments in the same format as would be passed
+to a C<set()> call.
+
+If $AtomicSub returns an empty list, no value is stored back
+in the cache. This avoids updating the expiry time on an entry
+if you want to do a "get if in cache, store if not present" type
+callback.
+
+For example:
+
+=over 4
+
+=item *
+
+To atomically increment a value in the cache
+
+  $Cache->get_and_set($Key, sub { return $_[1]+1; });
+
+=item *
+
+To add an item to a cached list and set the expiry time
+depending on the size of the list
+
+  $Cache->get_and_set($Key, sub ($, $v) {
+    push @$v, $item;
+    return ($v, { expire_time => @$v > 2 ? '10s' : '2m' });
+  });
+
+=item *
+
+To update a counter, but maintain the original expiry time
+
+  $Cache->get_and_set($Key, sub {
+    return ($_[1]+1, { expire_on => $_[2]->{expire_on} );
+  });
+
+
+=back
+
+In scalar context the return value from C<get_and_set()>, is the
+*new* value stored back into the cache.
+
+In list context, a two item array is returned; the new value stored
+back into the cache and a boolean that's true if the value was stored
+in the cache, false otherwise. See the PAGE SIZE AND KEY/VALUE LIMITS
+section for more details.
+
+Notes:
+
+=over 4
+
+=item *
+
+Do not perform any get/set operations from the callback sub, as these
+operations lock the page and you may end up with a dead lock!
+
+=item *
+
+Other processes can't access any key on the same page while the
+callback runs. For slow callbacks, use get() and cas() instead.
+
+=item *
+
+If your sub does a die/throws an exception, the page will correctly
+be unlocked (1.15 onwards)
+
+=back
+
+=cut
+sub get_and_set {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my ($Value, $DidStore, $Err);
+  eval {
+    ($Value, undef, my $Opts) = $Self->get($_[1], { skip_unlock => 1 });
+    # Page is still locked here.
+
+    my @NewValue = $_[2]->($_[1], $Value, $Opts);
+
+    $DidStore = 0;
+    if (@NewValue) {
+      ($Value, my $SetOpts) = @NewValue;
+      die "get_and_set callback options must be a hash reference"
+        if defined($SetOpts) && ref($SetOpts) ne 'HASH';
+
+      # set() with _locked=>1 takes ownership of the lock and unlocks at end.
+      $DidStore = $Self->set($_[1], $Value, { _locked => 1, %{$SetOpts || {}} });
+    } else {
+      fc_unlock($Cache);
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  if (defined $Err) {
+    fc_unlock($Cache) if fc_is_locked($Cache);
+    die $Err;
+  }
+
+  return wantarray ? ($Value, $DidStore) : $Value;
+}
+
+=item I<incr($Key, [ $Delta, \%Options ])>
+
+Atomically adds I<$Delta> (default 1, may be negative) to the counter
+stored under I<$Key>, and returns the new value. Counters are stored
+as native 64 bit integers and updated in place, so unlike counting
+with get_and_set(), no perl code runs with the page locked, and no
+page space is used up by each increment.
+
+A missing (or expired) key is created as I<initial> + I<$Delta>.
+I<%Options> takes I<initial> (default 0), and expire_on/expire_time
+as for set(), which only apply when the key is created. An existing
+counter keeps its expiry time, so a counter created with an
+expire_time counts over a fixed window. A key holding a plain
+integer value becomes a counter.
+
+Returns undef if the counter couldn't be stored (no space, or the key
+holds a tombstone), and dies if the key holds a value that isn't an
+integer. I<read_cb> isn't used, but the new value is passed to
+I<write_cb> (on expunge with I<write_back>) as with set().
+
+Counters are stored as native integers, which the serializer or a
+perl compressor can't read back (from get(), or when written back), so
+this is for caches with C<< serializer => '' >> and no perl
+compressor, and dies otherwise. A counter reads back from get() as a
+plain integer.
+
+=cut
+sub incr {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  my $Delta = defined $_[2] ? $_[2] : 1;
+  my $Opts = $_[3];
+
+  die "incr needs a cache with raw values and no compressor"
+    if $Self->{serialize} || $Self->{compress};
+
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+  my $Initial = $Opts && $Opts->{initial} || 0;
+
+  my $write_back = $Self->{write_back};
+  my $WBItems = $write_back && $Self->{write_cb} ? 1 : 0;
+  my ($Val, $Res, @WBItems) = fc_incr($Cache, $_[1], $Delta, $Initial, $expire_on,
+    $write_back ? FC_ISDIRTY : 0, $WBItems);
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+
+  die "incr of a value that isn't an integer" if $Res == -2;
+
+  # Write through, as set()
+  if (defined $Val && !$write_back && (my $write_cb = $Self->{write_cb})) {
+    local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+    eval { $write_cb->($Self->{context}, $_[1], $Val, $expire_on); };
+  }
+
+  return $Val;
+}
+
+=item I<decr($Key, [ $Delta, \%Options ])>
+
+The same as incr() with -I<$Delta>. Counters can go negative.
+
+=cut
+sub decr {
+  return $_[0]->incr($_[1], -(defined $_[2] ? $_[2] : 1), $_[3]);
+}
+
+=item I<append($Key, $Bytes, [ \%Options ])>
+
+Atomically appends I<$Bytes> to the value stored under I<$Key>. The
+bytes are added in place (or the entry is moved to the end of its
+page's data area if it can't grow where it is), so unlike appending
+with get_and_set(), the existing value isn't read into perl, and only
+the new bytes are copied.
+
+A missing (or expired) key is created with I<$Bytes> as its value.
+I<%Options> takes expire_on/expire_time as for set(), which only
+apply when the key is created, and I<max_len>: if the value would be
+longer than I<max_len> bytes, bytes are trimmed from the front, so
+the value keeps the newest I<max_len> bytes, eg. for a capped log of
+fixed size records.
+
+Values are joined as byte strings, so this is for caches with
+C<< serializer => '' >> and no perl compressor. I<$Bytes> is encoded
+to match the stored value: UTF-8 if it was stored from a character
+string, else bytes (dies if I<$Bytes> has wide characters). max_len
+counts bytes, so it dies with a UTF-8 value. Returns true if
+stored, false if not (no space, or the key holds a tombstone), and
+dies if the key holds a compressed value (see I<compressor>) or a
+counter. The new value is passed to I<write_cb> as with set().
+
+=cut
+sub append {
+  return $_[0]->_append(0, @_[1 .. $#_]);
+}
+
+=item I<prepend($Key, $Bytes, [ \%Options ])>
+
+The same as append(), but adds I<$Bytes> to the front of the value.
+With I<max_len>, bytes are trimmed from the end instead, again
+keeping the newest.
+
+=cut
+sub prepend {
+  return $_[0]->_append(1, @_[1 .. $#_]);
+}
+
+sub _append {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  my ($Prepend, $Opts) = ($_[1], $_[4]);
+
+  die "append needs a cache with raw values and no compressor"
+    if $Self->{serialize} || $Self->{compress};
+
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+  my $MaxLen = $Opts && $Opts->{max_len} || 0;
+
+  my $write_back = $Self->{write_back};
+  my $WBItems = $write_back && $Self->{write_cb} ? 1 : 0;
+  my ($Res, @WBItems) = fc_append($Cache, $_[2], $_[3], $Prepend, $MaxLen, $expire_on,
+    $write_back ? FC_ISDIRTY : 0, $WBItems);
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+
+  die "append to a compressed or counter value" if $Res == -2;
+
+  # Write through the whole new value, as set(). A plain read, fc_get
+  #  could pick this as the stale value refresh and push its expiry on
+  if ($Res > 0 && !$write_back && (my $write_cb = $Self->{write_cb})) {
+    my ($HashPage, $HashSlot) = fc_hash($Cache, $_[2]);
+    fc_lock($Cache, $HashPage);
+    my ($Val, $Err);
+    eval {
+      ($Val) = fc_read($Cache, $HashSlot, $_[2]);
+      1;
+    } || do {
+      $Err = $@ || 'unknown error';
+    };
+    fc_unlock($Cache) if fc_is_locked($Cache);
+    die $Err if defined $Err;
+
+    local $_[2] = $_[2][0] if ref($_[2]) eq 'Cache::FastMmap::KeyHandle';
+    eval { $write_cb->($Self->{context}, $_[2], $Val, $expire_on); };
+  }
+
+  return $Res > 0 ? 1 : 0;
+}
+
+=item I<exists($Key)>
+
+Search cache for given Key. Returns false if not found or true
+if found. This will *not* call the I<read_cb> if not found.
+
+This is also an optimisation over C<get()> as it will not uncompress or
+deserialize the value if found in the cache.
+
+=cut
+sub exists {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Hash value, lock page, read result
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  fc_lock($Cache, $HashPage);
+  my ($Found, $Err);
+  eval {
+    my ($Val, $Flags, $ExpireOn);
+    ($Val, $Flags, $Found, $ExpireOn) = fc_read($Cache, $HashSlot, $_[1]);
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  return $Found;
+}
+
+=item I<remove($Key, [ \%Options ])>
+
+Delete the given key from the cache
+
+I<%Options> is optional. Pass C<< modseq => $ModSeq >> to leave a
+tombstone recording the modseq of the invalidating change instead of
+plainly deleting (see L</TOMBSTONES AND MODSEQS>); expire_on or
+expire_time then override the tombstone's expiry (default
+C<tombstone_expire_time>). An existing tombstone with a newer modseq
+is kept. Other entries are used by get_and_remove() to control the
+locking behaviour. For now, you should probably ignore them unless
+you read the code to understand how it works
+
+=cut
+sub remove {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  my $Opts = $_[2];
+
+  my $ModSeq = $Opts ? $Opts->{modseq} : undef;
+  !defined($ModSeq) || $ModSeq =~ /^\d+$/
+    or die "remove modseq option must be an unsigned integer";
+
+  # Hash value, lock page (unless caller already holds the lock), delete
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  fc_lock($Cache, $HashPage) unless $Opts && $Opts->{_locked};
+  local $_[1] = $_[1][0] if ref($_[1]) eq 'Cache::FastMmap::KeyHandle';
+
+  my ($DidDel, $Flags, $Err);
+  eval {
+    if (defined $ModSeq) {
+      # Remove-with-modseq leaves a tombstone recording the invalidating
+      #  change, so conditional stores can refuse stale write-backs.
+      #  The C layer never lowers an existing tombstone's modseq
+      my $expire_on = -1;
+      if ($Opts && defined $Opts->{expire_on}) {
+        $expire_on = $Opts->{expire_on};
+      } elsif ($Opts && defined $Opts->{expire_time}) {
+        $expire_on = parse_expire_time($Opts->{expire_time}, _time());
+      } elsif (my $TombExpire = $Self->{tombstone_expire_time}) {
+        $expire_on = _time() + $TombExpire;
+      }
+
+      $Self->_expunge_page(2, 1, length($_[1]) + 8);
+      $DidDel = fc_tombstone($Cache, $HashSlot, $_[1], $expire_on, $ModSeq);
+      $Flags = 0;
+    } else {
+      ($DidDel, $Flags) = fc_delete($Cache, $HashSlot, $_[1]);
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  # If we deleted from the cache, and it's not dirty, also delete
+  #  from underlying store
+  if ((!$DidDel || ($DidDel && !($Flags & FC_ISDIRTY)))
+     && (my $delete_cb = $Self->{delete_cb})) {
+    eval { $delete_cb->($Self->{context}, $_[1]); };
+  }
+
+  return $DidDel;
+}
+
+=item I<get_and_remove($Key)>
+
+Atomically retrieve value of a Key while removing it from the cache.
+
+The page is locked while retrieving the $Key and is unlocked only after
+the value is removed, thus guaranteeing the value stored by someone else
+isn't removed by us.
+
+=cut
+sub get_and_remove {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my ($Value) = $Self->get($_[1], { skip_unlock => 1 });
+  my $DidDel = $Self->remove($_[1], { _locked => 1 });
+  return wantarray ? ($Value, $DidDel) : $Value;
+}
+
+=item I<expire($Key)>
+
+Explicitly expire the given $Key. For a cache in write-back mode, this
+will cause the item to be written back to the underlying store if dirty,
+otherwise it's the same as removing the item. 
+
+=cut
+sub expire {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Hash value, lock page, read result
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  fc_lock($Cache, $HashPage);
+  my ($Val, $Flags, $Found, $ExpireOn, $Err);
+  eval {
+    ($Val, $Flags, $Found, $ExpireOn) = fc_read($Cache, $HashSlot, $_[1]);
+
+    # If we found it, remove it
+    if ($Found) {
+      (undef, $Flags) = fc_delete($Cache, $HashSlot, $_[1]);
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  # If it's dirty, write it back
+  if (($Flags & FC_ISDIRTY) && (my $write_cb = $Self->{write_cb})) {
+    if (defined $Val) {
+      $Val = $Self->{uncompress}($Val) if $Self->{uncompress};
+      $Val = ${$Self->{deserialize}($Val)} if $Self->{deserialize};
+    }
+    eval { $write_cb->($Self->{context}, $_[1], $Val, $ExpireOn); };
+  }
+
+  return $Found;
+}
+
+=item I<clear()>
+
+Clear all items from the cache
+
+Note: If you're using callbacks, this has no effect
+on items in the underlying data store. No delete
+callbacks are made
+
+=cut
+sub clear {
+  my $Self = shift;
+  $Self->_expunge_all(1, 0);
+}
+
+=item I<purge()>
+
+Clear all expired items from the cache
+
+Note: If you're using callbacks, this has no effect
+on items in the underlying data store. No delete
+callbacks are made, and no write callbacks are made
+for the expired data
+
+=cut
+sub purge {
+  my $Self = shift;
+  $Self->_expunge_all(0, 0);
+}
+
+=item I<empty($OnlyExpired)>
+
+Empty all items from the cache, or if $OnlyExpired is
+true, only expired items.
+
+Note: If 'write_back' mode is enabled, any changed items
+are written back to the underlying store. Expired items are
+written back to the underlying store as well.
+
+=cut
+sub empty {
+  my $Self = shift;
+  $Self->_expunge_all($_[0] ? 0 : 1, 1);
+}
+
+=item I<flush_dirty(%Options)>
+
+In 'write_back' mode, write back all changed items to the underlying
+store, and mark them as unchanged, leaving them in the cache. Items
+are passed to I<write_many_cb> in batches of up to I<max_items>
+(default: 1000), or to I<write_cb> one at a time. Returns the number
+of items written back.
+
+An item changed again after it's been collected is written back by
+the next flush or expunge. Errors thrown by the callbacks are
+ignored, as for other write backs.
+
+=cut
+sub flush_dirty {
+  my ($Self, $Cache, %Args) = ($_[0], $_[0]->{Cache}, @_[1 .. $#_]);
+
+  return 0 if !$Self->{write_back} || !$Self->{write_cb};
+
+  my $MaxItems = $Args{max_items} || 1000;
+  my ($Page, $Count, $Err) = (0, 0);
+  my @Batch;
+
+  # Collect from each page till it has no more, handing over each
+  #  full batch
+  while ($Page < $Self->{num_pages}) {
+    my $Want = $MaxItems - @Batch;
+
+    fc_lock($Cache, $Page);
+    my @Items = eval { fc_take_dirty($Cache, $Want) };
+    $Err = $@;
+    fc_unlock($Cache) if fc_is_locked($Cache);
+    die $Err if $Err;
+
+    push @Batch, @Items;
+    $Page++ if @Items < $Want;
+
+    if (@Batch >= $MaxItems || ($Page == $Self->{num_pages} && @Batch)) {
+      $Self->_write_back_items(\@Batch);
+      $Count += @Batch;
+      @Batch = ();
+    }
+  }
+
+  return $Count;
+}
+
+=item I<get_keys($Mode)>
+
+Get a list of keys/values held in the cache. May immediately be out of
+date because of the shared access nature of the cache
+
+If $Mode == 0, an array of keys is returned
+
+If $Mode == 1, then an array of hashrefs, with 'key',
+'last_access', 'expire_on' and 'flags' keys is returned
+
+If $Mode == 2, then hashrefs also contain 'value' key
+
+=cut
+sub get_keys {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  my $Mode = $_[1] || 0;
+  my ($Uncompress, $Deserialize) = @$Self{qw(uncompress deserialize)};
+
+  return fc_get_keys($Cache, $Mode)
+    if $Mode <= 1 || ($Mode == 2 && !$Uncompress && !$Deserialize);
+
+  # If we're getting values as well, and they're not raw, unfreeze them
+  my @Details = fc_get_keys($Cache, 2);
+
+  for (@Details) {
+    my $Val = $_->{value};
+    if (defined $Val) {
+      $Val = $Uncompress->($Val) if $Uncompress;
+      $Val = ${$Deserialize->($Val)} if $Deserialize;
+      $_->{value} = $Val;
+    }
+  }
+  return @Details;
+}
+
+=item I<get_statistics($Clear)>
+
+Returns a two value list of (nreads, nreadhits). This
+only works if you passed enable_stats in the constructor
+
+nreads is the total number of read attempts done on the
+cache since it was created
+
+nreadhits is the total number of read attempts done on
+the cache since it was created that found the key/value
+in the cache
+
+If $Clear is true, the values (and all the other counters returned
+by get_all_statistics()) are reset immediately after they are
+retrieved
+
+Statistics are kept in per-process counters in the cache file, so
+this doesn't lock any pages
+
+=cut
+sub get_statistics {
+  my $Stats = $_[0]->get_all_statistics($_[1]);
+  return @$Stats{qw(nreads nreadhits)};
+}
+
+=item I<get_all_statistics($Clear)>
+
+Returns a hash ref of all statistics counters. Like get_statistics(),
+this only works if you passed enable_stats in the constructor. The
+counters are totals across all processes using the cache since it was
+created or last cleared:
+
+  nreads        read attempts
+  nreadhits     read attempts that found the key/value
+  nwrites       values (and tombstones) stored
+  nrefused      conditional stores refused (see TOMBSTONES AND MODSEQS)
+  ndeletes      keys removed
+  nevictions    unexpired entries expunged to make space (or by clear())
+  nexpirations  expired entries expunged
+  nexpunges     page expunge runs
+  bytes_evicted key/value bytes of evicted entries
+
+If $Clear is true, the values are reset immediately after they are
+retrieved
+
+=cut
+my @StatNames = qw(nreads nreadhits nwrites nrefused ndeletes
+  nevictions nexpirations nexpunges bytes_evicted);
+
+sub get_all_statistics {
+  my %Stats;
+  @Stats{@StatNames} = fc_get_stats($_[0]->{Cache}, $_[1] ? 1 : 0);
+  return \%Stats;
+}
+
+=item I<get_latency_statistics($Clear)>
+
+Returns a hash ref of latency percentiles for each timed operation,
+recorded by all processes using the cache since it was created (or
+last cleared). Only works if you passed latency_stats in the
+constructor, otherwise all counts are 0.
+
+The operations are:
+
+  lock_wait  waiting to get a page lock
+  read       finding a key in a locked page
+  write      storing a key in a locked page
+  expunge    working out what to expunge from a full page, and
+             compacting it (including building write back data)
+  get        the XS part of a get() (hash, lock, read, unlock)
+  set        the XS part of a set() (hash, lock, expunge, write,
+             unlock)
+
+Each is a hash ref of C<count> (number of operations timed), and
+C<p50>, C<p99>, C<p999> and C<max> latencies in nanoseconds.
+Latencies are kept in log scale buckets, so are accurate to within
+12.5%, and are reported as the top of their bucket.
+
+If $Clear is true, the histograms are reset immediately after they
+are retrieved.
+
+=cut
+sub get_latency_statistics {
+  my ($Self, $Clear) = @_;
+  my %Latency;
+  my $Op = 0;
+  for my $Name (qw(lock_wait read write expunge get set)) {
+    my %Op;
+    @Op{qw(count p50 p99 p999 max)}
+      = fc_get_latency($Self->{Cache}, $Op++, $Clear ? 1 : 0);
+    $Latency{$Name} = \%Op;
+  }
+  return \%Latency;
+}
+
+=item I<get_page_report([ \%Options ])>
+
+Returns a report of how full and how fragmented each page of the
+cache is, to help choose page_size/num_pages. The result is a hash
+ref with a C<pages> array ref, one hash ref per page, and a
+C<summary> hash ref of cache wide totals.
+
+Each page hash ref has:
+
+  page          page number
+  num_slots     hash slots in the page
+  used_slots    slots holding an entry (including expired ones)
+  old_slots     slots of deleted entries (free, but still searched)
+  data_bytes    size of the page's key/value data area
+  free_bytes    unused bytes at the end of the data area
+
+And unless the headers_only option is passed:
+
+  live_bytes    key/value bytes of unexpired entries
+  dead_bytes    used data bytes an expunge would reclaim (deleted,
+                overwritten and expired entries)
+  expired_slots slots holding expired entries
+  avg_probe     average number of slots a lookup of an entry checks
+  oldest_access oldest last access time of an unexpired entry
+  newest_access newest last access time of an unexpired entry
+
+The summary has the totals of the slot/byte counts above, num_pages,
+the overall avg_probe, oldest_access and newest_access, plus
+C<fill_histogram> and C<slot_histogram>, array refs of 10 counts of
+pages whose data area / hash slots are 0-10%, 10-20%, ... 90-100%
+used.
+
+Getting the full report locks each page in turn while its entries
+are walked. Pass C<< { headers_only => 1 } >> to instead just read
+each page's header without locking, which is much cheaper on big
+caches.
+
+=cut
+sub get_page_report {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+  my $HeadersOnly = $_[1] && $_[1]->{headers_only};
+
+  my @Pages;
+  for my $Page (0 .. $Self->{num_pages}-1) {
+    my $Report;
+    if ($HeadersOnly) {
+      $Report = fc_get_page_header_report($Cache, $Page);
+    } else {
+      fc_lock($Cache, $Page);
+      my $Err;
+      eval {
+        $Report = fc_get_page_report($Cache);
+        1;
+      } || do {
+        $Err = $@ || 'unknown error';
+      };
+      fc_unlock($Cache) if fc_is_locked($Cache);
+      die $Err if defined $Err;
+    }
+    $Report->{page} = $Page;
+    push @Pages, $Report;
+  }
+
+  my %Summary = (num_pages => scalar(@Pages),
+    fill_histogram => [ (0) x 10 ], slot_histogram => [ (0) x 10 ]);
+  my @Totals = qw(num_slots used_slots old_slots data_bytes free_bytes);
+  push @Totals, qw(live_bytes dead_bytes expired_slots) if !$HeadersOnly;
+  my $TotalProbe = 0;
+
+  for my $Report (@Pages) {
+    $Summary{$_} += $Report->{$_} for @Totals;
+
+    my $Fill = 1 - $Report->{free_bytes} / $Report->{data_bytes};
+    my $Load = $Report->{used_slots} / $Report->{num_slots};
+    $Summary{fill_histogram}->[$Fill >= 1 ? 9 : int($Fill * 10)]++;
+    $Summary{slot_histogram}->[$Load >= 1 ? 9 : int($Load * 10)]++;
+
+    next if $HeadersOnly;
+    $TotalProbe += $Report->{avg_probe} * $Report->{used_slots}
+      if $Report->{used_slots};
+    for (grep { defined $Report->{$_} } qw(oldest_access newest_access)) {
+      my $Access = $Report->{$_};
+      $Summary{oldest_access} = $Access
+        if !defined $Summary{oldest_access} || $Access < $Summary{oldest_access};
+      $Summary{newest_access} = $Access
+        if !defined $Summary{newest_access} || $Access > $Summary{newest_access};
+    }
+  }
+  $Summary{avg_probe} = $TotalProbe / $Summary{used_slots}
+    if !$HeadersOnly && $Summary{used_slots};
+
+  return { pages => \@Pages, summary => \%Summary };
+}
+
+=item I<get_hot_keys([ $N, $Clear ])>
+
+Returns the $N (default all) most accessed keys seen by this process
+since it opened the cache (or get_hot_keys() was last called with
+$Clear true), most accessed first. Only works if you passed hot_keys
+in the constructor, otherwise returns an empty list.
+
+Each key is a hash ref:
+
+  key      the key, as stored (utf8 keys are encoded), truncated
+           to the first 128 bytes for long keys
+  key_len  length of the full key in bytes
+  page     cache page the key is on
+  count    approximate number of reads and writes of the key
+  error    how much count might be over, so the real number of
+           accesses is between count - error and count
+
+Keys are counted with a Space-Saving sketch, which always includes
+any key making up more than 1/hot_keys of the accesses. A key with a
+lot of accesses is probably what's making the lock on its page
+contended, making it worth moving to a process local cache or giving
+its own cache.
+
+B<Note:> the sketch is per process. It's in this process's memory,
+not the cache file, so it only counts the accesses this process made.
+With many worker processes (eg. a preforking server), a key that's
+hot across all of them may not stand out in any one worker's sketch,
+so call get_hot_keys() in each worker (eg. periodically, logging the
+result) and add up the counts of the same keys.
+
+=cut
+sub get_hot_keys {
+  my ($Self, $N, $Clear) = @_;
+  return fc_get_hot_keys($Self->{Cache}, defined $N ? $N : -1, $Clear ? 1 : 0);
+}
+
+=item I<train_dictionary([ \%Options ])>
+
+Builds a compression dictionary from a sample of the values currently
+in the cache (as stored, so after serialization) and installs it in
+the share file with set_dictionary(). Returns the new dictionary's id,
+or undef if there wasn't enough data to train from.
+
+I<%Options> may contain C<dict_size>, the dictionary size in bytes (up
+to 32768, default 16384), and C<sample_bytes>, how much value data to
+sample (default 1M).
+
+Dictionaries help when values are small (hundreds of bytes) and share
+a lot of structure, such as JSON or Sereal of similar records, which
+compress poorly on their own. Only the 'native' compressor uses them.
+Retrain occasionally as the data changes.
+
+=cut
+sub train_dictionary {
+  my ($Self, $Opts) = @_;
+  my $DictSize = int($Opts && $Opts->{dict_size} || 16384);
+  my $SampleBytes = int($Opts && $Opts->{sample_bytes} || 1024*1024);
+
+  my (@Samples, $Total);
+  for (fc_get_keys($Self->{Cache}, 2)) {
+    next if !defined $_->{value};
+    push @Samples, $_->{value};
+    last if ($Total += length $_->{value}) >= $SampleBytes;
+  }
+
+  my $Dict = fc_train_dict(\@Samples, $DictSize);
+  return defined $Dict ? $Self->set_dictionary($Dict) : undef;
+}
+
+=item I<set_dictionary($Dict)>
+
+Installs $Dict (16 to 32768 bytes) as the compression dictionary used
+by all processes using the 'native' compressor on this cache from now
+on, and returns its id. Entries are recorded with the dictionary they
+were compressed with, and entries compressed with any of the previous
+3 dictionaries still read back. Older ones read as not found.
+
+=cut
+sub set_dictionary {
+  return fc_set_dict($_[0]->{Cache}, $_[1]);
+}
+
+=item I<get_dictionary()>
+
+Returns the current compression dictionary's id and contents, or
+(0, undef) if there isn't one.
+
+=cut
+sub get_dictionary {
+  return fc_get_dict($_[0]->{Cache});
+}
+
+=item I<on_tmpfs()>
+
+Returns 1 if the share file is on a memory backed (tmpfs/ramfs)
+filesystem, 0 if it isn't, and undef if that couldn't be determined
+(currently only detected on Linux)
+
+=cut
+sub on_tmpfs {
+  my $IsTmpfs = fc_get_param($_[0]->{Cache}, 'is_tmpfs');
+  return $IsTmpfs < 0 ? undef : $IsTmpfs;
+}
+
+=item I<get_dirty_count($Clear)>
+
+Returns the number of page visits by this process (since the cache was
+created or last cleared) that wrote to the cache file: stores, deletes,
+expunges and the last access time update done on each read hit. On a
+share file that's not on tmpfs, each of these dirties file pages the
+OS will write back to disk.
+
+If $Clear is true, the count is reset after it's retrieved
+
+=cut
+sub get_dirty_count {
+  return fc_get_dirty_count($_[0]->{Cache}, $_[1] ? 1 : 0);
+}
+
+=item I<multi_get($PageKey, [ $Key1, $Key2, ... ])>
+
+The two multi_xxx routines act a bit differently to the
+other routines. With the multi_get, you pass a separate
+PageKey value and then multiple keys. The PageKey value
+is hashed, and that page locked. Then that page is
+searched for each key. It returns a hash ref of
+Key => Value items found in that page in the cache.
+
+The main advantage of this is just a speed one, if you
+happen to need to search for a lot of items on each call.
+
+For instance, say you have users and a bunch of pieces
+of separate information for each user. On a particular
+run, you need to retrieve a sub-set of that information
+for a user. You could do lots of get() calls, or you
+could use the 'username' as the page key, and just
+use one multi_get() and multi_set() call instead.
+
+A couple of things to note:
+
+=over 4
+
+=item 1.
+
+This makes multi_get()/multi_set() and get()/set()
+incompatible. Don't mix calls to the two, because
+you won't find the data you're expecting
+
+=item 2.
+
+The writeback and callback modes of operation do
+not work with multi_get()/multi_set(). Don't attempt
+to use them together.
+
+=back
+
+=cut
+sub multi_get {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Hash value page key, lock page
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  fc_lock($Cache, $HashPage);
+
+  my ($Keys, %KVs) = ($_[2]);
+  my $Err;
+  eval {
+    # For each key to find
+    for (@$Keys) {
+
+      # Hash key to get slot in this page and read
+      my $FinalKey = "$_[1]-$_";
+      (undef, $HashSlot) = fc_hash($Cache, $FinalKey);
+      my ($Val, $Flags, $Found, $ExpireOn) = fc_read($Cache, $HashSlot, $FinalKey);
+      next unless $Found;
+
+      # If not using raw values, use thaw() to turn data back into object
+      $Val = $Self->{uncompress}($Val) if defined($Val) && $Self->{compress};
+      $Val = ${$Self->{deserialize}($Val)} if defined($Val) && $Self->{deserialize};
+
+      # Save to return
+      $KVs{$_} = $Val;
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  return \%KVs;
+}
+
+=item I<multi_set($PageKey, { $Key1 => $Value1, $Key2 => $Value2, ... }, [ \%Options ])>
+
+Store specified key/value pair into cache
+
+=cut
+sub multi_set {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Get opts, make compatible with Cache::Cache interface
+  my $Opts = defined($_[3]) ? (ref($_[3]) ? $_[3] : { expire_time => $_[3] }) : undef;
+  # expire_on takes precedence, otherwise use expire_time if present
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+
+  # Hash page key value, lock page
+  my ($HashPage, $HashSlot) = fc_hash($Cache, $_[1]);
+  fc_lock($Cache, $HashPage);
+
+  my $KVs = $_[2];
+  my $Err;
+  eval {
+    # Loop over each key/value storing into this page
+    while (my ($Key, $Val) = each %$KVs) {
+
+      $Val = $Self->{serialize}(\$Val) if $Self->{serialize};
+      $Val = $Self->{compress}($Val) if $Self->{compress};
+
+      # Get key/value len (we've got 'use bytes'), and do expunge check to
+      #  create space if needed
+      my $FinalKey = "$_[1]-$Key";
+      my $KVLen = length($FinalKey) + length($Val);
+      $Self->_expunge_page(2, 1, $KVLen);
+
+      # Now hash key and store into page
+      (undef, $HashSlot) = fc_hash($Cache, $FinalKey);
+      my $DidStore = fc_write($Cache, $HashSlot, $FinalKey, $Val, $expire_on, 0);
+    }
+    1;
+  } || do {
+    $Err = $@ || 'unknown error';
+  };
+
+  fc_unlock($Cache) if fc_is_locked($Cache);
+  die $Err if defined $Err;
+
+  return 1;
+}
+
+=item I<key_handle($Key)>
+
+Returns a handle for I<$Key> holding the key along with its
+precomputed hash page and slot, which can be passed in place of the
+key to get(), set(), remove(), get_into(), with_value() and the batch
+methods below, to save rehashing keys used over and over in a loop.
+
+A handle is only a shortcut for the same key, entries stored with it
+are found by the plain key and vice versa. Other methods given a
+handle use the key it holds. A handle made by a cache with a
+different num_pages is rehashed on each use.
+
+=cut
+sub key_handle {
+  my ($Self, $Key) = @_;
+  return $Key if ref($Key) eq 'Cache::FastMmap::KeyHandle';
+  return bless [ $Key, fc_hash($Self->{Cache}, $Key), $Self->{num_pages} ],
+    'Cache::FastMmap::KeyHandle';
+}
+
+=item I<key_batch($Key1, $Key2, ...)>
+
+Returns a prepared batch of keys (or key handles) for get_batch() and
+set_batch(). The keys are hashed and sorted by page once, so a batch
+that's reused saves both on every call.
+
+=cut
+sub key_batch {
+  my $Self = shift;
+  my @Handles = map { $Self->key_handle($_) } @_;
+  my @Order = sort { $Handles[$a][1] <=> $Handles[$b][1] } 0 .. $#Handles;
+  return bless { handles => [ @Handles[@Order] ], order => \@Order },
+    'Cache::FastMmap::KeyBatch';
+}
+
+=item I<get_batch($Batch)>
+
+Looks up every key of I<$Batch>, either from key_batch() or an array
+ref of keys and key handles, locking each page once, and returns a
+list of values in the same order as the keys (undef for those not
+found). I<read_cb> is not used.
+
+=cut
+sub get_batch {
+  my ($Self, $Batch) = @_;
+  $Batch = $Self->key_batch(@$Batch) if ref($Batch) ne 'Cache::FastMmap::KeyBatch';
+
+  my @Vals = fc_get_batch($Self->{Cache}, $Batch->{handles});
+  if ($Self->{compress} || $Self->{deserialize}) {
+    for (grep { defined } @Vals) {
+      $_ = $Self->{uncompress}($_) if $Self->{compress};
+      $_ = ${$Self->{deserialize}($_)} if $Self->{deserialize};
+    }
+  }
+
+  my @Res;
+  @Res[@{$Batch->{order}}] = @Vals;
+  return @Res;
+}
+
+=item I<set_batch($Batch, [ $Value1, $Value2, ... ], [ \%Options ])>
+
+Stores a value for every key of I<$Batch>, either from key_batch() or
+an array ref of keys and key handles, in the same order, locking each
+page once. I<%Options> takes expire_on and expire_time as for set().
+Returns the number of values stored.
+
+Writes through to I<write_cb> (or writes back expunged dirty items)
+the same as set().
+
+=cut
+sub set_batch {
+  my ($Self, $Batch, $Values, $Opts) = @_;
+  $Batch = $Self->key_batch(@$Batch) if ref($Batch) ne 'Cache::FastMmap::KeyBatch';
+
+  $Opts = { expire_time => $Opts } if defined $Opts && !ref $Opts;
+  my $expire_on = defined($Opts) ? (
+    defined $Opts->{expire_on} ? $Opts->{expire_on} :
+      (defined $Opts->{expire_time} ? parse_expire_time($Opts->{expire_time}, _time()): -1)
+  ) : -1;
+
+  my $write_back = $Self->{write_back};
+  my $Order = $Batch->{order};
+
+  my @Vals = @$Values[@$Order];
+  for (@Vals) {
+    $_ = $Self->{serialize}(\$_) if $Self->{serialize};
+    $_ = $Self->{compress}($_) if $Self->{compress};
+  }
+
+  my $WBItems = $write_back && $Self->{write_cb} ? 1 : 0;
+  my (@DidStore) = fc_set_batch($Self->{Cache}, $Batch->{handles}, \@Vals,
+    $expire_on, $write_back ? FC_ISDIRTY : 0, $WBItems);
+  my @WBItems = splice(@DidStore, scalar @$Order);
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+
+  # Write through, or write back values that didn't fit. Not for
+  #  stores refused by a tombstone
+  if (my $write_cb = $Self->{write_cb}) {
+    for (0 .. $#$Order) {
+      next if $DidStore[$_] < 0 || ($write_back && $DidStore[$_]);
+      my $Idx = $Order->[$_];
+      eval { $write_cb->($Self->{context}, $Batch->{handles}[$_][0], $Values->[$Idx], $expire_on); };
+    }
+  }
+
+  return scalar grep { $_ > 0 } @DidStore;
+}
+
+=back
+
+=cut
+
+=head1 INTERNAL METHODS
+
+=over 4
+
+=cut
+
+=item I<_expunge_all($Mode, $WB)>
+
+Expunge all items from the cache
+
+Expunged items (that have not expired) are written
+back to the underlying store if write_back is enabled
+
+=cut
+sub _expunge_all {
+  my ($Self, $Cache, $Mode, $WB) = ($_[0], $_[0]->{Cache}, $_[1], $_[2]);
+
+  # Repeat expunge for each page
+  for (0 .. $Self->{num_pages}-1) {
+    fc_lock($Cache, $_);
+    my $Err;
+    eval {
+      $Self->_expunge_page($Mode, $WB, -1);
+      1;
+    } || do {
+      $Err = $@ || 'unknown error';
+    };
+    fc_unlock($Cache) if fc_is_locked($Cache);
+    die $Err if defined $Err;
+  }
+
+}
+
+=item I<_expunge_page($Mode, $WB, $Len)>
+
+Expunge items from the current page to make space for
+$Len bytes key/value items
+
+Expunged items (that have not expired) are written
+back to the underlying store if write_back is enabled
+
+=cut
+sub _expunge_page {
+  my ($Self, $Cache, $Mode, $WB, $Len) = ($_[0], $_[0]->{Cache}, @_[1 .. 3]);
+
+  # If writeback mode, need to get expunged items to write back
+  my $write_cb = $Self->{write_back} && $WB ? $Self->{write_cb} : undef;
+
+  my @WBItems = fc_expunge($Cache, $Mode, $write_cb ? 1 : 0, $Len);
+
+  $Self->_write_back_items(\@WBItems) if @WBItems;
+}
+
+# Call write_cb for each dirty item of a list returned by fc_expunge()
+#  or fc_set(), or write_many_cb with all of them
+sub _write_back_items {
+  my ($Self, $WBItems) = @_;
+
+  my ($Uncompress, $Deserialize, $write_cb, $write_many_cb)
+    = @$Self{qw(uncompress deserialize write_cb write_many_cb)};
+
+  my @Items;
+  for (@$WBItems) {
+    next if !($_->{flags} & FC_ISDIRTY);
+
+    my $Val = $_->{value};
+    if (defined $Val) {
+      $Val = $Uncompress->($Val) if $Uncompress;
+      $Val = ${$Deserialize->($Val)} if $Deserialize;
+    }
+    if ($write_many_cb) {
+      push @Items, { key => $_->{key}, value => $Val, expire_on => $_->{expire_on} };
+    } else {
+      eval { $write_cb->($Self->{context}, $_->{key}, $Val, $_->{expire_on}); };
+    }
+  }
+
+  eval { $write_many_cb->($Self->{context}, \@Items); } if @Items;
+}
+
+sub _time {
+  $time_override ? $time_override : time;
+}
+
+sub _set_time_override {
+  my $Time = shift;
+  $time_override = $Time;
+  fc_set_time_override($Time || 0);
+}
+
+my %Times = ('' => 1, s => 1, m => 60, h => 60*60, d => 24*60*60, w => 7*24*60*60);
+
+sub parse_expire_time {
+  my $expire_time = shift || '';
+  return 0 if $expire_time eq 'never';
+  return @_ ? shift : 1 if $expire_time eq 'now';
+  my $offset = $expire_time =~ /^(\d+)\s*([mhdws]?)/i ? $1 * $Times{lc($2)} : 0;
+  return $offset + (@_ ? shift : 0);
+}
+
+sub cleanup {
+  my ($Self, $Cache) = ($_[0], $_[0]->{Cache});
+
+  # Avoid potential double cleanup
+  return if $Self->{cleaned};
+  $Self->{cleaned} = 1;
+
+  # Expunge all entries on exit if requested and in parent process
+  #  (not a thread's copy, which has the same pid)
+  if ($Self->{empty_on_exit} && $Cache && $Self->{pid} == $$ && !$Self->{cloned}) {
+    $Self->empty();
+  }
+
+  if ($Cache) {
+    fc_close($Cache);
+    $Cache = undef;
+    delete $Self->{Cache};
+  }
+
+  unlink($Self->{share_file})
+    if $Self->{unlink_on_exit} && $Self->{pid} == $$ && !$Self->{cloned};
+
+}
+
+sub DESTROY {
+  my $Self = shift;
+  $Self->cleanup();
+  delete $LiveCaches{"$Self"} if $Self->{empty_on_exit};
+  delete $OpenCaches{"$Self"};
+}
+
+sub END {
+  while (my (undef, $Self) = each %LiveCaches) {
+    # Weak reference, might be undef already
+    $Self->cleanup() if $Self;
+  }
+  %LiveCaches = ();
+}
+
+sub CLONE {
+  # A new thread's copy of each cache would share the C handle (and
+  #  its current page) with the parent, so give it a handle of its
+  #  own on the same mapping. Page locks exclude threads as well as
+  #  processes. Keys of the tracking hashes are the parent's addresses
+  for my $Caches (\%OpenCaches, \%LiveCaches) {
+    my @Selves = grep { defined } values %$Caches;
+    %$Caches = ();
+    weaken($Caches->{"$_"} = $_) for @Selves;
+  }
+  for my $Self (values %OpenCaches) {
+    next unless $Self && $Self->{Cache};
+    $Self->{Cache} = fc_clone($Self->{Cache});
+    $Self->{cloned} = 1;
+  }
+}
+
+package Cache::FastMmap::KeyHandle;
+
+# Methods that don't use the precomputed hash just see the key
+use overload '""' => sub { $_[0][0] }, fallback => 1;
+
+sub key { $_[0][0] }
+
+package Cache::FastMmap;
+
+1;
+
+__END__
+
+=back
+
+=cut
+
+=head1 INCOMPATIBLE CHANGES
+
+=over 4
+
+=item * From 1.15
+
+=over 4
+
+=item *
+
+Default share_file name is no-longer /tmp/sharefile, but /tmp/sharefile-$pid-$time.
+This ensures that different runs/processes don't interfere with each other, but
+means you may not connect up to the file you expect. You should be choosing an
+explicit name in most cases.
+
+On Unix systems, you can pass in the environment variable TMPDIR to
+override the default directory of /tmp
+
+=item *
+
+The new option unlink_on_exit defaults to true if you pass a filename for the
+share_file which doesn't already exist. This means if you have one process that
+creates the file, and another that expects the file to be there, by default it
+won't be.
+
+Otherwise the defaults seem sensible to cleanup unneeded share files rather than
+leaving them around to accumulate.
+
+=back
+
+=item * From 1.29
+
+=over 4
+
+=item *
+
+Default share_file name is no longer /tmp/sharefile-$pid-$time 
+but /tmp/sharefile-$pid-$time-$random.
+
+=back
+
+=item * From 1.31
+
+=over 4
+
+=item *
+
+Before 1.31, if you were using raw_values => 0 mode, then the write_cb
+would be called with raw frozen data, rather than the thawed object.
+From 1.31 onwards, it correctly calls write_cb with the thawed object
+value (eg what was passed to the ->set() call in the first place)
+
+=back
+
+=item * From 1.36
+
+=over 4
+
+=item *
+
+Before 1.36, an alarm(10) would be set before each attempt to lock
+a page. The only purpose of this was to detect deadlocks, which
+should only happen if the Cache::FastMmap code was buggy, or a
+callback function in get_and_set() made another call into
+Cache::FastMmap.
+
+However this added unnecessary extra system calls for every lookup,
+and for users using Time::HiRes, it could clobber any existing
+alarms that had been set with sub-second resolution.
+
+So this has now been made an optional feature via the catch_deadlocks
+option passed to new.
+
+=back
+
+=item * From 1.52
+
+=over 4
+
+=item *
+
+The term expire_time was overloaded in the code to sometimes mean
+a relative future time (e.g. as passed to new constructor) or an
+absolute unix epoch (e.g. as returned from get_keys(2)).
+
+To avoid this confusion, the code now uses expire_time to always
+means a relative future time, and expire_on to mean an absolute
+epoch time. You can use either as an optional argument to a
+set() call.
+
+Since expire_time was used in the constructor and is likely more
+commonly used, I changed the result of get_keys(2) so it now
+returns expire_on rather than expire_time.
+
+=back
+
+=back
+
+=cut
+
+=head1 SEE ALSO
+
+L<MLDBM::Sync>, L<IPC::MM>, L<Cache::FileCache>, L<Cache::SharedMemoryCache>,
+L<DBI>, L<Cache::Mmap>, L<BerkeleyDB>
+
+Latest news/details can also be found at:
+
+L<http://cpan.robm.fastmail.fm/cachefastmmap/>
+
+Available on github at:
+
+L<https://github.com/robmueller/cache-fastmmap/>
+
+=cut
+
+=head1 AUTHOR
+
+Rob Mueller L<mailto:cpan@robm.fastmail.fm>
+
+=cut
+
+=head1 COPYRIGHT AND LICENSE
+
+Copyright (C) 2003-2017 by FastMail Pty Ltd
+
+This library is free software; you can redistribute it and/or modify
+it under the same terms as Perl itself.
+
+=cut
@@ -0,0 +1,619 @@
+
+/*
+ * Value codecs
+ *
+ * Built in compression of stored values, applied by the XS (and C
+ * API) get/set paths so values don't have to go through Perl level
+ * compressors. The codec used is recorded in the FC_CODEC_MASK bits
+ * of each entry's flags, so readers decode any mix of plain and
+ * encoded entries whatever their own settings.
+ *
+ * An encoded value is the original length (4 bytes) followed by the
+ * codec's data. Values shorter than compress_threshold, or that don't
+ * shrink, are stored plain.
+ *
+ * The LZ4 codec writes standard LZ4 block format (greedy matching,
+ * a single hash probe per position), which favours speed over ratio.
+ *
+ * Small values compress poorly on their own, so a dictionary of
+ * content common to many values can be installed in the share file
+ * (mmc_set_dict, built with mmc_train_dict). LZ4 then treats it as
+ * data preceding every value, so matches can refer back into it. A
+ * value compressed this way is flagged MMC_CODEC_LZ4_DICT and has the
+ * dictionary's generation (4 bytes) after its original length.
+ *
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mmap_cache.h"
+#include "mmap_cache_internals.h"
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT       12
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_MAX_HASH_LOG  12
+
+static MU32 lz4_read32(const unsigned char * p) {
+  MU32 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/* Write the extra length bytes of a literal or match length */
+static unsigned char * lz4_put_len(unsigned char * op, size_t len) {
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static MU32 lz4_hash(MU32 v, int hash_log) {
+  return (v * 2654435761U) >> (32 - hash_log);
+}
+
+/*
+ * Compress src into dst as an LZ4 block, optionally with dict (and its
+ * match table from lz4_dict_table) as a prefix. Returns the compressed
+ * length, or 0 if it didn't fit in dst_cap bytes
+ *
+*/
+static int lz4_compress(const void * src, int src_len, void * dst, int dst_cap,
+    const void * dict, int dict_len, const MU32 * dict_table) {
+  const unsigned char * base = (const unsigned char *)src;
+  const unsigned char * ip = base, * anchor = base;
+  const unsigned char * iend = base + src_len;
+  const unsigned char * mflimit = iend - LZ4_MFLIMIT;
+  const unsigned char * matchlimit = iend - LZ4_LAST_LITERALS;
+  const unsigned char * dstart = (const unsigned char *)dict, * dend = dstart + dict_len;
+  unsigned char * op = (unsigned char *)dst, * oend = op + dst_cap;
+  MU32 table[1 << LZ4_MAX_HASH_LOG];
+  int hash_log = LZ4_MAX_HASH_LOG;
+  size_t lit_len;
+
+  if (src_len < LZ4_MFLIMIT + 1)
+    goto last_literals;
+
+  /* Smaller table for small values, it's cleared on every call */
+  while (hash_log > 8 && (1 << (hash_log + 1)) > src_len)
+    hash_log--;
+  memset(table, 0, sizeof(MU32) << hash_log);
+
+  while (ip < mflimit) {
+    MU32 seq = lz4_read32(ip);
+    MU32 h = lz4_hash(seq, hash_log);
+    const unsigned char * ref = base + table[h];
+    const unsigned char * mp, * mr, * mr_end;
+    unsigned char * token;
+    size_t match_len, offset;
+
+    table[h] = (MU32)(ip - base);
+
+    if (ref < ip && ip - ref <= LZ4_MAX_OFFSET && lz4_read32(ref) == seq) {
+      /* Match earlier in the value, extend backwards */
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      offset = ip - ref;
+      mr_end = iend;
+
+    } else if (dict_table
+        && (ref = dstart + dict_table[lz4_hash(seq, LZ4_MAX_HASH_LOG)]) + LZ4_MIN_MATCH <= dend
+        && (size_t)(ip - base) + (dend - ref) <= LZ4_MAX_OFFSET
+        && lz4_read32(ref) == seq) {
+      /* Match in the dictionary, which can't run past its end */
+      offset = (ip - base) + (dend - ref);
+      mr_end = dend;
+
+    } else {
+      /* Skip faster through data that isn't matching */
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    mp = ip + LZ4_MIN_MATCH;
+    mr = ref + LZ4_MIN_MATCH;
+    while (mp < matchlimit && mr < mr_end && *mp == *mr) {
+      mp++;
+      mr++;
+    }
+
+    lit_len = ip - anchor;
+    match_len = mp - ip - LZ4_MIN_MATCH;
+
+    if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1)
+      return 0;
+
+    token = op++;
+    if (lit_len >= 15) {
+      *token = 15 << 4;
+      op = lz4_put_len(op, lit_len - 15);
+    } else {
+      *token = (unsigned char)(lit_len << 4);
+    }
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+
+    if (match_len >= 15) {
+      *token |= 15;
+      op = lz4_put_len(op, match_len - 15);
+    } else {
+      *token |= (unsigned char)match_len;
+    }
+
+    ip = anchor = mp;
+  }
+
+last_literals:
+  lit_len = iend - anchor;
+  if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len)
+    return 0;
+
+  if (lit_len >= 15) {
+    *op++ = 15 << 4;
+    op = lz4_put_len(op, lit_len - 15);
+  } else {
+    *op++ = (unsigned char)(lit_len << 4);
+  }
+  memcpy(op, anchor, lit_len);
+  op += lit_len;
+
+  return (int)(op - (unsigned char *)dst);
+}
+
+/* Fill the match table (1 << LZ4_MAX_HASH_LOG entries) of a dictionary.
+ * Later positions win, as they give shorter offsets */
+static void lz4_dict_table(const void * dict, int dict_len, MU32 * table) {
+  const unsigned char * d = (const unsigned char *)dict;
+  int i;
+
+  memset(table, 0, sizeof(MU32) << LZ4_MAX_HASH_LOG);
+  for (i = 0; i + LZ4_MIN_MATCH <= dict_len; i++)
+    table[lz4_hash(lz4_read32(d + i), LZ4_MAX_HASH_LOG)] = i;
+}
+
+/*
+ * Decompress an LZ4 block from src into dst, which must decompress to
+ * exactly dst_len bytes, with dict as the data preceding it. Returns 0
+ * on success, -1 if src is corrupt
+ *
+*/
+static int lz4_decompress(const void * src, int src_len, void * dst, int dst_len,
+    const void * dict, int dict_len) {
+  const unsigned char * ip = (const unsigned char *)src, * iend = ip + src_len;
+  unsigned char * op = (unsigned char *)dst, * oend = op + dst_len;
+  const unsigned char * dend = (const unsigned char *)dict + dict_len;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+    size_t len = token >> 4, offset, out_pos;
+    const unsigned char * ref;
+
+    /* Literals */
+    if (len == 15) {
+      unsigned b;
+      do {
+        if (ip >= iend || len > (size_t)dst_len)
+          return -1;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+      return -1;
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+
+    /* Last sequence has no match */
+    if (ip == iend)
+      break;
+
+    /* Match */
+    if (iend - ip < 2)
+      return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    out_pos = op - (unsigned char *)dst;
+    if (!offset || offset > out_pos + dict_len)
+      return -1;
+
+    len = token & 15;
+    if (len == 15) {
+      unsigned b;
+      do {
+        if (ip >= iend || len > (size_t)dst_len)
+          return -1;
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += LZ4_MIN_MATCH;
+    if (len > (size_t)(oend - op))
+      return -1;
+
+    /* Starting in the dictionary, it may run on into the output */
+    if (offset > out_pos) {
+      for (ref = dend - (offset - out_pos); len && ref < dend; len--)
+        *op++ = *ref++;
+      ref = (unsigned char *)dst;
+    } else {
+      ref = op - offset;
+    }
+
+    /* Byte at a time, matches may overlap what they produce */
+    for (; len; len--)
+      *op++ = *ref++;
+  }
+
+  return op == oend ? 0 : -1;
+}
+
+/*
+ * int mmc_lz4_compress(const void * src, int src_len, void * dst, int dst_cap)
+ *
+ * Compress src into dst as an LZ4 block. Returns the compressed length,
+ * or 0 if it didn't fit in dst_cap bytes (MMC_LZ4_BOUND(src_len) is
+ * always enough)
+ *
+*/
+int mmc_lz4_compress(const void * src, int src_len, void * dst, int dst_cap) {
+  return lz4_compress(src, src_len, dst, dst_cap, NULL, 0, NULL);
+}
+
+/*
+ * int mmc_lz4_decompress(const void * src, int src_len, void * dst, int dst_len)
+ *
+ * Decompress an LZ4 block from src into dst, which must decompress to
+ * exactly dst_len bytes. Returns 0 on success, -1 if src is corrupt
+ *
+*/
+int mmc_lz4_decompress(const void * src, int src_len, void * dst, int dst_len) {
+  return lz4_decompress(src, src_len, dst, dst_len, NULL, 0);
+}
+
+/*
+ * Make this process's copy of dictionary generation gen, setting
+ * dict_gen to 0 if it's no longer there (or being replaced)
+ *
+*/
+static void _mmc_load_dict(mmap_cache * cache, MU64 gen) {
+  void * slot = M_DictSlot(cache->mm_meta, gen % M_DICT_SLOTS);
+  MU32 len;
+
+  cache->dict_gen = 0;
+  if (!cache->dict) {
+    cache->dict = (char *)malloc(MMC_DICT_MAX);
+    cache->dict_table = (MU32 *)malloc(sizeof(MU32) << LZ4_MAX_HASH_LOG);
+    if (!cache->dict || !cache->dict_table)
+      return;
+  }
+
+  if (MMC_ATOMIC_LOAD(MD_Gen(slot)) != gen)
+    return;
+  MMC_FENCE();
+  len = MD_Len(slot);
+  if (len < 16 || len > MMC_DICT_MAX)
+    return;
+  memcpy(cache->dict, MD_Data(slot), len);
+  MMC_FENCE();
+  if (MMC_ATOMIC_LOAD(MD_Gen(slot)) != gen)
+    return;
+
+  lz4_dict_table(cache->dict, len, cache->dict_table);
+  cache->dict_len = len;
+  cache->dict_gen = gen;
+}
+
+/*
+ * int mmc_encode_value(mmap_cache * cache, void * val, int val_len,
+ *   void ** enc_ptr, int * enc_len, MU32 * flags)
+ *
+ * Encode a value to store with the cache's codec, using the current
+ * dictionary if there is one. If it's encoded, sets enc_ptr/enc_len to
+ * the encoded data (in a buffer owned by the cache, valid until the
+ * next call), adds the codec to flags and returns 1. Otherwise sets
+ * them to the value as is and returns 0
+ *
+*/
+int mmc_encode_value(mmap_cache * cache, void * val, int val_len, void ** enc_ptr, int * enc_len, MU32 * flags) {
+  MU32 need = 8 + MMC_LZ4_BOUND(val_len);
+  MU32 hdr[2];
+  MU64 gen;
+  int len, hdr_len;
+
+  *enc_ptr = val;
+  *enc_len = val_len;
+
+  if (cache->codec != MMC_CODEC_LZ4 || val_len < (int)cache->compress_threshold)
+    return 0;
+
+  if (cache->codec_buf_size < need) {
+    free(cache->codec_buf);
+    cache->codec_buf = malloc(need);
+    cache->codec_buf_size = cache->codec_buf ? need : 0;
+    if (!cache->codec_buf)
+      return 0;
+  }
+
+  /* Pick up a newly installed dictionary */
+  gen = MMC_ATOMIC_LOAD(M_DictGen(cache->mm_meta));
+  if (gen != cache->dict_gen)
+    _mmc_load_dict(cache, gen);
+
+  hdr[0] = (MU32)val_len;
+  hdr[1] = (MU32)cache->dict_gen;
+  hdr_len = cache->dict_gen ? 8 : 4;
+
+  len = lz4_compress(val, val_len, (char *)cache->codec_buf + hdr_len, need - hdr_len,
+    cache->dict, cache->dict_len, cache->dict_gen ? cache->dict_table : NULL);
+  if (!len || len + hdr_len >= val_len)
+    return 0;
+
+  memcpy(cache->codec_buf, hdr, hdr_len);
+  *enc_ptr = cache->codec_buf;
+  *enc_len = len + hdr_len;
+  *flags |= (cache->dict_gen ? MMC_CODEC_LZ4_DICT : MMC_CODEC_LZ4) << FC_CODEC_SHIFT;
+
+  return 1;
+}
+
+/*
+ * int mmc_decoded_len(void * val, int val_len, MU32 flags)
+ *
+ * Length a stored value decodes to, -1 if it's not valid
+ *
+*/
+int mmc_decoded_len(void * val, int val_len, MU32 flags) {
+  MU32 orig_len;
+
+  if (!(flags & FC_CODEC_MASK))
+    return val_len;
+  if (val_len < ((flags & FC_CODEC_MASK) == (MMC_CODEC_LZ4_DICT << FC_CODEC_SHIFT) ? 8 : 4))
+    return -1;
+
+  /* Sanity check against the most LZ4 can expand to, plus the most
+   * a dictionary can add */
+  memcpy(&orig_len, val, 4);
+  return orig_len > (MU64)val_len * 255 + MMC_DICT_MAX ? -1 : (int)orig_len;
+}
+
+/*
+ * int mmc_decode_value(mmap_cache * cache, void * val, int val_len,
+ *   MU32 flags, void * out, int out_len)
+ *
+ * Decode a stored value into out, which must be mmc_decoded_len()
+ * bytes. Returns 0 on success, -1 with the cache error set if the
+ * value is corrupt or the codec unknown, -2 if it was compressed with
+ * a dictionary that's since been replaced
+ *
+*/
+int mmc_decode_value(mmap_cache * cache, void * val, int val_len, MU32 flags, void * out, int out_len) {
+  int codec = (flags & FC_CODEC_MASK) >> FC_CODEC_SHIFT;
+  MU32 gen;
+  void * slot;
+  int res;
+
+  if (!codec) {
+    memcpy(out, val, val_len);
+    return 0;
+  }
+
+  if (mmc_decoded_len(val, val_len, flags) != out_len)
+    return _mmc_set_error(cache, 0, "Corrupt compressed value");
+
+  if (codec == MMC_CODEC_LZ4) {
+    if (lz4_decompress((char *)val + 4, val_len - 4, out, out_len, NULL, 0) != 0)
+      return _mmc_set_error(cache, 0, "Corrupt compressed value");
+    return 0;
+  }
+
+  if (codec != MMC_CODEC_LZ4_DICT)
+    return _mmc_set_error(cache, 0, "Unknown value codec %d", codec);
+
+  /* Use our copy of the dictionary if it's the right one, otherwise
+   * straight from the share file, checking it wasn't replaced while
+   * we used it */
+  memcpy(&gen, (char *)val + 4, 4);
+  slot = M_DictSlot(cache->mm_meta, gen % M_DICT_SLOTS);
+  if ((MU32)MMC_ATOMIC_LOAD(MD_Gen(slot)) != gen || MD_Len(slot) > MMC_DICT_MAX) {
+    _mmc_set_error(cache, 0, "Compression dictionary %u has been replaced", gen);
+    return -2;
+  }
+  if (cache->dict_gen && (MU32)cache->dict_gen == gen) {
+    res = lz4_decompress((char *)val + 8, val_len - 8, out, out_len, cache->dict, cache->dict_len);
+  } else {
+    MMC_FENCE();
+    res = lz4_decompress((char *)val + 8, val_len - 8, out, out_len, MD_Data(slot), MD_Len(slot));
+    MMC_FENCE();
+    if ((MU32)MMC_ATOMIC_LOAD(MD_Gen(slot)) != gen) {
+      _mmc_set_error(cache, 0, "Compression dictionary %u has been replaced", gen);
+      return -2;
+    }
+  }
+  if (res != 0)
+    return _mmc_set_error(cache, 0, "Corrupt compressed value");
+
+  return 0;
+}
+
+/*
+ * MU64 mmc_set_dict(mmap_cache * cache, void * dict, int dict_len)
+ *
+ * Install a compression dictionary (16 to MMC_DICT_MAX bytes) in the
+ * share file, used for all values compressed from now on by every
+ * process. Entries compressed with one of the previous M_DICT_SLOTS - 1
+ * dictionaries still decode, older ones don't. Returns the new
+ * dictionary's generation, 0 on error
+ *
+*/
+MU64 mmc_set_dict(mmap_cache * cache, void * dict, int dict_len) {
+  MU64 m_offset = (MU64)cache->c_num_pages * cache->c_page_size;
+  MU64 gen;
+  void * slot;
+
+  if (dict_len < 16 || dict_len > MMC_DICT_MAX) {
+    _mmc_set_error(cache, 0, "Dictionary must be 16 to %d bytes", MMC_DICT_MAX);
+    return 0;
+  }
+
+  /* Lock the meta region against other installs */
+  if (mmc_lock_page(cache, m_offset) != 0)
+    return 0;
+
+  gen = MMC_ATOMIC_LOAD(M_DictGen(cache->mm_meta)) + 1;
+  slot = M_DictSlot(cache->mm_meta, gen % M_DICT_SLOTS);
+
+  /* Mark the slot as being written while it's changed */
+  MMC_ATOMIC_XCHG(MD_Gen(slot), 0);
+  MMC_FENCE();
+  MD_Len(slot) = dict_len;
+  memcpy(MD_Data(slot), dict, dict_len);
+  MMC_FENCE();
+  MMC_ATOMIC_XCHG(MD_Gen(slot), gen);
+  MMC_ATOMIC_XCHG(M_DictGen(cache->mm_meta), gen);
+
+  mmc_unlock_page(cache, m_offset);
+
+  return gen;
+}
+
+/*
+ * MU64 mmc_get_dict(mmap_cache * cache, void ** dict, int * dict_len)
+ *
+ * Get the current compression dictionary. Returns its generation (0
+ * if none), and sets dict/dict_len to this process's copy of it
+ *
+*/
+MU64 mmc_get_dict(mmap_cache * cache, void ** dict, int * dict_len) {
+  MU64 gen = MMC_ATOMIC_LOAD(M_DictGen(cache->mm_meta));
+
+  if (gen && gen != cache->dict_gen)
+    _mmc_load_dict(cache, gen);
+
+  *dict = cache->dict;
+  *dict_len = cache->dict_gen ? (int)cache->dict_len : 0;
+  return cache->dict_gen;
+}
+
+/* Dictionary training parameters: gram length, segment length, and
+ * log2 of the gram frequency table size */
+#define TRAIN_D 8
+#define TRAIN_K 128
+#define TRAIN_LOG 20
+
+static MU32 train_hash(const unsigned char * p) {
+  MU64 v;
+  memcpy(&v, p, sizeof(v));
+  return (MU32)((v * 0x9E3779B97F4A7C15ULL) >> (64 - TRAIN_LOG));
+}
+
+/*
+ * int mmc_train_dict(const void * samples, const MU32 * sample_lens,
+ *   int n_samples, void * dict, int dict_cap)
+ *
+ * Build a compression dictionary of up to dict_cap bytes from sample
+ * values (concatenated in samples). Counts how many samples each
+ * TRAIN_D byte gram appears in, then splits the samples into one
+ * epoch per TRAIN_K byte dictionary segment and takes the segment of
+ * each epoch whose grams are shared by the most other samples (grams
+ * already taken count for nothing), a simplified form of the COVER
+ * algorithm. Returns the dictionary length, 0 if the samples are too
+ * small or on error
+ *
+*/
+int mmc_train_dict(const void * samples, const MU32 * sample_lens, int n_samples, void * dict, int dict_cap) {
+  const unsigned char * buf = (const unsigned char *)samples;
+  unsigned char * out = (unsigned char *)dict;
+  MU32 * freq, * last;
+  MU64 total = 0, pos, epoch_size;
+  int s, n_epochs, e, dict_len = 0;
+
+  for (s = 0; s < n_samples; s++)
+    total += sample_lens[s];
+  if (dict_cap > MMC_DICT_MAX)
+    dict_cap = MMC_DICT_MAX;
+  if (total < TRAIN_K * 4 || dict_cap < TRAIN_K)
+    return 0;
+
+  /* Little enough data that it can all be the dictionary */
+  if (total <= (MU64)dict_cap) {
+    memcpy(out, buf, total);
+    return (int)total;
+  }
+
+  freq = (MU32 *)calloc(1 << TRAIN_LOG, sizeof(MU32));
+  last = (MU32 *)calloc(1 << TRAIN_LOG, sizeof(MU32));
+  if (!freq || !last) {
+    free(freq);
+    free(last);
+    return 0;
+  }
+
+  /* Number of samples each gram appears in */
+  for (s = 0, pos = 0; s < n_samples; pos += sample_lens[s++]) {
+    MU64 i;
+    for (i = 0; i + TRAIN_D <= sample_lens[s]; i++) {
+      MU32 h = train_hash(buf + pos + i);
+      if (last[h] != (MU32)s + 1) {
+        last[h] = s + 1;
+        freq[h]++;
+      }
+    }
+  }
+
+  /* Grams only seen in one sample are no use */
+  for (s = 0; s < (1 << TRAIN_LOG); s++)
+    if (freq[s] < 2)
+      freq[s] = 0;
+
+  n_epochs = dict_cap / TRAIN_K;
+  epoch_size = total / n_epochs;
+  if (epoch_size < TRAIN_K) {
+    epoch_size = TRAIN_K;
+    n_epochs = (int)(total / TRAIN_K);
+  }
+
+  for (e = 0; e < n_epochs; e++) {
+    MU64 start = e * epoch_size, end = start + epoch_size, best = 0, i;
+    MU64 score = 0, best_score = 0;
+
+    if (end > total)
+      end = total;
+    if (end - start < TRAIN_K)
+      break;
+
+    /* Slide a TRAIN_K window over the epoch, scoring its grams */
+    for (i = start; i + TRAIN_D <= start + TRAIN_K; i++)
+      score += freq[train_hash(buf + i)];
+    best_score = score;
+    best = start;
+    for (i = start + 1; i + TRAIN_K <= end; i++) {
+      score -= freq[train_hash(buf + i - 1)];
+      score += freq[train_hash(buf + i + TRAIN_K - TRAIN_D)];
+      if (score > best_score) {
+        best_score = score;
+        best = i;
+      }
+    }
+    if (!best_score)
+      continue;
+
+    /* Take it, and don't count its grams again */
+    memcpy(out + dict_len, buf + best, TRAIN_K);
+    dict_len += TRAIN_K;
+    for (i = best; i + TRAIN_D <= best + TRAIN_K; i++)
+      freq[train_hash(buf + i)] = 0;
+  }
+
+  free(freq);
+  free(last);
+
+  return dict_len;
+}
@@ -0,0 +1,341 @@
+/*
+ * High level get/set/delete, see fastmmap.h
+ *
+ * Each call does the whole hash/lock/read or write/unlock sequence
+ * of the perl XS fc_get/fc_set calls, copying values out (decoded)
+ * before the page is unlocked.
+ *
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "mmap_cache.h"
+#include "mmap_cache_internals.h"
+#include "fastmmap.h"
+
+/*
+ * mmap_cache * fmc_open(const char * const * params, char * err, int err_len)
+ *
+ * Create and initialise a cache from a NULL terminated list of
+ * param name/value pairs (see mmc_set_param). Returns NULL on failure,
+ * with the error copied into err if it's not NULL
+ *
+*/
+mmap_cache * fmc_open(const char * const * params, char * err, int err_len) {
+  mmap_cache * cache = mmc_new();
+  int i;
+
+  if (!cache) {
+    if (err)
+      snprintf(err, err_len, "Calloc of cache failed");
+    return NULL;
+  }
+
+  for (i = 0; params && params[i] && params[i+1]; i += 2) {
+    if (mmc_set_param(cache, (char *)params[i], (char *)params[i+1]) != 0)
+      break;
+  }
+
+  if ((params && params[i]) || mmc_init(cache) != 0) {
+    if (err)
+      snprintf(err, err_len, "%s", params && params[i] && !params[i+1]
+        ? "Param without a value" : mmc_error(cache));
+    mmc_close(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+/*
+ * int fmc_close(mmap_cache * cache)
+ *
+ * Close a cache opened with fmc_open (or a clone of it)
+ *
+*/
+int fmc_close(mmap_cache * cache) {
+  return mmc_close(cache);
+}
+
+/*
+ * Copy a value found on the locked page into a malloc'ed buffer, with
+ * a trailing nul, decoding it if needed. Returns 1, 0 if it was
+ * compressed with a replaced dictionary (as good as not found), or -1
+ */
+static int _fmc_copy_val(mmap_cache * cache, void * val_ptr, int val_len, MU32 flags, void ** val, int * out_len) {
+  int len = val_len, res;
+  char * buf;
+
+  if (flags & FC_CODEC_MASK) {
+    len = mmc_decoded_len(val_ptr, val_len, flags);
+    if (len < 0)
+      return _mmc_set_error(cache, 0, "Corrupt compressed value");
+  }
+
+  buf = (char *)malloc(len + 1);
+  if (!buf)
+    return _mmc_set_error(cache, errno, "Malloc of value failed");
+
+  if (flags & FC_CODEC_MASK) {
+    res = mmc_decode_value(cache, val_ptr, val_len, flags, buf, len);
+    if (res != 0) {
+      free(buf);
+      return res == -2 ? 0 : -1;
+    }
+  } else {
+    memcpy(buf, val_ptr, len);
+  }
+  buf[len] = '\0';
+
+  *val = buf;
+  *out_len = len;
+  return 1;
+}
+
+/*
+ * int fmc_get(
+ *   mmap_cache * cache, const void * key, int key_len,
+ *   void ** val, int * val_len, MU32 * flags
+ * )
+ *
+ * Look up key. If found, *val is set to a malloc'ed copy of the value
+ * (nul terminated, free with fmc_free), *val_len to its length, and
+ * *flags (if flags isn't NULL) to the entry's FMC_* flags. Returns 1
+ * if found, 0 if not, or -1 on error (see mmc_error)
+ *
+*/
+int fmc_get(mmap_cache * cache, const void * key, int key_len, void ** val, int * val_len, MU32 * flags) {
+  MU32 hash_page, hash_slot, expire_on, e_flags = 0;
+  MU64 modseq = 0, lat_start;
+  void * val_ptr;
+  int len, res = 0;
+
+  *val = NULL;
+  *val_len = 0;
+
+  lat_start = mmc_latency_start(cache);
+
+  mmc_hash(cache, (void *)key, key_len, &hash_page, &hash_slot);
+  if (mmc_lock(cache, hash_page) != 0)
+    return -1;
+
+  if (mmc_read(cache, hash_slot, (void *)key, key_len, &val_ptr, &len, &expire_on, &e_flags, &modseq) != -1)
+    res = _fmc_copy_val(cache, val_ptr, len, e_flags, val, val_len);
+
+  mmc_unlock(cache);
+
+  mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+  if (res == 1 && flags)
+    *flags = e_flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_HASVERSION);
+
+  return res;
+}
+
+/*
+ * int fmc_set(
+ *   mmap_cache * cache, const void * key, int key_len,
+ *   const void * val, int val_len, MU32 expire_on, MU32 flags
+ * )
+ *
+ * Store key/value, expunging entries from the page to make space if
+ * needed. expire_on is the epoch time the entry expires, 0 for never,
+ * or -1 for the cache's expire_time. flags are FMC_* flags to store
+ * (eg. FMC_UTF8VAL if perl readers should see a UTF8 string). The
+ * value is encoded with the cache's codec. Returns 1 if stored, 0 if
+ * not (too big for a page, or refused by a tombstone), or -1 on error
+ *
+*/
+int fmc_set(mmap_cache * cache, const void * key, int key_len, const void * val, int val_len, MU32 expire_on, MU32 flags) {
+  MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+  MU64 lat_start;
+  void * enc_ptr;
+  int enc_len, num_expunge, res;
+
+  lat_start = mmc_latency_start(cache);
+
+  flags &= ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE);
+  mmc_encode_value(cache, (void *)val, val_len, &enc_ptr, &enc_len, &flags);
+
+  mmc_hash(cache, (void *)key, key_len, &hash_page, &hash_slot);
+  if (mmc_lock(cache, hash_page) != 0)
+    return -1;
+
+  num_expunge = mmc_calc_expunge(cache, 2, key_len + enc_len, &new_num_slots, &to_expunge);
+  if (to_expunge && !mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+    mmc_unlock(cache);
+    return -1;
+  }
+
+  res = mmc_write(cache, hash_slot, (void *)key, key_len, enc_ptr, enc_len, expire_on, flags, 0);
+
+  mmc_unlock(cache);
+
+  mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+
+  return res > 0 ? 1 : 0;
+}
+
+/*
+ * int fmc_delete(mmap_cache * cache, const void * key, int key_len)
+ *
+ * Delete key. Returns 1 if it was found and deleted, 0 if not, or -1
+ * on error
+ *
+*/
+int fmc_delete(mmap_cache * cache, const void * key, int key_len) {
+  MU32 hash_page, hash_slot, flags;
+  int res;
+
+  mmc_hash(cache, (void *)key, key_len, &hash_page, &hash_slot);
+  if (mmc_lock(cache, hash_page) != 0)
+    return -1;
+
+  res = mmc_delete(cache, hash_slot, (void *)key, key_len, &flags);
+
+  mmc_unlock(cache);
+
+  return res ? 1 : 0;
+}
+
+/*
+ * int fmc_incr(
+ *   mmap_cache * cache, const void * key, int key_len,
+ *   int64_t delta, int64_t initial, MU32 expire_on, int64_t * result
+ * )
+ *
+ * Add delta to the counter under key in place, see mmc_incr. A new
+ * counter is initial + delta, expiring at expire_on. Returns 1 with
+ * the new value in *result, 0 if it couldn't be stored (no space, or
+ * a tombstone), -2 if the key's value isn't an integer, or -1 on error
+ *
+*/
+int fmc_incr(mmap_cache * cache, const void * key, int key_len, int64_t delta, int64_t initial, MU32 expire_on, int64_t * result) {
+  MU32 hash_page, hash_slot, new_num_slots = 0, ** to_expunge = 0;
+  int num_expunge, res;
+
+  mmc_hash(cache, (void *)key, key_len, &hash_page, &hash_slot);
+  if (mmc_lock(cache, hash_page) != 0)
+    return -1;
+
+  /* Only make space if a new counter didn't fit */
+  res = mmc_incr(cache, hash_slot, (void *)key, key_len, delta, initial, expire_on, 0, result);
+  if (res == 0) {
+    num_expunge = mmc_calc_expunge(cache, 2, key_len + (int)sizeof(int64_t), &new_num_slots, &to_expunge);
+    if (to_expunge) {
+      if (!mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge)) {
+        mmc_unlock(cache);
+        return -1;
+      }
+      res = mmc_incr(cache, hash_slot, (void *)key, key_len, delta, initial, expire_on, 0, result);
+    }
+  }
+
+  mmc_unlock(cache);
+
+  return res == -1 ? 0 : res;
+}
+
+/* Key index and its hash, for sorting fmc_get_many's keys by page */
+typedef struct {
+  MU32 page;
+  MU32 slot;
+  int  idx;
+} fmc_key_ref;
+
+static int _fmc_cmp_page(const void * a, const void * b) {
+  const fmc_key_ref * ka = (const fmc_key_ref *)a, * kb = (const fmc_key_ref *)b;
+  if (ka->page != kb->page)
+    return ka->page < kb->page ? -1 : 1;
+  return ka->idx - kb->idx;
+}
+
+/*
+ * int fmc_get_many(
+ *   mmap_cache * cache, int n, const void * const * keys, const int * key_lens,
+ *   void ** vals, int * val_lens, MU32 * flags
+ * )
+ *
+ * Look up n keys, locking each page once. For each key i, vals[i] is
+ * set as for fmc_get (NULL if not found), as are val_lens[i] and
+ * flags[i] (flags may be NULL). Returns the number found, or -1 on
+ * error, with no values left allocated
+ *
+*/
+int fmc_get_many(mmap_cache * cache, int n, const void * const * keys, const int * key_lens, void ** vals, int * val_lens, MU32 * flags) {
+  fmc_key_ref * refs;
+  MU32 cur_page = NOPAGE, expire_on, e_flags;
+  MU64 modseq;
+  void * val_ptr;
+  int i, len, res, found = 0;
+
+  refs = (fmc_key_ref *)malloc(sizeof(fmc_key_ref) * (n ? n : 1));
+  if (!refs)
+    return _mmc_set_error(cache, errno, "Malloc of key list failed");
+
+  for (i = 0; i < n; i++) {
+    mmc_hash(cache, (void *)keys[i], key_lens[i], &refs[i].page, &refs[i].slot);
+    refs[i].idx = i;
+    vals[i] = NULL;
+    val_lens[i] = 0;
+    if (flags)
+      flags[i] = 0;
+  }
+  qsort(refs, n, sizeof(fmc_key_ref), _fmc_cmp_page);
+
+  for (i = 0; i < n; i++) {
+    int idx = refs[i].idx;
+
+    if (refs[i].page != cur_page) {
+      if (cur_page != NOPAGE)
+        mmc_unlock(cache);
+      cur_page = refs[i].page;
+      if (mmc_lock(cache, cur_page) != 0) {
+        cur_page = NOPAGE;
+        found = -1;
+        break;
+      }
+    }
+
+    e_flags = 0;
+    if (mmc_read(cache, refs[i].slot, (void *)keys[idx], key_lens[idx], &val_ptr, &len, &expire_on, &e_flags, &modseq) == -1)
+      continue;
+
+    res = _fmc_copy_val(cache, val_ptr, len, e_flags, &vals[idx], &val_lens[idx]);
+    if (res < 0) {
+      found = -1;
+      break;
+    }
+    if (res == 1) {
+      found++;
+      if (flags)
+        flags[idx] = e_flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_HASVERSION);
+    }
+  }
+
+  if (cur_page != NOPAGE)
+    mmc_unlock(cache);
+  free(refs);
+
+  /* Don't leave anything allocated on error */
+  if (found < 0) {
+    for (i = 0; i < n; i++) {
+      free(vals[i]);
+      vals[i] = NULL;
+    }
+  }
+
+  return found;
+}
+
+/*
+ * void fmc_free(void * val)
+ *
+ * Free a value returned by fmc_get/fmc_get_many
+ *
+*/
+void fmc_free(void * val) {
+  free(val);
+}
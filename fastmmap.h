@@ -0,0 +1,82 @@
+/*
+ * AUTHOR
+ *
+ * Rob Mueller <cpan@robm.fastmail.fm>
+ *
+ * COPYRIGHT AND LICENSE
+ *
+ * Copyright (C) 2003 by FastMail IP Partners
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the same terms as Perl itself.
+ *
+ * fastmmap
+ *
+ * High level interface to the mmap_cache core, built as libfastmmap
+ * ("make lib", see Makefile.PL). Each call hashes the key, locks the
+ * page, does its work and unlocks, the same as the perl get()/set()
+ * calls, so C programs can share a cache file with perl processes
+ * using Cache::FastMmap.
+ *
+ *  #include <fastmmap.h>
+ *
+ *  const char * params[] = {
+ *    "share_file", "/dev/shm/mycache",
+ *    "num_pages", "89", "page_size", "65536",
+ *    "open_existing", "1",
+ *    NULL
+ *  };
+ *  char err[256];
+ *  mmap_cache * cache = fmc_open(params, err, sizeof(err));
+ *
+ *  fmc_set(cache, "key", 3, "value", 5, -1, 0);
+ *  if (fmc_get(cache, "key", 3, &val, &val_len, &flags) == 1) {
+ *    ...
+ *    fmc_free(val);
+ *  }
+ *  fmc_close(cache);
+ *
+ * Params are as for mmc_set_param. num_pages and page_size must be
+ * the same as every other user of the file (a perl process's are
+ * from its cache_size or num_pages/page_size options), otherwise the
+ * file is recreated with the new size, unless open_existing is set,
+ * in which case fmc_open fails.
+ *
+ * Values are the raw stored bytes, so perl processes sharing the
+ * cache must use serializer => '' (raw_values). Values stored with
+ * the native compressor are decoded, and stores use the codec param.
+ * Entries evicted by fmc_set aren't written back, even if a perl
+ * process stored them dirty with write_back.
+ *
+ * A cache handle is only for one thread at a time, use mmc_clone to
+ * get a handle for each thread.
+*/
+
+#ifndef fastmmap_h
+#define fastmmap_h
+
+#include "mmap_cache.h"
+
+/* Entry flag bits set by the perl module (see FastMmap.xs). fmc_get
+ * returns them in *flags, and fmc_set stores any passed in */
+#define FMC_ISDIRTY 1
+#define FMC_UTF8VAL (1U<<31)
+#define FMC_UTF8KEY (1U<<30)
+#define FMC_UNDEF   (1U<<29)
+
+/* Set on counters from fmc_incr (or perl's incr), whose value is a
+ * native int64_t */
+#define FMC_INTEGER FC_INTEGER
+
+mmap_cache * fmc_open(const char * const * params, char * err, int err_len);
+int fmc_close(mmap_cache * cache);
+
+int fmc_get(mmap_cache * cache, const void * key, int key_len, void ** val, int * val_len, MU32 * flags);
+int fmc_set(mmap_cache * cache, const void * key, int key_len, const void * val, int val_len, MU32 expire_on, MU32 flags);
+int fmc_delete(mmap_cache * cache, const void * key, int key_len);
+int fmc_incr(mmap_cache * cache, const void * key, int key_len, int64_t delta, int64_t initial, MU32 expire_on, int64_t * result);
+int fmc_get_many(mmap_cache * cache, int n, const void * const * keys, const int * key_lens, void ** vals, int * val_lens, MU32 * flags);
+
+void fmc_free(void * val);
+
+#endif
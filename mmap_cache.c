@@ -19,6 +19,11 @@
 #include <time.h>
 #include <errno.h>
 #include <stdarg.h>
+#ifdef WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 #include "mmap_cache.h"
 #include "mmap_cache_internals.h"
 
@@ -37,6 +42,8 @@ MU32    def_expire_time = 0;
 MU32    def_c_num_pages = 89;
 MU32    def_c_page_size = 65536;
 MU32    def_start_slots = 89;
+MU32    def_compress_threshold = 128;
+MU32    def_refresh_time = 10;
 
 /*
  * mmap_cache * mmc_new()
@@ -61,6 +68,11 @@ mmap_cache * mmc_new() {
   cache->permissions = 0640;
   cache->init_file = def_init_file;
   cache->test_file = def_test_file;
+  cache->compress_threshold = def_compress_threshold;
+  cache->refresh_time = def_refresh_time;
+
+  /* Unknown until the share file is opened */
+  cache->is_tmpfs = -1;
 
   return cache;
 }
@@ -70,6 +82,8 @@ int mmc_set_param(mmap_cache * cache, char * param, char * val) {
     cache->init_file = atoi(val);
   } else if (!strcmp(param, "test_file")) {
     cache->test_file = atoi(val);
+  } else if (!strcmp(param, "open_existing")) {
+    cache->open_existing = atoi(val);
   } else if (!strcmp(param, "page_size")) {
     cache->c_page_size = atoi(val);
   } else if (!strcmp(param, "num_pages")) {
@@ -86,6 +100,29 @@ int mmc_set_param(mmap_cache * cache, char * param, char * val) {
     cache->catch_deadlocks = atoi(val);
   } else if (!strcmp(param, "enable_stats")) {
     cache->enable_stats = atoi(val);
+  } else if (!strcmp(param, "lru_granularity")) {
+    cache->lru_granularity = atoi(val);
+  } else if (!strcmp(param, "trace_file")) {
+    cache->trace_file = val;
+  } else if (!strcmp(param, "latency_stats")) {
+    cache->latency_stats = atoi(val);
+  } else if (!strcmp(param, "hot_keys")) {
+    cache->hot_keys_size = atoi(val);
+    if (cache->hot_keys_size > MMC_HOT_KEYS_MAX)
+      cache->hot_keys_size = MMC_HOT_KEYS_MAX;
+  } else if (!strcmp(param, "codec")) {
+    if (!strcmp(val, "lz4"))
+      cache->codec = MMC_CODEC_LZ4;
+    else if (!*val || !strcmp(val, "none"))
+      cache->codec = MMC_CODEC_NONE;
+    else
+      return _mmc_set_error(cache, 0, "Unknown codec: %s", val);
+  } else if (!strcmp(param, "compress_threshold")) {
+    cache->compress_threshold = atoi(val);
+  } else if (!strcmp(param, "stale_time")) {
+    cache->stale_time = atoi(val);
+  } else if (!strcmp(param, "refresh_time")) {
+    cache->refresh_time = atoi(val);
   } else {
     return _mmc_set_error(cache, 0, "Bad set_param parameter: %s", param);
   }
@@ -100,6 +137,8 @@ int mmc_get_param(mmap_cache * cache, char * param) {
     return (int)cache->c_num_pages;
   } else if (!strcmp(param, "expire_time")) {
     return (int)cache->expire_time;
+  } else if (!strcmp(param, "is_tmpfs")) {
+    return cache->is_tmpfs;
   } else {
     return _mmc_set_error(cache, 0, "Bad set_param parameter: %s", param);
   }
@@ -131,7 +170,30 @@ int mmc_init(mmap_cache * cache) {
 
   ASSERT(cache->start_slots >= 10 && cache->start_slots <= 500);
 
-  cache->c_size = c_size = (MU64)c_num_pages * c_page_size;
+  /* Pages, then the meta region (stats etc) */
+  cache->c_size = c_size = (MU64)c_num_pages * c_page_size + M_SIZE;
+
+  /* Mapping details shared with clones, the page mutexes are needed
+   * before the first page lock */
+  if (!cache->shared) {
+    mmap_cache_shared * shared = (mmap_cache_shared *)calloc(1, sizeof(mmap_cache_shared));
+    if (!shared)
+      return _mmc_set_error(cache, errno, "Calloc of shared state failed");
+    shared->page_locks = (mmc_mutex *)calloc(c_num_pages + 1, sizeof(mmc_mutex));
+    shared->share_file = strdup(cache->share_file);
+    if (!shared->page_locks || !shared->share_file) {
+      free(shared->page_locks);
+      free(shared->share_file);
+      free(shared);
+      return _mmc_set_error(cache, errno, "Calloc of shared state failed");
+    }
+    MMC_MUTEX_INIT(&shared->lock);
+    shared->refcnt = 1;
+    for (i = 0; i <= c_num_pages; i++)
+      MMC_MUTEX_INIT(shared->page_locks + i);
+    cache->share_file = shared->share_file;
+    cache->shared = shared;
+  }
 
   if ( mmc_open_cache_file(cache, &do_init) == -1) return -1;
 
@@ -152,6 +214,42 @@ int mmc_init(mmap_cache * cache) {
     if ( mmc_map_memory(cache) == -1) return -1;
   }
 
+  /* Setup meta region, initialising it if new file or bad header */
+  cache->mm_meta = PTR_ADD(cache->mm_var, (MU64)c_num_pages * c_page_size);
+  if (!cache->open_existing &&
+      (do_init || M_Magic(cache->mm_meta) != M_MAGIC || M_Version(cache->mm_meta) != M_VERSION)) {
+    MU64 m_offset = (MU64)c_num_pages * c_page_size;
+    mmc_lock_page(cache, m_offset);
+    if (do_init || M_Magic(cache->mm_meta) != M_MAGIC || M_Version(cache->mm_meta) != M_VERSION)
+      _mmc_init_meta(cache);
+    mmc_unlock_page(cache, m_offset);
+  }
+
+  /* Pick a stats slot for this process. Slots are only to spread
+   * the counters over cache lines, counts are added atomically so
+   * it doesn't matter if processes share a slot */
+  cache->c_stats = M_StatsSlot(cache->mm_meta, (MU32)getpid() % M_STATS_SLOTS);
+  cache->c_lat = M_LatSlot(cache->mm_meta, (MU32)getpid() % M_LAT_SLOTS);
+
+  /* Open trace file for appending. Clones open it again, so the
+   * shared mapping keeps the name */
+  if (cache->trace_file && *cache->trace_file && !cache->trace_fh) {
+    if (_mmc_trace_open(cache, cache->trace_file) != 0)
+      return -1;
+    cache->shared->trace_file = strdup(cache->trace_file);
+    if (!cache->shared->trace_file)
+      return _mmc_set_error(cache, errno, "Calloc of shared state failed");
+  }
+  cache->trace_file = NULL;
+
+  /* Hot keys sketch is per process, so just in our memory */
+  if (cache->hot_keys_size && !cache->hot_keys) {
+    cache->hot_keys = (mmap_cache_hot_key *)calloc(cache->hot_keys_size, sizeof(mmap_cache_hot_key));
+    if (!cache->hot_keys)
+      return _mmc_set_error(cache, errno, "Calloc of hot keys failed");
+    cache->hot_keys_used = 0;
+  }
+
   /* Test pages in file if asked */
   if (cache->test_file) {
     for (i = 0; i < cache->c_num_pages; i++) {
@@ -191,15 +289,13 @@ int mmc_init(mmap_cache * cache) {
  * int mmc_close(mmap_cache * cache)
  *
  * Close the given cache, unmmap'ing any memory and closing file
- * descriptors. 
+ * descriptors. Also frees a cache that mmc_init failed on
  * 
 */
 int mmc_close(mmap_cache *cache) {
-  int res;
+  int res, last = 0;
 
-  /* Shouldn't call if not init'ed */
-  ASSERT(cache->fh);
-  ASSERT(cache->mm_var);
+  /* May be a cache mmc_init failed on, closes whatever it got to */
 
   /* Shouldn't call if page still locked */
   ASSERT(cache->p_cur == NOPAGE);
@@ -209,6 +305,22 @@ int mmc_close(mmap_cache *cache) {
     mmc_unlock(cache);
   }
 
+  /* Only the last handle on a mapping closes and unmaps it. Once the
+   *  lock's released another handle may free shared, so only last,
+   *  decided under the lock, says if this handle tears it down */
+  if (cache->shared) {
+    mmap_cache_shared * shared = cache->shared;
+
+    MMC_MUTEX_LOCK(&shared->lock);
+    last = --shared->refcnt == 0;
+    MMC_MUTEX_UNLOCK(&shared->lock);
+
+    if (!last) {
+      cache->fh = 0;
+      cache->mm_var = NULL;
+    }
+  }
+
   /* Close file */
   if (cache->fh) {
     mmc_close_fh(cache);
@@ -222,11 +334,153 @@ int mmc_close(mmap_cache *cache) {
     }
   }
 
+  if (cache->shared && last) {
+    mmap_cache_shared * shared = cache->shared;
+    int i;
+
+    for (i = 0; i <= cache->c_num_pages; i++)
+      MMC_MUTEX_DESTROY(shared->page_locks + i);
+    free(shared->page_locks);
+    MMC_MUTEX_DESTROY(&shared->lock);
+    free(shared->share_file);
+    free(shared->trace_file);
+    free(shared);
+  }
+
+  if (cache->hot_keys)
+    free(cache->hot_keys);
+
+  if (cache->codec_buf)
+    free(cache->codec_buf);
+
+  if (cache->dict) {
+    free(cache->dict);
+    free(cache->dict_table);
+  }
+
+  if (cache->trace_fh) {
+    _mmc_trace_flush(cache);
+    fclose(cache->trace_fh);
+    free(cache->trace_buf);
+  }
+
   free(cache);
 
   return 0;
 }
 
+/*
+ * mmap_cache * mmc_clone(mmap_cache * cache)
+ *
+ * Create another handle on an initialised cache's mapping, with its
+ * own current page, error state and buffers. A handle must only be
+ * used by one thread at a time, so give each thread its own clone.
+ * Page locks exclude other threads as well as other processes.
+ * Returns NULL with the error set in cache on failure. Close each
+ * clone with mmc_close, the mapping goes when the last is closed.
+ * Clones never use catch_deadlocks, alarm() is process wide so one
+ * thread's alarm would clobber or be taken by another's
+ *
+*/
+mmap_cache * mmc_clone(mmap_cache * cache) {
+  mmap_cache * clone;
+
+  if (!cache->shared || !cache->mm_var) {
+    _mmc_set_error(cache, 0, "Can't clone a cache that isn't initialised");
+    return NULL;
+  }
+
+  clone = (mmap_cache *)malloc(sizeof(mmap_cache));
+  if (!clone) {
+    _mmc_set_error(cache, errno, "Malloc of cache clone failed");
+    return NULL;
+  }
+  memcpy(clone, cache, sizeof(mmap_cache));
+
+  /* Nothing locked, and nothing of the original's per handle state */
+  clone->p_cur = NOPAGE;
+  clone->p_base = NULL;
+  clone->p_base_slots = NULL;
+  clone->p_changed = clone->p_touched = clone->p_snapshot = 0;
+  clone->lat_expunge_start = 0;
+  clone->c_n_dirtied = 0;
+  clone->last_error = NULL;
+  clone->catch_deadlocks = 0;
+
+  clone->codec_buf = NULL;
+  clone->codec_buf_size = 0;
+  clone->dict_gen = 0;
+  clone->dict_len = 0;
+  clone->dict = NULL;
+  clone->dict_table = NULL;
+
+  clone->hot_keys = NULL;
+  clone->hot_keys_used = 0;
+  if (clone->hot_keys_size) {
+    clone->hot_keys = (mmap_cache_hot_key *)calloc(clone->hot_keys_size, sizeof(mmap_cache_hot_key));
+    if (!clone->hot_keys) {
+      _mmc_set_error(cache, errno, "Calloc of hot keys failed");
+      free(clone);
+      return NULL;
+    }
+  }
+
+  clone->trace_fh = NULL;
+  clone->trace_buf = NULL;
+  clone->trace_buf_used = 0;
+  if (cache->shared->trace_file && _mmc_trace_open(clone, cache->shared->trace_file) != 0) {
+    cache->last_error = clone->last_error;
+    free(clone->hot_keys);
+    free(clone);
+    return NULL;
+  }
+
+  MMC_MUTEX_LOCK(&cache->shared->lock);
+  cache->shared->refcnt++;
+  MMC_MUTEX_UNLOCK(&cache->shared->lock);
+
+  return clone;
+}
+
+/*
+ * int mmc_lock_page(mmap_cache * cache, MU64 p_offset)
+ *
+ * Lock the page (or meta region) at p_offset. The in process mutex
+ * comes first, as the file lock doesn't exclude other threads
+ *
+*/
+int mmc_lock_page(mmap_cache * cache, MU64 p_offset) {
+  mmc_mutex * m = cache->shared
+    ? cache->shared->page_locks + p_offset / cache->c_page_size : NULL;
+
+  if (m)
+    MMC_MUTEX_LOCK(m);
+  if (mmc_lock_file(cache, p_offset) != 0) {
+    if (m)
+      MMC_MUTEX_UNLOCK(m);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * int mmc_unlock_page(mmap_cache * cache, MU64 p_offset)
+ *
+ * Unlock the page (or meta region) at p_offset. The file lock is
+ * released before the mutex, as another thread taking the mutex
+ * would share this process's file lock
+ *
+*/
+int mmc_unlock_page(mmap_cache * cache, MU64 p_offset) {
+  mmc_unlock_file(cache, p_offset);
+
+  if (cache->shared)
+    MMC_MUTEX_UNLOCK(cache->shared->page_locks + p_offset / cache->c_page_size);
+
+  return 0;
+}
+
 char * mmc_error(mmap_cache * cache) {
   if (cache->last_error)
     return cache->last_error;
@@ -243,7 +497,7 @@ char * mmc_error(mmap_cache * cache) {
  *
 */
 int mmc_lock(mmap_cache * cache, MU32 p_cur) {
-  MU64 p_offset;
+  MU64 p_offset, lat_start;
   void * p_ptr;
   int res = 0;
 
@@ -260,8 +514,10 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
   p_offset = (MU64)p_cur * cache->c_page_size;
   p_ptr = PTR_ADD(cache->mm_var, p_offset);
 
+  lat_start = mmc_latency_start(cache);
   res = mmc_lock_page(cache, p_offset);
   if (res) return res;
+  mmc_latency_end(cache, MMC_LAT_LOCK, lat_start);
 
   if (!(P_Magic(p_ptr) == 0x92f7e3b1)) {
     mmc_unlock_page(cache, p_offset);
@@ -310,6 +566,71 @@ int mmc_lock(mmap_cache * cache, MU32 p_cur) {
   return 0;
 }
 
+/*
+ * int mmc_snapshot_page(mmap_cache * cache, MU32 p_cur, void * buf, int retries)
+ *
+ * Copy the given page into buf (c_page_size bytes) without locking
+ * it, and set up cache->p_* fields for the copy as if it were the
+ * locked page, so functions that only read the current page
+ * (mmc_get_page_report, _mmc_test_page, ...) can be used on it. A
+ * concurrent writer can leave the copy inconsistent, so it's only
+ * accepted if the header didn't change while copying and the copy
+ * passes _mmc_test_page, trying up to retries more times. Call
+ * mmc_unlock when done, which leaves the real page alone
+ *
+*/
+int mmc_snapshot_page(mmap_cache * cache, MU32 p_cur, void * buf, int retries) {
+  MU32 header[P_HEADERSIZE / 4];
+  void * p_ptr;
+  int attempt;
+
+  if (p_cur >= cache->c_num_pages)
+    return _mmc_set_error(cache, 0, "page %u is NOPAGE or larger than number of pages", p_cur);
+
+  if (cache->p_cur != NOPAGE)
+    return _mmc_set_error(cache, 0, "page %u is already locked, can't lock multiple pages", cache->p_cur);
+
+  p_ptr = PTR_ADD(cache->mm_var, (MU64)p_cur * cache->c_page_size);
+
+  for (attempt = 0; attempt <= retries; attempt++) {
+    memcpy(header, p_ptr, P_HEADERSIZE);
+    memcpy(buf, p_ptr, cache->c_page_size);
+
+    /* Header changed while copying? */
+    if (memcmp(header, buf, P_HEADERSIZE) || memcmp(header, p_ptr, P_HEADERSIZE))
+      continue;
+
+    if (P_Magic(buf) != 0x92f7e3b1 ||
+        P_NumSlots(buf) > (cache->c_page_size - P_HEADERSIZE) / 4 ||
+        P_FreeSlots(buf) > P_NumSlots(buf) ||
+        P_OldSlots(buf) > P_FreeSlots(buf) ||
+        P_FreeData(buf) + P_FreeBytes(buf) != cache->c_page_size)
+      continue;
+
+    cache->p_num_slots = P_NumSlots(buf);
+    cache->p_free_slots = P_FreeSlots(buf);
+    cache->p_old_slots = P_OldSlots(buf);
+    cache->p_free_data = P_FreeData(buf);
+    cache->p_free_bytes = P_FreeBytes(buf);
+    cache->p_n_reads = P_NReads(buf);
+    cache->p_n_read_hits = P_NReadHits(buf);
+
+    cache->p_cur = p_cur;
+    cache->p_offset = (MU64)p_cur * cache->c_page_size;
+    cache->p_base = buf;
+    cache->p_base_slots = PTR_ADD(buf, P_HEADERSIZE);
+    cache->p_snapshot = 1;
+
+    if (_mmc_test_page(cache))
+      return 0;
+
+    cache->p_snapshot = 0;
+    cache->p_cur = NOPAGE;
+  }
+
+  return _mmc_set_error(cache, 0, "no consistent copy of page %u after %d tries", p_cur, retries + 1);
+}
+
 /*
  * mmc_unlock(
  *   cache_mmap * cache
@@ -322,6 +643,13 @@ int mmc_unlock(mmap_cache * cache) {
 
   ASSERT(cache->p_cur != NOPAGE);
 
+  /* A snapshot isn't really locked, and is just a copy */
+  if (cache->p_snapshot) {
+    cache->p_snapshot = 0;
+    cache->p_cur = NOPAGE;
+    return 0;
+  }
+
   /* If changed, save page header changes back */
   if (cache->p_changed) {
     void * p_ptr = cache->p_base;
@@ -336,6 +664,13 @@ int mmc_unlock(mmap_cache * cache) {
     P_NReadHits(p_ptr) = cache->p_n_read_hits;
 
     cache->p_changed = 0;
+    cache->p_touched = 1;
+  }
+
+  /* Count page visits that dirtied the mapping */
+  if (cache->p_touched) {
+    cache->c_n_dirtied++;
+    cache->p_touched = 0;
   }
 
   /* Test before unlocking */
@@ -403,20 +738,81 @@ int mmc_hash(
  * value carries a modseq, it's returned via *modseq and val_ptr/val_len
  * cover just the value bytes (check FC_HASMODSEQ in *flags)
  *
+ * Returns 0 if found, -1 if not. An entry stored with a stale time
+ * (FC_HASSTALE) that's past its expiry (soft) but not its hard expiry
+ * is returned as found, see mmc_read_stale to refresh it
+ *
 */
 int mmc_read(
   mmap_cache *cache, MU32 hash_slot,
   void *key_ptr, int key_len,
   void **val_ptr, int *val_len,
   MU32 *expire_on_p, MU32 *flags_p, MU64 *modseq_p
+) {
+  return _mmc_read_timed(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on_p, flags_p, modseq_p, 0);
+}
+
+/*
+ * int mmc_read_stale(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void **val_ptr, int *val_len,
+ *   MU32 *expire_on, MU32 *flags, MU64 *modseq
+ * )
+ *
+ * As mmc_read, but for a reader that will refresh a stale value. The
+ * first one to read it in its stale window gets 1. Its expiry is moved
+ * on by refresh_time seconds (to no later than the hard expiry), so
+ * meanwhile other readers get it with 0. If the refresh doesn't
+ * happen, the next reader after that gets 1
+ *
+*/
+int mmc_read_stale(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void **val_ptr, int *val_len,
+  MU32 *expire_on_p, MU32 *flags_p, MU64 *modseq_p
+) {
+  return _mmc_read_timed(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on_p, flags_p, modseq_p, 1);
+}
+
+int _mmc_read_timed(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void **val_ptr, int *val_len,
+  MU32 *expire_on_p, MU32 *flags_p, MU64 *modseq_p, int refresh
+) {
+  MU64 lat_start;
+  int res;
+
+  if (!cache->latency_stats && !cache->trace_fh)
+    return _mmc_read(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on_p, flags_p, modseq_p, refresh);
+
+  lat_start = mmc_latency_start(cache);
+  res = _mmc_read(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on_p, flags_p, modseq_p, refresh);
+  mmc_latency_end(cache, MMC_LAT_READ, lat_start);
+
+  if (cache->trace_fh)
+    _mmc_trace(cache, MMC_TRACE_READ, hash_slot, key_len, res != -1 ? *val_len : 0, 0, res != -1);
+
+  return res;
+}
+
+int _mmc_read(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void **val_ptr, int *val_len,
+  MU32 *expire_on_p, MU32 *flags_p, MU64 *modseq_p, int refresh
 ) {
   MU32 * slot_ptr;
+  int stale = 0;
 
-  /* Increase read count for page */
-  if (cache->enable_stats) {
-    cache->p_changed = 1;
-    cache->p_n_reads++;
-  }
+  /* Increase read count (in the stats region, not the page) */
+  if (cache->enable_stats)
+    MMC_STAT_ADD(cache, MMC_STAT_READS, 1);
+
+  if (cache->hot_keys)
+    _mmc_hot_key_touch(cache, hash_slot, key_ptr, key_len);
 
   /* Search slots for key */
   slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
@@ -440,20 +836,36 @@ int mmc_read(
 
     /* Value expired? */
     if (expire_on && now >= expire_on) {
+      MU32 hard_expire_on = _mmc_hard_expire_on(base_det);
 
       /* Return not found, but leave slot. Might need writeback */
+      if (!(S_Flags(base_det) & FC_HASSTALE) || now >= hard_expire_on
+          || (S_Flags(base_det) & (FC_TOMBSTONE | FC_LEASE)))
+        return -1;
 
-      return -1;
+      /* Stale. A reader that refreshes it gets it, and others see it
+       * as fresh for refresh_time meanwhile */
+      if (refresh) {
+        expire_on = now + cache->refresh_time < hard_expire_on ? now + cache->refresh_time : hard_expire_on;
+        S_ExpireOn(base_det) = expire_on;
+        cache->p_changed = 1;
+        stale = 1;
+      }
     }
 
     /* A tombstone is a miss (don't bump hit time - if it LRUs out
-     * early that just degrades to plain delete semantics) */
-    if (S_Flags(base_det) & FC_TOMBSTONE) {
+     * early that just degrades to plain delete semantics), as is a
+     * lease marker */
+    if (S_Flags(base_det) & (FC_TOMBSTONE | FC_LEASE)) {
       return -1;
     }
 
-    /* Update hit time */
-    S_LastAccess(base_det) = now;
+    /* Update hit time, unless it's already within lru_granularity
+     * seconds (default 1) of now, in which case skip dirtying the page */
+    if (now - S_LastAccess(base_det) >= (cache->lru_granularity ? cache->lru_granularity : 1)) {
+      S_LastAccess(base_det) = now;
+      cache->p_touched = 1;
+    }
 
     /* Copy values to pointers */
     *flags_p = S_Flags(base_det);
@@ -461,20 +873,15 @@ int mmc_read(
     *val_len = S_ValLen(base_det);
     *val_ptr = S_ValPtr(base_det);
 
-    /* Split off the modseq prefix if the value carries one */
-    if (*flags_p & FC_HASMODSEQ) {
-      memcpy(modseq_p, *val_ptr, FC_MODSEQ_LEN);
-      *val_ptr = PTR_ADD(*val_ptr, FC_MODSEQ_LEN);
-      *val_len -= FC_MODSEQ_LEN;
-    }
+    /* Split off the modseq and hard expiry prefix if the value
+     * carries one */
+    _mmc_split_prefix(base_det, val_ptr, val_len, modseq_p);
 
     /* Increase read hit count */
-    if (cache->enable_stats) {
-      cache->p_changed = 1;
-      cache->p_n_read_hits++;
-    }
+    if (cache->enable_stats)
+      MMC_STAT_ADD(cache, MMC_STAT_READ_HITS, 1);
 
-    return 0;
+    return stale;
   }
 }
 
@@ -498,16 +905,77 @@ int mmc_read(
  * whose modseq is already newer keeps the entry; both are success
  * no-ops (the cache already reflects something at least as new).
  *
+ * Entries that expire are stored with the cache's stale_time, see
+ * mmc_write_stale.
+ *
 */
 int mmc_write(
   mmap_cache *cache, MU32 hash_slot,
   void *key_ptr, int key_len,
   void *val_ptr, int val_len,
   MU32 expire_on, MU32 flags, MU64 modseq
+) {
+  return mmc_write_stale(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on, flags, modseq, cache->stale_time);
+}
+
+/*
+ * int mmc_write_stale(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len,
+ *   MU32 expire_on, MU32 flags, MU64 modseq, MU32 stale_time
+ * )
+ *
+ * As mmc_write, but if stale_time isn't 0 and the entry expires, it's
+ * stored with a hard expiry stale_time seconds after it (FC_HASSTALE).
+ * Between the two, mmc_read returns it as stale, and it's not
+ * expunged as expired.
+ *
+*/
+int mmc_write_stale(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_on, MU32 flags, MU64 modseq, MU32 stale_time
+) {
+  MU64 lat_start;
+  int res;
+
+  if (!cache->latency_stats && !cache->trace_fh)
+    return _mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on, flags, modseq, stale_time);
+
+  lat_start = mmc_latency_start(cache);
+  res = _mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on, flags, modseq, stale_time);
+  mmc_latency_end(cache, MMC_LAT_WRITE, lat_start);
+
+  if (cache->trace_fh)
+    _mmc_trace(cache, MMC_TRACE_WRITE, hash_slot, key_len, val_len, expire_on, res == 1);
+
+  return res;
+}
+
+int _mmc_write(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_on, MU32 flags, MU64 modseq, MU32 stale_time
 ) {
   int did_store = 0;
-  int ms_len = (flags & FC_HASMODSEQ) ? FC_MODSEQ_LEN : 0;
-  MU32 kvlen = KV_SlotLen(key_len, val_len + ms_len);
+  MU32 kvlen, version, now = time_override ? time_override : (MU32)time(0);
+
+  /* Calculate expiry time, and the hard expiry of entries that can be
+   * served stale after it */
+  if (expire_on == (MU32)-1)
+    expire_on = cache->expire_time ? now + cache->expire_time : 0;
+  flags &= ~FC_HASSTALE;
+  if (stale_time && expire_on && !(flags & FC_TOMBSTONE))
+    flags |= FC_HASSTALE;
+  flags |= FC_HASVERSION;
+
+  kvlen = KV_SlotLen(key_len, val_len + FC_PREFIX_LEN(flags));
+
+  if (cache->hot_keys)
+    _mmc_hot_key_touch(cache, hash_slot, key_ptr, key_len);
 
   /* Search for slot with given key */
   MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 1);
@@ -520,8 +988,7 @@ int mmc_write(
   if (*slot_ptr > 1) {
     MU32 * old_det = S_Ptr(cache->p_base, *slot_ptr);
     MU32 old_flags = S_Flags(old_det);
-    MU32 old_expire = S_ExpireOn(old_det);
-    MU32 now = time_override ? time_override : (MU32)time(0);
+    MU32 old_expire = _mmc_hard_expire_on(old_det);
 
     if ((old_flags & FC_HASMODSEQ) && !(old_expire && now >= old_expire)) {
       MU64 old_modseq;
@@ -534,6 +1001,8 @@ int mmc_write(
             return 1;
         } else if (!(flags & FC_HASMODSEQ) || modseq < old_modseq) {
           /* Value is older than the invalidating change (or can't say) */
+          if (cache->enable_stats)
+            MMC_STAT_ADD(cache, MMC_STAT_REFUSED, 1);
           return -1;
         }
       } else if (flags & FC_TOMBSTONE) {
@@ -542,6 +1011,8 @@ int mmc_write(
           return 1;
       } else if ((flags & FC_HASMODSEQ) && modseq < old_modseq) {
         /* Never regress a live value to an older one */
+        if (cache->enable_stats)
+          MMC_STAT_ADD(cache, MMC_STAT_REFUSED, 1);
         return -1;
       }
     }
@@ -551,13 +1022,31 @@ int mmc_write(
 
   ASSERT(cache->p_cur != NOPAGE);
 
-  /* If there's space, store the key/value in the data section.
+  /* Every store gives the entry a new version */
+  version = _mmc_next_version(cache, *slot_ptr > 1 ? S_Ptr(cache->p_base, *slot_ptr) : NULL);
+
+  /* If the existing entry's space is big enough, overwrite it in
+   * place. Frequently updated fixed size values then don't use up the
+   * page and force expunges. The key is unchanged, and any space left
+   * over is reclaimed by the next expunge like a deleted entry's */
+  if (*slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+    MU32 old_kvlen = S_SlotLen(base_det);
+    ROUNDLEN(old_kvlen);
+
+    if (kvlen <= old_kvlen) {
+      _mmc_store_entry(cache, base_det, hash_slot, NULL, key_len,
+        val_ptr, val_len, expire_on, expire_on + stale_time, flags, modseq, version);
+      did_store = 1;
+    }
+  }
+
+  /* Otherwise if there's space, store the key/value in the data section.
    * Important: we must not delete an existing slot for this key unless we
    * actually have space for the replacement; otherwise a failed set() would
    * silently destroy the previous value. */
-  if (cache->p_free_bytes >= kvlen) {
+  if (!did_store && cache->p_free_bytes >= kvlen) {
     MU32 * base_det;
-    MU32 now;
 
     /* If found, delete the existing slot before reusing it for the new value */
     if (*slot_ptr > 1) {
@@ -568,25 +1057,8 @@ int mmc_write(
     ASSERT(*slot_ptr <= 1);
 
     base_det = PTR_ADD(cache->p_base, cache->p_free_data);
-    now = time_override ? time_override : (MU32)time(0);
-
-    /* Calculate expiry time */
-    if (expire_on == (MU32)-1)
-      expire_on = cache->expire_time ? now + cache->expire_time : 0;
-
-    /* Store info into slot */
-    S_LastAccess(base_det) = now;
-    S_ExpireOn(base_det) = expire_on;
-    S_SlotHash(base_det) = hash_slot;
-    S_Flags(base_det) = flags;
-    S_KeyLen(base_det) = (MU32)key_len;
-    S_ValLen(base_det) = (MU32)(val_len + ms_len);
-
-    /* Copy key/value to data section, modseq prefix first if present */
-    memcpy(S_KeyPtr(base_det), key_ptr, key_len);
-    if (ms_len)
-      memcpy(S_ValPtr(base_det), &modseq, ms_len);
-    memcpy(PTR_ADD(S_ValPtr(base_det), ms_len), val_ptr, val_len);
+    _mmc_store_entry(cache, base_det, hash_slot, key_ptr, key_len,
+      val_ptr, val_len, expire_on, expire_on + stale_time, flags, modseq, version);
 
     /* Update used slots/free data info */
     cache->p_free_slots--;
@@ -599,49 +1071,702 @@ int mmc_write(
     cache->p_free_bytes -= kvlen;
     cache->p_free_data += kvlen;
 
-    /* Ensure changes are saved back */
-    cache->p_changed = 1;
+    did_store = 1;
+  }
+
+  if (cache->enable_stats && did_store)
+    MMC_STAT_ADD(cache, MMC_STAT_WRITES, 1);
+
+  return did_store;
+}
+
+/*
+ * void _mmc_store_entry(
+ *   mmap_cache * cache, MU32 * base_det, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len,
+ *   MU32 expire_on, MU32 hard_expire_on, MU32 flags, MU64 modseq,
+ *   MU32 version
+ * )
+ *
+ * Fill in the entry at base_det (new space, or an existing entry for
+ * the same key being overwritten in place, when key_ptr is NULL as the
+ * key is already there). val_ptr may point into the page. modseq,
+ * hard_expire_on and version are only stored if flags has
+ * FC_HASMODSEQ/FC_HASSTALE/FC_HASVERSION
+ *
+*/
+void _mmc_store_entry(
+  mmap_cache * cache, MU32 * base_det, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_on, MU32 hard_expire_on, MU32 flags, MU64 modseq,
+  MU32 version
+) {
+  int ms_len = (flags & FC_HASMODSEQ) ? FC_MODSEQ_LEN : 0;
+  int st_len = (flags & FC_HASSTALE) ? FC_STALE_LEN : 0;
+  int pre_len = FC_PREFIX_LEN(flags);
+  MU32 now = time_override ? time_override : (MU32)time(0);
+
+  /* Store info into slot */
+  S_LastAccess(base_det) = now;
+  S_ExpireOn(base_det) = expire_on;
+  S_SlotHash(base_det) = hash_slot;
+  S_Flags(base_det) = flags;
+  S_KeyLen(base_det) = (MU32)key_len;
+
+  /* Copy key/value to data section, modseq, hard expiry and version
+   * prefix first if present. Move the value before the prefix can
+   * overwrite it */
+  if (key_ptr)
+    memcpy(S_KeyPtr(base_det), key_ptr, key_len);
+  memmove(PTR_ADD(S_ValPtr(base_det), pre_len), val_ptr, val_len);
+  if (ms_len)
+    memcpy(S_ValPtr(base_det), &modseq, ms_len);
+  if (st_len)
+    memcpy(PTR_ADD(S_ValPtr(base_det), ms_len), &hard_expire_on, st_len);
+  if (flags & FC_HASVERSION)
+    memcpy(PTR_ADD(S_ValPtr(base_det), (ms_len + st_len)), &version, FC_VERSION_LEN);
+  S_ValLen(base_det) = (MU32)(val_len + pre_len);
+
+  /* Ensure changes are saved back */
+  cache->p_changed = 1;
+}
+
+/*
+ * int mmc_cas(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len,
+ *   MU32 expire_on, MU32 flags, MU64 modseq, MU32 version
+ * )
+ *
+ * Compare-and-swap: write key to the current page as mmc_write does,
+ * but only if it holds a live entry whose version is version, or
+ * if version is FC_NOVERSION, only if it holds no live entry. A lease
+ * marker counts as live, so the lease holder can replace it with the
+ * version from mmc_lease. Returns as mmc_write, or -2 if the entry's
+ * version didn't match
+ *
+*/
+int mmc_cas(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len,
+  MU32 expire_on, MU32 flags, MU64 modseq, MU32 version
+) {
+  MU32 * slot_ptr;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+  int live = 0;
+
+  ASSERT(cache->p_cur != NOPAGE);
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (slot_ptr && *slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+    MU32 old_expire = _mmc_hard_expire_on(base_det);
+
+    /* A stale entry is still live, so a reader refreshing it can */
+    live = !(old_expire && now >= old_expire) && !(S_Flags(base_det) & FC_TOMBSTONE);
+    if (live && version != FC_NOVERSION && _mmc_version(base_det) != version)
+      return -2;
+  }
+
+  if (live != (version != FC_NOVERSION))
+    return -2;
+
+  return mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on, flags, modseq);
+}
+
+/*
+ * int mmc_lease(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   MU32 lease_time, MU32 flags,
+ *   void **val_ptr, int *val_len, MU32 *flags_p, MU64 *modseq_p,
+ *   MU32 *version_p
+ * )
+ *
+ * Read key from the current page as mmc_read does, but on a miss take
+ * a lease on fetching the value, so concurrent readers don't all fetch
+ * it. Returns:
+ *
+ *  0 - found, the value is returned as for mmc_read
+ *  3 - found but stale, and the caller should refresh it (see
+ *      mmc_read_stale)
+ *  1 - not found, and the caller now holds the lease. A lease marker
+ *      expiring in lease_time seconds replaces any expired entry
+ *      (keeping its value), or is stored with flags. *version_p gets
+ *      its version, to replace it with mmc_cas
+ *  2 - not found, but another caller holds a lease. If it replaced an
+ *      expired entry, that stale value is returned as for mmc_read
+ *      (with its flags, which is all *flags_p has otherwise)
+ * -1 - not found, and no lease could be taken (a tombstone, or no
+ *      space for the marker)
+ *
+ * The lease ends when the value is stored, when the holder calls
+ * mmc_release_lease, or when it expires (eg. if the holder died).
+ *
+*/
+int mmc_lease(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 lease_time, MU32 flags,
+  void **val_ptr, int *val_len, MU32 *flags_p, MU64 *modseq_p,
+  MU32 *version_p
+) {
+  MU32 * slot_ptr, * base_det;
+  MU32 now = time_override ? time_override : (MU32)time(0), expire_on, version;
+  int res;
+
+  res = mmc_read_stale(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, &expire_on, flags_p, modseq_p);
+  if (res != -1)
+    return res == 1 ? 3 : 0;
+
+  *val_ptr = NULL;
+  *val_len = 0;
+  *flags_p = 0;
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (slot_ptr && *slot_ptr > 1) {
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    expire_on = S_ExpireOn(base_det);
+
+    if (!(expire_on && now >= expire_on)) {
+      if (S_Flags(base_det) & FC_TOMBSTONE)
+        return -1;
+
+      /* Someone else's lease, return any stale value */
+      ASSERT(S_Flags(base_det) & FC_LEASE);
+      *flags_p = S_Flags(base_det) & ~FC_LEASE;
+      _mmc_split_prefix(base_det, val_ptr, val_len, modseq_p);
+      return 2;
+    }
+
+    /* Expired, make it our lease marker in place, with a new version
+     * in its prefix. An expired tombstone has no value to keep, and a
+     * value past its hard expiry mustn't be served, so they're replaced
+     * by an empty marker below, as are entries from before versions,
+     * which have no room for one */
+    if (!(S_Flags(base_det) & FC_TOMBSTONE) && (S_Flags(base_det) & FC_HASVERSION)
+        && !((S_Flags(base_det) & FC_HASSTALE) && now >= _mmc_hard_expire_on(base_det))) {
+      version = _mmc_next_version(cache, base_det);
+      memcpy(PTR_ADD(S_ValPtr(base_det), (FC_PREFIX_LEN(S_Flags(base_det)) - FC_VERSION_LEN)), &version, FC_VERSION_LEN);
+      S_Flags(base_det) |= FC_LEASE;
+      S_ExpireOn(base_det) = now + lease_time;
+      S_LastAccess(base_det) = now;
+      cache->p_changed = 1;
+      *flags_p = S_Flags(base_det);
+      *version_p = version;
+      return 1;
+    }
+  }
+
+  /* Nothing (to keep) there, store an empty marker */
+  flags = (flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_TOMBSTONE | FC_INTEGER)) | FC_LEASE;
+  res = mmc_write_stale(cache, hash_slot, key_ptr, key_len, "", 0, now + lease_time, flags, 0, 0);
+  if (res != 1)
+    return -1;
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+  ASSERT(slot_ptr && *slot_ptr > 1);
+  base_det = S_Ptr(cache->p_base, *slot_ptr);
+  *flags_p = S_Flags(base_det);
+  *version_p = _mmc_version(base_det);
+  return 1;
+}
+
+/*
+ * int mmc_release_lease(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len, MU32 version
+ * )
+ *
+ * End a lease taken with mmc_lease without storing a value (eg. the
+ * fetch failed), by expiring the marker if it's still the one with
+ * version. Any stale value it kept stays for the next lease. Returns
+ * 1 if released, 0 if the lease had already ended
+ *
+*/
+int mmc_release_lease(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len, MU32 version
+) {
+  MU32 * slot_ptr, * base_det;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+  if (!slot_ptr || *slot_ptr <= 1)
+    return 0;
+
+  base_det = S_Ptr(cache->p_base, *slot_ptr);
+  if (!(S_Flags(base_det) & FC_LEASE) || _mmc_version(base_det) != version)
+    return 0;
+  if (S_ExpireOn(base_det) && now >= S_ExpireOn(base_det))
+    return 0;
+
+  S_ExpireOn(base_det) = now;
+  cache->p_changed = 1;
+  return 1;
+}
+
+/*
+ * MU32 _mmc_next_version(mmap_cache * cache, MU32 * base_det)
+ *
+ * Get the version for a write to the entry at base_det, or a new entry
+ * if it's NULL
+ *
+*/
+MU32 _mmc_next_version(mmap_cache * cache, MU32 * base_det) {
+  MU32 version;
+
+  /* New keys start at an arbitrary version, so a key that's deleted
+   * and stored again doesn't repeat versions a caller may be holding */
+  if (base_det)
+    version = _mmc_version(base_det) + 1;
+  else
+    version = (MU32)(mmc_now_ns() >> 8) ^ cache->p_free_data;
+
+  return version == FC_NOVERSION ? 0 : version;
+}
+
+/*
+ * MU32 _mmc_version(MU32 * base_det)
+ *
+ * Get the version of the entry at base_det, 0 if it's from before
+ * versions (no FC_HASVERSION)
+ *
+*/
+MU32 _mmc_version(MU32 * base_det) {
+  MU32 version;
+
+  if (!(S_Flags(base_det) & FC_HASVERSION))
+    return 0;
+
+  memcpy(&version, PTR_ADD(S_ValPtr(base_det), (FC_PREFIX_LEN(S_Flags(base_det)) - FC_VERSION_LEN)), FC_VERSION_LEN);
+  return version;
+}
+
+/*
+ * MU32 mmc_val_version(MU32 flags, void * val_ptr)
+ *
+ * Get the version of an entry from the flags and value pointer
+ * mmc_read (or mmc_get_details etc) returned for it, while the page is
+ * still locked. The version is the last prefix, just before the value
+ * bytes
+ *
+*/
+MU32 mmc_val_version(MU32 flags, void * val_ptr) {
+  MU32 version;
+
+  if (!(flags & FC_HASVERSION))
+    return 0;
+
+  memcpy(&version, PTR_ADD(val_ptr, -FC_VERSION_LEN), FC_VERSION_LEN);
+  return version;
+}
+
+/*
+ * MU32 _mmc_hard_expire_on(MU32 * base_det)
+ *
+ * Get the time after which the entry at base_det can't be served at
+ * all, its hard expiry if it has one (FC_HASSTALE), else its expiry.
+ * A lease marker that kept a stale value only lasts for the lease
+ *
+*/
+MU32 _mmc_hard_expire_on(MU32 * base_det) {
+  MU32 hard_expire_on;
+
+  if ((S_Flags(base_det) & (FC_HASSTALE | FC_LEASE)) != FC_HASSTALE)
+    return S_ExpireOn(base_det);
+
+  memcpy(&hard_expire_on, PTR_ADD(S_ValPtr(base_det),
+    ((S_Flags(base_det) & FC_HASMODSEQ) ? FC_MODSEQ_LEN : 0)), FC_STALE_LEN);
+  return hard_expire_on;
+}
+
+/*
+ * void _mmc_split_prefix(MU32 * base_det, void ** val_ptr, int * val_len, MU64 * modseq)
+ *
+ * Point val_ptr/val_len at just the value bytes of the entry at
+ * base_det, after any modseq (returned in *modseq), hard expiry and
+ * version
+ *
+*/
+void _mmc_split_prefix(MU32 * base_det, void ** val_ptr, int * val_len, MU64 * modseq) {
+  MU32 flags = S_Flags(base_det);
+
+  *val_ptr = S_ValPtr(base_det);
+  *val_len = S_ValLen(base_det);
+
+  if (flags & FC_HASMODSEQ) {
+    memcpy(modseq, *val_ptr, FC_MODSEQ_LEN);
+    *val_ptr = PTR_ADD(*val_ptr, FC_MODSEQ_LEN);
+    *val_len -= FC_MODSEQ_LEN;
+  }
+  if (flags & FC_HASSTALE) {
+    *val_ptr = PTR_ADD(*val_ptr, FC_STALE_LEN);
+    *val_len -= FC_STALE_LEN;
+  }
+  if (flags & FC_HASVERSION) {
+    *val_ptr = PTR_ADD(*val_ptr, FC_VERSION_LEN);
+    *val_len -= FC_VERSION_LEN;
+  }
+}
+
+/*
+ * int mmc_delete(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len
+ * )
+ *
+ * Delete key from current page
+ *
+*/
+int mmc_delete(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 * flags
+) {
+  int res = _mmc_delete(cache, hash_slot, key_ptr, key_len, flags);
+
+  if (cache->trace_fh)
+    _mmc_trace(cache, MMC_TRACE_DELETE, hash_slot, key_len, 0, 0, res);
+
+  return res;
+}
+
+int _mmc_delete(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  MU32 * flags
+) {
+  /* Search slots for key */
+  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 2);
+
+  /* Did we find a value? */
+  if (!slot_ptr || *slot_ptr == 0) {
+
+    /* Return 0 if not deleted */
+    return 0;
+
+  /* We found it, delete it */
+  } else {
+
+    /* Store flags in output pointer */
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+    *flags = S_Flags(base_det);
+
+    _mmc_delete_slot(cache, slot_ptr);
+
+    if (cache->enable_stats)
+      MMC_STAT_ADD(cache, MMC_STAT_DELETES, 1);
+
+    return 1;
+  }
+
+}
+
+/*
+ * int mmc_incr(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   int64_t delta, int64_t initial,
+ *   MU32 expire_on, MU32 flags, int64_t * result
+ * )
+ *
+ * Add delta to the counter stored under key in the current page, and
+ * put the new value in *result. Counters are native 64 bit integers
+ * flagged FC_INTEGER, updated in place keeping their expiry time, so
+ * counting doesn't use up page space. flags are or'ed into an existing
+ * counter's flags (eg. to mark it dirty).
+ *
+ * A missing (or expired) key is stored as initial + delta with
+ * expire_on and flags, as is a plain value that's a decimal integer,
+ * with its value as initial. Returns 1 if updated or stored, 0 if
+ * there was no space to store it, -1 if the store was refused by a
+ * tombstone, -2 if the existing value isn't an integer
+ *
+*/
+int mmc_incr(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  int64_t delta, int64_t initial,
+  MU32 expire_on, MU32 flags, int64_t * result
+) {
+  MU32 * slot_ptr;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+  int64_t value;
+  int res;
+
+  ASSERT(cache->p_cur != NOPAGE);
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  if (slot_ptr && *slot_ptr > 1) {
+    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
+    MU32 old_flags = S_Flags(base_det), old_expire = S_ExpireOn(base_det);
+
+    if (!(old_expire && now >= old_expire) && !(old_flags & (FC_TOMBSTONE | FC_LEASE))) {
+      void * old_val;
+      int old_len;
+      MU64 modseq;
+
+      _mmc_split_prefix(base_det, &old_val, &old_len, &modseq);
+
+      /* Existing counter, update in place, and the version just
+       * before it */
+      if ((old_flags & (FC_INTEGER | FC_HASVERSION)) == (FC_INTEGER | FC_HASVERSION) && old_len == sizeof(int64_t)) {
+        MU64 lat_start = mmc_latency_start(cache);
+        MU32 version = _mmc_next_version(cache, base_det);
+
+        if (cache->hot_keys)
+          _mmc_hot_key_touch(cache, hash_slot, key_ptr, key_len);
+
+        memcpy(&value, old_val, sizeof(int64_t));
+        value = (int64_t)((MU64)value + (MU64)delta);
+        memcpy(old_val, &value, sizeof(int64_t));
+        memcpy(PTR_ADD(old_val, -FC_VERSION_LEN), &version, FC_VERSION_LEN);
+
+        S_LastAccess(base_det) = now;
+        S_Flags(base_det) = old_flags
+          | (flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_HASVERSION));
+        cache->p_touched = 1;
+
+        if (cache->enable_stats)
+          MMC_STAT_ADD(cache, MMC_STAT_WRITES, 1);
+        mmc_latency_end(cache, MMC_LAT_WRITE, lat_start);
+        if (cache->trace_fh)
+          _mmc_trace(cache, MMC_TRACE_WRITE, hash_slot, key_len, sizeof(int64_t), old_expire, 1);
+
+        *result = value;
+        return 1;
+      }
+
+      /* A counter from before versions is stored again to get one,
+       * and a plain decimal integer becomes a counter, otherwise it's
+       * not something we can add to */
+      if ((old_flags & FC_INTEGER) && old_len == sizeof(int64_t))
+        memcpy(&initial, old_val, sizeof(int64_t));
+      else if (old_flags & (FC_CODEC_MASK | FC_HASMODSEQ))
+        return -2;
+      else if (_mmc_parse_int(old_val, old_len, &initial) != 0)
+        return -2;
+      expire_on = old_expire;
+    }
+  }
+
+  value = (int64_t)((MU64)initial + (MU64)delta);
+  flags = (flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_TOMBSTONE)) | FC_INTEGER;
+
+  res = mmc_write(cache, hash_slot, key_ptr, key_len, &value, sizeof(int64_t), expire_on, flags, 0);
+  if (res == 1)
+    *result = value;
+
+  return res;
+}
+
+/*
+ * int mmc_append(
+ *   cache_mmap * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len,
+ *   void *val_ptr, int val_len, int prepend, MU32 max_len,
+ *   MU32 expire_on, MU32 flags, MU32 clear_flags
+ * )
+ *
+ * Append (or if prepend is set, prepend) val bytes to the value stored
+ * under key in the current page. If max_len isn't 0 and the value
+ * would be longer, bytes are trimmed from the other end (the front
+ * when appending), so the newest max_len bytes are kept. The entry is
+ * extended in place if it's the last one in the page's data area (or
+ * already has room), otherwise it's moved to the end of the data area.
+ * The expiry time is kept, flags are or'ed into and clear_flags
+ * cleared from the entry's flags (eg. to mark it dirty).
+ *
+ * A missing (or expired) key is stored as the (trimmed) val bytes
+ * with expire_on and flags. Returns 1 if updated or stored, 0 if
+ * there was no space, -1 if the store was refused by a tombstone, -2
+ * if the existing value is compressed or a counter
+ *
+*/
+int mmc_append(
+  mmap_cache *cache, MU32 hash_slot,
+  void *key_ptr, int key_len,
+  void *val_ptr, int val_len, int prepend, MU32 max_len,
+  MU32 expire_on, MU32 flags, MU32 clear_flags
+) {
+  MU32 * slot_ptr, * base_det, * new_det;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+  MU32 old_flags, old_expire = 0, old_kvlen, new_kvlen, old_len, new_len, trim = 0;
+  MU32 offset, version;
+  int old_pre, pre_len;
+  char * old_val, * new_val;
+  MU64 lat_start;
+
+  ASSERT(cache->p_cur != NOPAGE);
+
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+
+  base_det = slot_ptr && *slot_ptr > 1 ? S_Ptr(cache->p_base, *slot_ptr) : NULL;
+  if (base_det) {
+    old_expire = S_ExpireOn(base_det);
+    if ((old_expire && now >= old_expire) || (S_Flags(base_det) & (FC_TOMBSTONE | FC_LEASE)))
+      base_det = NULL;
+  }
+
+  /* Nothing to add to, store the new bytes as the value */
+  if (!base_det) {
+    if (max_len && (MU32)val_len > max_len) {
+      if (!prepend)
+        val_ptr = PTR_ADD(val_ptr, val_len - max_len);
+      val_len = (int)max_len;
+    }
+    flags &= ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_TOMBSTONE | FC_INTEGER);
+    return mmc_write(cache, hash_slot, key_ptr, key_len, val_ptr, val_len, expire_on, flags, 0);
+  }
+
+  old_flags = S_Flags(base_det);
+  if (old_flags & (FC_CODEC_MASK | FC_INTEGER))
+    return -2;
+
+  lat_start = mmc_latency_start(cache);
+
+  if (cache->hot_keys)
+    _mmc_hot_key_touch(cache, hash_slot, key_ptr, key_len);
+
+  /* Any modseq and hard expiry prefix stays at the front of the value,
+   * then a new version (added to an entry from before versions) */
+  version = _mmc_next_version(cache, base_det);
+  old_pre = FC_PREFIX_LEN(old_flags);
+  pre_len = FC_PREFIX_LEN(old_flags | FC_HASVERSION);
+  old_len = S_ValLen(base_det) - old_pre;
+  new_len = old_len + val_len;
+  if (max_len && new_len > max_len) {
+    trim = new_len - max_len;
+    new_len = max_len;
+  }
+
+  old_kvlen = S_SlotLen(base_det);
+  ROUNDLEN(old_kvlen);
+  new_kvlen = KV_SlotLen(key_len, pre_len + new_len);
+  ROUNDLEN(new_kvlen);
+
+  offset = *slot_ptr;
+
+  /* The last entry in the data area can grow (or shrink) into the free
+   * space after it. Otherwise it must be moved if it doesn't fit */
+  if (offset + old_kvlen == cache->p_free_data) {
+    if (new_kvlen > old_kvlen && cache->p_free_bytes < new_kvlen - old_kvlen)
+      return 0;
+    cache->p_free_data = offset + new_kvlen;
+    cache->p_free_bytes = cache->p_free_bytes + old_kvlen - new_kvlen;
+    new_det = base_det;
+
+  } else if (new_kvlen <= old_kvlen) {
+    new_det = base_det;
+
+  } else {
+    if (cache->p_free_bytes < new_kvlen)
+      return 0;
+
+    /* Copy the header, key and any prefix, the value is built below */
+    new_det = S_Ptr(cache->p_base, cache->p_free_data);
+    memcpy(new_det, base_det, KV_SlotLen(key_len, old_pre));
+    *slot_ptr = cache->p_free_data;
+    cache->p_free_data += new_kvlen;
+    cache->p_free_bytes -= new_kvlen;
+  }
+
+  /* Build the new value from what's kept of the old one and the new
+   * bytes. new_val may be old_val, so move the old bytes first */
+  old_val = (char *)PTR_ADD(S_ValPtr(base_det), old_pre);
+  new_val = (char *)PTR_ADD(S_ValPtr(new_det), pre_len);
+  if (trim >= old_len) {
+    /* Nothing of the old value is kept */
+    memcpy(new_val, prepend ? (char *)val_ptr : (char *)val_ptr + (trim - old_len), new_len);
+  } else if (prepend) {
+    memmove(new_val + val_len, old_val, old_len - trim);
+    memcpy(new_val, val_ptr, val_len);
+  } else {
+    memmove(new_val, old_val + trim, old_len - trim);
+    memcpy(new_val + old_len - trim, val_ptr, val_len);
+  }
+  memcpy(new_val - FC_VERSION_LEN, &version, FC_VERSION_LEN);
+
+  S_ValLen(new_det) = pre_len + new_len;
+  S_LastAccess(new_det) = now;
+  S_Flags(new_det) = (old_flags & ~clear_flags) | FC_HASVERSION
+    | (flags & ~(FC_CODEC_MASK | FC_HASMODSEQ | FC_HASSTALE | FC_TOMBSTONE | FC_INTEGER | FC_HASVERSION));
+  cache->p_changed = 1;
 
-    did_store = 1;
-  }
+  if (cache->enable_stats)
+    MMC_STAT_ADD(cache, MMC_STAT_WRITES, 1);
+  mmc_latency_end(cache, MMC_LAT_WRITE, lat_start);
+  if (cache->trace_fh)
+    _mmc_trace(cache, MMC_TRACE_WRITE, hash_slot, key_len, new_len, old_expire, 1);
 
-  return did_store;
+  return 1;
 }
 
 /*
- * int mmc_delete(
+ * int mmc_peek_flags(
  *   cache_mmap * cache, MU32 hash_slot,
- *   void *key_ptr, int key_len
+ *   void *key_ptr, int key_len, MU32 *flags
  * )
  *
- * Delete key from current page
+ * Get the flags of the entry stored under key in the current page,
+ * without counting a read or touching its last access. Expired
+ * entries and tombstones are found too, check the flags if that
+ * matters. Returns 0 if found, -1 if not
  *
 */
-int mmc_delete(
+int mmc_peek_flags(
   mmap_cache *cache, MU32 hash_slot,
-  void *key_ptr, int key_len,
-  MU32 * flags
+  void *key_ptr, int key_len, MU32 *flags
 ) {
-  /* Search slots for key */
-  MU32 * slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 2);
+  MU32 * slot_ptr;
 
-  /* Did we find a value? */
-  if (!slot_ptr || *slot_ptr == 0) {
+  ASSERT(cache->p_cur != NOPAGE);
 
-    /* Return 0 if not deleted */
-    return 0;
+  slot_ptr = _mmc_find_slot(cache, hash_slot, key_ptr, key_len, 0);
+  if (!slot_ptr || *slot_ptr <= 1)
+    return -1;
 
-  /* We found it, delete it */
-  } else {
+  *flags = S_Flags(S_Ptr(cache->p_base, *slot_ptr));
+  return 0;
+}
 
-    /* Store flags in output pointer */
-    MU32 * base_det = S_Ptr(cache->p_base, *slot_ptr);
-    *flags = S_Flags(base_det);
+/*
+ * int _mmc_parse_int(void * val, int val_len, int64_t * value)
+ *
+ * Parse a value that's entirely a decimal integer, with an optional
+ * leading -. Returns 0 if it is, -1 if not
+ *
+*/
+int _mmc_parse_int(void * val, int val_len, int64_t * value) {
+  char buf[24], * end;
+  int i;
 
-    _mmc_delete_slot(cache, slot_ptr);
-    return 1;
+  if (val_len < 1 || val_len >= (int)sizeof(buf))
+    return -1;
+  memcpy(buf, val, val_len);
+  buf[val_len] = '\0';
+
+  for (i = buf[0] == '-' ? 1 : 0; i < val_len; i++) {
+    if (buf[i] < '0' || buf[i] > '9')
+      return -1;
   }
+  if (i == 1 && buf[0] == '-')
+    return -1;
+
+  errno = 0;
+  *value = (int64_t)strtoll(buf, &end, 10);
+  if (errno || *end)
+    return -1;
 
+  return 0;
 }
 
 int last_access_cmp(const void * a, const void * b) {
@@ -649,6 +1774,11 @@ int last_access_cmp(const void * a, const void * b) {
   MU32 bv = S_LastAccess(*(MU32 **)b);
   if (av < bv) return -1;
   if (av > bv) return 1;
+  /* Last access is only to the second, so break ties by position.
+   *  Writes append to the page and expunge keeps the order, so the
+   *  lower offset is usually the older entry */
+  if (*(MU32 **)a < *(MU32 **)b) return -1;
+  if (*(MU32 **)a > *(MU32 **)b) return 1;
   return 0;
 }
 
@@ -661,6 +1791,8 @@ int last_access_cmp(const void * a, const void * b) {
  *
  *  If len >= 0
  *    If space available for len bytes & >30% slots free, nothing is expunged
+ *    len is just the key + value length, room is also checked for the
+ *    version, modseq and hard expiry prefixes a write may add
  *  If len < 0 or not above
  *    If mode == 0, only expired items are expunged
  *    If mode == 1, all entries are expunged
@@ -683,17 +1815,25 @@ int mmc_calc_expunge(
 
   /* If len >= 0, and space available for len bytes, nothing is expunged */
   if (len >= 0) {
-    /* Length of key/value data when stored */
-    MU32 kvlen = KV_SlotLen(len, 0);
+    /* Length of key/value data when stored, with the largest prefix
+     *  _mmc_write could put in front of the value. The hard expiry is
+     *  counted even without a cache stale_time, set() can pass one */
+    MU32 kvlen = KV_SlotLen(len, FC_PREFIX_LEN(FC_HASVERSION | FC_HASMODSEQ | FC_HASSTALE));
     ROUNDLEN(kvlen);
 
     slots_pct = (double)(cache->p_free_slots - cache->p_old_slots) / cache->p_num_slots;
 
-    /* Nothing to do if hash table more than 30% free slots and enough free space */
-    if (slots_pct > 0.3 && cache->p_free_bytes >= kvlen)
+    /* Nothing to do if hash table more than 30% free slots and enough
+     *  free space, no mmc_do_expunge follows so don't leave a start time */
+    if (slots_pct > 0.3 && cache->p_free_bytes >= kvlen) {
+      cache->lat_expunge_start = 0;
       return 0;
+    }
   }
 
+  /* Time from here to the end of mmc_do_expunge */
+  cache->lat_expunge_start = mmc_latency_start(cache);
+
   {
     MU32 num_slots = cache->p_num_slots;
 
@@ -728,8 +1868,9 @@ int mmc_calc_expunge(
         continue;
       }
 
-      /* Definitely out if expired, and not dirty */
-      expire_on = S_ExpireOn(base_det);
+      /* Definitely out if expired (past any time it can be served
+       * stale), and not dirty */
+      expire_on = _mmc_hard_expire_on(base_det);
       if (expire_on && now >= expire_on) {
         *copy_base_det_out++ = base_det;
         continue;
@@ -821,8 +1962,33 @@ int mmc_do_expunge(
   MU32 new_offset = 0;
 
   /* Sanity check underlying fd is still the same file */
-  if (!mmc_check_fh(cache))
+  if (!mmc_check_fh(cache)) {
+    cache->lat_expunge_start = 0;
     return 0;
+  }
+
+  /* Count expired vs evicted entries we're throwing away */
+  if (cache->enable_stats) {
+    MU32 now = time_override ? time_override : (MU32)time(0);
+    MU64 n_expired = 0, n_evicted = 0, bytes_evicted = 0;
+    int item;
+
+    for (item = 0; item < num_expunge; item++) {
+      MU32 * base_det = to_expunge[item];
+      MU32 expire_on = _mmc_hard_expire_on(base_det);
+      if (expire_on && now >= expire_on) {
+        n_expired++;
+      } else {
+        n_evicted++;
+        bytes_evicted += S_SlotLen(base_det);
+      }
+    }
+
+    MMC_STAT_ADD(cache, MMC_STAT_EXPUNGE_RUNS, 1);
+    MMC_STAT_ADD(cache, MMC_STAT_EXPIRATIONS, n_expired);
+    MMC_STAT_ADD(cache, MMC_STAT_EVICTIONS, n_evicted);
+    MMC_STAT_ADD(cache, MMC_STAT_BYTES_EVICTED, bytes_evicted);
+  }
 
   /* Start all new slots empty */
   memset(new_slot_data, 0, slot_data_size);
@@ -890,6 +2056,9 @@ int mmc_do_expunge(
 
   ASSERT(_mmc_test_page(cache));
 
+  mmc_latency_end(cache, MMC_LAT_EXPUNGE, cache->lat_expunge_start);
+  cache->lat_expunge_start = 0;
+
   return 1;
 }
 
@@ -906,6 +2075,272 @@ void mmc_get_page_details(mmap_cache * cache, MU32 * n_reads, MU32 * n_read_hits
   return;
 }
 
+/*
+ * MU64 mmc_get_dirty_count(mmap_cache * cache, int clear)
+ *
+ * Return the number of page visits by this cache object that wrote
+ * to the mapping (stores, deletes, expunges and read hit time updates).
+ * On a share file not on tmpfs, each of those dirties file pages the
+ * OS will eventually write back to disk. Reset to 0 if clear is set
+ *
+*/
+MU64 mmc_get_dirty_count(mmap_cache * cache, int clear) {
+  MU64 n_dirtied = cache->c_n_dirtied;
+  if (clear)
+    cache->c_n_dirtied = 0;
+  return n_dirtied;
+}
+
+/*
+ * void mmc_get_stats(mmap_cache * cache, MU64 * counts, int clear)
+ *
+ * Sum the statistics counters (MMC_STAT_COUNT of them, see
+ * mmap_cache.h) over all processes' slots into counts. Doesn't lock
+ * anything, so counts being updated while this runs may or may not
+ * be included. If clear is set, counters are atomically reset as
+ * they're read, so no counts are lost
+ *
+*/
+void mmc_get_stats(mmap_cache * cache, MU64 * counts, int clear) {
+  int slot, stat;
+
+  memset(counts, 0, MMC_STAT_COUNT * sizeof(MU64));
+
+  for (slot = 0; slot < M_STATS_SLOTS; slot++) {
+    MU64 * slot_stats = M_StatsSlot(cache->mm_meta, slot);
+    for (stat = 0; stat < MMC_STAT_COUNT; stat++) {
+      counts[stat] += clear ? MMC_ATOMIC_XCHG(slot_stats + stat, 0)
+                            : MMC_ATOMIC_LOAD(slot_stats + stat);
+    }
+  }
+}
+
+/*
+ * void mmc_get_page_report(mmap_cache * cache, mmap_cache_page_report * report)
+ *
+ * Fill report with occupancy and fragmentation details of the current
+ * locked page. This walks every slot, like _mmc_test_page. Live bytes
+ * are the (rounded) key/value data of unexpired entries, dead bytes
+ * the rest of the used data area (deleted, overwritten and expired
+ * entries) that an expunge would reclaim. total_probe is the sum over
+ * used slots of how many slots a lookup of that entry checks
+ *
+*/
+void mmc_get_page_report(mmap_cache * cache, mmap_cache_page_report * report) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+  MU32 used_data;
+
+  ASSERT(cache->p_cur != NOPAGE);
+
+  memset(report, 0, sizeof(*report));
+  report->num_slots = cache->p_num_slots;
+  report->used_slots = cache->p_num_slots - cache->p_free_slots;
+  report->old_slots = cache->p_old_slots;
+  report->free_bytes = cache->p_free_bytes;
+  report->data_bytes = cache->c_page_size - P_HEADERSIZE - cache->p_num_slots * 4;
+  report->have_entries = 1;
+
+  for (; slot_ptr != slot_end; slot_ptr++) {
+    MU32 data_offset = *slot_ptr;
+    MU32 * base_det;
+    MU32 expire_on, last_access, kvlen, home_slot, slot;
+
+    if (data_offset <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, data_offset);
+
+    /* Distance from the slot the key hashes to, wrapping at the end */
+    slot = slot_ptr - cache->p_base_slots;
+    home_slot = S_SlotHash(base_det) % cache->p_num_slots;
+    report->total_probe += 1 + (slot >= home_slot ? slot - home_slot : slot + cache->p_num_slots - home_slot);
+
+    expire_on = _mmc_hard_expire_on(base_det);
+    if (expire_on && now >= expire_on) {
+      report->expired_slots++;
+      continue;
+    }
+
+    kvlen = S_SlotLen(base_det);
+    ROUNDLEN(kvlen);
+    report->live_bytes += kvlen;
+
+    last_access = S_LastAccess(base_det);
+    if (!report->oldest_access || last_access < report->oldest_access)
+      report->oldest_access = last_access;
+    if (last_access > report->newest_access)
+      report->newest_access = last_access;
+  }
+
+  used_data = report->data_bytes - report->free_bytes;
+  report->dead_bytes = used_data > report->live_bytes ? used_data - report->live_bytes : 0;
+}
+
+/*
+ * int mmc_get_page_header_report(mmap_cache * cache, MU32 p_num, mmap_cache_page_report * report)
+ *
+ * Fill the page header fields of report for the given page without
+ * locking it. The fields are read individually, so may be a mix of
+ * before and after a concurrent change, but it's cheap enough to do
+ * on every page of a big cache. Returns -1 if the page isn't valid
+ *
+*/
+int mmc_get_page_header_report(mmap_cache * cache, MU32 p_num, mmap_cache_page_report * report) {
+  void * p_ptr;
+  MU32 num_slots, free_slots;
+
+  if (p_num >= cache->c_num_pages)
+    return _mmc_set_error(cache, 0, "page %u is larger than number of pages", p_num);
+
+  p_ptr = PTR_ADD(cache->mm_var, (MU64)p_num * cache->c_page_size);
+  if (P_Magic(p_ptr) != 0x92f7e3b1)
+    return _mmc_set_error(cache, 0, "magic page start marker not found. page is %u", p_num);
+
+  num_slots = P_NumSlots(p_ptr);
+  free_slots = P_FreeSlots(p_ptr);
+
+  memset(report, 0, sizeof(*report));
+  report->num_slots = num_slots;
+  report->used_slots = free_slots <= num_slots ? num_slots - free_slots : 0;
+  report->old_slots = P_OldSlots(p_ptr);
+  report->free_bytes = P_FreeBytes(p_ptr);
+  report->data_bytes = cache->c_page_size - P_HEADERSIZE - num_slots * 4;
+
+  return 0;
+}
+
+/*
+ * MU64 mmc_latency_start(mmap_cache * cache)
+ * void mmc_latency_end(mmap_cache * cache, int op, MU64 start)
+ *
+ * Time an operation into this process's latency slot histogram for
+ * op. Start returns 0 if latency_stats isn't enabled, and end ignores
+ * a 0 start, so they're cheap to call when it's off
+ *
+*/
+MU64 mmc_latency_start(mmap_cache * cache) {
+  return cache->latency_stats ? mmc_now_ns() : 0;
+}
+
+void mmc_latency_end(mmap_cache * cache, int op, MU64 start) {
+  MU64 ns, v;
+  int msb = 0, bucket;
+
+  if (!start)
+    return;
+
+  ns = v = mmc_now_ns() - start;
+
+  /* Exact below 16ns, then 8 sub-buckets per power of 2 */
+  if (ns < 16) {
+    bucket = (int)ns;
+  } else {
+    while (v >>= 1) msb++;
+    if (msb > MMC_LAT_MAX_MSB)
+      bucket = MMC_LAT_BUCKETS - 1;
+    else
+      bucket = 16 + (msb - 4) * 8 + (int)((ns >> (msb - 3)) & 7);
+  }
+
+  MMC_ATOMIC_ADD(cache->c_lat + op * MMC_LAT_BUCKETS + bucket, (MU64)1);
+}
+
+/*
+ * MU64 mmc_get_latency(mmap_cache * cache, int op, MU64 * buckets, int clear)
+ *
+ * Sum the latency histogram for op over all the latency slots into
+ * buckets (MMC_LAT_BUCKETS counters), and return the total count.
+ * Like mmc_get_stats, doesn't lock anything
+ *
+*/
+MU64 mmc_get_latency(mmap_cache * cache, int op, MU64 * buckets, int clear) {
+  MU64 count = 0;
+  int slot, bucket;
+
+  memset(buckets, 0, MMC_LAT_BUCKETS * sizeof(MU64));
+
+  for (slot = 0; slot < M_LAT_SLOTS; slot++) {
+    MU64 * hist = M_LatSlot(cache->mm_meta, slot) + op * MMC_LAT_BUCKETS;
+    for (bucket = 0; bucket < MMC_LAT_BUCKETS; bucket++) {
+      MU64 n = clear ? MMC_ATOMIC_XCHG(hist + bucket, 0) : MMC_ATOMIC_LOAD(hist + bucket);
+      buckets[bucket] += n;
+      count += n;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * MU64 mmc_latency_percentile(MU64 * buckets, MU64 count, double pct)
+ *
+ * Return the latency (in ns) that pct (0 - 1) of the count entries
+ * in buckets are at or below, as the highest value in that bucket.
+ * Returns 0 for an empty histogram
+ *
+*/
+MU64 mmc_latency_percentile(MU64 * buckets, MU64 count, double pct) {
+  MU64 rank, seen = 0;
+  int bucket, msb;
+
+  if (!count)
+    return 0;
+
+  rank = (MU64)(pct * count + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > count) rank = count;
+
+  for (bucket = 0; bucket < MMC_LAT_BUCKETS - 1; bucket++) {
+    seen += buckets[bucket];
+    if (seen >= rank)
+      break;
+  }
+
+  if (bucket < 16)
+    return (MU64)bucket;
+
+  msb = 4 + (bucket - 16) / 8;
+  return ((MU64)(9 + (bucket - 16) % 8) << (msb - 3)) - 1;
+}
+
+static int hot_key_count_cmp(const void * a, const void * b) {
+  MU64 av = ((mmap_cache_hot_key *)a)->count;
+  MU64 bv = ((mmap_cache_hot_key *)b)->count;
+  if (av > bv) return -1;
+  if (av < bv) return 1;
+  return 0;
+}
+
+/*
+ * int mmc_get_hot_keys(mmap_cache * cache, mmap_cache_hot_key ** keys)
+ *
+ * Sort this process's hot keys sketch by count, most accessed first,
+ * point *keys at it and return the number of keys in it. Counts
+ * over estimate by at most each key's error. Only valid until the
+ * next read/write
+ *
+*/
+int mmc_get_hot_keys(mmap_cache * cache, mmap_cache_hot_key ** keys) {
+  *keys = cache->hot_keys;
+  if (!cache->hot_keys)
+    return 0;
+
+  qsort((void *)cache->hot_keys, cache->hot_keys_used, sizeof(mmap_cache_hot_key), hot_key_count_cmp);
+  return (int)cache->hot_keys_used;
+}
+
+/*
+ * void mmc_reset_hot_keys(mmap_cache * cache)
+ *
+ * Empty this process's hot keys sketch
+ *
+*/
+void mmc_reset_hot_keys(mmap_cache * cache) {
+  cache->hot_keys_used = 0;
+}
+
 /*
  * void mmc_reset_page_details(mmap_cache * cache)
  *
@@ -1059,17 +2494,57 @@ void mmc_get_details(
   *key_ptr = S_KeyPtr(base_det);
   *key_len = S_KeyLen(base_det);
 
-  *val_ptr = S_ValPtr(base_det);
-  *val_len = S_ValLen(base_det);
+  _mmc_split_prefix(base_det, val_ptr, val_len, modseq);
 
   *last_access = S_LastAccess(base_det);
   *expire_on = S_ExpireOn(base_det);
   *flags = S_Flags(base_det);
+}
 
-  if (*flags & FC_HASMODSEQ) {
-    memcpy(modseq, *val_ptr, FC_MODSEQ_LEN);
-    *val_ptr = PTR_ADD(*val_ptr, FC_MODSEQ_LEN);
-    *val_len -= FC_MODSEQ_LEN;
+
+/*
+ * int mmc_get_flagged(mmap_cache * cache, MU32 flag, int max, MU32 ** entries)
+ *
+ * Fill entries with up to max entries of the current page that have
+ * any of the flag bits set (eg. FC_ISDIRTY at the perl level), for
+ * mmc_get_details. Tombstones and lease markers are skipped. Returns
+ * the number found
+ *
+*/
+int mmc_get_flagged(mmap_cache * cache, MU32 flag, int max, MU32 ** entries) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+  int num = 0;
+
+  ASSERT(cache->p_cur != NOPAGE);
+
+  for (; slot_ptr != slot_end && num < max; slot_ptr++) {
+    MU32 * base_det;
+
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    if ((S_Flags(base_det) & flag) && !(S_Flags(base_det) & (FC_TOMBSTONE | FC_LEASE)))
+      entries[num++] = base_det;
+  }
+
+  return num;
+}
+
+/*
+ * void mmc_clear_flags(mmap_cache * cache, MU32 * base_det, MU32 flags)
+ *
+ * Clear flag bits of an entry in the current page (as returned by
+ * mmc_get_flagged), without changing its version
+ *
+*/
+void mmc_clear_flags(mmap_cache * cache, MU32 * base_det, MU32 flags) {
+  ASSERT(cache->p_cur != NOPAGE);
+
+  if (S_Flags(base_det) & flags) {
+    S_Flags(base_det) &= ~flags;
+    cache->p_changed = 1;
   }
 }
 
@@ -1177,6 +2652,146 @@ MU32 * _mmc_find_slot(
     return slot_ptr;
 }
 
+/*
+ * void _mmc_hot_key_touch(
+ *   mmap_cache * cache, MU32 hash_slot,
+ *   void *key_ptr, int key_len
+ * )
+ *
+ * Count an access to a key on the current page in the hot keys
+ * sketch. This is the Space-Saving algorithm: a key that's not
+ * tracked when the sketch is full takes over the counter with the
+ * smallest count, and inherits that count as its error. Any key
+ * accessed more than 1/hot_keys_size of the time is always tracked
+ *
+*/
+void _mmc_hot_key_touch(
+  mmap_cache * cache, MU32 hash_slot,
+  void *key_ptr, int key_len
+) {
+  mmap_cache_hot_key * hk = cache->hot_keys;
+  mmap_cache_hot_key * hk_end = hk + cache->hot_keys_used;
+  mmap_cache_hot_key * min_hk = hk;
+  int cmp_len = key_len > MMC_HOT_KEY_LEN ? MMC_HOT_KEY_LEN : key_len;
+
+  for (; hk != hk_end; hk++) {
+    if (hk->hash_slot == hash_slot && hk->page == cache->p_cur &&
+        hk->key_len == key_len && !memcmp(hk->key, key_ptr, cmp_len)) {
+      hk->count++;
+      return;
+    }
+    if (hk->count < min_hk->count)
+      min_hk = hk;
+  }
+
+  /* Not tracked, use a free counter, or take over the smallest */
+  if (cache->hot_keys_used < cache->hot_keys_size) {
+    hk = cache->hot_keys + cache->hot_keys_used++;
+    hk->error = 0;
+    hk->count = 1;
+  } else {
+    hk = min_hk;
+    hk->error = hk->count;
+    hk->count++;
+  }
+
+  hk->page = cache->p_cur;
+  hk->hash_slot = hash_slot;
+  hk->key_len = key_len;
+  memcpy(hk->key, key_ptr, cmp_len);
+}
+
+/*
+ * void _mmc_trace(
+ *   mmap_cache * cache, int op, MU32 hash_slot,
+ *   int key_len, int val_len, MU32 expire_on, int hit
+ * )
+ *
+ * Add a record for an operation on the current page to the trace
+ * buffer, flushing it to the trace file when full. expire_on is as
+ * passed to mmc_write
+ *
+*/
+void _mmc_trace(
+  mmap_cache * cache, int op, MU32 hash_slot,
+  int key_len, int val_len, MU32 expire_on, int hit
+) {
+  mmap_cache_trace_rec rec;
+  MU32 now = time_override ? time_override : (MU32)time(0);
+
+  /* Records buffered before a fork are the parent's to write */
+  if (cache->trace_pid != (int)getpid()) {
+    cache->trace_pid = (int)getpid();
+    cache->trace_buf_used = 0;
+  }
+
+  if (cache->trace_buf_used + sizeof(rec) > MMC_TRACE_BUFSIZE)
+    _mmc_trace_flush(cache);
+
+  /* Full hash, as mmc_hash split it into page and slot */
+  rec.time = now;
+  rec.hash = hash_slot * cache->c_num_pages + cache->p_cur;
+  rec.key_len = (MU32)key_len;
+  rec.val_len = (MU32)val_len;
+  if (expire_on == (MU32)-1)
+    rec.expire_in = cache->expire_time;
+  else
+    rec.expire_in = expire_on > now ? expire_on - now : (expire_on ? 1 : 0);
+  rec.magic = MMC_TRACE_MAGIC;
+  rec.op = (uint8_t)op;
+  rec.hit = hit ? 1 : 0;
+  rec.pad = 0;
+
+  memcpy(cache->trace_buf + cache->trace_buf_used, &rec, sizeof(rec));
+  cache->trace_buf_used += sizeof(rec);
+}
+
+/*
+ * int _mmc_trace_open(mmap_cache * cache, char * trace_file)
+ *
+ * Open the trace file for appending unbuffered, as records are
+ * buffered here and appended in whole writes
+ *
+*/
+int _mmc_trace_open(mmap_cache * cache, char * trace_file) {
+  cache->trace_fh = fopen(trace_file, "ab");
+  if (!cache->trace_fh)
+    return _mmc_set_error(cache, errno, "Open of trace file %s failed", trace_file);
+  setvbuf(cache->trace_fh, NULL, _IONBF, 0);
+  cache->trace_buf = (char *)malloc(MMC_TRACE_BUFSIZE);
+  if (!cache->trace_buf) {
+    int err = errno;
+    fclose(cache->trace_fh);
+    cache->trace_fh = NULL;
+    return _mmc_set_error(cache, err, "Malloc of trace buffer failed");
+  }
+  cache->trace_buf_used = 0;
+  cache->trace_pid = (int)getpid();
+
+  return 0;
+}
+
+/*
+ * int _mmc_trace_flush(mmap_cache * cache)
+ *
+ * Append any buffered trace records to the trace file in one write
+ *
+*/
+int _mmc_trace_flush(mmap_cache * cache) {
+  int res = 0;
+
+  if (cache->trace_pid != (int)getpid())
+    cache->trace_buf_used = 0;
+
+  if (cache->trace_buf_used) {
+    if (fwrite(cache->trace_buf, cache->trace_buf_used, 1, cache->trace_fh) != 1)
+      res = _mmc_set_error(cache, errno, "Write to trace file failed");
+    cache->trace_buf_used = 0;
+  }
+
+  return res;
+}
+
 /*
  * void _mmc_init_page(mmap_cache * cache, int page)
  *
@@ -1205,6 +2820,22 @@ void _mmc_init_page(mmap_cache * cache, MU32 p_cur) {
 
 }
 
+/*
+ * void _mmc_init_meta(mmap_cache * cache)
+ *
+ * Initialise the meta region as empty. It's expected
+ *  that you've already locked it before doing this
+ *
+*/
+void _mmc_init_meta(mmap_cache * cache) {
+  void * m_ptr = cache->mm_meta;
+
+  memset(m_ptr, 0, M_SIZE);
+
+  M_Magic(m_ptr) = M_MAGIC;
+  M_Version(m_ptr) = M_VERSION;
+}
+
 /*
  * int _mmc_test_page(mmap_cache * cache)
  *
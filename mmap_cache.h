@@ -103,10 +103,11 @@
  * 
  * - FreeBytes (4 bytes) - Bytes left in free data area
  * 
- * - N Reads (4 bytes) - Number of reads performed on this page
+ * - N Reads (4 bytes) - Unused. Was number of reads performed on this
+ *   page, statistics are now kept in the meta region
  *
- * - N Read Hits (4 bytes) - Number of reads on this page that have hit
- *   something in the cache
+ * - N Read Hits (4 bytes) - Unused. Was number of reads on this page
+ *   that have hit something in the cache
  * 
  * - Slots (4 bytes * NumSlots) - Hash slots
  *
@@ -139,6 +140,12 @@
  * 
  * - Value (ValueLen bytes) - Value data
  * 
+ * After the pages is a meta region, holding statistics counters and
+ * latency histograms (see mmap_cache_internals.h for the layout).
+ * Statistics are kept there in per-process slots rather than in the
+ * page headers, so counting a read doesn't write to the page, and
+ * they can be summed without locking any pages.
+ *
  * Each set/get/delete operation involves:
  * 
  * - Find the page for the key
@@ -172,6 +179,9 @@
  * 
 */
 
+#ifndef mmap_cache_h
+#define mmap_cache_h
+
 #include <stdint.h>
 
 /* Main cache structure passed as a pointer to each function */
@@ -180,15 +190,25 @@ typedef struct mmap_cache mmap_cache;
 /* Iterator structure for iterating over items in cache */
 typedef struct mmap_cache_it mmap_cache_it;
 
+/* Occupancy/fragmentation details of a page, see mmc_get_page_report */
+typedef struct mmap_cache_page_report mmap_cache_page_report;
+
+/* Record in an operation trace file, see trace_file param */
+typedef struct mmap_cache_trace_rec mmap_cache_trace_rec;
+
+/* Counter in the hot keys sketch, see mmc_get_hot_keys */
+typedef struct mmap_cache_hot_key mmap_cache_hot_key;
+
 /* Unsigned 32 bit integer */
 typedef uint32_t MU32;
 
 /* Unsigned 64 bit integer */
 typedef uint64_t MU64;
 
-/* Entry flag bits interpreted by the C layer. The perl level uses low
- * bits (FC_ISDIRTY = 1); the XS wrapper uses 1<<29 and up (FC_UNDEF
- * etc). These two live here because mmc_write/mmc_read interpret them.
+/* Entry flag bits interpreted by the C layer. The perl level uses bit
+ * 0 (FC_ISDIRTY = 1); the XS wrapper uses 1<<29 and up (FC_UNDEF
+ * etc). These live here because mmc_write/mmc_read or the value codecs
+ * interpret them.
  *
  * FC_TOMBSTONE: entry is a tombstone - a miss that remembers the
  * modseq of the change that invalidated the key, so stores of older
@@ -199,6 +219,137 @@ typedef uint64_t MU64;
 #define FC_HASMODSEQ (1<<27)
 #define FC_MODSEQ_LEN ((int)sizeof(MU64))
 
+/* FC_LEASE: entry is a lease marker, a miss that tells other readers
+ * someone is already fetching the value, see mmc_lease. It keeps any
+ * expired value it replaced, to serve stale meanwhile */
+#define FC_LEASE (1<<22)
+
+/* FC_HASSTALE: the stored value bytes (after any modseq) start with
+ * the entry's 4 byte hard expiry time. The entry can be read stale
+ * from its expiry till then, see mmc_write_stale */
+#define FC_HASSTALE (1<<21)
+#define FC_STALE_LEN ((int)sizeof(MU32))
+
+/* FC_INTEGER: the value is a native 64 bit integer counter, see
+ * mmc_incr */
+#define FC_INTEGER (1<<23)
+
+/* FC_HASVERSION: the stored value bytes (after any modseq and hard
+ * expiry) start with the entry's 4 byte version, changed by every
+ * write to it and checked by mmc_cas. Every write stores one, entries
+ * without it are from before versions and count as version 0. As the
+ * last prefix, it's just before the value bytes mmc_read returns, see
+ * mmc_val_version. FC_NOVERSION is passed to mmc_cas to only store if
+ * the key isn't in the cache, and is never an entry's version */
+#define FC_HASVERSION (1<<20)
+#define FC_VERSION_LEN ((int)sizeof(MU32))
+#define FC_NOVERSION ((MU32)-1)
+
+/* Length of the modseq, hard expiry and version prefix of the value
+ * bytes of an entry with flags f */
+#define FC_PREFIX_LEN(f) ((((f) & FC_HASMODSEQ) ? FC_MODSEQ_LEN : 0) + \
+  (((f) & FC_HASSTALE) ? FC_STALE_LEN : 0) + (((f) & FC_HASVERSION) ? FC_VERSION_LEN : 0))
+
+/* FC_CODEC_MASK: codec the stored value bytes are encoded with
+ * (MMC_CODEC_* << FC_CODEC_SHIFT), 0 for plain. See codec.c */
+#define FC_CODEC_SHIFT 24
+#define FC_CODEC_MASK (7<<FC_CODEC_SHIFT)
+
+#define MMC_CODEC_NONE     0
+#define MMC_CODEC_LZ4      1
+#define MMC_CODEC_LZ4_DICT 2
+
+/* Largest compression dictionary, see mmc_set_dict */
+#define MMC_DICT_MAX 32768
+
+/* Worst case LZ4 compressed size of n bytes */
+#define MMC_LZ4_BOUND(n) ((n) + (n) / 255 + 16)
+
+struct mmap_cache_page_report {
+  /* From the page header */
+  uint32_t num_slots;
+  uint32_t used_slots;
+  uint32_t old_slots;
+  uint32_t free_bytes;
+  uint32_t data_bytes;
+
+  /* From walking the entries (only if have_entries is set) */
+  int      have_entries;
+  uint32_t live_bytes;
+  uint32_t dead_bytes;
+  uint32_t expired_slots;
+  uint32_t total_probe;
+  uint32_t oldest_access;
+  uint32_t newest_access;
+};
+
+/* Keys longer than this are tracked in the hot keys sketch by their
+ * first MMC_HOT_KEY_LEN bytes, plus hash and length */
+#define MMC_HOT_KEY_LEN 128
+#define MMC_HOT_KEYS_MAX 4096
+
+struct mmap_cache_hot_key {
+  uint32_t page;
+  uint32_t hash_slot;
+  uint64_t count;
+  uint64_t error;
+  int      key_len;
+  char     key[MMC_HOT_KEY_LEN];
+};
+
+/* Operation trace records. With the trace_file param set, each
+ * mmc_read/mmc_write/mmc_delete appends one of these (in native byte
+ * order) to the trace file. Records are buffered per process and
+ * appended MMC_TRACE_BUFSIZE at a time, so several processes can
+ * share a trace file. The key is only recorded as its hash (as used
+ * by mmc_hash) and length. expire_in is the seconds the written
+ * entry expires in (0 for never). hit is 1 if the read found the
+ * key, the write stored it, or the delete deleted it */
+#define MMC_TRACE_MAGIC  0xfc
+#define MMC_TRACE_READ   1
+#define MMC_TRACE_WRITE  2
+#define MMC_TRACE_DELETE 3
+
+#define MMC_TRACE_BUFSIZE (24 * 256)
+
+struct mmap_cache_trace_rec {
+  uint32_t time;
+  uint32_t hash;
+  uint32_t key_len;
+  uint32_t val_len;
+  uint32_t expire_in;
+  uint8_t  magic;
+  uint8_t  op;
+  uint8_t  hit;
+  uint8_t  pad;
+};
+
+/* Statistics counters, indexes into the array filled by mmc_get_stats */
+#define MMC_STAT_READS         0
+#define MMC_STAT_READ_HITS     1
+#define MMC_STAT_WRITES        2
+#define MMC_STAT_REFUSED       3
+#define MMC_STAT_DELETES       4
+#define MMC_STAT_EVICTIONS     5
+#define MMC_STAT_EXPIRATIONS   6
+#define MMC_STAT_EXPUNGE_RUNS  7
+#define MMC_STAT_BYTES_EVICTED 8
+#define MMC_STAT_COUNT         9
+
+/* Latency histograms, op indexes for mmc_get_latency. Latencies are
+ * in nanoseconds, bucketed with 8 linear sub-buckets per power of 2
+ * (exact below 16ns, max ~68s), so values are within 12.5% */
+#define MMC_LAT_LOCK           0
+#define MMC_LAT_READ           1
+#define MMC_LAT_WRITE          2
+#define MMC_LAT_EXPUNGE        3
+#define MMC_LAT_GET            4
+#define MMC_LAT_SET            5
+#define MMC_LAT_COUNT          6
+
+#define MMC_LAT_MAX_MSB        35
+#define MMC_LAT_BUCKETS        (16 + (MMC_LAT_MAX_MSB - 3) * 8)
+
 /* Magic value for no p_cur */
 #define NOPAGE (~(MU32)0)
 
@@ -212,17 +363,28 @@ int mmc_set_param(mmap_cache *, char *, char *);
 int mmc_get_param(mmap_cache *, char *);
 int mmc_close(mmap_cache *);
 char * mmc_error(mmap_cache *);
+mmap_cache * mmc_clone(mmap_cache *);
 
 /* Functions for find/locking a page */
 int mmc_hash(mmap_cache *, void *, int, MU32 *, MU32 *);
 int mmc_lock(mmap_cache *, MU32);
 int mmc_unlock(mmap_cache *);
 int mmc_is_locked(mmap_cache *);
+int mmc_snapshot_page(mmap_cache *, MU32, void *, int);
 
 /* Functions for getting/setting/deleting values in current page */
 int mmc_read(mmap_cache *, MU32, void *, int, void **, int *, MU32 *, MU32 *, MU64 *);
+int mmc_read_stale(mmap_cache *, MU32, void *, int, void **, int *, MU32 *, MU32 *, MU64 *);
 int mmc_write(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32, MU64);
+int mmc_write_stale(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32, MU64, MU32);
 int mmc_delete(mmap_cache *, MU32, void *, int, MU32 *);
+int mmc_incr(mmap_cache *, MU32, void *, int, int64_t, int64_t, MU32, MU32, int64_t *);
+int mmc_cas(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32, MU64, MU32);
+int mmc_append(mmap_cache *, MU32, void *, int, void *, int, int, MU32, MU32, MU32, MU32);
+int mmc_peek_flags(mmap_cache *, MU32, void *, int, MU32 *);
+int mmc_lease(mmap_cache *, MU32, void *, int, MU32, MU32, void **, int *, MU32 *, MU64 *, MU32 *);
+int mmc_release_lease(mmap_cache *, MU32, void *, int, MU32);
+MU32 mmc_val_version(MU32, void *);
 
 /* Functions of expunging values in current page */
 int mmc_calc_expunge(mmap_cache *, int, int, MU32 *, MU32 ***);
@@ -235,19 +397,59 @@ void mmc_iterate_close(mmap_cache_it *);
 
 /* Retrieve details of a cache page/entry */
 void mmc_get_details(mmap_cache *, MU32 *, void **, int *, void **, int *, MU32 *, MU32 *, MU32 *, MU64 *);
+int mmc_get_flagged(mmap_cache * cache, MU32 flag, int max, MU32 ** entries);
+void mmc_clear_flags(mmap_cache * cache, MU32 * base_det, MU32 flags);
 void mmc_get_page_details(mmap_cache * cache, MU32 * nreads, MU32 * nreadhits);
 void mmc_reset_page_details(mmap_cache * cache);
+MU64 mmc_get_dirty_count(mmap_cache * cache, int clear);
+void mmc_get_stats(mmap_cache * cache, MU64 * counts, int clear);
+void mmc_get_page_report(mmap_cache * cache, mmap_cache_page_report * report);
+int mmc_get_page_header_report(mmap_cache * cache, MU32 p_num, mmap_cache_page_report * report);
+int mmc_get_hot_keys(mmap_cache * cache, mmap_cache_hot_key ** keys);
+MU64 mmc_get_latency(mmap_cache * cache, int op, MU64 * buckets, int clear);
+MU64 mmc_latency_percentile(MU64 * buckets, MU64 count, double pct);
+
+/* Value codecs */
+int mmc_encode_value(mmap_cache * cache, void * val, int val_len, void ** enc_ptr, int * enc_len, MU32 * flags);
+int mmc_decoded_len(void * val, int val_len, MU32 flags);
+int mmc_decode_value(mmap_cache * cache, void * val, int val_len, MU32 flags, void * out, int out_len);
+int mmc_lz4_compress(const void * src, int src_len, void * dst, int dst_cap);
+int mmc_lz4_decompress(const void * src, int src_len, void * dst, int dst_len);
+MU64 mmc_set_dict(mmap_cache * cache, void * dict, int dict_len);
+MU64 mmc_get_dict(mmap_cache * cache, void ** dict, int * dict_len);
+int mmc_train_dict(const void * samples, const MU32 * sample_lens, int n_samples, void * dict, int dict_cap);
+
+/* Time an operation into a latency histogram, start is 0 (and end a
+ * no-op) if latency_stats isn't enabled */
+MU64 mmc_latency_start(mmap_cache * cache);
+void mmc_latency_end(mmap_cache * cache, int op, MU64 start);
+void mmc_reset_hot_keys(mmap_cache * cache);
 
 /* Internal functions */
 int _mmc_set_error(mmap_cache *, int, char *, ...);
+int _mmc_read(mmap_cache *, MU32, void *, int, void **, int *, MU32 *, MU32 *, MU64 *, int);
+int _mmc_read_timed(mmap_cache *, MU32, void *, int, void **, int *, MU32 *, MU32 *, MU64 *, int);
+int _mmc_write(mmap_cache *, MU32, void *, int, void *, int, MU32, MU32, MU64, MU32);
+int _mmc_delete(mmap_cache *, MU32, void *, int, MU32 *);
+int _mmc_parse_int(void *, int, int64_t *);
 void _mmc_init_page(mmap_cache *, MU32);
 
 MU32 * _mmc_find_slot(mmap_cache * , MU32 , void *, int, int );
 void _mmc_delete_slot(mmap_cache * , MU32 *);
+void _mmc_store_entry(mmap_cache *, MU32 *, MU32, void *, int, void *, int, MU32, MU32, MU32, MU64, MU32);
+MU32 _mmc_next_version(mmap_cache *, MU32 *);
+MU32 _mmc_version(MU32 *);
+MU32 _mmc_hard_expire_on(MU32 *);
+void _mmc_split_prefix(MU32 *, void **, int *, MU64 *);
 
 int _mmc_check_expunge(mmap_cache * , int);
 
+void _mmc_hot_key_touch(mmap_cache *, MU32, void *, int);
+void _mmc_trace(mmap_cache *, int, MU32, int, int, MU32, int);
+int _mmc_trace_open(mmap_cache *, char *);
+int _mmc_trace_flush(mmap_cache *);
+
 int  _mmc_test_page(mmap_cache *);
 int  _mmc_dump_page(mmap_cache *);
 
-
+#endif
@@ -0,0 +1,442 @@
+
+/*
+ * mmap_cache_bench
+ *
+ * Multi-process benchmark of the mmap_cache C layer. Forks a number
+ * of workers that run a mix of get/set/delete operations against one
+ * cache file, and reports throughput, hit rate, expunge counts and
+ * latency percentiles (from the cache's own stats and latency
+ * histograms, so summed over all the workers).
+ *
+ * Build and run with "make bench", passing options in BENCH_ARGS, eg:
+ *
+ *   make bench BENCH_ARGS="-w 8 -d zipf -m 90:9:1 -V 100~10000"
+ *
+ * Options:
+ *
+ *   -w workers       Number of worker processes (default 4)
+ *   -n ops           Operations per worker (default 200000)
+ *   -k keys          Number of distinct keys (default 100000)
+ *   -d dist          Key distribution, uniform or zipf (default zipf)
+ *   -s theta         Zipf skew (default 0.99)
+ *   -m R:W:D         Read/write/delete mix percentages (default 90:9:1)
+ *   -K size          Key size in bytes (default 16-32)
+ *   -V size          Value size in bytes (default 64-1024)
+ *   -p page_size     Cache page size (default 65536)
+ *   -P num_pages     Cache number of pages (default 89)
+ *   -S start_slots   Cache start slots per page (default 89)
+ *   -e expire_time   Cache expire time in seconds (default 0)
+ *   -f share_file    Cache file (default a temporary file, removed after)
+ *   -F               Don't prefill the cache with every key first
+ *
+ * Sizes are N for a fixed size, A-B for uniformly distributed between
+ * A and B, or A~B for log-uniform between A and B (mostly small, with
+ * a long tail of big ones). Each key always has the same size.
+ *
+ * Zipf keys are scrambled over the key space, so the hot keys are
+ * spread over the pages rather than all being the lowest numbered
+ *
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "mmap_cache.h"
+
+/* Benchmark settings */
+typedef struct bench_opts {
+  int    workers;
+  long   ops;
+  MU32   keys;
+  int    zipf;
+  double theta;
+  int    read_pct;
+  int    write_pct;
+  int    delete_pct;
+  int    key_min, key_max, key_log;
+  int    val_min, val_max, val_log;
+  char * page_size;
+  char * num_pages;
+  char * start_slots;
+  char * expire_time;
+  char * share_file;
+  int    prefill;
+} bench_opts;
+
+/* Zipf generator state (Gray et al, "Quickly Generating
+ * Billion-Record Synthetic Databases", as used by YCSB) */
+typedef struct zipf_gen {
+  MU32   n;
+  double theta;
+  double alpha;
+  double zetan;
+  double eta;
+} zipf_gen;
+
+static char key_buf[65536];
+static char val_buf[1024*1024];
+
+double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void zipf_init(zipf_gen * z, MU32 n, double theta) {
+  double zeta2 = 1.0 + pow(0.5, theta);
+  MU32 i;
+
+  z->n = n;
+  z->theta = theta;
+  z->zetan = 0;
+  for (i = 1; i <= n; i++)
+    z->zetan += 1.0 / pow((double)i, theta);
+
+  z->alpha = 1.0 / (1.0 - theta);
+  z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+MU32 zipf_next(zipf_gen * z) {
+  double u = drand48();
+  double uz = u * z->zetan;
+  MU32 rank;
+
+  if (uz < 1.0)
+    return 0;
+  if (uz < 1.0 + pow(0.5, z->theta))
+    return 1;
+
+  rank = (MU32)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+  return rank >= z->n ? z->n - 1 : rank;
+}
+
+/*
+ * int parse_size(char * arg, int * min, int * max, int * log_dist)
+ *
+ * Parse a N, A-B or A~B size argument. Returns -1 if bad
+ *
+*/
+int parse_size(char * arg, int * min, int * max, int * log_dist) {
+  char sep = 0;
+
+  *log_dist = 0;
+  if (sscanf(arg, "%d%c%d", min, &sep, max) == 3 && (sep == '-' || sep == '~')) {
+    *log_dist = sep == '~';
+  } else if (sscanf(arg, "%d", min) == 1) {
+    *max = *min;
+  } else {
+    return -1;
+  }
+
+  return *min >= 0 && *max >= *min && *max <= (int)sizeof(val_buf) ? 0 : -1;
+}
+
+/* Pick a size from a distribution given a uniform random 0 - 1 */
+int pick_size(int min, int max, int log_dist, double u) {
+  if (min == max)
+    return min;
+  if (log_dist)
+    return (int)exp(log(min + 1.0) + u * (log(max + 1.0) - log(min + 1.0))) - 1;
+  return min + (int)(u * (max - min + 1));
+}
+
+/*
+ * int make_key(bench_opts * opts, MU32 key_num)
+ *
+ * Build the key for key number key_num in key_buf and return its
+ * length. The size comes from a hash of the key number, so a key
+ * is always the same
+ *
+*/
+int make_key(bench_opts * opts, MU32 key_num) {
+  MU32 h = key_num * 2654435761u;
+  int key_len = pick_size(opts->key_min, opts->key_max, opts->key_log, (h >> 8) / 16777216.0);
+  int len = snprintf(key_buf, sizeof(key_buf), "%u:", key_num);
+
+  if (key_len < len)
+    return len;
+  memset(key_buf + len, 'k', key_len - len);
+  return key_len;
+}
+
+/* Pick a key number from the configured distribution */
+MU32 pick_key(bench_opts * opts, zipf_gen * z) {
+  if (!opts->zipf)
+    return (MU32)(drand48() * opts->keys) % opts->keys;
+
+  /* Scramble the rank so the hot keys aren't all adjacent */
+  return (MU32)((MU64)zipf_next(z) * 2654435761u % opts->keys);
+}
+
+int bench_get(mmap_cache * cache, void * key_ptr, int key_len) {
+  MU32 hash_page, hash_slot, expire_on, flags;
+  MU64 modseq = 0, lat_start = mmc_latency_start(cache);
+  void * val_ptr;
+  int val_len, found;
+
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  mmc_lock(cache, hash_page);
+
+  found = mmc_read(cache, hash_slot, key_ptr, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+
+  /* Touch the value, like a real user would copy it out */
+  if (found != -1 && val_len)
+    memcpy(val_buf, val_ptr, val_len);
+
+  mmc_unlock(cache);
+  mmc_latency_end(cache, MMC_LAT_GET, lat_start);
+
+  return found != -1;
+}
+
+void bench_set(mmap_cache * cache, void * key_ptr, int key_len, int val_len) {
+  MU32 hash_page, hash_slot, new_num_slots, ** to_expunge = 0;
+  MU64 lat_start = mmc_latency_start(cache);
+  int num_expunge;
+
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  mmc_lock(cache, hash_page);
+
+  num_expunge = mmc_calc_expunge(cache, 2, key_len + val_len, &new_num_slots, &to_expunge);
+  if (to_expunge)
+    mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge);
+
+  mmc_write(cache, hash_slot, key_ptr, key_len, val_buf, val_len, (MU32)-1, 0, 0);
+
+  mmc_unlock(cache);
+  mmc_latency_end(cache, MMC_LAT_SET, lat_start);
+}
+
+void bench_delete(mmap_cache * cache, void * key_ptr, int key_len) {
+  MU32 hash_page, hash_slot, flags;
+
+  mmc_hash(cache, key_ptr, key_len, &hash_page, &hash_slot);
+  mmc_lock(cache, hash_page);
+  mmc_delete(cache, hash_slot, key_ptr, key_len, &flags);
+  mmc_unlock(cache);
+}
+
+mmap_cache * bench_open(bench_opts * opts, int init) {
+  mmap_cache * cache = mmc_new();
+
+  mmc_set_param(cache, "init_file", init ? "1" : "0");
+  mmc_set_param(cache, "share_file", opts->share_file);
+  mmc_set_param(cache, "page_size", opts->page_size);
+  mmc_set_param(cache, "num_pages", opts->num_pages);
+  mmc_set_param(cache, "start_slots", opts->start_slots);
+  mmc_set_param(cache, "expire_time", opts->expire_time);
+  mmc_set_param(cache, "enable_stats", "1");
+  mmc_set_param(cache, "latency_stats", "1");
+
+  if (mmc_init(cache) != 0) {
+    fprintf(stderr, "mmc_init failed: %s\n", mmc_error(cache));
+    exit(1);
+  }
+
+  return cache;
+}
+
+/* Run one worker's share of operations */
+void bench_worker(bench_opts * opts, zipf_gen * z, int start_fd, int worker) {
+  mmap_cache * cache = bench_open(opts, 0);
+  char go;
+  long op;
+
+  srand48((long)getpid() ^ (long)worker << 16);
+
+  /* Wait till all workers are ready */
+  if (read(start_fd, &go, 1) < 0)
+    exit(1);
+
+  for (op = 0; op < opts->ops; op++) {
+    int key_len = make_key(opts, pick_key(opts, z));
+    int pct = (int)(drand48() * 100);
+
+    if (pct < opts->read_pct) {
+      bench_get(cache, key_buf, key_len);
+    } else if (pct < opts->read_pct + opts->write_pct) {
+      bench_set(cache, key_buf, key_len, pick_size(opts->val_min, opts->val_max, opts->val_log, drand48()));
+    } else {
+      bench_delete(cache, key_buf, key_len);
+    }
+  }
+
+  mmc_close(cache);
+  exit(0);
+}
+
+void report_latency(mmap_cache * cache, char * name, int op) {
+  MU64 buckets[MMC_LAT_BUCKETS];
+  MU64 count = mmc_get_latency(cache, op, buckets, 0);
+
+  printf("  %-10s %10llu %9.2f %9.2f %9.2f %9.2f\n", name, (unsigned long long)count,
+    mmc_latency_percentile(buckets, count, 0.5) / 1000.0,
+    mmc_latency_percentile(buckets, count, 0.99) / 1000.0,
+    mmc_latency_percentile(buckets, count, 0.999) / 1000.0,
+    mmc_latency_percentile(buckets, count, 1.0) / 1000.0);
+}
+
+void usage(char * prog) {
+  fprintf(stderr, "Usage: %s [-w workers] [-n ops] [-k keys] [-d uniform|zipf] [-s theta]\n"
+    "  [-m read:write:delete] [-K key_size] [-V value_size] [-p page_size]\n"
+    "  [-P num_pages] [-S start_slots] [-e expire_time] [-f share_file] [-F]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  bench_opts opts;
+  zipf_gen z;
+  mmap_cache * cache;
+  MU64 counts[MMC_STAT_COUNT];
+  char tmp_file[64];
+  int start_pipe[2], i, c, status, failed = 0;
+  double start, elapsed;
+  MU32 key_num;
+
+  opts.workers = 4;
+  opts.ops = 200000;
+  opts.keys = 100000;
+  opts.zipf = 1;
+  opts.theta = 0.99;
+  opts.read_pct = 90; opts.write_pct = 9; opts.delete_pct = 1;
+  opts.key_min = 16; opts.key_max = 32; opts.key_log = 0;
+  opts.val_min = 64; opts.val_max = 1024; opts.val_log = 0;
+  opts.page_size = "65536";
+  opts.num_pages = "89";
+  opts.start_slots = "89";
+  opts.expire_time = "0";
+  opts.share_file = 0;
+  opts.prefill = 1;
+
+  while ((c = getopt(argc, argv, "w:n:k:d:s:m:K:V:p:P:S:e:f:F")) != -1) {
+    switch (c) {
+      case 'w': opts.workers = atoi(optarg); break;
+      case 'n': opts.ops = atol(optarg); break;
+      case 'k': opts.keys = (MU32)atol(optarg); break;
+      case 'd':
+        if (!strcmp(optarg, "zipf")) opts.zipf = 1;
+        else if (!strcmp(optarg, "uniform")) opts.zipf = 0;
+        else usage(argv[0]);
+        break;
+      case 's': opts.theta = atof(optarg); break;
+      case 'm':
+        if (sscanf(optarg, "%d:%d:%d", &opts.read_pct, &opts.write_pct, &opts.delete_pct) != 3
+            || opts.read_pct + opts.write_pct + opts.delete_pct != 100)
+          usage(argv[0]);
+        break;
+      case 'K':
+        if (parse_size(optarg, &opts.key_min, &opts.key_max, &opts.key_log)) usage(argv[0]);
+        break;
+      case 'V':
+        if (parse_size(optarg, &opts.val_min, &opts.val_max, &opts.val_log)) usage(argv[0]);
+        break;
+      case 'p': opts.page_size = optarg; break;
+      case 'P': opts.num_pages = optarg; break;
+      case 'S': opts.start_slots = optarg; break;
+      case 'e': opts.expire_time = optarg; break;
+      case 'f': opts.share_file = optarg; break;
+      case 'F': opts.prefill = 0; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (opts.workers < 1 || opts.ops < 1 || opts.keys < 1 || opts.key_max > (int)sizeof(key_buf)
+      || (opts.zipf && (opts.theta <= 0 || opts.theta == 1.0)))
+    usage(argv[0]);
+
+  if (!opts.share_file) {
+    snprintf(tmp_file, sizeof(tmp_file), "/tmp/mmap_cache_bench-%d", (int)getpid());
+    opts.share_file = tmp_file;
+  }
+
+  if (opts.zipf)
+    zipf_init(&z, opts.keys, opts.theta);
+
+  /* Create the cache, and fill it so reads start off hitting */
+  cache = bench_open(&opts, 1);
+  srand48((long)getpid());
+  if (opts.prefill) {
+    for (key_num = 0; key_num < opts.keys; key_num++) {
+      int key_len = make_key(&opts, key_num);
+      bench_set(cache, key_buf, key_len, pick_size(opts.val_min, opts.val_max, opts.val_log, drand48()));
+    }
+  }
+
+  /* Only measure the workers */
+  mmc_get_stats(cache, counts, 1);
+  for (i = 0; i < MMC_LAT_COUNT; i++) {
+    MU64 buckets[MMC_LAT_BUCKETS];
+    mmc_get_latency(cache, i, buckets, 1);
+  }
+
+  if (pipe(start_pipe) != 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  for (i = 0; i < opts.workers; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0) {
+      close(start_pipe[1]);
+      bench_worker(&opts, &z, start_pipe[0], i);
+    }
+  }
+
+  /* Closing the pipe starts the workers */
+  close(start_pipe[0]);
+  start = bench_now();
+  close(start_pipe[1]);
+
+  while (wait(&status) > 0) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+  }
+  elapsed = bench_now() - start;
+
+  mmc_get_stats(cache, counts, 0);
+
+  printf("mmap_cache_bench: page_size %s, num_pages %s, start_slots %s\n",
+    opts.page_size, opts.num_pages, opts.start_slots);
+  printf("  %d workers x %ld ops, %u keys (%s", opts.workers, opts.ops, opts.keys,
+    opts.zipf ? "zipf" : "uniform");
+  if (opts.zipf)
+    printf(" %.2f", opts.theta);
+  printf("), mix %d:%d:%d, key size %d-%d, value size %d%c%d\n",
+    opts.read_pct, opts.write_pct, opts.delete_pct, opts.key_min, opts.key_max,
+    opts.val_min, opts.val_log ? '~' : '-', opts.val_max);
+  if (failed)
+    printf("  %d workers FAILED\n", failed);
+
+  printf("\n");
+  printf("  throughput %.0f ops/s (%.3fs)\n", opts.workers * opts.ops / elapsed, elapsed);
+  printf("  reads %llu, hit rate %.2f%%\n", (unsigned long long)counts[MMC_STAT_READS],
+    counts[MMC_STAT_READS] ? 100.0 * counts[MMC_STAT_READ_HITS] / counts[MMC_STAT_READS] : 0);
+  printf("  writes %llu, deletes %llu\n",
+    (unsigned long long)counts[MMC_STAT_WRITES], (unsigned long long)counts[MMC_STAT_DELETES]);
+  printf("  expunge runs %llu, evictions %llu, expirations %llu, bytes evicted %llu\n",
+    (unsigned long long)counts[MMC_STAT_EXPUNGE_RUNS], (unsigned long long)counts[MMC_STAT_EVICTIONS],
+    (unsigned long long)counts[MMC_STAT_EXPIRATIONS], (unsigned long long)counts[MMC_STAT_BYTES_EVICTED]);
+
+  printf("\n");
+  printf("  %-10s %10s %9s %9s %9s %9s\n", "latency us", "count", "p50", "p99", "p999", "max");
+  report_latency(cache, "lock_wait", MMC_LAT_LOCK);
+  report_latency(cache, "read", MMC_LAT_READ);
+  report_latency(cache, "write", MMC_LAT_WRITE);
+  report_latency(cache, "expunge", MMC_LAT_EXPUNGE);
+  report_latency(cache, "get", MMC_LAT_GET);
+  report_latency(cache, "set", MMC_LAT_SET);
+
+  mmc_close(cache);
+  if (opts.share_file == tmp_file)
+    unlink(tmp_file);
+
+  return failed ? 1 : 0;
+}
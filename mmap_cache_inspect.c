@@ -0,0 +1,378 @@
+
+/*
+ * mmap_cache_inspect
+ *
+ * Looks inside a live cache file without changing it: per page slot
+ * and data area usage, deleted slots, entry expiry times, the largest
+ * entries, and an integrity check (_mmc_test_page) of each page.
+ *
+ * Usage:
+ *
+ *   mmap_cache_inspect [-p page_size] [-P num_pages] [-n] [-r retries]
+ *     [-j] [-q] [-l largest] share_file
+ *
+ *   -p, -P   Page size and number of pages. If not given, they're
+ *            worked out from the file size and page start markers
+ *   -n       Don't lock pages, copy each one and check the copy is
+ *            consistent instead, retrying up to -r times (default 10)
+ *   -j       Output JSON rather than tables
+ *   -q       Don't show each page, just the totals
+ *   -l N     Show the N largest entries (default 10)
+ *
+ * By default each page is locked (like a normal cache access) just
+ * while it's examined. The file is opened with the open_existing
+ * param, so it's never recreated or initialised, and nothing is
+ * written to it.
+ *
+ * Build with "make mmap_cache_inspect"
+ *
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "mmap_cache.h"
+#include "mmap_cache_internals.h"
+
+/* Expiry time buckets */
+#define EXP_NEVER   0
+#define EXP_EXPIRED 1
+#define EXP_MINUTE  2
+#define EXP_HOUR    3
+#define EXP_DAY     4
+#define EXP_LATER   5
+#define EXP_COUNT   6
+
+static char * exp_names[EXP_COUNT] = { "never", "expired", "lt_1m", "lt_1h", "lt_1d", "ge_1d" };
+
+/* One of the largest entries seen */
+typedef struct big_entry {
+  MU32 page;
+  MU32 kvlen;
+  MU32 key_len;
+  MU32 val_len;
+  MU32 last_access;
+  MU32 expire_on;
+  char key[64];
+} big_entry;
+
+typedef struct inspect_opts {
+  int lock_free;
+  int retries;
+  int json;
+  int quiet;
+  int n_largest;
+} inspect_opts;
+
+static big_entry * largest;
+static int n_largest_used = 0;
+static MU64 exp_counts[EXP_COUNT];
+
+/*
+ * int guess_geometry(char * share_file, MU32 * num_pages, MU32 * page_size)
+ *
+ * Work out the page size and number of pages of a cache file. The
+ * pages fill the file up to the meta region, and each starts with
+ * the page magic. The most pages that fit that is the answer (fewer
+ * bigger pages would also "fit", as they start at the same places)
+ *
+*/
+int guess_geometry(char * share_file, MU32 * num_pages, MU32 * page_size) {
+  struct stat statbuf;
+  MU64 data_size;
+  MU32 n, p;
+  int fh = open(share_file, O_RDONLY);
+
+  if (fh == -1 || fstat(fh, &statbuf) != 0) {
+    perror(share_file);
+    return -1;
+  }
+  if ((MU64)statbuf.st_size <= M_SIZE) {
+    fprintf(stderr, "%s: too small to be a cache file\n", share_file);
+    close(fh);
+    return -1;
+  }
+  data_size = (MU64)statbuf.st_size - M_SIZE;
+
+  for (n = (MU32)(data_size / 1024); n >= 1; n--) {
+    MU64 size = data_size / n;
+    if (data_size % n)
+      continue;
+
+    for (p = 0; p < n; p++) {
+      MU32 magic = 0;
+      if (pread(fh, &magic, sizeof(magic), (off_t)(p * size)) != sizeof(magic) || magic != 0x92f7e3b1)
+        break;
+    }
+    if (p == n) {
+      *num_pages = n;
+      *page_size = (MU32)size;
+      close(fh);
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "%s: couldn't work out page size, pass -p and -P\n", share_file);
+  close(fh);
+  return -1;
+}
+
+/* Print a string as a JSON string, or with non printables escaped */
+void print_str(char * str, int len, int json) {
+  int i;
+
+  if (json) putchar('"');
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)str[i];
+    if (json && (c == '"' || c == '\\'))
+      printf("\\%c", c);
+    else if (c < 32 || c >= 127)
+      printf(json ? "\\u%04x" : "\\x%02x", c);
+    else
+      putchar(c);
+  }
+  if (json) putchar('"');
+}
+
+/*
+ * void walk_entries(mmap_cache * cache, MU32 now, int n_largest)
+ *
+ * Add the current page's entries to the expiry distribution and the
+ * list of largest entries
+ *
+*/
+void walk_entries(mmap_cache * cache, MU32 now, int n_largest) {
+  MU32 * slot_ptr = cache->p_base_slots;
+  MU32 * slot_end = slot_ptr + cache->p_num_slots;
+
+  for (; slot_ptr != slot_end; slot_ptr++) {
+    MU32 * base_det;
+    MU32 expire_on, kvlen;
+    int i;
+
+    if (*slot_ptr <= 1)
+      continue;
+
+    base_det = S_Ptr(cache->p_base, *slot_ptr);
+    expire_on = _mmc_hard_expire_on(base_det);
+
+    if (!expire_on)
+      exp_counts[EXP_NEVER]++;
+    else if (expire_on <= now)
+      exp_counts[EXP_EXPIRED]++;
+    else if (expire_on - now < 60)
+      exp_counts[EXP_MINUTE]++;
+    else if (expire_on - now < 3600)
+      exp_counts[EXP_HOUR]++;
+    else if (expire_on - now < 86400)
+      exp_counts[EXP_DAY]++;
+    else
+      exp_counts[EXP_LATER]++;
+
+    /* Insert into largest list, kept sorted biggest first */
+    kvlen = S_SlotLen(base_det);
+    if (n_largest_used == n_largest && (!n_largest || largest[n_largest-1].kvlen >= kvlen))
+      continue;
+
+    i = n_largest_used < n_largest ? n_largest_used++ : n_largest - 1;
+    for (; i > 0 && largest[i-1].kvlen < kvlen; i--)
+      largest[i] = largest[i-1];
+
+    largest[i].page = cache->p_cur;
+    largest[i].kvlen = kvlen;
+    largest[i].key_len = S_KeyLen(base_det);
+    largest[i].val_len = S_ValLen(base_det);
+    largest[i].last_access = S_LastAccess(base_det);
+    largest[i].expire_on = expire_on;
+    memcpy(largest[i].key, S_KeyPtr(base_det),
+      S_KeyLen(base_det) < sizeof(largest[i].key) ? S_KeyLen(base_det) : sizeof(largest[i].key));
+  }
+}
+
+void usage(char * prog) {
+  fprintf(stderr, "Usage: %s [-p page_size] [-P num_pages] [-n] [-r retries] [-j] [-q] [-l largest] share_file\n", prog);
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  inspect_opts opts = { 0, 10, 0, 0, 10 };
+  MU32 num_pages = 0, page_size = 0, p, now = (MU32)time(0);
+  MU64 totals[8] = { 0 };
+  MU32 bad_pages = 0, skipped_pages = 0;
+  char num_buf[2][32];
+  char * share_file;
+  void * page_buf;
+  mmap_cache * cache;
+  int c, i, first = 1;
+
+  while ((c = getopt(argc, argv, "p:P:nr:jql:")) != -1) {
+    switch (c) {
+      case 'p': page_size = (MU32)atol(optarg); break;
+      case 'P': num_pages = (MU32)atol(optarg); break;
+      case 'n': opts.lock_free = 1; break;
+      case 'r': opts.retries = atoi(optarg); break;
+      case 'j': opts.json = 1; break;
+      case 'q': opts.quiet = 1; break;
+      case 'l': opts.n_largest = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || opts.n_largest < 0 || opts.retries < 0)
+    usage(argv[0]);
+  share_file = argv[optind];
+
+  if ((!page_size || !num_pages) && guess_geometry(share_file, &num_pages, &page_size) != 0)
+    return 1;
+
+  /* Attach to the existing file, never recreating or initialising it */
+  cache = mmc_new();
+  snprintf(num_buf[0], 32, "%u", page_size);
+  snprintf(num_buf[1], 32, "%u", num_pages);
+  mmc_set_param(cache, "share_file", share_file);
+  mmc_set_param(cache, "page_size", num_buf[0]);
+  mmc_set_param(cache, "num_pages", num_buf[1]);
+  mmc_set_param(cache, "start_slots", "10");
+  mmc_set_param(cache, "open_existing", "1");
+  if (mmc_init(cache) != 0) {
+    fprintf(stderr, "%s\n", mmc_error(cache));
+    return 1;
+  }
+
+  largest = (big_entry *)calloc(opts.n_largest + 1, sizeof(big_entry));
+  page_buf = malloc(page_size);
+
+  if (opts.json) {
+    printf("{\"share_file\":");
+    print_str(share_file, strlen(share_file), 1);
+    printf(",\"num_pages\":%u,\"page_size\":%u,\"locked\":%s,\"pages\":[",
+      num_pages, page_size, opts.lock_free ? "false" : "true");
+  } else {
+    printf("%s: %u pages of %u bytes\n\n", share_file, num_pages, page_size);
+    if (!opts.quiet)
+      printf("%6s %6s %6s %6s %7s %6s %6s %6s %7s %6s  %s\n", "page", "slots", "used", "load%",
+        "deleted", "data%", "live%", "dead%", "expired", "probe", "integrity");
+  }
+
+  for (p = 0; p < num_pages; p++) {
+    mmap_cache_page_report report;
+    int ok = 1;
+
+    if (opts.lock_free) {
+      if (mmc_snapshot_page(cache, p, page_buf, opts.retries) != 0) {
+        skipped_pages++;
+        if (!opts.quiet && !opts.json)
+          printf("%6u  %s\n", p, mmc_error(cache));
+        else if (!opts.quiet)
+          printf("%s{\"page\":%u,\"error\":\"inconsistent\"}", first ? "" : ",", p), first = 0;
+        continue;
+      }
+    } else if (mmc_lock(cache, p) != 0) {
+      /* Header checks failed */
+      bad_pages++;
+      if (!opts.quiet && !opts.json)
+        printf("%6u  BAD: %s\n", p, mmc_error(cache));
+      else if (!opts.quiet)
+        printf("%s{\"page\":%u,\"error\":\"bad header\"}", first ? "" : ",", p), first = 0;
+      continue;
+    } else {
+      ok = _mmc_test_page(cache);
+    }
+
+    /* Only walk the entries of pages that pass the integrity check */
+    if (ok) {
+      mmc_get_page_report(cache, &report);
+      walk_entries(cache, now, opts.n_largest);
+    } else {
+      mmc_get_page_header_report(cache, p, &report);
+      bad_pages++;
+    }
+    mmc_unlock(cache);
+
+    totals[0] += report.num_slots;
+    totals[1] += report.used_slots;
+    totals[2] += report.old_slots;
+    totals[3] += report.data_bytes;
+    totals[4] += report.data_bytes - report.free_bytes;
+    totals[5] += report.live_bytes;
+    totals[6] += report.dead_bytes;
+    totals[7] += report.expired_slots;
+
+    if (opts.quiet)
+      continue;
+
+    if (opts.json) {
+      printf("%s{\"page\":%u,\"num_slots\":%u,\"used_slots\":%u,\"old_slots\":%u,"
+        "\"data_bytes\":%u,\"free_bytes\":%u,\"live_bytes\":%u,\"dead_bytes\":%u,"
+        "\"expired_slots\":%u,\"avg_probe\":%.2f,\"ok\":%s}", first ? "" : ",",
+        p, report.num_slots, report.used_slots, report.old_slots, report.data_bytes,
+        report.free_bytes, report.live_bytes, report.dead_bytes, report.expired_slots,
+        report.used_slots ? (double)report.total_probe / report.used_slots : 0.0,
+        ok ? "true" : "false");
+      first = 0;
+    } else {
+      printf("%6u %6u %6u %6.1f %7u %6.1f %6.1f %6.1f %7u %6.2f  %s\n", p,
+        report.num_slots, report.used_slots, 100.0 * report.used_slots / report.num_slots,
+        report.old_slots, 100.0 * (report.data_bytes - report.free_bytes) / report.data_bytes,
+        100.0 * report.live_bytes / report.data_bytes, 100.0 * report.dead_bytes / report.data_bytes,
+        report.expired_slots, report.used_slots ? (double)report.total_probe / report.used_slots : 0.0,
+        ok ? "ok" : "BAD");
+    }
+  }
+
+  if (opts.json) {
+    printf("],\"summary\":{\"num_slots\":%llu,\"used_slots\":%llu,\"old_slots\":%llu,"
+      "\"data_bytes\":%llu,\"used_bytes\":%llu,\"live_bytes\":%llu,\"dead_bytes\":%llu,"
+      "\"expired_slots\":%llu,\"bad_pages\":%u,\"skipped_pages\":%u},\"expiry\":{",
+      (unsigned long long)totals[0], (unsigned long long)totals[1], (unsigned long long)totals[2],
+      (unsigned long long)totals[3], (unsigned long long)totals[4], (unsigned long long)totals[5],
+      (unsigned long long)totals[6], (unsigned long long)totals[7], bad_pages, skipped_pages);
+    for (i = 0; i < EXP_COUNT; i++)
+      printf("%s\"%s\":%llu", i ? "," : "", exp_names[i], (unsigned long long)exp_counts[i]);
+    printf("},\"largest\":[");
+    for (i = 0; i < n_largest_used; i++) {
+      big_entry * e = largest + i;
+      printf("%s{\"page\":%u,\"key\":", i ? "," : "", e->page);
+      print_str(e->key, e->key_len < sizeof(e->key) ? e->key_len : sizeof(e->key), 1);
+      printf(",\"key_len\":%u,\"val_len\":%u,\"last_access\":%u,\"expire_on\":%u}",
+        e->key_len, e->val_len, e->last_access, e->expire_on);
+    }
+    printf("]}\n");
+
+  } else {
+    printf("%stotal: %llu/%llu slots used (%.1f%%), %llu deleted, %llu expired\n", opts.quiet ? "" : "\n",
+      (unsigned long long)totals[1], (unsigned long long)totals[0],
+      totals[0] ? 100.0 * totals[1] / totals[0] : 0, (unsigned long long)totals[2],
+      (unsigned long long)totals[7]);
+    printf("       %llu/%llu data bytes used (%.1f%%), %llu live, %llu dead\n",
+      (unsigned long long)totals[4], (unsigned long long)totals[3],
+      totals[3] ? 100.0 * totals[4] / totals[3] : 0,
+      (unsigned long long)totals[5], (unsigned long long)totals[6]);
+    printf("       %u bad pages, %u pages skipped as inconsistent\n", bad_pages, skipped_pages);
+
+    printf("\nexpiry:");
+    for (i = 0; i < EXP_COUNT; i++)
+      printf(" %s %llu", exp_names[i], (unsigned long long)exp_counts[i]);
+    printf("\n");
+
+    if (n_largest_used) {
+      printf("\nlargest entries:\n%6s %8s %8s %12s %12s  %s\n", "page", "key_len", "val_len",
+        "last_access", "expire_on", "key");
+      for (i = 0; i < n_largest_used; i++) {
+        big_entry * e = largest + i;
+        printf("%6u %8u %8u %12u %12u  ", e->page, e->key_len, e->val_len, e->last_access, e->expire_on);
+        print_str(e->key, e->key_len < sizeof(e->key) ? e->key_len : sizeof(e->key), 0);
+        printf("%s\n", e->key_len > sizeof(e->key) ? "..." : "");
+      }
+    }
+  }
+
+  free(page_buf);
+  free(largest);
+  mmc_close(cache);
+
+  return bad_pages ? 1 : 0;
+}
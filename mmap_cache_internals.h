@@ -10,8 +10,40 @@
 
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* In process mutexes, and thread local storage for the error string */
+#ifdef WIN32
+typedef CRITICAL_SECTION mmc_mutex;
+#define MMC_MUTEX_INIT(m) InitializeCriticalSection(m)
+#define MMC_MUTEX_LOCK(m) EnterCriticalSection(m)
+#define MMC_MUTEX_UNLOCK(m) LeaveCriticalSection(m)
+#define MMC_MUTEX_DESTROY(m) DeleteCriticalSection(m)
+#define MMC_THREAD_LOCAL __declspec(thread)
+#else
+typedef pthread_mutex_t mmc_mutex;
+#define MMC_MUTEX_INIT(m) pthread_mutex_init((m), NULL)
+#define MMC_MUTEX_LOCK(m) pthread_mutex_lock(m)
+#define MMC_MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#define MMC_MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+#define MMC_THREAD_LOCAL __thread
 #endif
 
+/* The mapping shared by a cache and its clones (see mmc_clone), which
+ * each keep their own current page and buffers so each thread can
+ * use its own. File locks are per process, so they're paired with a
+ * mutex per page (and one for the meta region) so threads exclude
+ * each other too. The last handle closed unmaps the file */
+typedef struct mmap_cache_shared {
+  mmc_mutex   lock;
+  int         refcnt;
+  mmc_mutex * page_locks;
+  char *      share_file;
+  char *      trace_file;
+} mmap_cache_shared;
+
 /* Cache structure */
 struct mmap_cache {
 
@@ -30,20 +62,73 @@ struct mmap_cache {
   MU32    p_n_read_hits;
 
   int    p_changed;
+  int    p_touched;
+  int    p_snapshot;
 
   /* General page details */
   MU32    c_num_pages;
   MU32    c_page_size;
   MU64    c_size;
 
-  /* Pointer to mmapped area */
+  /* Pointer to mmapped area, and the meta region after the pages */
   void * mm_var;
+  void * mm_meta;
+
+  /* This process's stats counters and latency histograms in the
+   * meta region */
+  MU64 * c_stats;
+  MU64 * c_lat;
 
   /* Cache general details */
   MU32    start_slots;
   MU32    expire_time;
   int     catch_deadlocks;
+
+  /* Seconds after expiry that entries can still be read stale (see
+   * mmc_write_stale), and how long a reader refreshing one has before
+   * the next reader is asked to */
+  MU32    stale_time;
+  MU32    refresh_time;
   int     enable_stats;
+  MU32    lru_granularity;
+  int     latency_stats;
+
+  /* Start time of the expunge between mmc_calc_expunge and
+   * mmc_do_expunge */
+  MU64    lat_expunge_start;
+
+  /* Count of page visits that wrote to the mapping (each one dirties
+   * file pages the OS may write back to disk) */
+  MU64    c_n_dirtied;
+
+  /* This process's hot keys sketch (hot_keys_size counters, of which
+   * hot_keys_used are filled), NULL if not enabled */
+  mmap_cache_hot_key * hot_keys;
+  MU32    hot_keys_size;
+  MU32    hot_keys_used;
+
+  /* Operation trace file, and this process's buffered records
+   * (trace_pid is who they belong to, a forked child starts afresh) */
+  char * trace_file;
+  FILE * trace_fh;
+  char * trace_buf;
+  MU32   trace_buf_used;
+  int    trace_pid;
+
+  /* Value codec for stores (MMC_CODEC_*), values shorter than
+   * compress_threshold are stored plain. codec_buf holds the last
+   * encoded value */
+  int     codec;
+  MU32    compress_threshold;
+  void *  codec_buf;
+  MU32    codec_buf_size;
+
+  /* This process's copy of the current compression dictionary
+   * (generation dict_gen, 0 if none) and its LZ4 match table */
+  MU64    dict_gen;
+  MU32    dict_len;
+  char *  dict;
+  MU32 *  dict_table;
 
   /* Share mmap file details */
 #ifdef WIN32
@@ -56,7 +141,12 @@ struct mmap_cache {
   int    permissions;
   int    init_file;
   int    test_file;
+  int    open_existing;
   int    cache_not_found;
+  int    is_tmpfs;
+
+  /* Mapping shared with clones, NULL until mmc_init */
+  mmap_cache_shared * shared;
 
   /* Last error string */
   char * last_error;
@@ -84,6 +174,76 @@ struct mmap_cache_it {
 
 #define P_HEADERSIZE 32
 
+/* The meta region follows the pages. Its layout is:
+ *
+ * - Magic (4 bytes) - M_MAGIC meta region marker
+ * - Version (4 bytes) - M_VERSION layout version
+ * - (reserved up to M_HEADERSIZE)
+ * - Stats slots (M_STATS_SLOTS * M_STATS_SLOTSIZE bytes) - each slot
+ *   is MMC_STAT_COUNT 64 bit counters, padded to a multiple of the
+ *   cache line size. Processes pick a slot by pid and add to it
+ *   atomically, readers sum all slots
+ * - Latency slots (M_LAT_SLOTS * M_LAT_SLOTSIZE bytes) - each slot is
+ *   MMC_LAT_COUNT histograms of MMC_LAT_BUCKETS 64 bit counters,
+ *   picked and summed the same way as the stats slots. Fewer slots
+ *   as they're much bigger and only updated with latency_stats on
+ * - Dictionary slots (M_DICT_SLOTS * M_DICT_SLOTSIZE bytes) - each is
+ *   a generation (8 bytes, 0 while being written), length (4 bytes),
+ *   reserved (4 bytes), then up to MMC_DICT_MAX bytes of compression
+ *   dictionary. Generation g lives in slot g % M_DICT_SLOTS, so
+ *   entries compressed with the last few dictionaries still decode.
+ *   The header's M_DictGen is the current (newest) generation, 0 if
+ *   none
+ */
+#define M_MAGIC 0x92f7e3b2
+#define M_VERSION 3
+
+#define M_Magic(m) (*(PP(m)+0))
+#define M_Version(m) (*(PP(m)+1))
+#define M_DictGen(m) ((MU64 *)PTR_ADD(m, 8))
+
+#define M_HEADERSIZE 128
+#define M_STATS_SLOTS 64
+#define M_STATS_SLOTSIZE 128
+#define M_StatsSlot(m,i) ((MU64 *)PTR_ADD(m, M_HEADERSIZE + (i) * M_STATS_SLOTSIZE))
+
+#define M_LAT_OFFSET (M_HEADERSIZE + M_STATS_SLOTS * M_STATS_SLOTSIZE)
+#define M_LAT_SLOTS 4
+#define M_LAT_SLOTSIZE (MMC_LAT_COUNT * MMC_LAT_BUCKETS * 8)
+#define M_LatSlot(m,i) ((MU64 *)PTR_ADD(m, M_LAT_OFFSET + (i) * M_LAT_SLOTSIZE))
+
+#define M_DICT_OFFSET (M_LAT_OFFSET + M_LAT_SLOTS * M_LAT_SLOTSIZE)
+#define M_DICT_SLOTS 4
+#define M_DICT_SLOTSIZE (16 + MMC_DICT_MAX)
+#define M_DictSlot(m,i) PTR_ADD(m, M_DICT_OFFSET + (i) * M_DICT_SLOTSIZE)
+#define MD_Gen(d) ((MU64 *)(d))
+#define MD_Len(d) (*(PP(d)+2))
+#define MD_Data(d) PTR_ADD(d, 16)
+
+#define M_SIZE (M_DICT_OFFSET + M_DICT_SLOTS * M_DICT_SLOTSIZE)
+
+/* Relaxed atomic 64 bit counter operations for the meta region, and a
+ * full memory barrier */
+#if defined(__ATOMIC_RELAXED)
+#define MMC_ATOMIC_ADD(p,v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define MMC_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define MMC_ATOMIC_XCHG(p,v) __atomic_exchange_n((p), (v), __ATOMIC_RELAXED)
+#define MMC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+#define MMC_ATOMIC_ADD(p,v) InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(v))
+#define MMC_ATOMIC_LOAD(p) (*(volatile MU64 *)(p))
+#define MMC_ATOMIC_XCHG(p,v) InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v))
+#define MMC_FENCE() MemoryBarrier()
+#else
+#define MMC_ATOMIC_ADD(p,v) (*(p) += (v))
+#define MMC_ATOMIC_LOAD(p) (*(volatile MU64 *)(p))
+#define MMC_ATOMIC_XCHG(p,v) _mmc_xchg((p), (v))
+#define MMC_FENCE()
+static MU64 _mmc_xchg(MU64 * p, MU64 v) { MU64 o = *p; *p = v; return o; }
+#endif
+
+#define MMC_STAT_ADD(c,s,v) MMC_ATOMIC_ADD((c)->c_stats + (s), (MU64)(v))
+
 /* Macros to access cache slot entries */
 #define SP(s) ((MU32 *)s)
 
@@ -109,6 +269,11 @@ struct mmap_cache_it {
 /* Found key/val len to nearest 4 bytes */
 #define ROUNDLEN(l)     ((l) += 3 - (((l)-1) & 3))  
 
+/* Lock/unlock the page (or meta region) at p_offset against other
+ * threads and processes, defined in mmap_cache.c */
+int mmc_lock_page(mmap_cache* cache, MU64 p_offset);
+int mmc_unlock_page(mmap_cache * cache, MU64 p_offset);
+
 /* Externs from mmap_cache.c */ 
 extern char * def_share_file;
 extern MU32    def_init_file;
@@ -123,10 +288,12 @@ extern char* _mmc_get_def_share_filename(mmap_cache * cache);
 int mmc_open_cache_file(mmap_cache* cache, int * do_init);
 int mmc_map_memory(mmap_cache* cache);
 int mmc_unmap_memory(mmap_cache* cache);
-int mmc_lock_page(mmap_cache* cache, MU64 p_offset);
-int mmc_unlock_page(mmap_cache * cache, MU64 p_offset);
+int mmc_lock_file(mmap_cache* cache, MU64 p_offset);
+int mmc_unlock_file(mmap_cache * cache, MU64 p_offset);
 int mmc_check_fh(mmap_cache* cache);
+void _mmc_init_meta(mmap_cache * cache);
 int mmc_close_fh(mmap_cache* cache);
+MU64 mmc_now_ns();
 int _mmc_set_error(mmap_cache *cache, int err, char * error_string, ...);
 char* _mmc_get_def_share_filename(mmap_cache * cache);
 
@@ -0,0 +1,246 @@
+
+/*
+ * mmap_cache_replay
+ *
+ * Replays operation traces (written by caches with the trace_file
+ * param set) against scratch caches of different configurations,
+ * using the real mmap_cache code, and reports the read hit ratio and
+ * expunge cost of each. Use it to size a cache from real traffic.
+ *
+ * Build and run with "make replay", eg:
+ *
+ *   make replay TRACE=/tmp/cache.trace \
+ *     REPLAY_ARGS="-c num_pages=89,page_size=64k -c num_pages=89,page_size=256k"
+ *
+ * Usage:
+ *
+ *   mmap_cache_replay [-c config]... [-f scratch_file] trace_file...
+ *
+ * Each -c config is a comma separated list of param=value cache
+ * settings (num_pages, page_size, start_slots, expire_time,
+ * lru_granularity...), page_size may have a k or m suffix. Each
+ * config is replayed separately, with no -c the default settings
+ * are used.
+ *
+ * Keys are replayed as made up keys built from the traced key hash
+ * and length, and values as zero bytes of the traced length. Time
+ * is replayed from the trace, so entries expire as they did. Reads
+ * are replayed as reads only; a miss that the application filled in
+ * shows up in the trace as its own write.
+ *
+ * The only eviction policy mmap_cache has is LRU (entries expunged in
+ * last access order once a page is full), so the knobs to compare
+ * are page size/count, slots and lru_granularity
+ *
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "mmap_cache.h"
+
+#define MAX_CONFIGS 32
+
+static char key_buf[65536];
+static char val_buf[1024*1024*4];
+
+double replay_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * int apply_config(mmap_cache * cache, char * config)
+ *
+ * Set each param=value of a comma separated config on cache.
+ * Modifies config. Returns -1 on a bad param
+ *
+*/
+int apply_config(mmap_cache * cache, char * config) {
+  char * param = strtok(config, ",");
+  static char num_buf[MAX_CONFIGS][32];
+  static int num_buf_used = 0;
+
+  for (; param; param = strtok(NULL, ",")) {
+    char * val = strchr(param, '=');
+    size_t val_len;
+
+    if (!val) {
+      fprintf(stderr, "Bad config setting: %s\n", param);
+      return -1;
+    }
+    *val++ = 0;
+
+    /* Allow size suffixes on page_size */
+    val_len = strlen(val);
+    if (val_len && (val[val_len-1] == 'k' || val[val_len-1] == 'm') && num_buf_used < MAX_CONFIGS) {
+      long size = atol(val) * (val[val_len-1] == 'k' ? 1024 : 1024*1024);
+      snprintf(num_buf[num_buf_used], 32, "%ld", size);
+      val = num_buf[num_buf_used++];
+    }
+
+    if (mmc_set_param(cache, param, val) != 0) {
+      fprintf(stderr, "%s\n", mmc_error(cache));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * int replay_file(mmap_cache * cache, char * trace_file, MU64 * traced, double * expunge_time)
+ *
+ * Replay one trace file against cache. traced has the number of
+ * reads and read hits in the trace added, expunge_time the seconds
+ * spent expunging. Returns -1 on error
+ *
+*/
+int replay_file(mmap_cache * cache, char * trace_file, MU64 * traced, double * expunge_time) {
+  mmap_cache_trace_rec rec;
+  FILE * fh = fopen(trace_file, "rb");
+
+  if (!fh) {
+    perror(trace_file);
+    return -1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, fh) == 1) {
+    MU32 hash_page, hash_slot, flags, expire_on;
+    MU64 modseq = 0;
+    void * val_ptr;
+    int key_len, val_len;
+
+    if (rec.magic != MMC_TRACE_MAGIC) {
+      fprintf(stderr, "%s: bad trace record\n", trace_file);
+      fclose(fh);
+      return -1;
+    }
+    if (rec.key_len >= sizeof(key_buf) || rec.val_len > sizeof(val_buf))
+      continue;
+
+    mmc_set_time_override(rec.time);
+
+    /* Made up key, unique per traced hash and length */
+    key_len = snprintf(key_buf, sizeof(key_buf), "%08x", rec.hash);
+    if ((int)rec.key_len > key_len) {
+      memset(key_buf + key_len, '-', rec.key_len - key_len);
+      key_len = rec.key_len;
+    }
+
+    mmc_hash(cache, key_buf, key_len, &hash_page, &hash_slot);
+    mmc_lock(cache, hash_page);
+
+    if (rec.op == MMC_TRACE_READ) {
+      mmc_read(cache, hash_slot, key_buf, key_len, &val_ptr, &val_len, &expire_on, &flags, &modseq);
+      traced[0]++;
+      traced[1] += rec.hit;
+
+    } else if (rec.op == MMC_TRACE_WRITE) {
+      MU32 new_num_slots, ** to_expunge = 0;
+      double start = replay_now();
+      int num_expunge = mmc_calc_expunge(cache, 2, key_len + rec.val_len, &new_num_slots, &to_expunge);
+
+      if (to_expunge) {
+        mmc_do_expunge(cache, num_expunge, new_num_slots, to_expunge);
+        *expunge_time += replay_now() - start;
+      }
+
+      mmc_write(cache, hash_slot, key_buf, key_len, val_buf, rec.val_len,
+        rec.expire_in ? rec.time + rec.expire_in : 0, 0, 0);
+
+    } else if (rec.op == MMC_TRACE_DELETE) {
+      mmc_delete(cache, hash_slot, key_buf, key_len, &flags);
+    }
+
+    mmc_unlock(cache);
+  }
+
+  fclose(fh);
+  mmc_set_time_override(0);
+  return 0;
+}
+
+void usage(char * prog) {
+  fprintf(stderr, "Usage: %s [-c param=value,...]... [-f scratch_file] trace_file...\n", prog);
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  char * configs[MAX_CONFIGS];
+  char * scratch_file = 0;
+  char tmp_file[64], config_desc[256];
+  int n_configs = 0, c, i, f;
+
+  while ((c = getopt(argc, argv, "c:f:")) != -1) {
+    switch (c) {
+      case 'c':
+        if (n_configs == MAX_CONFIGS) usage(argv[0]);
+        configs[n_configs++] = optarg;
+        break;
+      case 'f': scratch_file = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc)
+    usage(argv[0]);
+  if (!n_configs)
+    configs[n_configs++] = "";
+
+  if (!scratch_file) {
+    snprintf(tmp_file, sizeof(tmp_file), "/tmp/mmap_cache_replay-%d", (int)getpid());
+    scratch_file = tmp_file;
+  }
+
+  printf("%-40s %10s %8s %8s %8s %10s %10s %10s %9s\n", "config", "reads", "hit%",
+    "traced%", "expunges", "evictions", "expired", "expunge ms", "p99 us");
+
+  for (i = 0; i < n_configs; i++) {
+    mmap_cache * cache = mmc_new();
+    MU64 counts[MMC_STAT_COUNT], traced[2] = { 0, 0 };
+    MU64 buckets[MMC_LAT_BUCKETS], n_lat;
+    double expunge_time = 0;
+    char * config = strdup(configs[i]);
+    int failed = 0;
+
+    snprintf(config_desc, sizeof(config_desc), "%s", *configs[i] ? configs[i] : "(defaults)");
+
+    mmc_set_param(cache, "init_file", "1");
+    mmc_set_param(cache, "share_file", scratch_file);
+    mmc_set_param(cache, "enable_stats", "1");
+    mmc_set_param(cache, "latency_stats", "1");
+    if (apply_config(cache, config) != 0)
+      return 1;
+    if (mmc_init(cache) != 0) {
+      fprintf(stderr, "%s: %s\n", config_desc, mmc_error(cache));
+      return 1;
+    }
+
+    for (f = optind; f < argc && !failed; f++)
+      failed = replay_file(cache, argv[f], traced, &expunge_time) != 0;
+    if (failed)
+      return 1;
+
+    mmc_get_stats(cache, counts, 0);
+    n_lat = mmc_get_latency(cache, MMC_LAT_EXPUNGE, buckets, 0);
+
+    printf("%-40s %10llu %8.2f %8.2f %8llu %10llu %10llu %10.1f %9.1f\n", config_desc,
+      (unsigned long long)counts[MMC_STAT_READS],
+      counts[MMC_STAT_READS] ? 100.0 * counts[MMC_STAT_READ_HITS] / counts[MMC_STAT_READS] : 0,
+      traced[0] ? 100.0 * traced[1] / traced[0] : 0,
+      (unsigned long long)counts[MMC_STAT_EXPUNGE_RUNS],
+      (unsigned long long)counts[MMC_STAT_EVICTIONS],
+      (unsigned long long)counts[MMC_STAT_EXPIRATIONS],
+      expunge_time * 1000,
+      mmc_latency_percentile(buckets, n_lat, 0.99) / 1000.0);
+
+    mmc_close(cache);
+    unlink(scratch_file);
+    free(config);
+  }
+
+  return 0;
+}
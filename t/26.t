@@ -0,0 +1,51 @@
+
+#########################
+
+use Test::More tests => 12;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Dirty page accounting and tmpfs detection: get_dirty_count() counts
+# page visits that wrote to the share file, on_tmpfs() reports what
+# the share file is on, and check_tmpfs => 'die' refuses a disk backed
+# share file (only where that can be detected)
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+);
+ok( defined $FC );
+
+$FC->get_dirty_count(1);
+ok( $FC->set("a", "b"), "stored" );
+is( $FC->get_dirty_count, 1, "set dirtied one page" );
+
+ok( !defined $FC->get("nope"), "miss" );
+is( $FC->get_dirty_count, 1, "miss didn't dirty a page" );
+
+is( $FC->get("a"), "b", "hit" );
+is( $FC->get_dirty_count, 1, "hit in same second didn't dirty a page" );
+Cache::FastMmap::_set_time_override(time() + 2);
+is( $FC->get("a"), "b", "hit" );
+is( $FC->get_dirty_count(1), 2, "later hit updated last access time" );
+Cache::FastMmap::_set_time_override(0);
+is( $FC->get_dirty_count, 0, "count cleared" );
+
+# A share file in the build dir, which might or might not be tmpfs
+my $DiskFile = "t/26-tmpfs-check.cache";
+my $Disk = Cache::FastMmap->new(share_file => $DiskFile, init_file => 1);
+my $OnTmpfs = $Disk->on_tmpfs;
+undef $Disk;
+unlink $DiskFile;
+
+SKIP: {
+  skip "Can't detect tmpfs, or build dir is on tmpfs", 1
+    if !defined $OnTmpfs || $OnTmpfs;
+
+  ok( !eval { Cache::FastMmap->new(share_file => $DiskFile,
+    init_file => 1, check_tmpfs => 'die') }, "check_tmpfs died" );
+  unlink $DiskFile;
+}
+
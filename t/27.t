@@ -0,0 +1,76 @@
+
+#########################
+
+use Test::More tests => 16;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Approximate recency (lru_granularity): read hits only update an
+# entry's last access time if it's older than the granularity, so hot
+# read hits don't write to the page, even with enable_stats (whose
+# counts live outside the pages).
+
+my $now = time;
+Cache::FastMmap::_set_time_override($now);
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  enable_stats => 1,
+  lru_granularity => 60,
+);
+ok( defined $FC );
+
+ok( $FC->set("a", "b"), "stored" );
+$FC->get_dirty_count(1);
+
+for (1 .. 10) {
+  Cache::FastMmap::_set_time_override($now + $_);
+  $FC->get("a");
+}
+$FC->get("nope");
+is( $FC->get_dirty_count, 0, "hits within granularity and misses don't write" );
+
+my ($Details) = $FC->get_keys(1);
+is( $Details->{last_access}, $now, "last access not updated" );
+
+Cache::FastMmap::_set_time_override($now + 61);
+is( $FC->get("a"), "b", "hit after granularity" );
+is( $FC->get_dirty_count(1), 1, "hit after granularity wrote" );
+($Details) = $FC->get_keys(1);
+is( $Details->{last_access}, $now + 61, "last access updated" );
+
+# 12 reads, 11 hits
+my ($NReads, $NReadHits) = $FC->get_statistics();
+is( $NReads, 12, "reads counted" );
+is( $NReadHits, 11, "read hits counted" );
+
+($NReads, $NReadHits) = $FC->get_statistics(1);
+is( $NReads, 12, "reads returned on clear" );
+($NReads, $NReadHits) = $FC->get_statistics();
+is( $NReads, 0, "reads cleared" );
+is( $NReadHits, 0, "read hits cleared" );
+
+# Stats are shared with other processes/cache objects
+$FC->get("a") for 1 .. 5;
+$FC->set("a", "c");
+my $Other = Cache::FastMmap->new(
+  share_file => $FC->{share_file},
+  serializer => '',
+  enable_stats => 1,
+  unlink_on_exit => 0,
+);
+($NReads, $NReadHits) = $Other->get_statistics();
+is( $NReads, 5, "stats visible to other cache object" );
+is( $NReadHits, 5, "read hits too" );
+
+# And without lru_granularity
+my $FC2 = Cache::FastMmap->new(serializer => '', init_file => 1, enable_stats => 1);
+$FC2->set("a", "b");
+$FC2->get("a");
+($NReads) = $FC2->get_statistics();
+is( $NReads, 1, "stats without lru_granularity" );
+
+Cache::FastMmap::_set_time_override(0);
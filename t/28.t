@@ -0,0 +1,88 @@
+
+#########################
+
+use Test::More tests => 17;
+BEGIN { use_ok('Cache::FastMmap') };
+use POSIX ":sys_wait_h";
+use strict;
+
+#########################
+
+# Sharded statistics: get_all_statistics() sums per-process counters
+# kept in the cache file, covering writes, refused stores, deletes,
+# evictions, expirations and expunge runs, across forked processes.
+
+my $now = time;
+Cache::FastMmap::_set_time_override($now);
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 1,
+  page_size => 8192,
+  enable_stats => 1,
+);
+ok( defined $FC );
+
+$FC->set("a", "1");
+$FC->set("b", "2", { expire_time => 5 });
+$FC->get("a");
+$FC->get("c");
+$FC->remove("a");
+$FC->remove("c");
+$FC->remove("t", { modseq => 5 });
+ok( !$FC->set("t", "stale", { modseq => 4 }), "refused store" );
+
+my $Stats = $FC->get_all_statistics();
+is( $Stats->{nreads}, 2, "reads" );
+is( $Stats->{nreadhits}, 1, "read hits" );
+is( $Stats->{nwrites}, 3, "writes (including tombstone)" );
+is( $Stats->{nrefused}, 1, "refused" );
+is( $Stats->{ndeletes}, 1, "deletes" );
+
+# Expire "b", then fill the page till things get evicted
+Cache::FastMmap::_set_time_override($now + 10);
+$FC->set("k$_", "x" x 100) for 1 .. 200;
+
+$Stats = $FC->get_all_statistics(1);
+is( $Stats->{nexpirations}, 1, "expired entry counted" );
+ok( $Stats->{nevictions} > 0, "evictions counted" );
+ok( $Stats->{nexpunges} > 0, "expunge runs counted" );
+ok( $Stats->{bytes_evicted} >= $Stats->{nevictions} * 100, "bytes evicted counted" );
+
+$Stats = $FC->get_all_statistics();
+is( (grep { $_ } values %$Stats), 0, "all cleared" );
+
+# Counts from forked children are summed
+$FC->clear;
+$FC->set("a", "1");
+$FC->get_statistics(1);
+my %Kids;
+for my $Kid (1 .. 4) {
+  my $Pid = fork();
+  if (!$Pid) {
+    $FC->get("a") for 1 .. 25;
+    $FC->get("b") for 1 .. 5;
+    exit(0);
+  }
+  $Kids{$Pid} = 1;
+}
+while (%Kids) {
+  my $Kid = waitpid(-1, 0);
+  last if $Kid <= 0;
+  delete $Kids{$Kid};
+}
+
+my ($NReads, $NReadHits) = $FC->get_statistics();
+is( $NReads, 120, "reads from all children" );
+is( $NReadHits, 100, "read hits from all children" );
+
+# Stats aren't counted without enable_stats
+my $FC2 = Cache::FastMmap->new(serializer => '', init_file => 1);
+$FC2->set("a", "1");
+$FC2->get("a");
+($NReads, $NReadHits) = $FC2->get_statistics();
+is( $NReads, 0, "no reads counted without enable_stats" );
+is( $FC2->get_all_statistics()->{nwrites}, 0, "no writes counted without enable_stats" );
+
+Cache::FastMmap::_set_time_override(0);
@@ -0,0 +1,66 @@
+
+#########################
+
+use Test::More tests => 22;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# get_page_report(): per page slot/byte occupancy, live vs dead data,
+# probe lengths and access times, the headers_only mode, and the cache
+# wide summary and histograms.
+
+my $now = time;
+Cache::FastMmap::_set_time_override($now);
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 3,
+  page_size => 8192,
+);
+ok( defined $FC );
+
+my $Report = $FC->get_page_report();
+is( scalar @{$Report->{pages}}, 3, "3 pages" );
+my $P = $Report->{pages}->[0];
+is( $P->{used_slots}, 0, "empty page has no used slots" );
+is( $P->{num_slots}, 89, "start slots" );
+is( $P->{free_bytes}, $P->{data_bytes}, "empty page all free" );
+is( $P->{live_bytes}, 0, "no live bytes" );
+is( $P->{avg_probe}, undef, "no probes in empty page" );
+
+# Fill, then delete some to create dead space. Same size overwrites
+#  are done in place so leave none
+$FC->set("k$_", "v" x 20) for 1 .. 30;
+$FC->set("k$_", "w" x 20) for 1 .. 5;
+$FC->remove("k$_") for 6 .. 10;
+$FC->set("e", "x" x 20, { expire_time => 5 });
+Cache::FastMmap::_set_time_override($now + 10);
+
+$Report = $FC->get_page_report();
+my $Summary = $Report->{summary};
+is( $Summary->{num_pages}, 3, "summary num_pages" );
+is( $Summary->{used_slots}, 26, "used slots: 30 kept, 5 deleted, 1 expired" );
+is( $Summary->{old_slots}, 5, "deleted slots" );
+is( $Summary->{expired_slots}, 1, "expired slot" );
+
+# Each entry is 24 bytes header + 1-3 key + 4 version + 20 value,
+#  rounded to 52
+is( $Summary->{live_bytes}, 25 * 52, "live bytes" );
+is( $Summary->{dead_bytes}, 6 * 52, "dead bytes: deleted, expired" );
+is( $Summary->{data_bytes} - $Summary->{free_bytes},
+  $Summary->{live_bytes} + $Summary->{dead_bytes}, "used = live + dead" );
+ok( $Summary->{avg_probe} >= 1, "avg probe" );
+is( $Summary->{oldest_access}, $now, "oldest access" );
+is( $Summary->{newest_access}, $now, "newest access" );
+is( (eval { my $t = 0; $t += $_ for @{$Summary->{fill_histogram}}; $t }), 3, "fill histogram counts every page" );
+is( $Summary->{slot_histogram}->[0] + $Summary->{slot_histogram}->[1], 3, "pages under 20% slot load" );
+
+# Header only report doesn't walk entries
+my $HReport = $FC->get_page_report({ headers_only => 1 });
+is( $HReport->{summary}->{used_slots}, 26, "header report used slots" );
+ok( !exists $HReport->{pages}->[0]->{live_bytes}, "header report has no entry details" );
+
+Cache::FastMmap::_set_time_override(0);
@@ -0,0 +1,61 @@
+
+#########################
+
+use Test::More tests => 17;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# hot_keys: per process Space-Saving sketch of the most accessed keys
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 17,
+  page_size => 8192,
+  hot_keys => 4,
+);
+ok( defined $FC );
+
+is_deeply( [ $FC->get_hot_keys() ], [], "empty sketch" );
+
+$FC->set("hot", "v");
+$FC->get("hot") for 1 .. 100;
+$FC->set("warm", "v");
+$FC->get("warm") for 1 .. 30;
+
+# Lots of keys seen once, more than the sketch can hold
+$FC->get("cold$_") for 1 .. 40;
+
+my @Hot = $FC->get_hot_keys();
+is( scalar @Hot, 4, "sketch holds 4 keys" );
+is( $Hot[0]->{key}, "hot", "hottest key first" );
+is( $Hot[0]->{count}, 101, "hot key count" );
+is( $Hot[0]->{error}, 0, "hot key count exact" );
+is( $Hot[1]->{key}, "warm", "next hottest" );
+is( $Hot[1]->{count}, 31, "warm key count" );
+is( $Hot[0]->{key_len}, 3, "key length" );
+
+my ($HashPage) = Cache::FastMmap::fc_hash($FC->{Cache}, "hot");
+is( $Hot[0]->{page}, $HashPage, "page of key" );
+
+# Cold keys take over each other's counters, the error says by how much
+my $Cold = $Hot[2];
+ok( $Cold->{count} - $Cold->{error} <= 1, "cold key count within error" );
+
+my @Top = $FC->get_hot_keys(1);
+is( scalar @Top, 1, "limit number returned" );
+
+# Long keys are truncated
+my $LongKey = "x" x 200;
+$FC->get($LongKey) for 1 .. 200;
+@Top = $FC->get_hot_keys(1, 1);
+is( $Top[0]->{key}, "x" x 128, "long key truncated" );
+is( $Top[0]->{key_len}, 200, "long key full length" );
+
+is_deeply( [ $FC->get_hot_keys() ], [], "sketch cleared" );
+
+my $FC2 = Cache::FastMmap->new(serializer => '', init_file => 1);
+$FC2->get("a");
+is_deeply( [ $FC2->get_hot_keys() ], [], "no sketch when disabled" );
@@ -0,0 +1,79 @@
+
+#########################
+
+use Test::More tests => 22;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# latency_stats: shared latency histograms and get_latency_statistics()
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 3,
+  page_size => 8192,
+  latency_stats => 1,
+);
+ok( defined $FC );
+
+my $Lat = $FC->get_latency_statistics();
+is_deeply( [ sort keys %$Lat ], [ sort qw(lock_wait read write expunge get set) ], "all ops" );
+is( $Lat->{read}->{count}, 0, "nothing timed yet" );
+is( $Lat->{read}->{p50}, 0, "empty percentile is 0" );
+
+$FC->set("k$_", "v" x 100) for 1 .. 20;
+$FC->get("k$_") for 1 .. 20;
+
+$Lat = $FC->get_latency_statistics();
+is( $Lat->{read}->{count}, 20, "reads timed" );
+is( $Lat->{write}->{count}, 20, "writes timed" );
+ok( $Lat->{lock_wait}->{count} >= 40, "lock waits timed" );
+
+my $R = $Lat->{read};
+ok( $R->{p50} > 0, "read p50" );
+ok( $R->{p50} <= $R->{p99} && $R->{p99} <= $R->{p999} && $R->{p999} <= $R->{max},
+  "percentiles ordered" );
+
+# XS fast paths
+Cache::FastMmap::fc_set($FC->{Cache}, "x", "y");
+is( Cache::FastMmap::fc_get($FC->{Cache}, "x"), "y", "fc_get" );
+$Lat = $FC->get_latency_statistics();
+is( $Lat->{get}->{count}, 21, "get() and fc_get timed" );
+is( $Lat->{set}->{count}, 21, "set() and fc_set timed" );
+
+# Overflow the pages to cause expunges
+$FC->set("big$_", "v" x 1000) for 1 .. 50;
+$Lat = $FC->get_latency_statistics();
+ok( $Lat->{expunge}->{count} > 0, "expunges timed" );
+
+# Other processes add to the same histograms
+my $Pid = fork;
+if (!$Pid) {
+  my $FC2 = Cache::FastMmap->new(
+    serializer => '', init_file => 0, num_pages => 3, page_size => 8192,
+    share_file => $FC->{share_file}, unlink_on_exit => 0, latency_stats => 1,
+  );
+  $FC2->get("k1") for 1 .. 10;
+  exit 0;
+}
+waitpid($Pid, 0);
+is( $?, 0, "child ok" );
+
+my $Before = $Lat->{read}->{count};
+$Lat = $FC->get_latency_statistics(1);
+is( $Lat->{read}->{count}, $Before + 10, "child reads counted" );
+
+$Lat = $FC->get_latency_statistics();
+is( $Lat->{read}->{count}, 0, "cleared" );
+is( $Lat->{write}->{count}, 0, "cleared writes" );
+is( $Lat->{expunge}->{max}, 0, "cleared max" );
+
+# Not enabled, nothing recorded
+my $FC3 = Cache::FastMmap->new(serializer => '', init_file => 1, num_pages => 3, page_size => 8192);
+$FC3->set("a", "b");
+is( $FC3->get("a"), "b", "get ok" );
+$Lat = $FC3->get_latency_statistics();
+is( $Lat->{read}->{count}, 0, "no reads timed when disabled" );
+is( $Lat->{lock_wait}->{count}, 0, "no locks timed when disabled" );
@@ -0,0 +1,76 @@
+
+#########################
+
+use Test::More tests => 14;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# trace_file: binary trace of reads/writes/deletes
+
+my $TraceFile = "/tmp/fc-trace-$$";
+unlink $TraceFile;
+
+my $now = time;
+Cache::FastMmap::_set_time_override($now);
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 3,
+  page_size => 8192,
+  trace_file => $TraceFile,
+);
+ok( defined $FC );
+
+$FC->set("abc", "12345");
+$FC->get("abc");
+$FC->get("def");
+$FC->set("exp", "1", { expire_time => 10 });
+$FC->remove("abc");
+$FC->remove("abc");
+
+# Nothing written till the buffer fills or the cache is closed
+is( -s $TraceFile, 0, "trace buffered" );
+
+# Child's records are its own
+my $Pid = fork;
+if (!$Pid) {
+  $FC->get("child");
+  $FC->cleanup();
+  exit 0;
+}
+waitpid($Pid, 0);
+
+$FC->cleanup();
+Cache::FastMmap::_set_time_override(0);
+
+open(my $Fh, '<', $TraceFile) || die "open $TraceFile: $!";
+binmode $Fh;
+my @Recs;
+while (read($Fh, my $Rec, 24) == 24) {
+  my %R;
+  @R{qw(time hash key_len val_len expire_in magic op hit)} = unpack("L5C3", $Rec);
+  push @Recs, \%R;
+}
+close $Fh;
+unlink $TraceFile;
+
+is( scalar @Recs, 7, "7 records" );
+is( (grep { $_->{magic} == 0xfc } @Recs), 7, "all have magic" );
+
+# Child's record written by its close, before the parent's
+my $Child = shift @Recs;
+is( "$Child->{op}/$Child->{hit}/$Child->{key_len}", "1/0/5", "child read" );
+
+is_deeply( [ map { "$_->{op}/$_->{hit}" } @Recs ],
+  [ "2/1", "1/1", "1/0", "2/1", "3/1", "3/0" ], "ops and hits" );
+
+is( $Recs[0]->{time}, $now, "time" );
+is( $Recs[0]->{key_len}, 3, "key len" );
+is( $Recs[0]->{val_len}, 5, "write value len" );
+is( $Recs[1]->{val_len}, 5, "read hit value len" );
+is( $Recs[0]->{expire_in}, 0, "no expiry" );
+is( $Recs[3]->{expire_in}, 10, "expiry" );
+is( $Recs[0]->{hash}, $Recs[1]->{hash}, "same key same hash" );
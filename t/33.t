@@ -0,0 +1,58 @@
+
+#########################
+
+use Test::More tests => 16;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# get() fast path: one fc_get() XS call, falling back to the full path
+#  only for a read_cb miss
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 17,
+  page_size => 8192,
+);
+ok( defined $FC );
+
+# fc_get returns an empty list on a miss, and undef for a cached undef
+$FC->set("u", undef);
+is_deeply( [ Cache::FastMmap::fc_get($FC->{Cache}, "nope") ], [], "miss is empty list" );
+is_deeply( [ Cache::FastMmap::fc_get($FC->{Cache}, "u") ], [ undef ], "cached undef" );
+ok( !defined $FC->get("u"), "get cached undef" );
+
+# UTF8 values come back as UTF8
+my $Utf8 = "\x{263a} smile";
+$FC->set("utf8", $Utf8);
+my $Got = $FC->get("utf8");
+is( $Got, $Utf8, "utf8 value" );
+ok( utf8::is_utf8($Got), "utf8 flag set" );
+
+# modseq reporting, including resetting it on a miss
+$FC->set("m", "mv", { modseq => 42 });
+my $ModSeq;
+is( $FC->get("m", { modseq => \$ModSeq }), "mv", "value with modseq" );
+is( $ModSeq, 42, "modseq reported" );
+$FC->get("nope", { modseq => \$ModSeq });
+ok( !defined $ModSeq, "modseq undef on miss" );
+ok( !eval { $FC->get("m", { modseq => [] }); 1 }, "bad modseq option" );
+like( $@, qr/scalar ref/, "bad modseq option message" );
+
+# A read_cb miss still goes through the callback and stores the result
+my $Calls = 0;
+my $FC2 = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 17,
+  page_size => 8192,
+  read_cb => sub { $Calls++; return { key => $_[1] } },
+);
+is_deeply( $FC2->get("a"), { key => "a" }, "read_cb value" );
+is_deeply( $FC2->get("a"), { key => "a" }, "deserialized hit" );
+is( $Calls, 1, "second get was a hit" );
+
+# Values stored by the full path read back by the fast path
+$FC2->get_and_set("b", sub { return [ 1, 2 ] });
+is_deeply( $FC2->get("b"), [ 1, 2 ], "get_and_set value" );
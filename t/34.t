@@ -0,0 +1,55 @@
+
+#########################
+
+use Test::More tests => 11;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# set() fast path: one fc_set() XS call including the expunge, which
+#  only returns expunged items when they need writing back
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 1,
+  page_size => 8192,
+);
+ok( defined $FC );
+
+is_deeply( [ Cache::FastMmap::fc_set($FC->{Cache}, "a", "b") ], [ 1 ], "stored, nothing expunged" );
+$FC->set("big$_", "x" x 500) for 1 .. 40;
+is_deeply( [ Cache::FastMmap::fc_set($FC->{Cache}, "c", "x" x 500) ], [ 1 ], "no write back items unless asked" );
+is( $FC->get("c"), "x" x 500, "stored after expunge" );
+
+my $Utf8 = "\x{263a}";
+ok( $FC->set($Utf8, $Utf8), "utf8 key and value" );
+is( $FC->get($Utf8), $Utf8, "utf8 round trip" );
+
+# Write back of dirty evicted entries, with a serializer
+my %WB;
+my $FC2 = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  page_size => 8192,
+  write_action => 'write_back',
+  write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+$FC2->set("k$_", [ $_, "x" x 200 ]) for 1 .. 100;
+ok( scalar(keys %WB), "evicted entries written back" );
+my ($WBKey) = sort keys %WB;
+is_deeply( $WB{$WBKey}, [ substr($WBKey, 1), "x" x 200 ], "written back value deserialized" );
+ok( !exists $WB{k100}, "live entries not written back" );
+
+# A refused conditional store isn't written through
+my $Writes = 0;
+my $FC3 = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  page_size => 8192,
+  write_cb => sub { $Writes++ },
+);
+$FC3->remove("t", { modseq => 10 });
+$FC3->set("t", "old", { modseq => 5 });
+is( $Writes, 0, "refused store not written through" );
@@ -0,0 +1,98 @@
+
+#########################
+
+use Test::More tests => 17;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Built in LZ4 codec ('native' compressor), recorded per entry so any
+#  reader decodes it
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  compressor => 'native',
+  compress_threshold => 64,
+  init_file => 1,
+  num_pages => 3,
+  page_size => 1024*1024,
+);
+ok( defined $FC );
+
+# Round trip all sorts of values: compressible, incompressible, long
+#  runs, longer than the 64k match window, around the threshold
+srand(7);
+my @Vals = (
+  '', 'a', 'x' x 63, 'x' x 64, 'x' x 65, 'abcd' x 1000,
+  join('', map { chr(int(rand(256))) } 1 .. 5000),
+  join('', map { chr(65 + int(rand(4))) } 1 .. 100000),
+  join(',', map { "{\"id\":$_,\"name\":\"user$_\"}" } 1 .. 5000),
+  ('y' x 70000) . 'z' . ('y' x 70000),
+);
+my $Bad = 0;
+for my $I (0 .. $#Vals) {
+  $FC->set("v$I", $Vals[$I]);
+  $Bad++ if $FC->get("v$I") ne $Vals[$I];
+}
+is( $Bad, 0, "all values round trip" );
+
+my $Utf8 = "\x{263a}" x 200;
+$FC->set("utf8", $Utf8);
+is( $FC->get("utf8"), $Utf8, "utf8 value round trip" );
+ok( utf8::is_utf8($FC->get("utf8")), "utf8 flag kept" );
+
+# Compressible values take less space, small ones aren't touched
+sub live_bytes {
+  my $Report = $_[0]->get_page_report();
+  return $Report->{summary}->{live_bytes};
+}
+my $Plain = Cache::FastMmap->new(
+  serializer => '', init_file => 1, num_pages => 1, page_size => 65536,
+);
+my $Native = Cache::FastMmap->new(
+  serializer => '', compressor => 'native', init_file => 1, num_pages => 1, page_size => 65536,
+);
+$_->set("big", 'hello world ' x 100) for $Plain, $Native;
+ok( live_bytes($Native) * 4 < live_bytes($Plain), "compressible value stored smaller" );
+my ($PlainBefore, $NativeBefore) = (live_bytes($Plain), live_bytes($Native));
+$_->set("small", 'hello world ' x 5) for $Plain, $Native;
+is( live_bytes($Native) - $NativeBefore, live_bytes($Plain) - $PlainBefore, "below threshold stored plain" );
+
+# Readers decode natively compressed entries whatever their settings
+my $Reader = Cache::FastMmap->new(
+  serializer => '', init_file => 0, num_pages => 3, page_size => 1024*1024,
+  share_file => $FC->{share_file},
+);
+is( $Reader->get("v5"), 'abcd' x 1000, "plain reader decodes" );
+my ($Item) = grep { $_->{key} eq 'v5' } $Reader->get_keys(2);
+is( $Item->{value}, 'abcd' x 1000, "get_keys(2) decodes" );
+ok( !($Item->{flags} & ~1), "codec bits not reported in flags" );
+
+# Locked (fc_read/fc_write) paths
+$FC->get_and_set("gs", sub { return 'q' x 1000 });
+is( $FC->get("gs"), 'q' x 1000, "get_and_set stores compressed" );
+$FC->get_and_set("gs", sub { return $_[1] . 'r' });
+is( $FC->get("gs"), ('q' x 1000) . 'r', "get_and_set reads compressed" );
+
+# With a serializer too
+my $FC2 = Cache::FastMmap->new(
+  compressor => 'native', init_file => 1, num_pages => 3, page_size => 65536,
+);
+my $Data = { list => [ (1 .. 100) x 5 ], text => 'blah ' x 100 };
+$FC2->set("d", $Data);
+is_deeply( $FC2->get("d"), $Data, "serialized value round trip" );
+
+# Write back of evicted compressed entries
+my %WB;
+my $FC3 = Cache::FastMmap->new(
+  serializer => '', compressor => 'native', init_file => 1, num_pages => 1, page_size => 8192,
+  write_action => 'write_back', write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+$FC3->set("k$_", "$_:" . ('z' x 2000)) for 1 .. 200;
+ok( scalar(keys %WB), "evicted entries written back" );
+my ($WBKey) = sort keys %WB;
+is( $WB{$WBKey}, substr($WBKey, 1) . ':' . ('z' x 2000), "written back value decoded" );
+
+ok( !eval { Cache::FastMmap->new(init_file => 1, compressor => 'nope'); 1 }, "unknown compressor" );
+ok( $FC->get("v0") eq '' && $FC->get("v1") eq 'a', "tiny values" );
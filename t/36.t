@@ -0,0 +1,68 @@
+
+#########################
+
+use Test::More tests => 14;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Compression dictionaries for the 'native' compressor, kept in the
+#  share file and recorded per entry
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  compressor => 'native',
+  compress_threshold => 32,
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+);
+ok( defined $FC );
+
+is_deeply( [ $FC->get_dictionary() ], [ 0, undef ], "no dictionary" );
+ok( !defined $FC->train_dictionary(), "nothing to train from" );
+
+srand(3);
+my @Names = qw(alice bob carol dave erin frank);
+sub rec {
+  return '{"id":' . $_[0] . ',"user":"' . $Names[rand @Names] . int(rand(1e6))
+    . '","email":"' . $Names[rand @Names] . '@example.com","roles":["reader","writer"],'
+    . '"preferences":{"theme":"dark","language":"en-US","notify":{"email":true,"sms":false}},'
+    . '"status":"active"}';
+}
+my @Vals = map { rec($_) } 1 .. 500;
+
+sub store_all { $FC->set("k$_", $Vals[$_]) for 0 .. $#Vals; }
+sub live_bytes { return $FC->get_page_report()->{summary}->{live_bytes}; }
+sub bad_reads { return scalar grep { ($FC->get("k$_") // '') ne $Vals[$_] } 0 .. $#Vals; }
+
+store_all();
+my $Plain = live_bytes();
+
+my $Id = $FC->train_dictionary({ dict_size => 8192 });
+is( $Id, 1, "first dictionary id" );
+my ($GotId, $Dict) = $FC->get_dictionary();
+ok( $GotId == 1 && length($Dict) > 1000 && length($Dict) <= 8192, "dictionary installed" );
+is( bad_reads(), 0, "entries from before the dictionary read fine" );
+
+store_all();
+ok( live_bytes() * 2 < $Plain, "dictionary compresses much better" );
+is( bad_reads(), 0, "dictionary compressed entries read back" );
+
+# Other processes see the same dictionary
+my $FC2 = Cache::FastMmap->new(
+  serializer => '', init_file => 0, num_pages => 17, page_size => 65536,
+  share_file => $FC->{share_file},
+);
+is( $FC2->get("k10"), $Vals[10], "other cache object decodes" );
+
+# Entries compressed with the last few dictionaries still decode,
+#  older ones are misses
+$FC->set_dictionary($Dict . "x") for 1 .. 3;
+is( bad_reads(), 0, "entries readable after 3 more dictionaries" );
+$FC->set_dictionary($Dict . "y");
+ok( !defined $FC->get("k10"), "entries of a replaced dictionary are misses" );
+is( ($FC->get_dictionary())[0], 5, "dictionary id incremented" );
+
+ok( !eval { $FC->set_dictionary("short"); 1 }, "too short dictionary" );
@@ -0,0 +1,84 @@
+
+#########################
+
+use Test::More tests => 25;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# get_into() into a reused buffer, and with_value() aliasing the
+#  mapped value bytes
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+);
+ok( defined $FC );
+
+ok( $FC->set("big", "x" x 10000), "set big" );
+ok( $FC->set("small", "abc"), "set small" );
+ok( $FC->set("undef", undef), "set undef" );
+
+my $Buf = "";
+ok( $FC->get_into("big", $Buf), "get_into big" );
+is( $Buf, "x" x 10000, "big value" );
+
+# The buffer is kept when a smaller value is read into it
+my $Addr = unpack("J", pack("p", $Buf));
+ok( $FC->get_into("small", $Buf), "get_into small" );
+is( $Buf, "abc", "small value" );
+is( unpack("J", pack("p", $Buf)), $Addr, "buffer reused" );
+
+ok( $FC->get_into("undef", $Buf), "stored undef is found" );
+ok( !defined $Buf, "as undef" );
+ok( !$FC->get_into("missing", $Buf), "miss" );
+
+my $Utf8 = "caf\x{e9}\x{263a}";
+$FC->set("utf8", $Utf8);
+$FC->get_into("utf8", $Buf);
+is( $Buf, $Utf8, "utf8 value" );
+
+eval { $FC->get_into("small", "const") };
+like( $@, qr/read-only/, "read only buffer croaks" );
+
+is( $FC->with_value("big", sub { length $_[0] }), 10000, "with_value length" );
+ok( !defined $FC->with_value("missing", sub { die "called" }), "not called on a miss" );
+
+# A callback that grows (and so reallocates) the perl stack
+my @Got = (1 .. 3, $FC->with_value("big", sub { my @x = (0) x 500000; scalar(() = (@x, @x)) + length $_[0] }));
+is_deeply( \@Got, [ 1, 2, 3, 1010000 ], "with_value after stack growth" );
+
+eval { $FC->with_value("small", sub { $_[0] .= "d" }) };
+like( $@, qr/read-only/, "aliased value is read only" );
+
+# A kept reference gets its own copy
+my $Kept;
+$FC->with_value("small", sub { $Kept = \$_[0]; 1 });
+$FC->set("small", "zzz");
+is( $$Kept, "abc", "kept value was copied" );
+
+# Errors are rethrown and the page unlocked
+eval { $FC->with_value("small", sub { die "oops\n" }) };
+is( $@, "oops\n", "callback error rethrown" );
+ok( $FC->set("small", "after"), "page unlocked after error" );
+
+# Natively compressed values are decoded first
+my $FCZ = Cache::FastMmap->new(
+  serializer => '',
+  compressor => 'native',
+  compress_threshold => 32,
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+);
+$FCZ->set("z", "abcd" x 1000);
+ok( $FCZ->get_into("z", $Buf) && $Buf eq "abcd" x 1000, "get_into decodes" );
+is( $FCZ->with_value("z", sub { $_[0] }), "abcd" x 1000, "with_value decodes" );
+
+# And serialized caches fall back to get()
+my $FCS = Cache::FastMmap->new(init_file => 1, num_pages => 3);
+$FCS->set("s", { a => 1 });
+is( $FCS->with_value("s", sub { $_[0]{a} }), 1, "with_value deserializes" );
@@ -0,0 +1,71 @@
+
+#########################
+
+use Test::More tests => 25;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Key handles with a precomputed hash page/slot, and the batch API
+
+my (%WBData, @Written);
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+  write_cb => sub { push @Written, $_[1]; $WBData{$_[1]} = $_[2] },
+  delete_cb => sub { delete $WBData{$_[1]} },
+);
+ok( defined $FC );
+
+my $H = $FC->key_handle("abc");
+isa_ok( $H, 'Cache::FastMmap::KeyHandle' );
+is( $H->key, "abc", "handle key" );
+is( "$H", "abc", "stringifies to key" );
+is( $FC->key_handle($H), $H, "handle of a handle" );
+
+ok( $FC->set($H, "val1"), "set via handle" );
+is( $FC->get("abc"), "val1", "found by plain key" );
+$FC->set("abc", "val2");
+is( $FC->get($H), "val2", "get via handle" );
+is( $Written[-1], "abc", "write_cb given the key" );
+ok( $FC->exists($H), "other methods use the key" );
+$FC->remove($H);
+ok( !defined $FC->get("abc"), "remove via handle" );
+ok( !exists $WBData{abc}, "delete_cb given the key" );
+
+# Handles from a cache with a different number of pages are rehashed
+my $FC2 = Cache::FastMmap->new(serializer => '', init_file => 1, num_pages => 5);
+$FC2->set($H, "other");
+is( $FC2->get("abc"), "other", "foreign handle rehashed" );
+
+my $Utf8 = "k\x{263a}";
+my $HU = $FC->key_handle($Utf8);
+$FC->set($HU, "u");
+is( $FC->get($Utf8), "u", "utf8 key handle" );
+
+# Batches, sorted by page once and reused
+my @Keys = map { "key$_" } 1 .. 200;
+my $Batch = $FC->key_batch(@Keys);
+isa_ok( $Batch, 'Cache::FastMmap::KeyBatch' );
+@Written = ();
+is( $FC->set_batch($Batch, [ map { "val$_" } 1 .. 200 ]), 200, "set_batch stored all" );
+is( scalar @Written, 200, "written through" );
+is( $FC->get("key17"), "val17", "set_batch value found by get" );
+is_deeply( [ $FC->get_batch($Batch) ], [ map { "val$_" } 1 .. 200 ], "get_batch in key order" );
+
+$FC->remove("key5");
+my @Vals = $FC->get_batch([ "key5", $FC->key_handle("key6"), "nope" ]);
+is_deeply( \@Vals, [ undef, "val6", undef ], "get_batch of keys/handles, misses undef" );
+
+# Serialized cache, with expiry
+my $FCS = Cache::FastMmap->new(init_file => 1, num_pages => 7);
+is( $FCS->set_batch([ "a", "b" ], [ { x => 1 }, [ 2 ] ], { expire_time => 1 }), 2, "serialized set_batch" );
+is_deeply( [ $FCS->get_batch([ "b", "a" ]) ], [ [ 2 ], { x => 1 } ], "serialized get_batch" );
+sleep 2;
+is_deeply( [ $FCS->get_batch([ "a", "b" ]) ], [ undef, undef ], "batch entries expired" );
+
+eval { $FC->get(bless [], 'Cache::FastMmap::KeyHandle') };
+like( $@, qr/Corrupt key handle/, "bad handle croaks" );
@@ -0,0 +1,56 @@
+
+#########################
+
+use Config;
+use Test::More;
+BEGIN {
+  plan skip_all => "No ithreads" unless $Config{useithreads};
+  plan tests => 8;
+}
+use threads;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Threads get their own handle on the same mapping, and page locks
+#  exclude threads as well as processes
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 11,
+  page_size => 262144,
+  empty_on_exit => 1,
+);
+ok( defined $FC );
+
+$FC->set("counter", 0);
+$FC->set("parent", "p");
+
+my @Threads = map {
+  threads->create(sub {
+    my $Id = shift;
+    my $Seen = $FC->get("parent");
+    # Start together
+    1 while !$FC->get("go");
+    for (1 .. 2000) {
+      $FC->get_and_set("counter", sub { $_[1] + 1 });
+      $FC->set("t$Id-$_", $_);
+    }
+    return $Seen;
+  }, $_)
+} 1 .. 4;
+$FC->set("go", 1);
+
+is_deeply( [ map { $_->join } @Threads ], [ ("p") x 4 ], "threads see parent's entries" );
+is( $FC->get("counter"), 8000, "increments from all threads counted" );
+my ($Stored) = grep { defined $FC->get("t1-$_") } 1 .. 500;
+ok( $Stored, "thread stores visible" );
+
+# A thread's copy didn't empty the cache on exit
+is( $FC->get("parent"), "p", "not emptied by thread exit" );
+
+# And the parent's handle still works after the threads' are closed
+ok( $FC->set("after", 1), "set after threads" );
+is( $FC->get("after"), 1, "get after threads" );
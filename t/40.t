@@ -0,0 +1,126 @@
+
+#########################
+
+use Config;
+use File::Temp qw(tempdir);
+use Test::More;
+BEGIN {
+  plan skip_all => "C API tests need a unix like system" if $^O eq 'MSWin32';
+}
+use Cache::FastMmap;
+use strict;
+
+#########################
+
+# The C API in fastmmap.h, sharing a cache file with perl. A small C
+#  program built from the library sources reads what perl stored,
+#  and stores values for perl to read
+
+my $Dir = tempdir(CLEANUP => 1);
+my $Prog = "$Dir/fmc_test";
+
+open(my $Fh, '>', "$Prog.c") || die $!;
+print $Fh <<'C';
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "fastmmap.h"
+
+int main(int argc, char ** argv) {
+  const char * params[] = {
+    "share_file", argv[1], "num_pages", "17", "page_size", "65536",
+    "open_existing", "1", "codec", "lz4", "compress_threshold", "32", NULL
+  };
+  const void * keys[3] = { "plain", "missing", "packed" };
+  int key_lens[3] = { 5, 7, 6 }, val_lens[3], i, len, n;
+  void * vals[3], * val;
+  char err[256];
+  MU32 flags[3], f;
+  mmap_cache * cache = fmc_open(params, err, sizeof(err));
+
+  if (!cache) {
+    printf("open failed: %s\n", err);
+    return 1;
+  }
+
+  if (fmc_get(cache, "plain", 5, &val, &len, &f) == 1) {
+    printf("get plain %d %s\n", len, (char *)val);
+    fmc_free(val);
+  }
+  printf("get missing %d\n", fmc_get(cache, "missing", 7, &val, &len, &f));
+  if (fmc_get(cache, "utf8", 4, &val, &len, &f) == 1) {
+    printf("get utf8 %d %d\n", len, (f & FMC_UTF8VAL) ? 1 : 0);
+    fmc_free(val);
+  }
+
+  n = fmc_get_many(cache, 3, keys, key_lens, vals, val_lens, flags);
+  printf("get_many %d", n);
+  for (i = 0; i < 3; i++) {
+    printf(" %d", vals[i] ? val_lens[i] : -1);
+    fmc_free(vals[i]);
+  }
+  printf("\n");
+
+  printf("delete %d", fmc_delete(cache, "plain", 5));
+  printf(" %d\n", fmc_delete(cache, "plain", 5));
+
+  printf("set %d\n", fmc_set(cache, "from_c", 6, "abcabcabcabcabcabcabcabcabcabcabcabc", 36, 0, 0));
+  val = malloc(100000);
+  for (i = 0; i < 100000; i++)
+    ((unsigned char *)val)[i] = rand() & 0xff;
+  printf("set big %d\n", fmc_set(cache, "too_big", 7, val, 100000, 0, 0));
+  free(val);
+
+  {
+    int64_t count = 0;
+    n = fmc_incr(cache, "hits", 4, 5, 0, 0, &count);
+    printf("incr %d %ld\n", n, (long)count);
+  }
+
+  fmc_close(cache);
+
+  /* A failed open (wrong size for the existing file) is cleaned up */
+  params[3] = "3";
+  cache = fmc_open(params, err, sizeof(err));
+  printf("reopen %d %d\n", cache ? 1 : 0, err[0] ? 1 : 0);
+
+  return 0;
+}
+C
+close($Fh);
+
+my $Cmd = join(' ', $Config{cc}, $Config{ccflags}, '-I.', '-o', $Prog, "$Prog.c",
+  qw(fastmmap.c mmap_cache.c codec.c unix.c -lpthread), '2>&1');
+my $Out = `$Cmd`;
+plan skip_all => "Can't build C API test program: $Out" if $?;
+plan tests => 13;
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  compressor => 'native',
+  compress_threshold => 32,
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+  unlink_on_exit => 1,
+);
+$FC->set("plain", "hello");
+$FC->set("packed", "xyz" x 1000);
+$FC->set("utf8", "\x{263a}");
+$FC->incr("hits", 2);
+
+my @Lines = `$Prog $FC->{share_file}`;
+is( $?, 0, "ran C program" );
+is( $Lines[0], "get plain 5 hello\n", "C reads perl value" );
+is( $Lines[1], "get missing 0\n", "C miss" );
+is( $Lines[2], "get utf8 3 1\n", "C sees UTF8 flag" );
+is( $Lines[3], "get_many 2 5 -1 3000\n", "C get_many decodes native compressed" );
+is( $Lines[4], "delete 1 0\n", "C delete" );
+is( $Lines[5], "set 1\n", "C set" );
+is( $Lines[6], "set big 0\n", "C set too big" );
+is( $Lines[7], "incr 1 7\n", "C incr of perl counter" );
+is( $Lines[8], "reopen 0 1\n", "C open of wrong size fails" );
+
+ok( !defined $FC->get("plain"), "perl sees C delete" );
+is( $FC->get("from_c"), "abc" x 12, "perl reads C value" );
+is( $FC->incr("hits", 0), 7, "perl sees C incr" );
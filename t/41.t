@@ -0,0 +1,76 @@
+
+#########################
+
+use Test::More tests => 25;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# In place integer counters
+
+my (%WB);
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 3,
+  page_size => 65536,
+  enable_stats => 1,
+  write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+ok( defined $FC );
+
+is( $FC->incr("c"), 1, "new counter" );
+is( $FC->incr("c"), 2, "incr" );
+is( $FC->incr("c", 10), 12, "incr by 10" );
+is( $FC->decr("c", 3), 9, "decr" );
+is( $FC->decr("c", 20), -11, "goes negative" );
+is( $FC->get("c"), -11, "get reads counter" );
+is( $WB{c}, -11, "written through" );
+
+is( $FC->incr("d", 5, { initial => 100 }), 105, "initial" );
+is( $FC->incr("d", 0), 105, "read with incr 0" );
+
+# Updated in place, so counting doesn't use up the page
+my $Before = $FC->get_page_report()->{summary}->{free_bytes};
+$FC->incr("c") for 1 .. 1000;
+is( $FC->get("c"), 989, "1000 more increments" );
+my $After = $FC->get_page_report()->{summary}->{free_bytes};
+is( $After, $Before, "no page space used" );
+
+# Plain integers become counters, anything else dies
+$FC->set("n", "41");
+is( $FC->incr("n"), 42, "plain integer converted" );
+$FC->set("s", "abc");
+eval { $FC->incr("s") };
+like( $@, qr/isn't an integer/, "non integer dies" );
+is( $FC->get("s"), "abc", "left alone" );
+
+# Existing expiry is kept, counters count over a window
+Cache::FastMmap::_set_time_override(1000);
+$FC->incr("w", 1, { expire_time => 10 });
+Cache::FastMmap::_set_time_override(1005);
+is( $FC->incr("w", 1, { expire_time => 10 }), 2, "within window" );
+Cache::FastMmap::_set_time_override(1011);
+is( $FC->incr("w", 1, { expire_time => 10 }), 1, "new window" );
+Cache::FastMmap::_set_time_override(0);
+
+# Tombstones refuse
+$FC->set("t", 1);
+$FC->remove("t", { modseq => 5 });
+ok( !defined $FC->incr("t"), "tombstone refuses" );
+
+# Key handles, get_into, with_value and get_keys see the number
+my $H = $FC->key_handle("c");
+is( $FC->incr($H, 11), 1000, "incr via handle" );
+my $Buf = "xx";
+$FC->get_into("c", $Buf);
+is( $Buf, 1000, "get_into counter" );
+is( $FC->with_value("c", sub { $_[0] + 1 }), 1001, "with_value counter" );
+my ($Item) = grep { $_->{key} eq "c" } $FC->get_keys(2);
+is( $Item->{value}, 1000, "get_keys counter" );
+
+# Serialized caches can't read them back, so refuse to make them
+my $FCS = Cache::FastMmap->new(init_file => 1, num_pages => 3);
+ok( !eval { $FCS->incr("x", 3); 1 }, "incr needs raw values" );
+like( $@, qr/raw values/, "incr error" );
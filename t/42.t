@@ -0,0 +1,45 @@
+
+#########################
+
+use Test::More tests => 13;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Overwrites that fit in the old entry's space are done in place
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 1,
+  page_size => 65536,
+);
+ok( defined $FC );
+
+sub free_bytes { $FC->get_page_report()->{pages}->[0]->{free_bytes} }
+
+$FC->set("a", "x" x 20);
+$FC->set("b", "y" x 20);
+my $Free = free_bytes();
+
+$FC->set("a", sprintf("%020d", $_)) for 1 .. 1000;
+is( $FC->get("a"), sprintf("%020d", 1000), "same size overwrite" );
+is( free_bytes(), $Free, "no space used" );
+
+$FC->set("a", "short");
+is( $FC->get("a"), "short", "smaller overwrite" );
+is( free_bytes(), $Free, "no space used" );
+is( $FC->get("b"), "y" x 20, "neighbour untouched" );
+
+$FC->set("a", "z" x 100);
+is( $FC->get("a"), "z" x 100, "bigger overwrite" );
+ok( free_bytes() < $Free, "appended" );
+
+# Modseq rules still apply, including overwriting with a modseq prefix
+$FC->set("m", "v1" x 10, { modseq => 10 });
+$Free = free_bytes();
+ok( !$FC->set("m", "v0", { modseq => 5 }), "older modseq refused" );
+ok( $FC->set("m", "v2", { modseq => 11 }), "newer modseq stored" );
+is( $FC->get("m"), "v2", "in place value" );
+is( free_bytes(), $Free, "no space used" );
@@ -0,0 +1,104 @@
+
+#########################
+
+use Test::More tests => 27;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Compare-and-swap with entry versions
+
+my (%WB);
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 3,
+  write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+ok( defined $FC );
+
+ok( !defined $FC->get("a", { version => \my $V0 }), "miss" );
+ok( !defined $V0, "no version on a miss" );
+ok( $FC->cas("a", 1, undef), "cas undef stores a new key" );
+ok( !$FC->cas("a", 2, undef), "cas undef refuses an existing key" );
+
+is( $FC->get("a", { version => \my $V1 }), 1, "get" );
+ok( defined $V1, "got version" );
+ok( $FC->cas("a", 2, $V1), "cas with current version" );
+is( $FC->get("a", { version => \my $V2 }), 2, "stored" );
+isnt( $V2, $V1, "version changed" );
+is( $WB{a}, 2, "written through" );
+
+is( $FC->cas("a", 3, $V1), 0, "cas with old version refused" );
+is( $FC->get("a"), 2, "not stored" );
+
+# Any store changes the version, even of the same value
+$FC->set("a", 2);
+ok( !$FC->cas("a", 3, $V2), "set changes version" );
+
+# As do deleting and storing again
+$FC->get("a", { version => \my $V3 });
+$FC->remove("a");
+$FC->set("a", 2);
+ok( !$FC->cas("a", 3, $V3), "remove and set changes version" );
+
+# Expired and removed keys only match an undef version
+$FC->get("a", { version => \my $V4 });
+$FC->remove("a");
+ok( !$FC->cas("a", 4, $V4), "removed key refused" );
+
+# Counters are versioned too
+$FC->incr("n");
+$FC->get("n", { version => \my $V5 });
+$FC->incr("n");
+ok( !$FC->cas("n", 10, $V5), "incr changes version" );
+
+# Read-modify-write from several processes
+$FC->set("c", 0);
+my @Kids;
+for (1 .. 4) {
+  my $Pid = fork();
+  if (!$Pid) {
+    for (1 .. 250) {
+      while (1) {
+        my $Val = $FC->get("c", { version => \my $V });
+        last if $FC->cas("c", $Val + 1, $V);
+      }
+    }
+    exit(0);
+  }
+  push @Kids, $Pid;
+}
+waitpid($_, 0) for @Kids;
+is( $FC->get("c"), 1000, "no lost updates" );
+
+# Key handles and get_and_set's slow path report versions too
+my $H = $FC->key_handle("c");
+$FC->get($H, { version => \my $V6 });
+ok( $FC->cas($H, 1001, $V6), "cas with key handle" );
+
+my $FCR = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 3,
+  read_cb => sub { "from_cb" },
+);
+is( $FCR->get("r", { version => \my $V7 }), "from_cb", "read_cb" );
+$FCR->get("r", { version => \$V7 });
+ok( $FCR->cas("r", "new", $V7), "cas after read_cb stored it" );
+
+# Appends change the version too
+$FC->set("s", "a");
+$FC->get("s", { version => \my $V8 });
+$FC->append("s", "b");
+ok( !$FC->cas("s", "c", $V8), "append changes version" );
+
+# Values that can't be stored whatever the version are undef, so a
+#  retry loop stops
+$FC->get("s", { version => \my $V9 });
+ok( !defined $FC->cas("s", "x" x 100000, $V9), "too big is undef" );
+is( $FC->get("s"), "ab", "not stored" );
+$FC->set("m", 1, { modseq => 10 });
+$FC->get("m", { version => \my $V10 });
+ok( !defined $FC->cas("m", 2, $V10, { modseq => 5 }), "refused by modseq is undef" );
+is( $FC->get("m"), 1, "not stored" );
@@ -0,0 +1,124 @@
+
+#########################
+
+use Test::More tests => 33;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Native append/prepend
+
+my (%WB);
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 1,
+  page_size => 65536,
+  write_cb => sub { $WB{$_[1]} = $_[2] },
+);
+ok( defined $FC );
+
+sub free_bytes { $FC->get_page_report()->{pages}->[0]->{free_bytes} }
+
+ok( $FC->append("l", "a"), "append creates" );
+ok( $FC->append("l", "b"), "append" );
+ok( $FC->prepend("l", "z"), "prepend" );
+is( $FC->get("l"), "zab", "joined" );
+is( $WB{l}, "zab", "written through" );
+
+# The last entry grows in place
+my $Free = free_bytes();
+$FC->append("l", "x" x 100);
+is( free_bytes(), $Free - 100, "grew in place" );
+is( $FC->get("l"), "zab" . "x" x 100, "grown value" );
+
+# Others are moved, keeping their neighbours
+$FC->set("m", "first");
+$FC->append("l", "y");
+is( $FC->get("l"), "zab" . "x" x 100 . "y", "moved value" );
+is( $FC->get("m"), "first", "neighbour intact" );
+$FC->append("m", ",second");
+is( $FC->get("m"), "first,second", "append to other" );
+
+# Trimming keeps the newest bytes
+$FC->set("r", "");
+$FC->append("r", sprintf("%04d", $_), { max_len => 20 }) for 1 .. 10;
+is( $FC->get("r"), "00060007000800090010", "trimmed from the front" );
+$FC->append("r", "0" x 30, { max_len => 20 });
+is( $FC->get("r"), "0" x 20, "trimmed all old" );
+$FC->set("p", "");
+$FC->prepend("p", sprintf("%04d", $_), { max_len => 12 }) for 1 .. 5;
+is( $FC->get("p"), "000500040003", "prepend trimmed from the end" );
+$FC->append("n", "abcdef", { max_len => 4 });
+is( $FC->get("n"), "cdef", "new value trimmed" );
+
+# Undef and modseq values
+$FC->set("u", undef);
+$FC->append("u", "now");
+is( $FC->get("u"), "now", "append to undef" );
+$FC->set("s", "abc", { modseq => 7 });
+$FC->append("s", "def");
+is( $FC->get("s", { modseq => \my $ModSeq }), "abcdef", "append to modseq value" );
+is( $ModSeq, 7, "modseq kept" );
+
+# Expiry is kept, an expired value is replaced
+Cache::FastMmap::_set_time_override(1000);
+$FC->append("e", "a", { expire_time => 10 });
+Cache::FastMmap::_set_time_override(1005);
+$FC->append("e", "b", { expire_time => 100 });
+Cache::FastMmap::_set_time_override(1011);
+ok( !defined $FC->get("e"), "expiry kept" );
+$FC->append("e", "c");
+is( $FC->get("e"), "c", "expired replaced" );
+Cache::FastMmap::_set_time_override(0);
+
+# Refusals
+$FC->incr("i");
+eval { $FC->append("i", "x") };
+like( $@, qr/counter/, "append to counter dies" );
+$FC->set("t", 1);
+$FC->remove("t", { modseq => 5 });
+ok( !$FC->append("t", "x"), "tombstone refuses" );
+
+my $FCS = Cache::FastMmap->new(init_file => 1, num_pages => 1);
+eval { $FCS->append("x", "y") };
+like( $@, qr/raw values/, "needs raw values" );
+
+# The new bytes are encoded to match the stored value
+$FC->set("w", "\x{263a}");
+ok( $FC->append("w", "\xe9"), "append bytes to a character value" );
+my $W = $FC->get("w");
+ok( utf8::valid($W) && $W eq "\x{263a}\xe9", "bytes encoded to match" );
+is( $WB{w}, "\x{263a}\xe9", "written through" );
+$FC->set("b", "\xe9");
+my $U = "\xe8";
+utf8::upgrade($U);
+$FC->append("b", $U);
+is( $FC->get("b"), "\xe9\xe8", "characters downgraded to match" );
+eval { $FC->append("b", "\x{263a}") };
+like( $@, qr/Wide character/, "wide characters to a byte value die" );
+$FC->append("c", "\x{263a}");
+is( $FC->get("c"), "\x{263a}", "new character value" );
+eval { $FC->append("c", "x", { max_len => 4 }) };
+like( $@, qr/max_len/, "max_len with a character value dies" );
+
+# Writing through doesn't take a stale value's refresh
+my @Refreshed;
+my $FCR = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 1,
+  stale_time => 60,
+  write_cb => sub { },
+  refresh_cb => sub { push @Refreshed, $_[1] },
+);
+$FCR->append("a", "x", { expire_on => time() - 1 });
+$FCR->get("a");
+is_deeply( \@Refreshed, [ "a" ], "stale value refreshed by get" );
+
+# Appending many keeps the page consistent through expunges
+$FC->clear();
+$FC->append("k" . ($_ % 50), "x" x 20) for 1 .. 5000;
+my @Keys = $FC->get_keys(2);
+ok( scalar(@Keys) > 0 && !(grep { $_->{value} !~ /^(x{20})+$/ } @Keys), "values intact after expunges" );
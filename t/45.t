@@ -0,0 +1,107 @@
+
+#########################
+
+use Test::More tests => 18;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Lease markers against read_cb stampedes
+
+my $Calls = Cache::FastMmap->new(serializer => '', init_file => 1, num_pages => 1, unlink_on_exit => 1);
+my ($CbSleep, $CbVal, $CbDie) = (0, "fetched", 0);
+
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 3,
+  lease_time => 10,
+  lease_wait => 5,
+  read_cb => sub {
+    $Calls->incr($_[1]);
+    select(undef, undef, undef, $CbSleep) if $CbSleep;
+    die "fetch failed\n" if $CbDie;
+    return $CbVal;
+  },
+);
+ok( defined $FC );
+
+is( $FC->get("a"), "fetched", "read_cb value" );
+is( $FC->get("a"), "fetched", "then cached" );
+is( $Calls->incr("a", 0), 1, "read_cb called once" );
+
+# Many processes missing at once only fetch once
+$CbSleep = 0.5;
+my @Kids;
+for (1 .. 5) {
+  my $Pid = fork();
+  if (!$Pid) {
+    $Calls->incr("got") if ($FC->get("b") || '') eq "fetched";
+    exit(0);
+  }
+  push @Kids, $Pid;
+}
+waitpid($_, 0) for @Kids;
+is( $Calls->incr("got", 0), 5, "all processes got the value" );
+is( $Calls->incr("b", 0), 1, "read_cb called once" );
+
+# While someone fetches, an expired value is served stale
+$FC->set("s", "old", { expire_time => 1 });
+sleep 2;
+pipe(my $R, my $W) || die $!;
+my $Pid = fork();
+if (!$Pid) {
+  close($R);
+  $CbSleep = 0;
+  local $FC->{read_cb} = sub { print $W "x"; close($W); sleep 2; "new" };
+  $FC->get("s");
+  exit(0);
+}
+close($W);
+sysread($R, my $Buf, 1);
+is( $FC->get("s"), "old", "stale value while leased" );
+ok( !$FC->exists("s"), "lease isn't a value" );
+ok( !(grep { $_ eq "s" } $FC->get_keys(0)), "lease hidden from get_keys" );
+waitpid($Pid, 0);
+is( $FC->get("s"), "new", "lease holder stored value" );
+
+# A failed fetch releases the lease, so the next get fetches at once
+$CbSleep = 0;
+($CbVal, $CbDie) = (undef, 1);
+eval { $FC->get("c") };
+is( $@, "fetch failed\n", "read_cb error" );
+($CbVal, $CbDie) = ("later", 0);
+my $Start = time;
+is( $FC->get("c"), "later", "fetched after release" );
+ok( time - $Start < 3, "didn't wait for the lease" );
+
+# A lease left by a process that died is waited on for lease_wait,
+#  then the value is fetched anyway
+my $FCW = Cache::FastMmap->new(
+  init_file => 0,
+  share_file => $FC->{share_file},
+  num_pages => 3,
+  lease_time => 10,
+  lease_wait => 0.3,
+  read_cb => sub { "waited" },
+);
+$Pid = fork();
+if (!$Pid) {
+  my ($Page, $Slot) = Cache::FastMmap::fc_hash($FCW->{Cache}, "d");
+  Cache::FastMmap::fc_lock($FCW->{Cache}, $Page);
+  Cache::FastMmap::fc_lease($FCW->{Cache}, $Slot, "d", 10);
+  Cache::FastMmap::fc_unlock($FCW->{Cache});
+  require POSIX;
+  POSIX::_exit(0);
+}
+waitpid($Pid, 0);
+is( $FCW->get("d"), "waited", "fetched after lease_wait" );
+
+# The marker stays, and expires after lease_time
+ok( !$FCW->exists("d"), "waiter didn't replace the lease" );
+Cache::FastMmap::_set_time_override(time + 11);
+$FCW->{lease_wait} = 5;
+$Start = time;
+is( $FCW->get("d"), "waited", "expired lease retaken" );
+ok( time - $Start < 3 && $FCW->exists("d"), "and stored without waiting" );
+Cache::FastMmap::_set_time_override(0);
@@ -0,0 +1,117 @@
+
+#########################
+
+use Test::More tests => 30;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Stale-while-revalidate with stale_time. Uses _set_time_override to
+#  step through the soft and hard expiry
+
+my $now = time;
+Cache::FastMmap::_set_time_override($now);
+
+my ($Calls, $CbVal, $CbDie) = (0, "new", 0);
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  expire_time => 10,
+  stale_time => 60,
+  refresh_time => 5,
+  unlink_on_exit => 1,
+  read_cb => sub { $Calls++; die "fetch failed\n" if $CbDie; $CbVal },
+);
+ok( defined $FC );
+
+ok( $FC->set("a", "old"), "set" );
+is( $FC->get("a"), "old", "fresh" );
+is( $Calls, 0, "no fetch" );
+
+# Past the soft expiry, the first get refreshes, and gets the new value
+Cache::FastMmap::_set_time_override($now + 20);
+is( $FC->get("a"), "new", "stale refreshed by read_cb" );
+is( $Calls, 1, "one fetch" );
+is( $FC->get("a"), "new", "then fresh" );
+
+# A failed refresh serves the stale value, and the next attempt is
+#  only after refresh_time
+$CbDie = 1;
+Cache::FastMmap::_set_time_override($now + 40);
+is( $FC->get("a"), "new", "stale value kept on error" );
+is( $FC->get("a"), "new", "stale value while refreshing" );
+is( $Calls, 2, "only one refresh attempted" );
+Cache::FastMmap::_set_time_override($now + 46);
+is( $FC->get("a"), "new", "stale value kept on error again" );
+is( $Calls, 3, "refresh retried after refresh_time" );
+
+# Past the hard expiry, it's a miss
+$CbDie = 0;
+$CbVal = "newer";
+Cache::FastMmap::_set_time_override($now + 200);
+is( $FC->get("a"), "newer", "hard expired is a miss" );
+
+# The stale option leaves refreshing to the caller, only one is picked
+my $NC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  serializer => '',
+  stale_time => 60,
+  unlink_on_exit => 1,
+);
+Cache::FastMmap::_set_time_override($now);
+ok( $NC->set("b", "old", { expire_time => 10 }), "set with expiry" );
+Cache::FastMmap::_set_time_override($now + 20);
+my $Stale;
+is( $NC->get("b", { stale => \$Stale }), "old", "stale value" );
+ok( $Stale, "picked to refresh" );
+is( $NC->get("b", { stale => \$Stale }), "old", "stale value again" );
+ok( !$Stale, "not picked again" );
+
+# Still there for get_keys etc, and not expunged as expired
+$NC->purge();
+is( $NC->get("b"), "old", "not expunged in the stale window" );
+
+# A per set() stale_time, and none for entries that don't expire
+ok( $NC->set("c", "x", { expire_time => 10, stale_time => 0 }), "set without stale" );
+ok( $NC->set("d", "y", { expire_time => 'never' }), "set never expiring" );
+Cache::FastMmap::_set_time_override($now + 40);
+ok( !defined $NC->get("c"), "no stale window" );
+
+# refresh_cb is called with the stale value instead
+my @Refreshed;
+$NC->{refresh_cb} = sub { push @Refreshed, [ @_[1, 2] ] };
+$NC->set("e", "old", { expire_time => 10 });
+Cache::FastMmap::_set_time_override($now + 60);
+$NC->get("e");
+is_deeply( \@Refreshed, [ [ "e", "old" ] ], "refresh_cb called" );
+
+# Other reads of a stale value don't use up the refresh
+$NC->set("f", "old", { expire_time => 10 });
+Cache::FastMmap::_set_time_override($now + 80);
+ok( $NC->exists("f"), "exists in the stale window" );
+is( $NC->get_and_set("g", sub { 1 }), 1, "other read paths" );
+is( $NC->get("f", { stale => \$Stale }), "old", "stale value after exists" );
+ok( $Stale, "still picked to refresh" );
+
+# A lease never keeps a value past its hard expiry for waiters
+my $LC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 1,
+  serializer => '',
+  stale_time => 10,
+  lease_time => 5,
+  read_cb => sub { "x" },
+  unlink_on_exit => 1,
+);
+Cache::FastMmap::_set_time_override($now);
+$LC->set("h", "old", { expire_time => 10 });
+Cache::FastMmap::_set_time_override($now + 30);
+my ($Page, $Slot) = Cache::FastMmap::fc_hash($LC->{Cache}, "h");
+Cache::FastMmap::fc_lock($LC->{Cache}, $Page);
+my (undef, $State) = Cache::FastMmap::fc_lease($LC->{Cache}, $Slot, "h", 5);
+my ($Val, $State2) = Cache::FastMmap::fc_lease($LC->{Cache}, $Slot, "h", 5);
+Cache::FastMmap::fc_unlock($LC->{Cache});
+is( $State, 1, "lease taken" );
+ok( $State2 == 2 && !defined $Val, "no hard expired value for waiters" );
@@ -0,0 +1,63 @@
+
+#########################
+
+use Test::More tests => 16;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Batched write back with write_many_cb and flush_dirty()
+
+my (@Batches, %Store);
+my $FC = Cache::FastMmap->new(
+  init_file => 1,
+  num_pages => 5,
+  page_size => 8192,
+  write_action => 'write_back',
+  write_many_cb => sub {
+    push @Batches, scalar @{$_[1]};
+    $Store{$_->{key}} = $_->{value} for @{$_[1]};
+  },
+  unlink_on_exit => 1,
+);
+ok( defined $FC );
+
+$FC->set("k$_", { n => $_ }) for 1 .. 25;
+is( scalar keys %Store, 0, "nothing written yet" );
+
+# Flush in batches, items stay in the cache, clean
+is( $FC->flush_dirty(max_items => 10), 25, "flushed all" );
+is_deeply( \@Batches, [ 10, 10, 5 ], "in batches of max_items" );
+is( scalar keys %Store, 25, "all written" );
+is_deeply( $Store{k7}, { n => 7 }, "deserialized value" );
+is_deeply( $FC->get("k7"), { n => 7 }, "still cached" );
+is( (grep { $_->{flags} & 1 } $FC->get_keys(1)), 0, "none dirty" );
+
+@Batches = ();
+is( $FC->flush_dirty(), 0, "nothing more to flush" );
+is( scalar @Batches, 0, "no empty batches" );
+
+# Only changed items are written by the next flush
+$FC->set("k3", "changed");
+$FC->set("new", "item");
+is( $FC->flush_dirty(), 2, "flushed changes" );
+is( $Store{k3}, "changed", "changed item written" );
+
+# empty() writes back each page's items together
+@Batches = ();
+%Store = ();
+$FC->set("k$_", $_) for 1 .. 20;
+$FC->empty();
+is( scalar keys %Store, 20, "empty wrote all back" );
+ok( @Batches <= 5, "at most a batch per page" );
+
+# No write_cb, so a write through cache uses write_many_cb for each set
+my $WT = Cache::FastMmap->new(
+  init_file => 1,
+  serializer => '',
+  write_many_cb => sub { $Store{$_->{key}} = $_->{value} for @{$_[1]} },
+  unlink_on_exit => 1,
+);
+$WT->set("wt", "through");
+is( $Store{wt}, "through", "write through" );
@@ -0,0 +1,131 @@
+
+#########################
+
+use Config;
+use Digest::MD5;
+use File::Temp qw(tempdir);
+use Test::More;
+BEGIN {
+  plan skip_all => "C tool tests need a unix like system" if $^O eq 'MSWin32';
+}
+use Cache::FastMmap;
+use strict;
+
+#########################
+
+# Read-only access to a cache file perl wrote: the open_existing
+#  param, mmc_snapshot_page and the mmap_cache_inspect tool. None of
+#  them may change the file
+
+my $Dir = tempdir(CLEANUP => 1);
+my $Prog = "$Dir/snap_test";
+my $Inspect = "$Dir/mmap_cache_inspect";
+
+open(my $Fh, '>', "$Prog.c") || die $!;
+print $Fh <<'C';
+#include <stdio.h>
+#include <string.h>
+#include "mmap_cache.h"
+
+static mmap_cache * open_cache(char * share_file, char * num_pages) {
+  mmap_cache * cache = mmc_new();
+  mmc_set_param(cache, "share_file", share_file);
+  mmc_set_param(cache, "num_pages", num_pages);
+  mmc_set_param(cache, "page_size", "65536");
+  mmc_set_param(cache, "open_existing", "1");
+  return cache;
+}
+
+int main(int argc, char ** argv) {
+  mmap_cache * cache;
+  MU32 hash_page, hash_slot, expire_on, flags;
+  MU64 modseq;
+  void * val;
+  int val_len, res;
+  char buf[65536], buf2[65536];
+
+  /* Wrong size or missing, nothing is created or initialised */
+  cache = open_cache(argv[1], "3");
+  res = mmc_init(cache);
+  printf("wrong size %d %s\n", res, strstr(mmc_error(cache), "expected") ? "expected" : mmc_error(cache));
+  mmc_close(cache);
+
+  cache = open_cache(argv[2], "17");
+  printf("missing %d\n", mmc_init(cache));
+  mmc_close(cache);
+
+  cache = open_cache(argv[1], "17");
+  if (mmc_init(cache) != 0) {
+    printf("open failed: %s\n", mmc_error(cache));
+    return 1;
+  }
+
+  /* A snapshot acts as the locked page, for reading */
+  mmc_hash(cache, argv[3], strlen(argv[3]), &hash_page, &hash_slot);
+  res = mmc_snapshot_page(cache, hash_page, buf, 0);
+  printf("snapshot %d %d\n", res, mmc_is_locked(cache));
+  if (mmc_read(cache, hash_slot, argv[3], strlen(argv[3]), &val, &val_len, &expire_on, &flags, &modseq) == 0)
+    printf("read %.*s\n", val_len, (char *)val);
+  printf("snapshot locked %d", mmc_snapshot_page(cache, (hash_page + 1) % 17, buf2, 0));
+  printf(" %s\n", strstr(mmc_error(cache), "already locked") ? "already locked" : mmc_error(cache));
+  mmc_unlock(cache);
+
+  res = mmc_snapshot_page(cache, 17, buf, 0);
+  printf("snapshot bad page %d %d\n", res, mmc_is_locked(cache));
+
+  mmc_close(cache);
+  return 0;
+}
+C
+close($Fh);
+
+my $Cmd = join(' ', $Config{cc}, $Config{ccflags}, '-I.', '-o', $Prog, "$Prog.c",
+  qw(mmap_cache.c unix.c), '2>&1');
+my $Out = `$Cmd`;
+plan skip_all => "Can't build snapshot test program: $Out" if $?;
+$Cmd = join(' ', $Config{cc}, $Config{ccflags}, '-I.', '-o', $Inspect,
+  qw(mmap_cache_inspect.c mmap_cache.c unix.c), '2>&1');
+$Out = `$Cmd`;
+plan skip_all => "Can't build mmap_cache_inspect: $Out" if $?;
+plan tests => 14;
+
+my $FC = Cache::FastMmap->new(
+  serializer => '',
+  init_file => 1,
+  num_pages => 17,
+  page_size => 65536,
+  unlink_on_exit => 1,
+);
+$FC->set("k$_", "v$_") for 1 .. 100;
+$FC->set("big", "x" x 5000);
+$FC->remove("k1");
+
+my $File = $FC->{share_file};
+my $Digest = FileDigest($File);
+
+my @Lines = `$Prog $File $Dir/missing k42`;
+is( $?, 0, "ran snapshot program" );
+is( $Lines[0], "wrong size -1 expected\n", "open_existing of wrong size fails" );
+is( $Lines[1], "missing -1\n", "open_existing of missing file fails" );
+ok( !-e "$Dir/missing", "missing file not created" );
+is( $Lines[2], "snapshot 0 1\n", "snapshot of page" );
+is( $Lines[3], "read v42\n", "read from snapshot" );
+is( $Lines[4], "snapshot locked -1 already locked\n", "one snapshot at a time" );
+is( $Lines[5], "snapshot bad page -1 0\n", "snapshot of bad page" );
+is( FileDigest($File), $Digest, "file unchanged by open_existing/snapshot" );
+
+# The inspector, working out the geometry itself
+$Out = `$Inspect -j $File`;
+is( $?, 0, "inspector, locking pages" );
+like( $Out, qr/"summary":\{[^}]*"used_slots":100,[^}]*"bad_pages":0,/, "inspector sees all entries" );
+like( $Out, qr/"largest":\[\{"page":\d+,"key":"big",/, "inspector sees largest entry" );
+
+$Out = `$Inspect -n -q $File`;
+like( $Out, qr/100\/\d+ slots used .* 1 deleted.*0 bad pages, 0 pages skipped/s, "inspector, copying pages" );
+is( FileDigest($File), $Digest, "file unchanged by inspector" );
+
+sub FileDigest {
+  open(my $Fh, '<', $_[0]) || die $!;
+  binmode($Fh);
+  return Digest::MD5->new->addfile($Fh)->hexdigest;
+}
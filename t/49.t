@@ -0,0 +1,32 @@
+
+#########################
+
+use Test::More tests => 4;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# Every entry carries prefixes in front of its value (a version, and
+#  maybe a modseq). The room check before a write has to count them, or
+#  a page that's a few bytes short isn't expunged and the set silently
+#  stores nothing. Walking value lengths over a single small page lands
+#  on every "few bytes short" case many times over
+
+my $FC = Cache::FastMmap->new(
+  page_size => 4096,
+  num_pages => 1,
+  init_file => 1,
+  serializer => '',
+);
+ok( defined $FC );
+
+my ($Failed, $Unread) = (0, 0);
+foreach my $i (1 .. 2000) {
+  my $V = 'x' x ($i % 97);
+  $FC->set("k$i", $V) or $Failed++;
+  my $Got = $FC->get("k$i");
+  defined $Got && $Got eq $V or $Unread++;
+}
+is( $Failed, 0, "every set stored" );
+is( $Unread, 0, "every set readable" );
@@ -0,0 +1,43 @@
+
+#########################
+
+use Test::More tests => 6;
+BEGIN { use_ok('Cache::FastMmap') };
+use strict;
+
+#########################
+
+# With stale_time set, entries that can expire also carry a 4 byte
+#  hard expiry prefix, which the room check before a write must count
+#  as well. Fill a single page over and over, every set must store,
+#  then again with a modseq prefix too
+
+my $FC = Cache::FastMmap->new(
+  page_size => 4096,
+  num_pages => 1,
+  init_file => 1,
+  serializer => '',
+  expire_time => 60,
+  stale_time => 30,
+);
+ok( defined $FC );
+
+my ($Failed, $Unread) = (0, 0);
+foreach my $i (1 .. 2000) {
+  my $V = 'x' x ($i % 97);
+  $FC->set("k$i", $V) or $Failed++;
+  my $Got = $FC->get("k$i");
+  defined $Got && $Got eq $V or $Unread++;
+}
+is( $Failed, 0, "every set stored" );
+is( $Unread, 0, "every set readable" );
+
+($Failed, $Unread) = (0, 0);
+foreach my $i (1 .. 2000) {
+  my $V = 'y' x ($i % 97);
+  $FC->set("m$i", $V, { modseq => $i }) or $Failed++;
+  my $Got = $FC->get("m$i");
+  defined $Got && $Got eq $V or $Unread++;
+}
+is( $Failed, 0, "every set with modseq stored" );
+is( $Unread, 0, "every set with modseq readable" );
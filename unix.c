@@ -21,27 +21,45 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
 #include <time.h>
 #include <errno.h>
 #include <stdarg.h>
 #include "mmap_cache.h"
 #include "mmap_cache_internals.h"
 
+#ifdef __linux__
+/* statfs f_type values of memory only filesystems (linux/magic.h) */
+#define MMC_TMPFS_MAGIC 0x01021994
+#define MMC_RAMFS_MAGIC 0x858458f6
+#endif
+
 char* _mmc_get_def_share_filename(mmap_cache * cache)
 {
   return def_share_file;
 }
 
 int mmc_open_cache_file(mmap_cache* cache, int * do_init) {
-  int res, i, fh;
+  int res, i, fh, written;
   void * tmp;
   struct stat statbuf;
 
   /* Check if file exists */
   res = stat(cache->share_file, &statbuf);
 
+  /* Only attaching to an existing cache, never recreate it */
+  if (cache->open_existing) {
+    if (res == -1)
+      return _mmc_set_error(cache, errno, "Open of share file %s failed", cache->share_file);
+    if (statbuf.st_size != cache->c_size)
+      return _mmc_set_error(cache, 0, "Share file %s is %lld bytes, expected %lld", cache->share_file,
+        (long long)statbuf.st_size, (long long)cache->c_size);
+  }
+
   /* Remove if different size or remove requested */
-  if (!res &&
+  else if (!res &&
       (cache->init_file || (statbuf.st_size != cache->c_size))) {
     res = remove(cache->share_file);
     if (res == -1 && errno != ENOENT) {
@@ -65,7 +83,7 @@ int mmc_open_cache_file(mmap_cache* cache, int * do_init) {
     }
 
     for (i = 0; i < cache->c_num_pages; i++) {
-      int written = write(res, tmp, cache->c_page_size);
+      written = write(res, tmp, cache->c_page_size);
       if (written < 0) {
         free(tmp);
         return _mmc_set_error(cache, errno, "Write to share file %s failed", cache->share_file);
@@ -75,6 +93,16 @@ int mmc_open_cache_file(mmap_cache* cache, int * do_init) {
         return _mmc_set_error(cache, 0, "Write to share file %s failed; short write (%d of %d bytes written)", cache->share_file, written, cache->c_page_size);
       }
     }
+
+    /* And the meta region after the pages */
+    for (i = 0; i < M_SIZE; i += written) {
+      int len = M_SIZE - i < cache->c_page_size ? M_SIZE - i : cache->c_page_size;
+      written = write(res, tmp, len);
+      if (written <= 0) {
+        free(tmp);
+        return _mmc_set_error(cache, errno, "Write to share file %s failed", cache->share_file);
+      }
+    }
     free(tmp);
 
     /* Later on initialise page structures */
@@ -95,6 +123,18 @@ int mmc_open_cache_file(mmap_cache* cache, int * do_init) {
   fstat(fh, &statbuf);
   cache->inode = statbuf.st_ino;
 
+  /* Note if the file is memory backed. If not, every page we dirty
+   * will eventually be written back to disk by the OS */
+#ifdef __linux__
+  {
+    struct statfs fsbuf;
+    if (fstatfs(fh, &fsbuf) == 0) {
+      cache->is_tmpfs = ((unsigned long)fsbuf.f_type == MMC_TMPFS_MAGIC ||
+                         (unsigned long)fsbuf.f_type == MMC_RAMFS_MAGIC) ? 1 : 0;
+    }
+  }
+#endif
+
   cache->fh = fh;
 
   return 0;
@@ -154,7 +194,13 @@ int mmc_close_fh(mmap_cache* cache) {
   return res;
 }
 
-int mmc_lock_page(mmap_cache* cache, MU64 p_offset) {
+MU64 mmc_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (MU64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int mmc_lock_file(mmap_cache* cache, MU64 p_offset) {
   struct flock lock;
   int old_alarm, alarm_left = 10;
   int lock_res = -1;
@@ -165,6 +211,8 @@ int mmc_lock_page(mmap_cache* cache, MU64 p_offset) {
   lock.l_start = p_offset;
   lock.l_len = cache->c_page_size;
 
+  /* alarm() is per process, not per thread, so mmc_clone turns
+   *  catch_deadlocks off for the handles it makes */
   if (cache->catch_deadlocks)
     old_alarm = alarm(alarm_left);
 
@@ -201,7 +249,7 @@ int mmc_lock_page(mmap_cache* cache, MU64 p_offset) {
   return 0;
 }
 
-int mmc_unlock_page(mmap_cache * cache, MU64 p_offset) {
+int mmc_unlock_file(mmap_cache * cache, MU64 p_offset) {
   struct flock lock;
 
   /* Setup fcntl locking structure */
@@ -225,7 +273,8 @@ int mmc_unlock_page(mmap_cache * cache, MU64 p_offset) {
 */
 int _mmc_set_error(mmap_cache *cache, int err, char * error_string, ...) {
   va_list ap;
-  static char errbuf[1024];
+  /* Per thread, each thread has its own handle (see mmc_clone) */
+  static MMC_THREAD_LOCAL char errbuf[1024];
 
   va_start(ap, error_string);
 
@@ -52,9 +52,22 @@ int mmc_open_cache_file(mmap_cache* cache, int* do_init) {
     WIN32_FIND_DATA statbuf;
 
     findHandle = FindFirstFile(cache->share_file, &statbuf);
-        
-    /* Create file if it doesn't exist */    
-    if (findHandle == INVALID_HANDLE_VALUE) {
+
+    /* Only attaching to an existing cache, never recreate it */
+    if (cache->open_existing) {
+        if (findHandle == INVALID_HANDLE_VALUE) {
+            _mmc_set_error(cache, GetLastError(), "Open of share file %s failed", cache->share_file);
+            return -1;
+        }
+        FindClose(findHandle);
+        if (statbuf.nFileSizeLow != cache->c_size) {
+            _mmc_set_error(cache, 0, "Share file %s is %lu bytes, expected %lu", cache->share_file,
+                (unsigned long)statbuf.nFileSizeLow, (unsigned long)cache->c_size);
+            return -1;
+        }
+
+    /* Create file if it doesn't exist */
+    } else if (findHandle == INVALID_HANDLE_VALUE) {
         fh = CreateFile(cache->share_file, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
                         CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
                 
@@ -74,6 +87,12 @@ int mmc_open_cache_file(mmap_cache* cache, int* do_init) {
             DWORD tmpOut;
             WriteFile(fh, tmp, cache->c_page_size, &tmpOut, NULL);
         }
+
+        /* And the meta region after the pages */
+        for (i = 0; i < M_SIZE; i += cache->c_page_size) {
+            DWORD tmpOut;
+            WriteFile(fh, tmp, M_SIZE - i < cache->c_page_size ? M_SIZE - i : cache->c_page_size, &tmpOut, NULL);
+        }
         free(tmp);
         
         /* Later on initialise page structures */
@@ -160,7 +179,15 @@ int mmc_unmap_memory(mmap_cache* cache) {
   return res;
 }
 
-int mmc_lock_page(mmap_cache* cache, MU64 p_offset) {
+MU64 mmc_now_ns() {
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (MU64)(count.QuadPart / freq.QuadPart) * 1000000000
+      + (MU64)(count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+
+int mmc_lock_file(mmap_cache* cache, MU64 p_offset) {
     OVERLAPPED lock;
     DWORD lock_res, bytesTransfered;
     memset(&lock, 0, sizeof(lock));
@@ -189,7 +216,7 @@ int mmc_lock_page(mmap_cache* cache, MU64 p_offset) {
     return 0;
 }
 
-int mmc_unlock_page(mmap_cache* cache, MU64 p_offset) {
+int mmc_unlock_file(mmap_cache* cache, MU64 p_offset) {
     OVERLAPPED lock;
     memset(&lock, 0, sizeof(lock));
     /* Offset is a DWORD so we must split p_offset across Offset/OffsetHigh,
@@ -211,7 +238,8 @@ int mmc_unlock_page(mmap_cache* cache, MU64 p_offset) {
 */
 int _mmc_set_error(mmap_cache *cache, int err, char * error_string, ...) {
   va_list ap;
-  static char errbuf[1024];
+  /* Per thread, each thread has its own handle (see mmc_clone) */
+  static MMC_THREAD_LOCAL char errbuf[1024];
   char *msgBuff;
 
   va_start(ap, error_string);